@@ -1,28 +1,255 @@
 #include "Cartridge.hh"
 
+#include <algorithm>
+#include <chrono>
+
+#include "logging/Logger.hh"
 #include "romfile/RomFile.hh"
+#include "savestate/StateStream.hh"
+
+static auto const logger = Logger::Create("Cartridge");
 
 namespace gb4e
 {
+u8 constexpr MBC3_RTC_FIRST_REGISTER = 0x08;
+u8 constexpr MBC3_RTC_LAST_REGISTER = 0x0C;
+u8 constexpr RTC_DH_DAY_HIGH = BIT(0);
+u8 constexpr RTC_DH_HALT = BIT(6);
+u8 constexpr RTC_DH_CARRY = BIT(7);
+// Bits of S, M, H, DL and DH which exist in the hardware
+std::array<u8, 5> constexpr RTC_REGISTER_MASKS = {0x3F, 0x3F, 0x1F, 0xFF, RTC_DH_DAY_HIGH | RTC_DH_HALT | RTC_DH_CARRY};
+u64 constexpr NS_PER_SECOND = 1000000000;
+u64 constexpr SECONDS_PER_DAY = 24 * 60 * 60;
+// The day counter is 9 bits, DH carry is set when it overflows
+u64 constexpr RTC_MAX_DAYS = 512;
+
+static std::array<u8, 2 * CARTRIDGE_ROM_BANK_SIZE> const EMPTY_ROM{};
+
+static MbcType ToMbcType(CartridgeType const * cartridgeType)
+{
+    if (cartridgeType->IsMbc1()) {
+        return MbcType::MBC1;
+    }
+    if (cartridgeType->IsMbc2()) {
+        return MbcType::MBC2;
+    }
+    if (cartridgeType->IsMbc3()) {
+        return MbcType::MBC3;
+    }
+    if (cartridgeType->IsMbc5()) {
+        return MbcType::MBC5;
+    }
+    return MbcType::NONE;
+}
+
+Cartridge::Cartridge() : rom(EMPTY_ROM.data()), numRomBanks(2)
+{
+    UpdateBanks();
+}
+
+Cartridge::~Cartridge()
+{
+    WriteRtcFooter();
+}
+
+static u64 WallClockNs()
+{
+    auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+    return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(sinceEpoch).count();
+}
+
+// Seconds counted by the S, M, H, DL and DH registers, ignoring the flags
+static u64 ToRtcSeconds(std::array<u8, 5> const & registers)
+{
+    u64 days = registers[3] | ((registers[4] & RTC_DH_DAY_HIGH) << 8);
+    return registers[0] + registers[1] * 60 + registers[2] * 60 * 60 + days * SECONDS_PER_DAY;
+}
+
+static void WriteLittleEndian(u8 * out, u64 value, size_t numBytes)
+{
+    for (size_t i = 0; i < numBytes; ++i) {
+        out[i] = (u8)(value >> (8 * i));
+    }
+}
+
+static u64 ReadLittleEndian(u8 const * in, size_t numBytes)
+{
+    u64 value = 0;
+    for (size_t i = 0; i < numBytes; ++i) {
+        value |= (u64)in[i] << (8 * i);
+    }
+    return value;
+}
 
 void Cartridge::LoadRom(RomFile const * romFile)
 {
     this->romFile = romFile;
-    this->activeRamBank = ramBanks[0];
-    this->activeRomBank1 = romBanks[1];
+    mbcType = ToMbcType(romFile->GetCartridgeType());
+    if (mbcType == MbcType::NONE && !romFile->GetCartridgeType()->IsRomOnly() &&
+        romFile->GetCartridgeType()->GetType() != CartridgeTypeValue::ROM_RAM &&
+        romFile->GetCartridgeType()->GetType() != CartridgeTypeValue::ROM_RAM_BATTERY) {
+        logger->Warnf("Unsupported cartridge type=%s, running without a bank controller",
+                      ToString(romFile->GetCartridgeType()->GetType()).c_str());
+    }
+
+    // The header can claim a different size than the file has, only the file size can be trusted
+    size_t romSize = romFile->GetSize();
+    if (romSize < 2 * CARTRIDGE_ROM_BANK_SIZE || romSize % CARTRIDGE_ROM_BANK_SIZE != 0) {
+        size_t paddedSize = std::max(2 * CARTRIDGE_ROM_BANK_SIZE,
+                                     (romSize + CARTRIDGE_ROM_BANK_SIZE - 1) / CARTRIDGE_ROM_BANK_SIZE *
+                                         CARTRIDGE_ROM_BANK_SIZE);
+        paddedRom.assign(paddedSize, 0xFF);
+        std::copy(romFile->GetData(), romFile->GetData() + romSize, paddedRom.begin());
+        rom = paddedRom.data();
+        romSize = paddedSize;
+    } else {
+        paddedRom.clear();
+        rom = romFile->GetData();
+    }
+    numRomBanks = romSize / CARTRIDGE_ROM_BANK_SIZE;
 
-    auto romSize = romFile->GetRomSize();
+    hasBattery = romFile->GetCartridgeType()->HasBattery();
+    ramSize = mbcType == MbcType::MBC2 ? MBC2_RAM_SIZE : romFile->GetRamSize()->GetByteSize();
+    saveFile.reset();
+    ownedRam.assign(ramSize, 0);
+    ram = ownedRam.data();
+    numRamBanks = (ramSize + CARTRIDGE_RAM_BANK_SIZE - 1) / CARTRIDGE_RAM_BANK_SIZE;
+    ramAddressMask = (u16)(std::min(ramSize, CARTRIDGE_RAM_BANK_SIZE) - 1);
 
-    for (int i = 0; i < romSize->GetNumBanks(); ++i) {
-        // TODO: This seems pretty unsafe
-        memcpy(&romBanks[i][0], romFile->GetData() + i * CARTRIDGE_ROM_BANK_SIZE, CARTRIDGE_ROM_BANK_SIZE);
+    isRamEnabled = mbcType == MbcType::NONE;
+    romBankRegister = 1;
+    secondaryBank = 0;
+    isAdvancedBanking = false;
+    hasRtc = romFile->GetCartridgeType()->HasTimer();
+    rtcCounterNs = 0;
+    rtcBaseNs = GetRtcClockNs();
+    isRtcHalted = false;
+    hasRtcDayCarry = false;
+    latchedRtcRegisters.fill(0);
+    lastLatchWrite = 0xFF;
+    UpdateBanks();
+
+    logger->Infof("Loaded cartridge with numRomBanks=%zu, ramSize=%zu", numRomBanks, ramSize);
+}
+
+bool Cartridge::AttachSaveFile(std::unique_ptr<SaveFile> && saveFile)
+{
+    if (GetSaveSize() == 0 || saveFile->GetSize() < GetSaveSize()) {
+        logger->Errorf("Cannot attach save of size=%zu to cartridge with save size=%zu", saveFile->GetSize(),
+                       GetSaveSize());
+        return false;
     }
+    this->saveFile = std::move(saveFile);
+    ram = this->saveFile->GetData();
+    ownedRam.clear();
+    ownedRam.shrink_to_fit();
+    ReadRtcFooter();
+    UpdateBanks();
+    return true;
+}
+
+void Cartridge::SetCycleCounter(u64 const * totalCycles)
+{
+    u64 counterNs = GetRtcCounterNs();
+    this->totalCycles = totalCycles;
+    rtcCounterNs = counterNs;
+    rtcBaseNs = GetRtcClockNs();
+}
+
+void Cartridge::SetRtcClock(RtcClock rtcClock)
+{
+    u64 counterNs = GetRtcCounterNs();
+    this->rtcClock = rtcClock;
+    rtcCounterNs = counterNs;
+    rtcBaseNs = GetRtcClockNs();
+}
+
+void Cartridge::SaveState(StateWriter & writer) const
+{
+    writer.Write((u64)(romFile ? romFile->GetSize() : 0));
+    writer.Write(romFile ? romFile->GetHeaderChecksum() : (u8)0);
+    writer.Write(romFile ? romFile->GetGlobalChecksum() : (u16)0);
+    writer.Write((u32)ramSize);
+    writer.Write(isRamEnabled);
+    writer.Write(romBankRegister);
+    writer.Write(secondaryBank);
+    writer.Write(isAdvancedBanking);
+    writer.Write(GetRtcCounterNs());
+    writer.Write(rtcClock);
+    writer.Write(rtcCounterNs);
+    writer.Write(rtcBaseNs);
+    writer.Write(isRtcHalted);
+    writer.Write(hasRtcDayCarry);
+    writer.WriteBytes(latchedRtcRegisters.data(), latchedRtcRegisters.size());
+    writer.Write(lastLatchWrite);
+    writer.WriteBytes(ram, ramSize);
+}
+
+void Cartridge::LoadState(StateReader & reader)
+{
+    u64 romSize = reader.Read<u64>();
+    u8 headerChecksum = reader.Read<u8>();
+    u16 globalChecksum = reader.Read<u16>();
+    u32 savedRamSize = reader.Read<u32>();
+    if (reader.HasFailed() || romSize != (romFile ? romFile->GetSize() : 0) ||
+        headerChecksum != (romFile ? romFile->GetHeaderChecksum() : 0) ||
+        globalChecksum != (romFile ? romFile->GetGlobalChecksum() : 0) || savedRamSize != ramSize) {
+        logger->Errorf("State was saved with a different ROM, romSize=%zu, headerChecksum=%x", (size_t)romSize,
+                       headerChecksum);
+        reader.Fail();
+        return;
+    }
+    reader.Read(isRamEnabled);
+    reader.Read(romBankRegister);
+    reader.Read(secondaryBank);
+    reader.Read(isAdvancedBanking);
+    u64 currentRtcCounterNs = reader.Read<u64>();
+    RtcClock savedRtcClock = reader.Read<RtcClock>();
+    u64 savedRtcCounterNs = reader.Read<u64>();
+    u64 savedRtcBaseNs = reader.Read<u64>();
+    reader.Read(isRtcHalted);
+    reader.Read(hasRtcDayCarry);
+    reader.ReadBytes(latchedRtcRegisters.data(), latchedRtcRegisters.size());
+    reader.Read(lastLatchWrite);
+    reader.ReadBytes(ram, ramSize);
+
+    if (rtcClock == RtcClock::EMULATED && savedRtcClock == RtcClock::EMULATED) {
+        // The base is in emulated time, which the CPU section restores, so the RTC replays exactly
+        rtcCounterNs = savedRtcCounterNs;
+        rtcBaseNs = savedRtcBaseNs;
+    } else {
+        // Wall time keeps going, the RTC continues from where it was when saved
+        SetRtcCounterNs(currentRtcCounterNs);
+    }
+    if (saveFile) {
+        saveFile->MarkAllDirty();
+    }
+    UpdateBanks();
 }
 
 bool Cartridge::WriteMemory(u16 addr, u8 val)
 {
+    if (addr <= 0x7FFF) {
+        switch (mbcType) {
+        case MbcType::MBC1:
+            WriteMbc1(addr, val);
+            break;
+        case MbcType::MBC2:
+            WriteMbc2(addr, val);
+            break;
+        case MbcType::MBC3:
+            WriteMbc3(addr, val);
+            break;
+        case MbcType::MBC5:
+            WriteMbc5(addr, val);
+            break;
+        case MbcType::NONE:
+            break;
+        }
+        return true;
+    }
     if (addr >= 0xA000 && addr <= 0xBFFF) {
-        activeRamBank[addr - 0xA000] = val;
+        WriteRam(addr, val);
         return true;
     }
     return false;
@@ -31,15 +258,302 @@ bool Cartridge::WriteMemory(u16 addr, u8 val)
 std::optional<u8> Cartridge::ReadMemory(u16 addr) const
 {
     if (addr <= 0x3FFF) {
-        return romBanks[0][addr];
+        return romBank0[addr];
     }
     if (addr <= 0x7FFF) {
-        return activeRomBank1[addr - 0x4000];
+        return romBankN[addr - 0x4000];
     }
     if (addr >= 0xA000 && addr <= 0xBFFF) {
-        return activeRamBank[addr - 0xA000];
+        return ReadRam(addr);
     }
 
     return {};
 }
+
+std::optional<u8> Cartridge::ReadUndoValue(u16 addr) const
+{
+    if (addr >= 0xA000 && addr <= 0xBFFF) {
+        if (mbcType == MbcType::MBC3 && isRamEnabled && secondaryBank >= MBC3_RTC_FIRST_REGISTER &&
+            secondaryBank <= MBC3_RTC_LAST_REGISTER) {
+            return {};
+        }
+        return ReadRam(addr);
+    }
+    if (addr > 0x7FFF) {
+        return {};
+    }
+
+    u8 ramEnable = isRamEnabled ? 0x0A : 0x00;
+    switch (mbcType) {
+    case MbcType::MBC1:
+        if (addr <= 0x1FFF) {
+            return ramEnable;
+        } else if (addr <= 0x3FFF) {
+            return (u8)romBankRegister;
+        } else if (addr <= 0x5FFF) {
+            return secondaryBank;
+        }
+        return isAdvancedBanking ? 0x01 : 0x00;
+    case MbcType::MBC2:
+        return (addr & 0x100) ? (u8)romBankRegister : ramEnable;
+    case MbcType::MBC3:
+        if (addr <= 0x1FFF) {
+            return ramEnable;
+        } else if (addr <= 0x3FFF) {
+            return (u8)romBankRegister;
+        } else if (addr <= 0x5FFF) {
+            return secondaryBank;
+        }
+        return lastLatchWrite;
+    case MbcType::MBC5:
+        if (addr <= 0x1FFF) {
+            return ramEnable;
+        } else if (addr <= 0x2FFF) {
+            return (u8)(romBankRegister & 0xFF);
+        } else if (addr <= 0x3FFF) {
+            return (u8)(romBankRegister >> 8);
+        }
+        return secondaryBank;
+    case MbcType::NONE:
+        break;
+    }
+    // No register, the write was ignored and so is this one
+    return 0x00;
+}
+
+void Cartridge::WriteMbc1(u16 addr, u8 val)
+{
+    if (addr <= 0x1FFF) {
+        isRamEnabled = (val & 0x0F) == 0x0A;
+    } else if (addr <= 0x3FFF) {
+        romBankRegister = val & 0x1F;
+    } else if (addr <= 0x5FFF) {
+        secondaryBank = val & 0x03;
+    } else {
+        isAdvancedBanking = val & 0x01;
+    }
+    UpdateBanks();
+}
+
+void Cartridge::WriteMbc2(u16 addr, u8 val)
+{
+    if (addr > 0x3FFF) {
+        return;
+    }
+    // Bit 8 of the address selects between the RAM enable and the ROM bank register
+    if (addr & 0x100) {
+        romBankRegister = val & 0x0F;
+    } else {
+        isRamEnabled = (val & 0x0F) == 0x0A;
+    }
+    UpdateBanks();
+}
+
+void Cartridge::WriteMbc3(u16 addr, u8 val)
+{
+    if (addr <= 0x1FFF) {
+        isRamEnabled = (val & 0x0F) == 0x0A;
+    } else if (addr <= 0x3FFF) {
+        romBankRegister = val & 0x7F;
+    } else if (addr <= 0x5FFF) {
+        secondaryBank = val & 0x0F;
+    } else {
+        if (lastLatchWrite == 0x00 && val == 0x01) {
+            latchedRtcRegisters = GetRtcRegisters();
+            WriteRtcFooter();
+        }
+        lastLatchWrite = val;
+    }
+    UpdateBanks();
+}
+
+void Cartridge::WriteMbc5(u16 addr, u8 val)
+{
+    if (addr <= 0x1FFF) {
+        isRamEnabled = (val & 0x0F) == 0x0A;
+    } else if (addr <= 0x2FFF) {
+        romBankRegister = (romBankRegister & 0x100) | val;
+    } else if (addr <= 0x3FFF) {
+        romBankRegister = (romBankRegister & 0xFF) | ((val & 0x01) << 8);
+    } else if (addr <= 0x5FFF) {
+        secondaryBank = val & 0x0F;
+    }
+    UpdateBanks();
+}
+
+void Cartridge::UpdateBanks()
+{
+    size_t bank0 = 0;
+    size_t bankN = 1;
+    size_t ramBankIndex = 0;
+    switch (mbcType) {
+    case MbcType::NONE:
+        break;
+    case MbcType::MBC1:
+        // Bank register value 0 selects bank 1, but only the lower 5 bits are checked
+        bankN = (secondaryBank << 5) | std::max<u16>(romBankRegister, 1);
+        if (isAdvancedBanking) {
+            bank0 = secondaryBank << 5;
+            ramBankIndex = secondaryBank;
+        }
+        break;
+    case MbcType::MBC2:
+    case MbcType::MBC3:
+        bankN = std::max<u16>(romBankRegister, 1);
+        ramBankIndex = secondaryBank;
+        break;
+    case MbcType::MBC5:
+        // MBC5 is the only controller which can map bank 0 to 4000-7FFF
+        bankN = romBankRegister;
+        ramBankIndex = secondaryBank;
+        break;
+    }
+    // Carts only decode as many bank bits as they have banks
+    romBank0 = rom + (bank0 % numRomBanks) * CARTRIDGE_ROM_BANK_SIZE;
+    romBankN = rom + (bankN % numRomBanks) * CARTRIDGE_ROM_BANK_SIZE;
+
+    if (isRamEnabled && numRamBanks > 0 && !(mbcType == MbcType::MBC3 && secondaryBank >= MBC3_RTC_FIRST_REGISTER)) {
+        ramBank = ram + (mbcType == MbcType::MBC2 ? 0 : (ramBankIndex % numRamBanks) * CARTRIDGE_RAM_BANK_SIZE);
+    } else {
+        ramBank = nullptr;
+    }
+}
+
+u8 Cartridge::ReadRam(u16 addr) const
+{
+    if (mbcType == MbcType::MBC3 && isRamEnabled && secondaryBank >= MBC3_RTC_FIRST_REGISTER &&
+        secondaryBank <= MBC3_RTC_LAST_REGISTER) {
+        return latchedRtcRegisters[secondaryBank - MBC3_RTC_FIRST_REGISTER];
+    }
+    if (ramBank == nullptr) {
+        return 0xFF;
+    }
+    if (mbcType == MbcType::MBC2) {
+        // Only the lower nibble is stored, the 512 half-bytes repeat through A000-BFFF
+        return 0xF0 | ramBank[addr & (MBC2_RAM_SIZE - 1)];
+    }
+    return ramBank[(addr - 0xA000) & ramAddressMask];
+}
+
+void Cartridge::WriteRam(u16 addr, u8 val)
+{
+    if (mbcType == MbcType::MBC3 && isRamEnabled && secondaryBank >= MBC3_RTC_FIRST_REGISTER &&
+        secondaryBank <= MBC3_RTC_LAST_REGISTER) {
+        WriteRtcRegister(secondaryBank - MBC3_RTC_FIRST_REGISTER, val);
+        return;
+    }
+    if (ramBank == nullptr) {
+        return;
+    }
+    size_t offset;
+    if (mbcType == MbcType::MBC2) {
+        offset = addr & (MBC2_RAM_SIZE - 1);
+        ramBank[offset] = val & 0x0F;
+    } else {
+        offset = (addr - 0xA000) & ramAddressMask;
+        ramBank[offset] = val;
+    }
+    if (saveFile) {
+        saveFile->MarkDirty(ramBank - ram + offset);
+    }
+}
+
+u64 Cartridge::GetRtcClockNs() const
+{
+    if (rtcClock == RtcClock::WALL) {
+        return WallClockNs();
+    }
+    if (totalCycles == nullptr) {
+        return 0;
+    }
+    // Split so that clocks * NS_PER_SECOND cannot overflow
+    u64 clocks = *totalCycles * 4;
+    return clocks / CLOCK_FREQUENCY * NS_PER_SECOND + clocks % CLOCK_FREQUENCY * NS_PER_SECOND / CLOCK_FREQUENCY;
+}
+
+u64 Cartridge::GetRtcCounterNs() const
+{
+    if (isRtcHalted) {
+        return rtcCounterNs;
+    }
+    return rtcCounterNs + (GetRtcClockNs() - rtcBaseNs);
+}
+
+void Cartridge::SetRtcCounterNs(u64 counterNs)
+{
+    u64 days = counterNs / NS_PER_SECOND / SECONDS_PER_DAY;
+    if (days >= RTC_MAX_DAYS) {
+        // The carry stays set until the game clears it
+        hasRtcDayCarry = true;
+        counterNs -= days / RTC_MAX_DAYS * RTC_MAX_DAYS * SECONDS_PER_DAY * NS_PER_SECOND;
+    }
+    rtcCounterNs = counterNs;
+    rtcBaseNs = GetRtcClockNs();
+}
+
+std::array<u8, 5> Cartridge::GetRtcRegisters()
+{
+    SetRtcCounterNs(GetRtcCounterNs());
+    u64 seconds = rtcCounterNs / NS_PER_SECOND;
+    u64 days = seconds / SECONDS_PER_DAY;
+    u8 dh = (u8)((days >> 8) & RTC_DH_DAY_HIGH) | (isRtcHalted ? RTC_DH_HALT : 0) | (hasRtcDayCarry ? RTC_DH_CARRY : 0);
+    return {(u8)(seconds % 60), (u8)(seconds / 60 % 60), (u8)(seconds / (60 * 60) % 24), (u8)days, dh};
+}
+
+void Cartridge::WriteRtcRegister(u8 index, u8 val)
+{
+    std::array<u8, 5> registers = GetRtcRegisters();
+    // Writing the seconds also resets the divider counting up to the next second
+    u64 subsecondNs = index == 0 ? 0 : rtcCounterNs % NS_PER_SECOND;
+    registers[index] = val & RTC_REGISTER_MASKS[index];
+
+    hasRtcDayCarry = registers[4] & RTC_DH_CARRY;
+    // Also rebases the counter, so time spent halted is never counted
+    SetRtcCounterNs(ToRtcSeconds(registers) * NS_PER_SECOND + subsecondNs);
+    isRtcHalted = registers[4] & RTC_DH_HALT;
+    WriteRtcFooter();
+}
+
+void Cartridge::ReadRtcFooter()
+{
+    if (!hasRtc || !saveFile) {
+        return;
+    }
+    u8 const * footer = saveFile->GetData() + ramSize;
+    u64 timestamp = ReadLittleEndian(footer + 40, 8);
+    if (timestamp == 0) {
+        // A new save, or one written without an RTC
+        return;
+    }
+    std::array<u8, 5> registers;
+    for (size_t i = 0; i < registers.size(); ++i) {
+        registers[i] = (u8)ReadLittleEndian(footer + 4 * i, 4) & RTC_REGISTER_MASKS[i];
+        latchedRtcRegisters[i] = (u8)ReadLittleEndian(footer + 20 + 4 * i, 4) & RTC_REGISTER_MASKS[i];
+    }
+    hasRtcDayCarry = registers[4] & RTC_DH_CARRY;
+    u64 counterNs = ToRtcSeconds(registers) * NS_PER_SECOND;
+    // Emulated time does not pass while the emulator is closed
+    u64 now = WallClockNs() / NS_PER_SECOND;
+    if (rtcClock == RtcClock::WALL && !(registers[4] & RTC_DH_HALT) && now > timestamp) {
+        counterNs += (now - timestamp) * NS_PER_SECOND;
+    }
+    SetRtcCounterNs(counterNs);
+    isRtcHalted = registers[4] & RTC_DH_HALT;
+}
+
+void Cartridge::WriteRtcFooter()
+{
+    if (!hasRtc || !saveFile) {
+        return;
+    }
+    std::array<u8, 5> registers = GetRtcRegisters();
+    u8 * footer = saveFile->GetData() + ramSize;
+    for (size_t i = 0; i < registers.size(); ++i) {
+        WriteLittleEndian(footer + 4 * i, registers[i], 4);
+        WriteLittleEndian(footer + 20 + 4 * i, latchedRtcRegisters[i], 4);
+    }
+    WriteLittleEndian(footer + 40, WallClockNs() / NS_PER_SECOND, 8);
+    saveFile->MarkDirty(ramSize);
+    saveFile->MarkDirty(ramSize + RTC_SAVE_FOOTER_SIZE - 1);
+}
 }
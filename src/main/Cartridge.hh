@@ -1,35 +1,174 @@
 #pragma once
 
 #include <array>
+#include <memory>
 #include <optional>
+#include <vector>
 
 #include "Common.hh"
+#include "SaveFile.hh"
 
 namespace gb4e
 {
 class RomFile;
+class StateReader;
+class StateWriter;
 
 size_t constexpr CARTRIDGE_RAM_BANK_SIZE = 0x2000;
 size_t constexpr CARTRIDGE_ROM_BANK_SIZE = 0x4000;
+// MBC2 has 512 half-bytes of RAM built into the controller
+size_t constexpr MBC2_RAM_SIZE = 0x200;
 
+// The RTC registers, as 32-bit little-endian values, followed by a 64-bit UNIX timestamp, appended to the RAM in the
+// .sav of cartridges with a timer. The same layout as used by most other emulators.
+size_t constexpr RTC_SAVE_FOOTER_SIZE = 48;
+
+enum class RtcClock {
+    // Advances with emulated cycles, the same inputs always give the same times
+    EMULATED,
+    // Advances with the host's clock, also while the emulator is not running
+    WALL,
+};
+
+enum class MbcType {
+    NONE,
+    MBC1,
+    MBC2,
+    MBC3,
+    MBC5,
+};
+
+/**
+ * The cartridge ROM, RAM and memory bank controller.
+ *
+ * The ROM is never copied: the banks mapped at 0000-3FFF and 4000-7FFF are pointers into the RomFile data, which can be
+ * shared by any number of instances, and are only recomputed when a bank register is written. Only the cartridge RAM,
+ * sized from the header, is owned per instance, unless a SaveFile is attached in which case the RAM lives in the save.
+ */
 class Cartridge
 {
 public:
+    // Until a ROM is loaded the cartridge reads as zeros
+    Cartridge();
+    // Writes the RTC footer of an attached save
+    ~Cartridge();
+
+    /**
+     * The cartridge keeps a pointer to romFile, meaning romFile must be a valid pointer for as long as the cartridge
+     * is in use.
+     */
     void LoadRom(RomFile const *);
 
+    RomFile const * GetRomFile() const { return romFile; }
+
+    /**
+     * Replaces the cartridge RAM with saveFile, which must be at least GetRamSize bytes. Returns false, without taking
+     * saveFile, if the loaded cartridge has no RAM. Must be called after LoadRom, which detaches any save.
+     */
+    bool AttachSaveFile(std::unique_ptr<SaveFile> && saveFile);
+
+    // Battery backed RAM should be kept in a SaveFile
+    bool HasBattery() const { return hasBattery; }
+
+    bool HasRtc() const { return hasRtc; }
+
+    size_t GetRamSize() const { return ramSize; }
+
+    // The size of the SaveFile to attach, the RAM followed by the RTC footer if the cartridge has a timer
+    size_t GetSaveSize() const { return ramSize + (hasRtc ? RTC_SAVE_FOOTER_SIZE : 0); }
+
+    /**
+     * The RTC registers are only computed when latched, from the time elapsed since they were last set. With
+     * RtcClock::EMULATED time is read from totalCycles, a count of 4-clock cycles which must outlive the cartridge.
+     * Without a cycle counter the emulated RTC stands still.
+     */
+    void SetCycleCounter(u64 const * totalCycles);
+    void SetRtcClock(RtcClock rtcClock);
+
     bool WriteMemory(u16 addr, u8 val);
     std::optional<u8> ReadMemory(u16 addr) const;
 
+    /**
+     * The value which, written to addr, undoes a write to addr: for 0000-7FFF the current value of the bank register
+     * addr selects, which reading addr does not return, for A000-BFFF the RAM. Nothing if the RTC is mapped at addr,
+     * the registers keep counting and a write would set them to the latched time. Undoing a latch leaves the latched
+     * registers as they are.
+     */
+    std::optional<u8> ReadUndoValue(u16 addr) const;
+
+    /**
+     * The bank registers, RTC and RAM. The ROM is identified by its size and checksums, loading fails without changing
+     * anything if a different ROM is loaded. Loaded RAM is also written to an attached save.
+     */
+    void SaveState(StateWriter & writer) const;
+    void LoadState(StateReader & reader);
+
+    MbcType GetMbcType() const { return mbcType; }
+
 private:
-    RomFile const * romFile;
+    void WriteMbc1(u16 addr, u8 val);
+    void WriteMbc2(u16 addr, u8 val);
+    void WriteMbc3(u16 addr, u8 val);
+    void WriteMbc5(u16 addr, u8 val);
+    // Recomputes the bank pointers from the bank registers
+    void UpdateBanks();
+
+    u8 ReadRam(u16 addr) const;
+    void WriteRam(u16 addr, u8 val);
 
-    std::array<std::array<u8, CARTRIDGE_RAM_BANK_SIZE>, 16> ramBanks;
-    // A000-BFFF
-    std::array<u8, CARTRIDGE_RAM_BANK_SIZE> & activeRamBank = ramBanks[0];
+    // Current time of the RTC clock source
+    u64 GetRtcClockNs() const;
+    // Time counted by the RTC, including the part of a second which is not visible in the registers
+    u64 GetRtcCounterNs() const;
+    void SetRtcCounterNs(u64 counterNs);
+    std::array<u8, 5> GetRtcRegisters();
+    void WriteRtcRegister(u8 index, u8 val);
+    void ReadRtcFooter();
+    void WriteRtcFooter();
+
+    RomFile const * romFile = nullptr;
+    MbcType mbcType = MbcType::NONE;
+
+    u8 const * rom = nullptr;
+    size_t numRomBanks = 0;
+    // Only used if the ROM file is not a whole number of banks, in which case it is padded with 0xFF
+    std::vector<u8> paddedRom;
+
+    // Points into ownedRam, or into saveFile if one is attached
+    u8 * ram = nullptr;
+    size_t ramSize = 0;
+    std::vector<u8> ownedRam;
+    std::unique_ptr<SaveFile> saveFile;
+    bool hasBattery = false;
+    size_t numRamBanks = 0;
+    // RAM smaller than a bank, on 2 KB carts, repeats within A000-BFFF
+    u16 ramAddressMask = 0;
 
     // 0000-3FFF
-    std::array<std::array<u8, CARTRIDGE_ROM_BANK_SIZE>, 512> romBanks;
-    // 0000-7FFF
-    std::array<u8, CARTRIDGE_ROM_BANK_SIZE> & activeRomBank1 = romBanks[1];
+    u8 const * romBank0 = nullptr;
+    // 4000-7FFF
+    u8 const * romBankN = nullptr;
+    // A000-BFFF, nullptr if RAM is disabled or the cartridge has no RAM
+    u8 * ramBank = nullptr;
+
+    bool isRamEnabled = false;
+    // The ROM bank register, the upper bits come from secondaryBank on MBC1
+    u16 romBankRegister = 1;
+    // The RAM bank register, which on MBC1 also holds the upper ROM bank bits and on MBC3 selects an RTC register
+    u8 secondaryBank = 0;
+    // MBC1 banking mode, if set secondaryBank also applies to 0000-3FFF and the RAM
+    bool isAdvancedBanking = false;
+
+    // MBC3 real time clock. The registers S, M, H, DL and DH are not ticked, rtcCounterNs is the time they held at
+    // rtcBaseNs of the clock source. Only the copy latched by writing 0 then 1 to 6000-7FFF is readable.
+    bool hasRtc = false;
+    RtcClock rtcClock = RtcClock::EMULATED;
+    u64 const * totalCycles = nullptr;
+    u64 rtcCounterNs = 0;
+    u64 rtcBaseNs = 0;
+    bool isRtcHalted = false;
+    bool hasRtcDayCarry = false;
+    std::array<u8, 5> latchedRtcRegisters{};
+    u8 lastLatchWrite = 0xFF;
 };
 }
@@ -24,6 +24,13 @@ enum class GbModel { DMG, CGB };
 u64 constexpr CLOCK_FREQUENCY = 4194304;
 u64 constexpr CYCLE_DURATION_NS = (1000000000 / CLOCK_FREQUENCY) * 4;
 
+// One LCD frame is 70224 clocks, or 17556 of the 4-clock cycles ticked by GbCpu::TickCycle
+u64 constexpr CYCLES_PER_FRAME = 70224 / 4;
+// Length of one frame in the emulated time passed to GbCpu::Tick
+u64 constexpr FRAME_DURATION_NS = CYCLES_PER_FRAME * CYCLE_DURATION_NS;
+// Length of one frame in real time, the hardware refreshes at CLOCK_FREQUENCY / 70224 ~= 59.73 Hz
+double constexpr FRAME_REAL_DURATION_NS = 70224 * 1000000000.0 / CLOCK_FREQUENCY;
+
 size_t constexpr MEMORY_SIZE = 0x10000;
 size_t constexpr VRAM_SIZE = 0x2000;
 
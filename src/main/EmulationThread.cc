@@ -0,0 +1,152 @@
+#include "EmulationThread.hh"
+
+#include "FramePacer.hh"
+#include "GbCpu.hh"
+#include "Register.hh"
+#include "logging/Logger.hh"
+
+static auto const logger = Logger::Create("EmulationThread");
+
+namespace gb4e
+{
+
+EmulationThread::~EmulationThread()
+{
+    Stop();
+}
+
+void EmulationThread::Start()
+{
+    isShuttingDown.store(false);
+    thread = std::thread(&EmulationThread::Run, this);
+}
+
+void EmulationThread::Stop()
+{
+    isShuttingDown.store(true);
+    pacer->Stop();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+EmulatorSnapshot const & EmulationThread::GetSnapshot()
+{
+    snapshots.Consume();
+    return snapshots.GetReadBuffer();
+}
+
+void EmulationThread::Run()
+{
+    logger->Infof("Starting emulation thread");
+    int cyclesPerFrame = 0;
+    while (!isShuttingDown.load()) {
+        // Wait even while paused so that commands are handled at the same rate as when running
+        u64 sliceNs = pacer->WaitForNextSlice();
+
+        EmulatorCommand command;
+        while (commands.try_dequeue(command)) {
+            HandleCommand(command);
+        }
+
+        if (isRunning && sliceNs > 0) {
+            cyclesPerFrame = cpu->Tick(sliceNs);
+            rewindBuffer.Update(*cpu);
+            u16 pc = cpu->GetState()->Get16BitRegisterValue(GetRegister(RegisterName::PC));
+            auto const & breakpoints = cpu->GetBreakpoints();
+            if (breakpoints.find(pc) != breakpoints.end()) {
+                isRunning = false;
+            }
+        }
+
+        PublishSnapshot(cyclesPerFrame);
+    }
+    logger->Infof("Stopping emulation thread");
+}
+
+void EmulationThread::HandleCommand(EmulatorCommand const & command)
+{
+    switch (command.type) {
+    case EmulatorCommandType::RUN:
+        isRunning = true;
+        break;
+    case EmulatorCommandType::BREAK:
+        isRunning = false;
+        break;
+    case EmulatorCommandType::STEP:
+        cpu->StepInstruction();
+        break;
+    case EmulatorCommandType::STEP_BACK:
+        cpu->StepBack();
+        break;
+    case EmulatorCommandType::CONTINUE_BACK:
+        cpu->ContinueBack();
+        break;
+    case EmulatorCommandType::RESET:
+        cpu->Reset();
+        rewindBuffer.Clear();
+        break;
+    case EmulatorCommandType::ADD_BREAKPOINT:
+        cpu->AddBreakpoint(command.argument);
+        break;
+    case EmulatorCommandType::REMOVE_BREAKPOINT:
+        cpu->RemoveBreakpoint(command.argument);
+        break;
+    case EmulatorCommandType::ADD_MEMORY_WRITE_BREAKPOINT:
+        cpu->AddMemoryWriteBreakpoint(command.argument);
+        break;
+    case EmulatorCommandType::REMOVE_MEMORY_WRITE_BREAKPOINT:
+        cpu->RemoveMemoryWriteBreakpoint(command.argument);
+        break;
+    case EmulatorCommandType::SET_BREAK_ON_DECODE_ERROR:
+        cpu->SetBreakOnDecodeError(command.argument != 0);
+        break;
+    case EmulatorCommandType::SET_UNDO_LOG_CAPACITY:
+        cpu->SetUndoLogCapacity(command.argument);
+        break;
+    case EmulatorCommandType::REWIND: {
+        // As far back as there is history
+        u64 frame = cpu->GetGpu()->GetFrameCount();
+        u64 oldestFrame = rewindBuffer.GetOldestFrame();
+        if (rewindBuffer.GetSnapshotCount() > 0 && frame > oldestFrame) {
+            rewindBuffer.RewindTo(*cpu, frame - std::min<u64>(frame - oldestFrame, command.argument));
+        }
+        break;
+    }
+    }
+}
+
+void EmulationThread::PublishSnapshot(int cyclesPerFrame)
+{
+    EmulatorSnapshot & snapshot = snapshots.GetWriteBuffer();
+    snapshot.isRunning = isRunning;
+    snapshot.cyclesPerFrame = cyclesPerFrame;
+    snapshot.cpuState = *cpu->GetState();
+    snapshot.oam = cpu->GetGpu()->DebugGetOam();
+    snapshot.breakpoints = cpu->GetBreakpoints();
+    snapshot.memoryWriteBreakpoints = cpu->GetMemoryWriteBreakpoints();
+    snapshot.breakOnDecodeError = cpu->GetBreakOnDecodeError();
+    snapshot.rewindableFrames =
+        rewindBuffer.GetSnapshotCount() > 0 ? cpu->GetGpu()->GetFrameCount() - rewindBuffer.GetOldestFrame() : 0;
+
+    u8 flags = snapshotFlags.load(std::memory_order_relaxed);
+    if (flags & SNAPSHOT_MEMORY) {
+        MemoryState const * memory = cpu->GetMemory();
+        for (size_t i = 0; i < MEMORY_SIZE; ++i) {
+            snapshot.memory.Write(i, memory->Read(i));
+        }
+    }
+    if (flags & SNAPSHOT_HISTORY) {
+        debug::UndoLog const & undoLog = cpu->GetUndoLog();
+        snapshot.historySize = undoLog.ReadNewest(cpu->GetUndoCpuState(), snapshot.history);
+        for (size_t i = 0; i < snapshot.historySize; ++i) {
+            snapshot.historyOpcodes[i] =
+                cpu->GetMemory()->Read16(snapshot.history[i].previousRegisters[debug::UNDO_REGISTER_PC]);
+        }
+        snapshot.undoLogRecordCount = undoLog.GetRecordCount();
+        snapshot.undoLogUsedSize = undoLog.GetUsedSize();
+    }
+
+    snapshots.Publish();
+}
+};
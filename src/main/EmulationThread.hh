@@ -0,0 +1,122 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <concurrentqueue/concurrentqueue.h>
+
+#include "Common.hh"
+#include "GbCpuState.hh"
+#include "GbGpuState.hh"
+#include "MemoryState.hh"
+#include "concurrency/TripleBuffer.hh"
+#include "debug/UndoLog.hh"
+#include "savestate/RewindBuffer.hh"
+
+namespace gb4e
+{
+class FramePacer;
+class GbCpu;
+
+enum class EmulatorCommandType {
+    RUN,
+    BREAK,
+    STEP,
+    STEP_BACK,
+    CONTINUE_BACK,
+    RESET,
+    ADD_BREAKPOINT,
+    REMOVE_BREAKPOINT,
+    ADD_MEMORY_WRITE_BREAKPOINT,
+    REMOVE_MEMORY_WRITE_BREAKPOINT,
+    SET_BREAK_ON_DECODE_ERROR,
+    SET_UNDO_LOG_CAPACITY,
+    REWIND,
+};
+
+struct EmulatorCommand {
+    EmulatorCommandType type;
+    // Address for breakpoint commands, 0/1 for SET_BREAK_ON_DECODE_ERROR, bytes for SET_UNDO_LOG_CAPACITY, frames for
+    // REWIND
+    u32 argument;
+};
+
+// Bits for EmulationThread::SetSnapshotFlags. Parts of the snapshot that are not requested are left stale.
+u8 constexpr SNAPSHOT_MEMORY = BIT(0);
+u8 constexpr SNAPSHOT_HISTORY = BIT(1);
+
+size_t constexpr SNAPSHOT_HISTORY_SIZE = 128;
+
+// Memory for rewind history while running, and how often it is recorded
+size_t constexpr REWIND_MEMORY_BUDGET = 8 * 1024 * 1024;
+u32 constexpr REWIND_FRAMES_PER_SNAPSHOT = 2;
+
+/**
+ * Copy of the emulator state which the UI can read while the emulation thread keeps running
+ */
+struct EmulatorSnapshot {
+    bool isRunning = false;
+    int cyclesPerFrame = 0;
+
+    GbCpuState cpuState;
+    // Contents of the full address space as seen by the CPU
+    MemoryStateFake memory;
+    std::array<OamEntry, 40> oam;
+
+    std::set<u16> breakpoints;
+    std::set<u16> memoryWriteBreakpoints;
+    bool breakOnDecodeError = false;
+
+    // How far back REWIND can go
+    u64 rewindableFrames = 0;
+
+    // The most recently executed instructions, newest first, and the opcode at the PC each started from
+    std::array<debug::UndoRecord, SNAPSHOT_HISTORY_SIZE> history;
+    std::array<u16, SNAPSHOT_HISTORY_SIZE> historyOpcodes;
+    size_t historySize = 0;
+    // Everything which can be stepped back through
+    size_t undoLogRecordCount = 0;
+    size_t undoLogUsedSize = 0;
+};
+
+/**
+ * Runs a GbCpu on its own thread. All interaction with the CPU while the thread is running must go through
+ * PushCommand and GetSnapshot. The pacer decides when and for how long to emulate.
+ */
+class EmulationThread
+{
+public:
+    EmulationThread(GbCpu * cpu, FramePacer * pacer) : cpu(cpu), pacer(pacer) {}
+    ~EmulationThread();
+
+    void Start();
+    void Stop();
+
+    void PushCommand(EmulatorCommand command) { commands.enqueue(command); }
+    void SetSnapshotFlags(u8 flags) { snapshotFlags.store(flags, std::memory_order_relaxed); }
+
+    // Returns the most recently published snapshot. The reference is valid until the next call.
+    EmulatorSnapshot const & GetSnapshot();
+
+private:
+    void Run();
+    void HandleCommand(EmulatorCommand const & command);
+    void PublishSnapshot(int cyclesPerFrame);
+
+    GbCpu * cpu;
+    FramePacer * pacer;
+    std::thread thread;
+    std::atomic_bool isShuttingDown = false;
+
+    moodycamel::ConcurrentQueue<EmulatorCommand> commands;
+    std::atomic<u8> snapshotFlags = 0;
+    TripleBuffer<EmulatorSnapshot> snapshots;
+
+    // Only touched by the emulation thread
+    bool isRunning = false;
+    RewindBuffer rewindBuffer{REWIND_MEMORY_BUDGET, REWIND_FRAMES_PER_SNAPSHOT};
+};
+};
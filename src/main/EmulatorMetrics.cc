@@ -0,0 +1,87 @@
+#include "EmulatorMetrics.hh"
+
+#include <sstream>
+
+namespace gb4e
+{
+
+char const * MetricToString(Metric metric)
+{
+    switch (metric) {
+    case Metric::CYCLE:
+        return "cycle";
+    case Metric::INSTRUCTION:
+        return "instruction";
+    case Metric::APPLY:
+        return "apply";
+    case Metric::APPLY_FLAGS:
+        return "applyFlags";
+    case Metric::APPLY_INTERRUPTS:
+        return "applyInterrupts";
+    case Metric::APPLY_MEMORY:
+        return "applyMemory";
+    case Metric::APPLY_REGISTERS:
+        return "applyRegisters";
+    case Metric::APPLY_PC:
+        return "applyPc";
+    case Metric::GPU_CYCLE:
+        return "gpuCycle";
+    case Metric::AUDIO_CALLBACK:
+        return "audioCallback";
+    default:
+        return "unknown";
+    }
+}
+
+u64 MetricSnapshot::GetPercentileNs(double percentile) const
+{
+    u64 total = 0;
+    for (u64 bucketCount : histogram) {
+        total += bucketCount;
+    }
+    u64 target = (u64)(percentile * total);
+    u64 seen = 0;
+    for (size_t i = 0; i < histogram.size(); ++i) {
+        seen += histogram[i];
+        if (seen > target) {
+            return i == 0 ? 0 : (u64)1 << i;
+        }
+    }
+    return (u64)1 << (histogram.size() - 1);
+}
+
+std::string MetricsSnapshot::ToString() const
+{
+    std::stringstream ss;
+    ss << '{';
+    for (size_t i = 0; i < metrics.size(); ++i) {
+        auto const & metric = metrics[i];
+        ss << "\"" << MetricToString((Metric)i) << "\": {";
+        ss << "\"lastNs\": " << metric.lastNs << ", ";
+        ss << "\"count\": " << metric.count << ", ";
+        ss << "\"meanNs\": " << metric.GetMeanNs() << ", ";
+        ss << "\"p99Ns\": " << metric.GetPercentileNs(0.99) << '}';
+        if (i + 1 < metrics.size()) {
+            ss << ", ";
+        }
+    }
+    ss << '}';
+    return ss.str();
+}
+
+MetricsSnapshot EmulatorMetrics::Snapshot() const
+{
+    MetricsSnapshot snapshot;
+    for (size_t i = 0; i < counters.size(); ++i) {
+        auto const & counter = counters[i];
+        auto & metric = snapshot.metrics[i];
+        metric.lastNs = counter.lastNs.load(std::memory_order_relaxed);
+        metric.count = counter.count.load(std::memory_order_relaxed);
+        metric.totalNs = counter.totalNs.load(std::memory_order_relaxed);
+        for (size_t j = 0; j < METRIC_HISTOGRAM_BUCKETS; ++j) {
+            metric.histogram[j] = counter.histogram[j].load(std::memory_order_relaxed);
+        }
+    }
+    return snapshot;
+}
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <string>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+enum class Metric {
+    // Wall time between two emulated cycles
+    CYCLE,
+    // Time spent in the instruction applier, which computes the InstructionResult
+    INSTRUCTION,
+    // Time spent applying the InstructionResult, APPLY_* break this down further
+    APPLY,
+    APPLY_FLAGS,
+    APPLY_INTERRUPTS,
+    APPLY_MEMORY,
+    APPLY_REGISTERS,
+    APPLY_PC,
+    // Time spent ticking the GPU for one CPU cycle
+    GPU_CYCLE,
+    // Wall time between two callbacks of the audio device
+    AUDIO_CALLBACK,
+    COUNT,
+};
+
+char const * MetricToString(Metric metric);
+
+// Bucket i counts samples in [2^(i-1), 2^i) ns, bucket 0 counts 0 ns and the last bucket everything from ~4 ms up
+size_t constexpr METRIC_HISTOGRAM_BUCKETS = 24;
+
+struct MetricSnapshot {
+    u64 lastNs = 0;
+    u64 count = 0;
+    u64 totalNs = 0;
+    std::array<u64, METRIC_HISTOGRAM_BUCKETS> histogram{};
+
+    double GetMeanNs() const { return count > 0 ? (double)totalNs / count : 0; }
+    // Upper bound of the histogram bucket containing the given percentile, percentile is between 0 and 1
+    u64 GetPercentileNs(double percentile) const;
+};
+
+struct MetricsSnapshot {
+    std::array<MetricSnapshot, (size_t)Metric::COUNT> metrics;
+
+    MetricSnapshot const & Get(Metric metric) const { return metrics[(size_t)metric]; }
+    std::string ToString() const;
+};
+
+/**
+ * Timing metrics of one emulator instance.
+ *
+ * Each metric must only be recorded from one thread, which allows updating the counters with relaxed loads and stores
+ * instead of atomic read-modify-writes. Any thread may take a Snapshot at any time. Individual values in a snapshot are
+ * never torn, but the values of one metric may be from slightly different points in time. Every metric lives on its own
+ * cache line so that the emulation and audio threads do not slow each other down.
+ */
+class EmulatorMetrics
+{
+public:
+    void Record(Metric metric, u64 durationNs)
+    {
+        auto & counter = counters[(size_t)metric];
+        Increment(counter.count, 1);
+        Increment(counter.totalNs, durationNs);
+        Increment(counter.histogram[GetHistogramBucket(durationNs)], 1);
+        counter.lastNs.store(durationNs, std::memory_order_relaxed);
+    }
+
+    MetricsSnapshot Snapshot() const;
+
+private:
+    struct alignas(64) Counter {
+        std::atomic<u64> lastNs = 0;
+        std::atomic<u64> count = 0;
+        std::atomic<u64> totalNs = 0;
+        std::array<std::atomic<u64>, METRIC_HISTOGRAM_BUCKETS> histogram{};
+    };
+
+    static void Increment(std::atomic<u64> & value, u64 amount)
+    {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    static size_t GetHistogramBucket(u64 durationNs)
+    {
+        size_t bucket = 0;
+        while (durationNs > 0 && bucket < METRIC_HISTOGRAM_BUCKETS - 1) {
+            durationNs >>= 1;
+            ++bucket;
+        }
+        return bucket;
+    }
+
+    std::array<Counter, (size_t)Metric::COUNT> counters;
+};
+};
@@ -0,0 +1,110 @@
+#include "FramePacer.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "audio/GbApuState.hh"
+#include "logging/Logger.hh"
+
+static auto const logger = Logger::Create("FramePacer");
+
+// How far ahead of the audio device emulation should be
+double constexpr AUDIO_TARGET_LEAD_NS = 3 * gb4e::FRAME_REAL_DURATION_NS;
+// If emulation falls further behind the audio device than this, for example because it was paused, the backlog is
+// dropped instead of being caught up
+double constexpr AUDIO_MAX_LAG_NS = 8 * gb4e::FRAME_REAL_DURATION_NS;
+double constexpr AUDIO_MAX_RATE_ADJUSTMENT = 0.005;
+// Real time a CPU cycle takes, CYCLE_DURATION_NS is rounded down to whole nanoseconds
+double constexpr CYCLE_REAL_DURATION_NS = gb4e::FRAME_REAL_DURATION_NS / gb4e::CYCLES_PER_FRAME;
+
+// Never emulate more than this many frames for a single vsync, e.g. after the window has been dragged
+u64 constexpr VSYNC_MAX_FRAMES_PER_SLICE = 4;
+
+namespace gb4e
+{
+
+std::optional<PacingMode> ToPacingMode(std::string const & str)
+{
+    if (str == "audio") {
+        return PacingMode::AUDIO;
+    }
+    if (str == "vsync") {
+        return PacingMode::VSYNC;
+    }
+    return {};
+}
+
+u64 AudioFramePacer::WaitForNextSlice()
+{
+    while (!isStopped.load()) {
+        auto audioClockNs = apu->GetAudioClockNs();
+        auto queuedAudioNs = apu->GetQueuedAudioNs();
+        if (!audioClockNs.has_value() || !queuedAudioNs.has_value()) {
+            logger->Errorf("AudioFramePacer requires an APU with an audio device");
+            return 0;
+        }
+        double lead = emulatedNs - (double)audioClockNs.value();
+        if (lead < -AUDIO_MAX_LAG_NS) {
+            logger->Tracef("Emulation is behind audio by %f ns, resynchronizing", -lead);
+            emulatedNs = (double)audioClockNs.value();
+            lead = 0;
+        }
+        if (lead > AUDIO_TARGET_LEAD_NS) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds((u64)(lead - AUDIO_TARGET_LEAD_NS)));
+            continue;
+        }
+
+        // Positive error means the device is running out of audio and emulation should run slightly faster, negative
+        // that audio is piling up and it should run slightly slower
+        double error =
+            std::clamp((AUDIO_TARGET_LEAD_NS - (double)queuedAudioNs.value()) / AUDIO_TARGET_LEAD_NS, -1.0, 1.0);
+        double rate = 1.0 + error * AUDIO_MAX_RATE_ADJUSTMENT;
+        // Round to whole cycles so the CPU does not carry over a partial cycle between slices
+        u64 cycles = (u64)std::llround(CYCLES_PER_FRAME * rate);
+        emulatedNs += cycles * CYCLE_REAL_DURATION_NS;
+        return cycles * CYCLE_DURATION_NS;
+    }
+    return 0;
+}
+
+VsyncFramePacer::VsyncFramePacer(double displayRefreshRate)
+    : displayRefreshPeriodNs(1000000000.0 / displayRefreshRate), lastVsync(std::chrono::high_resolution_clock::now())
+{
+    logger->Infof("VsyncFramePacer displayRefreshRate=%f", displayRefreshRate);
+}
+
+void VsyncFramePacer::OnVsync()
+{
+    auto now = std::chrono::high_resolution_clock::now();
+    double elapsedNs = (double)(now - lastVsync).count();
+    lastVsync = now;
+    // Count how many refreshes passed so that a missed vsync still advances emulation by the right amount
+    double refreshes = std::max(1.0, std::round(elapsedNs / displayRefreshPeriodNs));
+    double frames = refreshes * displayRefreshPeriodNs / FRAME_REAL_DURATION_NS;
+    accumulatedFrames.fetch_add((u64)(frames * FRAME_ONE));
+    accumulatedFrames.notify_one();
+}
+
+u64 VsyncFramePacer::WaitForNextSlice()
+{
+    while (!isStopped.load()) {
+        u64 accumulated = accumulatedFrames.load();
+        if (accumulated < FRAME_ONE) {
+            accumulatedFrames.wait(accumulated);
+            continue;
+        }
+        u64 wholeFrames = accumulated / FRAME_ONE;
+        accumulatedFrames.fetch_sub(wholeFrames * FRAME_ONE);
+        return std::min(wholeFrames, VSYNC_MAX_FRAMES_PER_SLICE) * FRAME_DURATION_NS;
+    }
+    return 0;
+}
+
+void VsyncFramePacer::Stop()
+{
+    isStopped.store(true);
+    accumulatedFrames.fetch_add(FRAME_ONE);
+    accumulatedFrames.notify_one();
+}
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <string>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+class ApuState;
+
+enum class PacingMode { AUDIO, VSYNC };
+
+std::optional<PacingMode> ToPacingMode(std::string const & str);
+
+/**
+ * Decides when the emulation thread should run and for how long, so that emulation advances at the hardware frame
+ * rate of ~59.73 Hz regardless of the host display rate.
+ */
+class FramePacer
+{
+public:
+    virtual ~FramePacer() = default;
+
+    /**
+     * Blocks until it is time to emulate more and returns how much emulated time (in GbCpu::Tick units) to run.
+     * Returns 0 after Stop has been called.
+     */
+    virtual u64 WaitForNextSlice() = 0;
+
+    // Wakes up any thread blocked in WaitForNextSlice
+    virtual void Stop() = 0;
+};
+
+/**
+ * Paces emulation to the audio device. The amount of audio played by the device is used as the clock and emulation is
+ * kept AUDIO_TARGET_LEAD_NS ahead of it. The device drops or pads samples when the two drift apart, so the clock alone
+ * does not say how much audio is waiting. Instead of jumping when the queued audio drifts from AUDIO_TARGET_LEAD_NS,
+ * the length of each slice is adjusted by up to AUDIO_MAX_RATE_ADJUSTMENT in either direction, which is small enough to
+ * not be audible as a pitch change.
+ */
+class AudioFramePacer final : public FramePacer
+{
+public:
+    AudioFramePacer(ApuState const * apu) : apu(apu) {}
+
+    u64 WaitForNextSlice() final override;
+    void Stop() final override { isStopped.store(true); }
+
+private:
+    ApuState const * apu;
+    std::atomic_bool isStopped = false;
+
+    // Real time of the cycles handed out so far, on the same clock as ApuState::GetAudioClockNs
+    double emulatedNs = 0;
+};
+
+/**
+ * Paces emulation to the display refresh. The UI thread calls OnVsync after every buffer swap, which adds the fraction
+ * of a Game Boy frame that a display refresh corresponds to. The emulation thread runs every whole frame that has
+ * accumulated, so on a 60 Hz display roughly one vsync in 225 emulates no frame at all.
+ */
+class VsyncFramePacer final : public FramePacer
+{
+public:
+    VsyncFramePacer(double displayRefreshRate);
+
+    u64 WaitForNextSlice() final override;
+    void Stop() final override;
+
+    // Called by the UI thread after every presented frame
+    void OnVsync();
+
+private:
+    // Accumulated frames are stored as fixed point with 16 fractional bits
+    static u64 constexpr FRAME_ONE = 1 << 16;
+
+    double displayRefreshPeriodNs;
+    std::chrono::high_resolution_clock::time_point lastVsync;
+
+    std::atomic_uint64_t accumulatedFrames = 0;
+    std::atomic_bool isStopped = false;
+};
+};
@@ -0,0 +1,13 @@
+#include "Framebuffer.hh"
+
+namespace gb4e
+{
+u32 const DMG_COLOR_PALETTE[NUM_DMG_SHADES] = {0xFFFFFFFF, 0xFFC0C0C0, 0xFF606060, 0xFF000000};
+
+void FramebufferToRgba(Framebuffer const & framebuffer, u32 * out)
+{
+    for (size_t i = 0; i < framebuffer.size(); ++i) {
+        out[i] = DMG_COLOR_PALETTE[framebuffer[i] & 0b11];
+    }
+}
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <array>
+
+#include "Common.hh"
+#include "concurrency/TripleBuffer.hh"
+
+namespace gb4e
+{
+int constexpr NUM_DMG_SHADES = 4;
+
+// Each pixel is a DMG shade index (0=white, 3=black) with the BGP/OBP palette already applied.
+// Conversion to a displayable color is left to the consumer.
+using Framebuffer = std::array<u8, SCREEN_HEIGHT * SCREEN_WIDTH>;
+
+// Completed frames are published through this by the GPU at the start of VBlank
+using FrameExchange = TripleBuffer<Framebuffer>;
+
+// RGBA colors of the DMG shades, in the byte order expected by GL_RGBA/GL_UNSIGNED_BYTE
+extern u32 const DMG_COLOR_PALETTE[NUM_DMG_SHADES];
+
+/**
+ * Converts a shade-indexed framebuffer to RGBA using DMG_COLOR_PALETTE.
+ * out must have room for SCREEN_WIDTH * SCREEN_HEIGHT pixels.
+ */
+void FramebufferToRgba(Framebuffer const & framebuffer, u32 * out);
+};
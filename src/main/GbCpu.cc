@@ -8,7 +8,9 @@
 #include "debug/InstructionTrace.hh"
 #include "logging/Logger.hh"
 #include "romfile/RomFile.hh"
-#include "ui/Metrics.hh"
+#include "savestate/InputMovie.hh"
+#include "savestate/SaveState.hh"
+#include "savestate/StateStream.hh"
 
 auto const logger = Logger::Create("GbCpu");
 
@@ -17,17 +19,25 @@ namespace gb4e
 
 std::optional<GbCpu> GbCpu::Create(size_t bootromSize, u8 const * bootrom, GbModel gbModel, Renderer * renderer,
                                    InputSystem const & inputSystem,
-                                   std::vector<std::shared_ptr<MemoryListener>> listeners)
+                                   std::vector<std::shared_ptr<MemoryListener>> listeners,
+                                   std::unique_ptr<AudioSink> && audioSink)
 {
     logger->Infof("CLOCK_FREQUENCY=%zu, CYCLE_DURATION_NS=%zu", CLOCK_FREQUENCY, CYCLE_DURATION_NS);
 
-    return GbCpu(bootromSize, bootrom, gbModel, renderer, inputSystem, listeners);
+    if (!audioSink) {
+        audioSink = std::make_unique<NullAudioSink>();
+    }
+    auto metrics = std::make_unique<EmulatorMetrics>();
+    audioSink->SetMetrics(metrics.get());
+    return GbCpu(
+        bootromSize, bootrom, gbModel, renderer, inputSystem, listeners, std::move(audioSink), std::move(metrics));
 }
 
 void GbCpu::Reset()
 {
     this->gpuState->Reset();
     this->state->Reset();
+    undoLog.Clear();
 }
 
 void GbCpu::LoadRom(RomFile const * romFile)
@@ -35,6 +45,205 @@ void GbCpu::LoadRom(RomFile const * romFile)
     this->cartridge->LoadRom(romFile);
 }
 
+static void WriteInstructionResult(StateWriter & writer, InstructionResult const & result)
+{
+    std::optional<FlagSet> flagSet = result.GetFlagSet();
+    writer.Write(flagSet.has_value());
+    if (flagSet) {
+        writer.Write(flagSet->GetPreviousValue());
+        writer.Write(flagSet->GetValue());
+    }
+    std::optional<InterruptSet> interruptSet = result.GetInterruptSet();
+    writer.Write(interruptSet.has_value());
+    if (interruptSet) {
+        writer.Write(interruptSet->GetPreviousValue());
+        writer.Write(interruptSet->GetValue());
+        writer.Write(interruptSet->GetWithInstructionDelay());
+    }
+    writer.Write((u8)result.GetMemoryWrites().size());
+    for (MemoryWrite const & memoryWrite : result.GetMemoryWrites()) {
+        writer.Write(memoryWrite.GetLocation());
+        writer.Write(memoryWrite.GetPreviousValue());
+        writer.Write(memoryWrite.GetValue());
+    }
+    writer.Write((u8)result.GetRegisterWrites().size());
+    for (RegisterWrite const & registerWrite : result.GetRegisterWrites()) {
+        Register reg = registerWrite.GetRegister();
+        writer.Write((u8)reg.GetRegisterName());
+        writer.Write<u16>(reg.Is8Bit() ? registerWrite.GetBytePreviousValue() : registerWrite.GetWordPreviousValue());
+        writer.Write<u16>(reg.Is8Bit() ? registerWrite.GetByteValue() : registerWrite.GetWordValue());
+    }
+    writer.Write(result.GetConsumedBytes());
+    writer.Write(result.GetConsumedCycles());
+}
+
+static InstructionResult ReadInstructionResult(StateReader & reader)
+{
+    std::optional<FlagSet> flagSet;
+    if (reader.Read<bool>()) {
+        u8 previousValue = reader.Read<u8>();
+        flagSet.emplace(previousValue, reader.Read<u8>());
+    }
+    std::optional<InterruptSet> interruptSet;
+    if (reader.Read<bool>()) {
+        bool previousValue = reader.Read<bool>();
+        bool value = reader.Read<bool>();
+        interruptSet.emplace(previousValue, value, reader.Read<bool>());
+    }
+    std::vector<MemoryWrite> memoryWrites;
+    for (u8 i = 0, count = reader.Read<u8>(); i < count; ++i) {
+        u16 location = reader.Read<u16>();
+        u8 previousValue = reader.Read<u8>();
+        memoryWrites.emplace_back(location, previousValue, reader.Read<u8>());
+    }
+    std::vector<RegisterWrite> registerWrites;
+    for (u8 i = 0, count = reader.Read<u8>(); i < count; ++i) {
+        u8 registerName = reader.Read<u8>();
+        if (registerName > (u8)RegisterName::HL) {
+            reader.Fail();
+            break;
+        }
+        Register reg((RegisterName)registerName);
+        u16 previousValue = reader.Read<u16>();
+        u16 value = reader.Read<u16>();
+        if (reg.Is8Bit()) {
+            registerWrites.emplace_back(reg, (u8)previousValue, (u8)value);
+        } else {
+            registerWrites.emplace_back(reg, previousValue, value);
+        }
+    }
+    u8 consumedBytes = reader.Read<u8>();
+    u8 consumedCycles = reader.Read<u8>();
+    if (consumedBytes > 3 || consumedCycles > 6) {
+        reader.Fail();
+        return InstructionResult();
+    }
+    return InstructionResult(flagSet, interruptSet, std::move(memoryWrites), std::move(registerWrites), consumedBytes,
+                             consumedCycles);
+}
+
+void GbCpu::SaveState(StateWriter & writer) const
+{
+    // The cartridge goes first so that loading a state of another ROM fails before anything else is changed
+    writer.BeginSection(SectionTag("CART"));
+    cartridge->SaveState(writer);
+    writer.EndSection();
+
+    writer.BeginSection(SectionTag("CPU "));
+    state->SaveState(writer);
+    writer.EndSection();
+
+    writer.BeginSection(SectionTag("SCHD"));
+    writer.Write(clockTimeNs);
+    writer.Write(lastCycleNs);
+    writer.Write(pendingApuCycles);
+    writer.Write(waitCycles);
+    writer.Write(interruptRoutineCycle);
+    writer.Write(queuedInterruptAddress);
+    writer.Write(oamDmaCycles);
+    writer.Write(queuedInstructionResult.has_value());
+    if (queuedInstructionResult) {
+        WriteInstructionResult(writer, *queuedInstructionResult);
+    }
+    writer.EndSection();
+
+    writer.BeginSection(SectionTag("GPU "));
+    gpuState->SaveState(writer);
+    writer.EndSection();
+
+    writer.BeginSection(SectionTag("APU "));
+    apuState->SaveState(writer);
+    writer.EndSection();
+
+    writer.BeginSection(SectionTag("JOYP"));
+    joypad->SaveState(writer);
+    writer.EndSection();
+}
+
+bool GbCpu::LoadState(StateReader & reader)
+{
+    // The history leads up to the state being replaced
+    undoLog.Clear();
+    while (!reader.IsAtEnd()) {
+        u32 tag = reader.Read<u32>();
+        StateReader section = reader.ReadSubReader(reader.Read<u32>());
+        if (reader.HasFailed()) {
+            logger->Errorf("Save state is truncated");
+            return false;
+        }
+
+        if (tag == SectionTag("CART")) {
+            cartridge->LoadState(section);
+        } else if (tag == SectionTag("CPU ")) {
+            state->LoadState(section);
+        } else if (tag == SectionTag("SCHD")) {
+            section.Read(clockTimeNs);
+            section.Read(lastCycleNs);
+            section.Read(pendingApuCycles);
+            section.Read(waitCycles);
+            section.Read(interruptRoutineCycle);
+            section.Read(queuedInterruptAddress);
+            section.Read(oamDmaCycles);
+            queuedInstructionResult.reset();
+            if (section.Read<bool>()) {
+                queuedInstructionResult = ReadInstructionResult(section);
+            }
+        } else if (tag == SectionTag("GPU ")) {
+            gpuState->LoadState(section);
+        } else if (tag == SectionTag("APU ")) {
+            apuState->LoadState(section);
+        } else if (tag == SectionTag("JOYP")) {
+            joypad->LoadState(section);
+        } else {
+            // Written by a newer version, which also knows how to do without it
+            logger->Warnf("Skipping unknown save state section tag=%08x", tag);
+            continue;
+        }
+
+        if (section.HasFailed() || !section.IsAtEnd()) {
+            logger->Errorf("Malformed save state section tag=%08x", tag);
+            return false;
+        }
+    }
+    return true;
+}
+
+GbCpu GbCpu::Clone(InputSystem const & inputSystem) const
+{
+    auto cloneMetrics = std::make_unique<EmulatorMetrics>();
+    auto audioSink = std::make_unique<NullAudioSink>();
+    audioSink->SetMetrics(cloneMetrics.get());
+    GbCpu clone(state->bootromSize, state->bootrom, gpuState->GetModel(), nullptr, inputSystem, {},
+                std::move(audioSink), std::move(cloneMetrics));
+    clone.enableMetrics = enableMetrics;
+    if (cartridge->GetRomFile() != nullptr) {
+        clone.LoadRom(cartridge->GetRomFile());
+    }
+    Snapshot snapshot;
+    TakeSnapshot(snapshot);
+    clone.RestoreFrom(snapshot);
+    return clone;
+}
+
+void GbCpu::TakeSnapshot(Snapshot & snapshot) const
+{
+    StateWriter writer(snapshot.data.data(), snapshot.data.size());
+    SaveState(writer);
+    if (writer.HasOverflowed()) {
+        // Only the queued instruction changes the size, leave room for it to grow
+        snapshot.data.resize(writer.GetSize() + 64);
+        writer = StateWriter(snapshot.data.data(), snapshot.data.size());
+        SaveState(writer);
+    }
+    snapshot.size = writer.GetSize();
+}
+
+bool GbCpu::RestoreFrom(Snapshot const & snapshot)
+{
+    StateReader reader(snapshot.GetData(), snapshot.GetSize(), SAVE_STATE_VERSION);
+    return LoadState(reader);
+}
+
 void GbCpu::StepInstruction()
 {
     while (!queuedInstructionResult.has_value()) {
@@ -44,6 +253,7 @@ void GbCpu::StepInstruction()
     for (int i = 0; i < numCyclesToTick; ++i) {
         TickCycle();
     }
+    SyncApu();
 }
 
 int GbCpu::Tick(u64 deltaTimeNs)
@@ -52,18 +262,43 @@ int GbCpu::Tick(u64 deltaTimeNs)
     if (IsAtMemoryBreakpoint()) {
         return numCycles;
     }
-    auto joypadTickResult = joypad->Tick();
-    if (joypadTickResult.triggerInterrupt) {
-        u8 iflags = state->ReadMemory(0xFF0F).value();
-        iflags |= BIT(4);
-        state->WriteMemory(0xFF0F, iflags);
+    TickJoypad();
+    auto beforeTick = std::chrono::high_resolution_clock::now();
+    numCycles = TickUntilBreak(deltaTimeNs);
+    SyncApu();
+    if (maxAdaptiveFrameSkip > 0) {
+        u64 wallTimeNs = (std::chrono::high_resolution_clock::now() - beforeTick).count();
+        UpdateAdaptiveFrameSkip(deltaTimeNs, wallTimeNs);
     }
+    return numCycles;
+}
+
+int GbCpu::RunFrames(u32 frames)
+{
+    TickJoypad();
+    int numCycles = 0;
+    u64 targetFrame = gpuState->GetFrameCount() + frames;
+    while (gpuState->GetFrameCount() < targetFrame) {
+        // Keep the clock in step so that a later Tick continues from here
+        clockTimeNs += CYCLE_DURATION_NS;
+        lastCycleNs = clockTimeNs;
+        numCycles++;
+        TickCycle();
+    }
+    SyncApu();
+    return numCycles;
+}
+
+int GbCpu::TickUntilBreak(u64 deltaTimeNs)
+{
+    int numCycles = 0;
     auto beforeCycle = std::chrono::high_resolution_clock::now();
     while (deltaTimeNs > 0) {
-        auto afterCycle = std::chrono::high_resolution_clock::now();
-        auto cycleTimeNs = (afterCycle - beforeCycle).count();
-        gb4e::ui::cycleTimeNs = cycleTimeNs;
-        beforeCycle = std::chrono::high_resolution_clock::now();
+        if (enableMetrics) {
+            auto afterCycle = std::chrono::high_resolution_clock::now();
+            metrics->Record(Metric::CYCLE, (afterCycle - beforeCycle).count());
+            beforeCycle = afterCycle;
+        }
         if (deltaTimeNs > CYCLE_DURATION_NS) {
             clockTimeNs += CYCLE_DURATION_NS;
             deltaTimeNs -= CYCLE_DURATION_NS;
@@ -99,11 +334,81 @@ int GbCpu::Tick(u64 deltaTimeNs)
     return numCycles;
 }
 
+void GbCpu::SetMovie(InputMovie * movie, bool isPlaying, size_t nextInput)
+{
+    this->movie = movie;
+    isPlayingMovie = movie != nullptr && isPlaying;
+    nextMovieInput = nextInput;
+    nextMovieInputCycle = UINT64_MAX;
+    if (isPlayingMovie && nextInput < movie->GetInputs().size()) {
+        nextMovieInputCycle = movie->GetInputs()[nextInput].cycle;
+    }
+}
+
+void GbCpu::TickJoypad()
+{
+    // Sampled once per Tick, which depends on the host. Movies record when that was to replay it exactly.
+    if (isPlayingMovie) {
+        return;
+    }
+    u8 joypadState = joypad->SampleInput();
+    ApplyJoypadState(joypadState);
+    if (movie != nullptr) {
+        movie->OnJoypadSampled(*this, joypadState);
+    }
+}
+
+void GbCpu::ApplyMovieInputs()
+{
+    auto const & inputs = movie->GetInputs();
+    while (nextMovieInput < inputs.size() && inputs[nextMovieInput].cycle <= state->totalCycles) {
+        ApplyJoypadState(inputs[nextMovieInput].joypadState);
+        ++nextMovieInput;
+    }
+    nextMovieInputCycle = nextMovieInput < inputs.size() ? inputs[nextMovieInput].cycle : UINT64_MAX;
+}
+
+void GbCpu::ApplyJoypadState(u8 joypadState)
+{
+    auto joypadTickResult = joypad->Tick(joypadState);
+    if (joypadTickResult.triggerInterrupt) {
+        u8 iflags = state->ReadMemory(0xFF0F).value();
+        iflags |= BIT(4);
+        state->WriteMemory(0xFF0F, iflags);
+    }
+}
+
+void GbCpu::SyncApu()
+{
+    if (pendingApuCycles > 0) {
+        apuState->Tick(pendingApuCycles);
+        pendingApuCycles = 0;
+    }
+}
+
+void GbCpu::UpdateAdaptiveFrameSkip(u64 emulatedTimeNs, u64 wallTimeNs)
+{
+    u8 frameSkip = gpuState->GetFrameSkip();
+    if (wallTimeNs > emulatedTimeNs && frameSkip < maxAdaptiveFrameSkip) {
+        gpuState->SetFrameSkip(frameSkip + 1);
+        logger->Tracef("Falling behind, increasing frameSkip to %u", frameSkip + 1);
+    } else if (wallTimeNs < emulatedTimeNs / 2 && frameSkip > 0) {
+        gpuState->SetFrameSkip(frameSkip - 1);
+        logger->Tracef("Keeping up, decreasing frameSkip to %u", frameSkip - 1);
+    }
+}
+
 void GbCpu::TickCycle()
 {
-    totalCycles++;
-    auto beforeGpu = std::chrono::high_resolution_clock::now();
-    apuState->TickCycle();
+    if (state->totalCycles >= nextMovieInputCycle) {
+        ApplyMovieInputs();
+    }
+    state->totalCycles++;
+    pendingApuCycles++;
+    std::chrono::high_resolution_clock::time_point beforeGpu;
+    if (enableMetrics) {
+        beforeGpu = std::chrono::high_resolution_clock::now();
+    }
     GpuTickResult gpuTickResult = {0};
     for (int i = 0; i < 4; ++i) {
         gpuTickResult = gpuState->TickCycle();
@@ -113,11 +418,14 @@ void GbCpu::TickCycle()
             state->WriteMemory(0xFF0F, iflags);
         }
     }
-    gb4e::ui::gpuCycleTimeNs = (std::chrono::high_resolution_clock::now() - beforeGpu).count();
+    if (enableMetrics) {
+        metrics->Record(Metric::GPU_CYCLE, (std::chrono::high_resolution_clock::now() - beforeGpu).count());
+    }
     --waitCycles;
     if (oamDmaCycles > 0) {
         --oamDmaCycles;
         if (oamDmaCycles == 0) {
+            SyncApu();
             // TODO: This is probably incorrect if you write to FF46 during OAM DMA
             u16 base = state->GetOamDmaLocation();
             for (u16 i = 0; i < 0xA0; ++i) {
@@ -132,6 +440,12 @@ void GbCpu::TickCycle()
             Register constexpr spReg(RegisterName::SP);
             u16 pc = state->Get16BitRegisterValue(GetRegister(RegisterName::PC));
             u16 sp = state->Get16BitRegisterValue(spReg);
+            // Recorded as one step which ends on the next cycle
+            if (undoLog.IsEnabled()) {
+                undoLog.Begin(state->totalCycles, GetUndoCpuState(), true);
+                RecordUndoMemoryWrite(sp - 1, pc >> 8);
+                RecordUndoMemoryWrite(sp - 2, pc & 0x00FF);
+            }
             memoryState->Write(sp - 1, pc >> 8);
             memoryState->Write(sp - 2, pc & 0x00FF);
             state->Set16BitRegisterValue(spReg, sp - 2);
@@ -144,7 +458,13 @@ void GbCpu::TickCycle()
             u16 interruptHandlerAddress = 0x40 + interruptId * 8;
             state->Set16BitRegisterValue(pcReg, interruptHandlerAddress);
             state->SetInterruptMasterEnable(false);
+            if (undoLog.IsRecording()) {
+                undoLog.RecordMemoryWrite(0xFF0F, iflags, iflags ^ (1 << interruptId));
+            }
             memoryState->Write(0xFF0F, iflags ^ (1 << interruptId));
+            if (undoLog.IsRecording()) {
+                undoLog.End(GetUndoCpuState());
+            }
             interruptRoutineCycle = 0xFF;
             waitCycles = 0;
         } else {
@@ -156,21 +476,28 @@ void GbCpu::TickCycle()
         logger->Tracef("TickCycle waitCycles=%d, early out", waitCycles);
         return;
     }
+    // The instruction result may write to and the next instruction may read from the APU
+    SyncApu();
     u16 oamDmaLocBefore = state->GetOamDmaLocation();
     if (queuedInstructionResult.has_value()) {
         logger->Tracef("TickCycle applying instructionResult."); // TODO: InstructionResult::ToString
-        auto beforeApply = std::chrono::high_resolution_clock::now();
-        ApplyInstructionResult(state.get(), memoryState.get(), queuedInstructionResult.value());
-        gb4e::ui::applyTimeNs = (std::chrono::high_resolution_clock::now() - beforeApply).count();
-        if (historicInstructions.size() > 0) {
-            historicInstructions[historicInstructionsPtr] =
-                HistoricInstructionResult(totalCycles, queuedInstructionResult.value());
-            historicInstructionsPtr++;
-            if (historicInstructionsPtr >= historicInstructions.size()) {
-                historicInstructionsPtr = 0;
+        if (undoLog.IsEnabled()) {
+            undoLog.Begin(state->totalCycles, GetUndoCpuState(), false);
+            for (auto const & memoryWrite : queuedInstructionResult.value().GetMemoryWrites()) {
+                RecordUndoMemoryWrite(memoryWrite.GetLocation(), memoryWrite.GetValue());
             }
         }
-        if (enableTracing) {
+        if (enableMetrics) {
+            auto beforeApply = std::chrono::high_resolution_clock::now();
+            ApplyInstructionResult(state.get(), memoryState.get(), queuedInstructionResult.value(), metrics.get());
+            metrics->Record(Metric::APPLY, (std::chrono::high_resolution_clock::now() - beforeApply).count());
+        } else {
+            ApplyInstructionResult(state.get(), memoryState.get(), queuedInstructionResult.value());
+        }
+        if (undoLog.IsEnabled()) {
+            undoLog.End(GetUndoCpuState());
+        }
+        if (tracer != nullptr) {
             gb4e::debug::TraceData traceData{
                 .a = state->Get8BitRegisterValue(Register(RegisterName::A)),
                 .f = state->GetFlags(),
@@ -179,10 +506,10 @@ void GbCpu::TickCycle()
                 .hl = state->Get16BitRegisterValue(Register(RegisterName::HL)),
                 .sp = state->Get16BitRegisterValue(Register(RegisterName::SP)),
                 .pc = state->Get16BitRegisterValue(Register(RegisterName::PC)),
-                .cy = totalCycles,
+                .cy = state->totalCycles,
                 .instr = memoryState->Read16(traceData.pc),
             };
-            gb4e::debug::PushTrace(traceData);
+            tracer->Push(traceData);
         }
         queuedInstructionResult = {};
     }
@@ -190,6 +517,11 @@ void GbCpu::TickCycle()
     if (oamDmaLocAfter != oamDmaLocBefore) {
         oamDmaCycles = 160;
     }
+    QueueNextInstruction();
+}
+
+void GbCpu::QueueNextInstruction()
+{
     u8 iflags = state->ReadMemory(0xFF0F).value();
     u8 interruptMask = iflags & state->GetInterruptEnable();
     if (interruptMask && state->GetInterruptMasterEnable()) {
@@ -205,13 +537,96 @@ void GbCpu::TickCycle()
     }
     logger->Tracef(
         "TickCycle pc=%04x, applying opcode=%04x, instruction=%s", pc, opcode, instruction->GetLabel().c_str());
-    auto beforeApplier = std::chrono::high_resolution_clock::now();
-    queuedInstructionResult = instruction->GetApplier()(state.get(), memoryState.get());
-    gb4e::ui::instructionTimeNs = (std::chrono::high_resolution_clock::now() - beforeApplier).count();
+    if (enableMetrics) {
+        auto beforeApplier = std::chrono::high_resolution_clock::now();
+        queuedInstructionResult = instruction->GetApplier()(state.get(), memoryState.get());
+        metrics->Record(Metric::INSTRUCTION, (std::chrono::high_resolution_clock::now() - beforeApplier).count());
+    } else {
+        queuedInstructionResult = instruction->GetApplier()(state.get(), memoryState.get());
+    }
     waitCycles = queuedInstructionResult.value().GetConsumedCycles();
     logger->Tracef("TickCycle queued, waitCycles=%u", waitCycles);
 }
 
+debug::UndoCpuState GbCpu::GetUndoCpuState() const
+{
+    return {state->registers, state->ime, state->hasPendingImeEnable};
+}
+
+void GbCpu::RecordUndoMemoryWrite(u16 location, u8 value)
+{
+    std::optional<u8> previousValue;
+    if (location <= 0x7FFF || (location >= 0xA000 && location <= 0xBFFF)) {
+        // Reading the bank registers returns the ROM
+        previousValue = cartridge->ReadUndoValue(location);
+    } else if (location == 0xFF46 || location == 0xFF50 || location == 0xFF69 ||
+               (location >= 0xFF10 && location <= 0xFF2F)) {
+        // Writing again would start another OAM DMA, leave the boot ROM unmapped, advance the palette index, or read
+        // back other bits than were written and retrigger a sound channel
+        return;
+    } else {
+        previousValue = memoryState->Read(location);
+    }
+    if (previousValue.has_value()) {
+        undoLog.RecordMemoryWrite(location, previousValue.value(), value);
+    }
+}
+
+bool GbCpu::UndoStep()
+{
+    // Stopped in the middle of an interrupt dispatch, which restarts once it has been undone
+    if (undoLog.IsRecording()) {
+        undoLog.End(GetUndoCpuState());
+    }
+    interruptRoutineCycle = 0xFF;
+
+    debug::UndoRecord record;
+    if (!undoLog.Pop(record)) {
+        return false;
+    }
+    SyncApu();
+    for (size_t i = record.numMemoryWrites; i-- > 0;) {
+        memoryState->Write(record.memoryWrites[i].location, record.memoryWrites[i].previousValue);
+    }
+    for (size_t i = 0; i < debug::NUM_UNDO_REGISTERS; ++i) {
+        if (record.changedRegisters & BIT(i)) {
+            state->registers[i] = record.previousRegisters[i];
+        }
+    }
+    if (record.hasImeChange) {
+        state->ime = record.previousIme;
+        state->hasPendingImeEnable = record.previousHasPendingImeEnable;
+    }
+    return true;
+}
+
+bool GbCpu::StepBack()
+{
+    if (!UndoStep()) {
+        return false;
+    }
+    // The queued instruction was decoded from the state which has just been undone
+    queuedInstructionResult.reset();
+    QueueNextInstruction();
+    return true;
+}
+
+u64 GbCpu::ContinueBack()
+{
+    u64 numSteps = 0;
+    while (UndoStep()) {
+        ++numSteps;
+        if (breakpoints.contains(state->registers[debug::UNDO_REGISTER_PC])) {
+            break;
+        }
+    }
+    if (numSteps > 0) {
+        queuedInstructionResult.reset();
+        QueueNextInstruction();
+    }
+    return numSteps;
+}
+
 std::string GbCpu::DumpInstructions(u16 startAddress, u16 endAddress)
 {
     std::stringstream ss;
@@ -249,20 +664,30 @@ bool GbCpu::IsAtMemoryBreakpoint() const
 GbCpu::GbCpu(std::unique_ptr<ApuState> && apuState, std::unique_ptr<GbCpuState> && state,
              std::unique_ptr<GbGpuState> && gpuState, std::unique_ptr<Cartridge> && cartridge,
              std::unique_ptr<GbJoypad> && joypad)
-    : apuState(std::move(apuState)), state(std::move(state)), gpuState(std::move(gpuState)),
-      cartridge(std::move(cartridge)), memoryState(std::move(memoryState)), joypad(std::move(joypad))
+    : apuState(apuState.release()), state(state.release()), gpuState(gpuState.release()),
+      cartridge(cartridge.release()), joypad(joypad.release())
 {
-    this->memoryState =
-        std::make_unique<GbMemoryState>(state.get(), gpuState.get(), apuState.get(), cartridge.get(), joypad.get());
+    this->memoryState.reset(new GbMemoryState(
+        this->state.get(), this->gpuState.get(), this->apuState.get(), this->cartridge.get(), this->joypad.get()));
+    this->cartridge->SetCycleCounter(&this->state->totalCycles);
 }
 
 GbCpu::GbCpu(size_t bootromSize, u8 const * bootrom, GbModel gbModel, Renderer * renderer,
-             InputSystem const & inputSystem, std::vector<std::shared_ptr<MemoryListener>> listeners)
-    : apuState(new GbApuState()), gpuState(new GbGpuState(gbModel, renderer)),
-      state(new GbCpuState(bootromSize, bootrom)), cartridge(new Cartridge()), joypad(new GbJoypad(inputSystem))
+             InputSystem const & inputSystem, std::vector<std::shared_ptr<MemoryListener>> listeners,
+             std::unique_ptr<AudioSink> && audioSink, std::unique_ptr<EmulatorMetrics> && metrics)
+    : metrics(std::move(metrics)),
+      arena(InstanceArena::CapacityFor<GbJoypad, GbApuState, Cartridge, GbCpuState, GbGpuState, GbMemoryState>())
 {
-    this->memoryState = std::make_unique<GbMemoryState>(
-        state.get(), gpuState.get(), apuState.get(), cartridge.get(), joypad.get(), listeners);
+    // Small components first, so that they share cache lines with the registers at the start of GbCpuState
+    joypad = arena.Create<GbJoypad>(inputSystem);
+    apuState = arena.Create<GbApuState>(std::move(audioSink));
+    cartridge = arena.Create<Cartridge>();
+    state = arena.Create<GbCpuState>(bootromSize, bootrom);
+    gpuState = arena.Create<GbGpuState>(gbModel, renderer);
+    memoryState =
+        arena.Create<GbMemoryState>(state.get(), gpuState.get(), apuState.get(), cartridge.get(), joypad.get(), listeners);
+    cartridge->SetCycleCounter(&state->totalCycles);
+    logger->Infof("Created instance with arenaSize=%zu", arena.GetSize());
 }
 
 };
\ No newline at end of file
@@ -8,17 +8,30 @@
 
 #include "Cartridge.hh"
 #include "Common.hh"
+#include "EmulatorMetrics.hh"
 #include "GbCpuState.hh"
 #include "GbGpuState.hh"
 #include "GbJoypad.hh"
+#include "InstanceArena.hh"
 #include "MemoryState.hh"
+#include "audio/AudioSink.hh"
 #include "audio/GbApuState.hh"
+#include "debug/UndoLog.hh"
+#include "savestate/Snapshot.hh"
+
+namespace gb4e::debug
+{
+class Tracer;
+}
 
 namespace gb4e
 {
+class InputMovie;
 class InputSystem;
 class Renderer;
 class RomFile;
+class StateReader;
+class StateWriter;
 
 class GbCpu
 {
@@ -28,7 +41,8 @@ public:
      */
     static std::optional<GbCpu> Create(size_t bootromSize, u8 const * bootrom, GbModel gbModel, Renderer * renderer,
                                        InputSystem const & inputSystem,
-                                       std::vector<std::shared_ptr<MemoryListener>> listeners = {});
+                                       std::vector<std::shared_ptr<MemoryListener>> listeners = {},
+                                       std::unique_ptr<AudioSink> && audioSink = nullptr);
     GbCpu(std::unique_ptr<ApuState> && apuState, std::unique_ptr<GbCpuState> && state,
           std::unique_ptr<GbGpuState> && gpuState, std::unique_ptr<Cartridge> && cartridge,
           std::unique_ptr<GbJoypad> && joypad);
@@ -41,15 +55,50 @@ public:
      */
     void LoadRom(RomFile const * romFile);
 
+    /**
+     * Writes every component as a tagged section, see savestate/SaveState.hh for the container around them. Loading
+     * skips sections it does not know and returns false if a known section is malformed or was saved with another ROM,
+     * in which case the CPU must be reset or loaded again before it runs.
+     */
+    void SaveState(StateWriter & writer) const;
+    bool LoadState(StateReader & reader);
+
+    /**
+     * Returns a new instance in exactly the state of this one, down to the instruction and interrupt in flight and
+     * the OAM DMA progress. The clone shares the ROM and the bootrom, reads its buttons from inputSystem, and has no
+     * renderer, audio output, save file or memory listeners. Its RTC runs on emulated time.
+     *
+     * Constructing an instance allocates, when exploring many branches it is faster to keep a few instances and
+     * RestoreFrom snapshots of the branch points.
+     */
+    GbCpu Clone(InputSystem const & inputSystem) const;
+
+    // Copies the state into snapshot, reusing its memory
+    void TakeSnapshot(Snapshot & snapshot) const;
+
+    /**
+     * Restores a snapshot taken from this instance or from another instance running the same ROM. Returns false if
+     * the snapshot is of another ROM, in which case this instance must be restored again before it runs.
+     */
+    bool RestoreFrom(Snapshot const & snapshot);
+
     void StepInstruction();
     int Tick(u64 deltaTimeNs);
+    /**
+     * Emulates until the GPU has entered VBlank frames more times and returns the number of cycles emulated. Unlike
+     * Tick this always stops right after a frame has been completed, and ignores breakpoints.
+     */
+    int RunFrames(u32 frames);
     void TickCycle();
 
     std::string DumpInstructions(u16 startAddress, u16 endAddress);
 
+    ApuState const * GetApu() const { return apuState.get(); }
     GbCpuState const * GetState() const { return state.get(); }
     GbGpuState const * GetGpu() const { return gpuState.get(); }
     MemoryState const * GetMemory() const { return memoryState.get(); }
+    Cartridge * GetCartridge() { return cartridge.get(); }
+    Cartridge const * GetCartridge() const { return cartridge.get(); }
 
     void AddBreakpoint(u16 breakpoint) { breakpoints.emplace(breakpoint); }
     void RemoveBreakpoint(u16 breakpoint) { breakpoints.erase(breakpoint); }
@@ -62,37 +111,91 @@ public:
     void SetBreakOnDecodeError(bool b) { breakOnDecodeError = b; }
     bool GetBreakOnDecodeError() const { return breakOnDecodeError; }
 
-    void SetHistoricInstructionsBufferSize(size_t size)
-    {
-        historicInstructions.resize(size);
-        if (historicInstructionsPtr >= historicInstructions.size()) {
-            historicInstructionsPtr = 0;
-        }
-    }
-    std::vector<HistoricInstructionResult> const & GetHistoricInstructionsBuffer() const
-    {
-        return historicInstructions;
-    }
-    size_t GetHistoricInstructionsPtr() const { return historicInstructionsPtr; }
-
-    void SetEnableTracing(bool b) { enableTracing = b; }
+    /**
+     * Executed instructions and interrupt dispatches are recorded in an undo log of capacity bytes, so that StepBack
+     * can undo them. 0 disables the log. Changing the capacity drops the recorded history.
+     */
+    void SetUndoLogCapacity(size_t capacity) { undoLog.SetCapacity(capacity); }
+    debug::UndoLog const & GetUndoLog() const { return undoLog; }
+    // The registers and IME as the undo log sees them, the state after its newest record
+    debug::UndoCpuState GetUndoCpuState() const;
+
+    /**
+     * Undoes the most recently executed instruction, or interrupt dispatch, and returns false if there is none left
+     * in the undo log. Registers, IME, memory and the cartridge bank registers written by the CPU are restored. Writes
+     * which writing again cannot undo are not: OAM DMA, unmapping the boot ROM, the sound registers, the palette data
+     * and the RTC. The GPU, APU, timers and RTC go on from where they are.
+     */
+    bool StepBack();
+    // Steps back until the PC is at a breakpoint or the undo log is empty, returns the number of steps undone
+    u64 ContinueBack();
+
+    /**
+     * Hands the joypad to an InputMovie, see savestate/InputMovie.hh, or back to the input system if movie is nullptr.
+     * While recording, every joypad state sampled from the input system is also passed to the movie. While playing,
+     * the input system is ignored and the inputs of the movie from nextInput on are applied at the start of the cycle
+     * they were sampled on.
+     */
+    void SetMovie(InputMovie * movie, bool isPlaying, size_t nextInput = 0);
+
+    // Traces of every executed instruction are pushed to tracer, or not collected at all if tracer is nullptr
+    void SetTracer(debug::Tracer * tracer) { this->tracer = tracer; }
+
+    // Timing metrics of this instance. They can be read from any thread while the CPU is running.
+    EmulatorMetrics const * GetMetrics() const { return metrics.get(); }
+
+    // Timing every step has a small cost, instances which nobody looks at can disable it
+    void SetEnableMetrics(bool b) { enableMetrics = b; }
+
+    // See GbGpuState::SetFrameOutput
+    void SetFrameOutput(u8 * out) { gpuState->SetFrameOutput(out); }
+
+    // See GbGpuState::SetObservationSink
+    void SetObservationSink(ObservationSink * sink) { gpuState->SetObservationSink(sink); }
+
+    // See GbGpuState::SetFrameSkip
+    void SetFrameSkip(u8 frameSkip) { gpuState->SetFrameSkip(frameSkip); }
+
+    /**
+     * If maxFrameSkip > 0, Tick will adjust the GPU frame skip between 0 and maxFrameSkip depending on whether
+     * emulating deltaTimeNs takes longer than deltaTimeNs of wall time.
+     */
+    void SetAdaptiveFrameSkip(u8 maxFrameSkip) { maxAdaptiveFrameSkip = maxFrameSkip; }
 
 private:
     GbCpu(size_t bootromSize, u8 const * bootrom, GbModel gbModel, Renderer * renderer, InputSystem const & inputSystem,
-          std::vector<std::shared_ptr<MemoryListener>> listeners = {});
+          std::vector<std::shared_ptr<MemoryListener>> listeners, std::unique_ptr<AudioSink> && audioSink,
+          std::unique_ptr<EmulatorMetrics> && metrics);
 
     bool IsAtMemoryBreakpoint() const;
-
-    std::unique_ptr<ApuState> apuState;
-    std::unique_ptr<GbCpuState> state;
-    std::unique_ptr<GbGpuState> gpuState;
-    std::unique_ptr<Cartridge> cartridge;
-    std::unique_ptr<MemoryState> memoryState;
-    std::unique_ptr<GbJoypad> joypad;
+    void TickJoypad();
+    void ApplyJoypadState(u8 joypadState);
+    void ApplyMovieInputs();
+    void SyncApu();
+    int TickUntilBreak(u64 deltaTimeNs);
+    void UpdateAdaptiveFrameSkip(u64 emulatedTimeNs, u64 wallTimeNs);
+    // Starts the interrupt dispatch if one is due, otherwise decodes and queues the instruction at PC
+    void QueueNextInstruction();
+    // Records the value location has before value is written to it, unless writing that value would not undo the write
+    void RecordUndoMemoryWrite(u16 location, u8 value);
+    bool UndoStep();
+
+    // Heap allocated so that its address, which the audio sink keeps, survives moving the GbCpu. Declared first so
+    // that it outlives the audio sink.
+    std::unique_ptr<EmulatorMetrics> metrics = std::make_unique<EmulatorMetrics>();
+    // Holds the components below in one block of memory. Declared before them so that it outlives them.
+    InstanceArena arena;
+    ComponentPtr<ApuState> apuState;
+    ComponentPtr<GbCpuState> state;
+    ComponentPtr<GbGpuState> gpuState;
+    ComponentPtr<Cartridge> cartridge;
+    ComponentPtr<MemoryState> memoryState;
+    ComponentPtr<GbJoypad> joypad;
 
     u64 clockTimeNs = 0;
     u64 lastCycleNs = 0;
-    u64 totalCycles = 0;
+    // Cycles which have passed since the APU was last ticked. The APU is only caught up once per instruction.
+    u32 pendingApuCycles = 0;
 
     // Represents how many cycles the currently executing command takes to execute
     // When QueueInstructionResult is called, waitCycles will be set to InstructionResult::consumedCycles and the
@@ -124,9 +227,17 @@ private:
     // breakpoints
     bool breakOnDecodeError = false;
 
-    std::vector<HistoricInstructionResult> historicInstructions;
-    size_t historicInstructionsPtr;
+    debug::UndoLog undoLog;
+
+    InputMovie * movie = nullptr;
+    bool isPlayingMovie = false;
+    size_t nextMovieInput = 0;
+    // Cycle of the next input of a playing movie, checked every cycle so it is never reached otherwise
+    u64 nextMovieInputCycle = UINT64_MAX;
+
+    debug::Tracer * tracer = nullptr;
+    bool enableMetrics = true;
 
-    bool enableTracing = false;
+    u8 maxAdaptiveFrameSkip = 0;
 };
 };
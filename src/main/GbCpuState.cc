@@ -3,6 +3,7 @@
 #include <cassert>
 
 #include "Register.hh"
+#include "savestate/StateStream.hh"
 #include "logging/Logger.hh"
 
 static auto const logger = Logger::Create("GbCpuState");
@@ -31,6 +32,36 @@ void GbCpuState::Reset()
     isBootromActive = true;
 }
 
+void GbCpuState::SaveState(StateWriter & writer) const
+{
+    for (u16 value : registers) {
+        writer.Write(value);
+    }
+    writer.Write(hasPendingImeEnable);
+    writer.Write(ime);
+    writer.Write(interruptFlags);
+    writer.Write(oamDmaLocation);
+    writer.Write(interruptEnable);
+    writer.Write(isBootromActive);
+    writer.Write(totalCycles);
+    writer.WriteBytes(memory.data(), memory.size());
+}
+
+void GbCpuState::LoadState(StateReader & reader)
+{
+    for (u16 & value : registers) {
+        reader.Read(value);
+    }
+    reader.Read(hasPendingImeEnable);
+    reader.Read(ime);
+    reader.Read(interruptFlags);
+    reader.Read(oamDmaLocation);
+    reader.Read(interruptEnable);
+    reader.Read(isBootromActive);
+    reader.Read(totalCycles);
+    reader.ReadBytes(memory.data(), memory.size());
+}
+
 u8 GbCpuState::Get8BitRegisterValue(Register const * reg) const
 {
     assert(reg->Is8Bit());
@@ -60,13 +91,7 @@ std::optional<u8> GbCpuState::ReadMemory(u16 location) const
     if (isBootromActive && location < bootromSize) {
         return bootrom[location];
     }
-    if (location < 0x7FFF) {
-        return {};
-    }
-    if (location >= 0x8000 && location <= 0x9FFF) {
-        return {};
-    }
-    if (location >= 0xA000 && location <= 0xBFFF) {
+    if (location < CPU_MEMORY_START) {
         return {};
     }
     if (location == 0xFF0F) {
@@ -75,7 +100,7 @@ std::optional<u8> GbCpuState::ReadMemory(u16 location) const
     if (location == 0xFFFF) {
         return interruptEnable;
     }
-    return memory[location];
+    return memory[location - CPU_MEMORY_START];
 }
 
 u8 GbCpuState::GetFlags() const
@@ -110,13 +135,16 @@ void GbCpuState::Set16BitRegisterValue(Register const reg, u16 value)
 
 bool GbCpuState::WriteMemory(u16 location, u8 value)
 {
+    if (location < CPU_MEMORY_START) {
+        return false;
+    }
     if (location == 0xFF46) {
         oamDmaLocation = value << 8;
         return true;
     }
     if (location == 0xFF50 && value) {
         isBootromActive = false;
-        memory[location] = value;
+        memory[location - CPU_MEMORY_START] = value;
         return true;
     }
     if (location == 0xFF0F) {
@@ -127,7 +155,7 @@ bool GbCpuState::WriteMemory(u16 location, u8 value)
         interruptEnable = value;
         return true;
     }
-    memory[location] = value;
+    memory[location - CPU_MEMORY_START] = value;
     return true;
 }
 
@@ -10,9 +10,14 @@
 
 namespace gb4e
 {
+// Memory below this is owned by the cartridge and the GPU
+u16 constexpr CPU_MEMORY_START = 0xC000;
+
 class GbCpu;
 class GbGpuState;
 class Register;
+class StateReader;
+class StateWriter;
 
 class GbCpuState final
 {
@@ -23,6 +28,10 @@ public:
 
     void Reset();
 
+    // Registers, flags and memory from C000 up, everything below is owned by the GPU or the cartridge
+    void SaveState(StateWriter & writer) const;
+    void LoadState(StateReader & reader);
+
     u8 Get8BitRegisterValue(Register const * reg) const;
     u16 Get16BitRegisterValue(Register const * reg) const;
 
@@ -50,9 +59,11 @@ public:
     void SetOamDmaLocation(u16 oamDmaLocation) { this->oamDmaLocation = oamDmaLocation; }
     u16 GetOamDmaLocation() const { return this->oamDmaLocation; }
 
+    // 4-clock cycles ticked since the CPU was created
+    u64 GetTotalCycles() const { return totalCycles; }
+
 private:
     std::array<u16, 6> registers;
-    std::array<u8, MEMORY_SIZE> memory{0};
 
     // Set by EI
     bool hasPendingImeEnable = false;
@@ -71,5 +82,11 @@ private:
     size_t bootromSize;
     u8 const * bootrom;
     bool isBootromActive = true;
+
+    // Lives here rather than in GbCpu so that its address stays valid when the GbCpu is moved
+    u64 totalCycles = 0;
+
+    // WRAM, echo RAM, OAM and the I/O registers, HRAM. Last so that the fields above share a cache line.
+    std::array<u8, MEMORY_SIZE - CPU_MEMORY_START> memory{0};
 };
 };
\ No newline at end of file
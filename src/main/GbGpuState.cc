@@ -2,7 +2,9 @@
 
 #include <cassert>
 
+#include "ObservationSink.hh"
 #include "Renderer.hh"
+#include "savestate/StateStream.hh"
 #include "logging/Logger.hh"
 
 static auto const logger = Logger::Create("GbGpuState");
@@ -10,11 +12,11 @@ static auto const logger = Logger::Create("GbGpuState");
 namespace gb4e
 {
 
-static u32 const DMG_COLOR_PALETTE[] = {0xFFFFFFFF, 0xFFC0C0C0, 0xFF606060, 0xFF000000};
-
 GbGpuState::GbGpuState(GbModel gbModel, Renderer * renderer) : gbModel(gbModel)
 {
-    renderer->SetFramebuffer(&this->framebuffer);
+    if (renderer != nullptr) {
+        renderer->SetFrameExchange(this->frameExchange.get());
+    }
     lcdc = 0x91;
     scrollY = 0;
     scrollX = 0;
@@ -25,10 +27,61 @@ GbGpuState::GbGpuState(GbModel gbModel, Renderer * renderer) : gbModel(gbModel)
     windowY = 0;
     windowX = 0;
     vramBank = 0;
-    activeBank = bank0;
+    activeBank = &bank0;
     bgpIndex = 0;
 }
 
+void GbGpuState::SaveState(StateWriter & writer) const
+{
+    writer.Write((u8)mode);
+    writer.Write(modeCycles);
+    writer.Write(currentScanline);
+    writer.Write(lcdc);
+    writer.Write(scrollY);
+    writer.Write(scrollX);
+    writer.WriteBytes(bgp, sizeof(bgp));
+    writer.Write(windowY);
+    writer.Write(windowX);
+    writer.Write(vramBank);
+    writer.Write(bgpIndex);
+    writer.WriteBytes(bank0.data(), bank0.size());
+    writer.WriteBytes(bank1.data(), bank1.size());
+    writer.WriteBytes(bgPaletteData.data(), bgPaletteData.size());
+    writer.WriteBytes(oamData.data(), oamData.size());
+    writer.WriteBytes(scanline.data(), scanline.size());
+    writer.Write(frameCount);
+    writer.Write(currentBackground.attributes);
+    writer.Write(currentBackground.data);
+    writer.Write(framesUntilRender);
+    writer.Write(isSkippingFrame);
+}
+
+void GbGpuState::LoadState(StateReader & reader)
+{
+    mode = (GbGpuMode)reader.Read<u8>();
+    reader.Read(modeCycles);
+    reader.Read(currentScanline);
+    reader.Read(lcdc);
+    reader.Read(scrollY);
+    reader.Read(scrollX);
+    reader.ReadBytes(bgp, sizeof(bgp));
+    reader.Read(windowY);
+    reader.Read(windowX);
+    reader.Read(vramBank);
+    activeBank = (vramBank & 1) ? &bank1 : &bank0;
+    reader.Read(bgpIndex);
+    reader.ReadBytes(bank0.data(), bank0.size());
+    reader.ReadBytes(bank1.data(), bank1.size());
+    reader.ReadBytes(bgPaletteData.data(), bgPaletteData.size());
+    reader.ReadBytes(oamData.data(), oamData.size());
+    reader.ReadBytes(scanline.data(), scanline.size());
+    reader.Read(frameCount);
+    reader.Read(currentBackground.attributes);
+    reader.Read(currentBackground.data);
+    reader.Read(framesUntilRender);
+    reader.Read(isSkippingFrame);
+}
+
 void GbGpuState::Reset()
 {
     lcdc = 0x91;
@@ -41,7 +94,7 @@ void GbGpuState::Reset()
     windowY = 0;
     windowX = 0;
     vramBank = 0;
-    activeBank = bank0;
+    activeBank = &bank0;
     bgpIndex = 0;
 }
 
@@ -64,7 +117,7 @@ GpuTickResult GbGpuState::TickCycle()
 std::optional<u8> GbGpuState::ReadMemory(u16 location) const
 {
     if (location >= 0x8000 && location <= 0x9FFF) {
-        return activeBank[location - 0x8000];
+        return (*activeBank)[location - 0x8000];
     } else if (location >= 0xFE00 && location <= 0xFE9F) {
         return oamData[location - 0xFE00];
     } else if (location == 0xFF40) {
@@ -100,7 +153,7 @@ std::optional<u8> GbGpuState::ReadMemory(u16 location) const
 bool GbGpuState::WriteMemory(u16 location, u8 value)
 {
     if (location >= 0x8000 && location <= 0x9FFF) {
-        activeBank[location - 0x8000] = value;
+        (*activeBank)[location - 0x8000] = value;
         return true;
     } else if (location >= 0xFE00 && location <= 0xFE9F) {
         oamData[location - 0xFE00] = value;
@@ -127,11 +180,7 @@ bool GbGpuState::WriteMemory(u16 location, u8 value)
         windowX = value;
         return true;
     } else if (location == 0xFF4F) {
-        if (value & 1) {
-            activeBank = bank1;
-        } else {
-            activeBank = bank0;
-        }
+        activeBank = (value & 1) ? &bank1 : &bank0;
         vramBank = value;
         return true;
     } else if (location == 0xFF68) {
@@ -163,7 +212,12 @@ GpuTickResult GbGpuState::CycleOamRead()
 GpuTickResult GbGpuState::CycleVramRead()
 {
     if (modeCycles < SCREEN_WIDTH) {
-        DrawScanlinePixel(modeCycles);
+        if (!isSkippingFrame) {
+            DrawScanlinePixel(modeCycles);
+            if (observationSink != nullptr && modeCycles == SCREEN_WIDTH - 1) {
+                observationSink->AddScanline(currentScanline, scanline.data());
+            }
+        }
         modeCycles++;
     } else if (modeCycles == VRAM_READ_CYCLES) {
         mode = GbGpuMode::HBLANK;
@@ -178,9 +232,16 @@ GpuTickResult GbGpuState::CycleHblank()
 {
     if (modeCycles == HBLANK_CYCLES) {
         currentScanline++;
-        if (currentScanline == 143) {
+        if (currentScanline == SCREEN_HEIGHT) {
             mode = GbGpuMode::VBLANK;
             modeCycles = 0;
+            frameCount++;
+            if (observationSink != nullptr) {
+                observationSink->EndFrame();
+            } else if (!isSkippingFrame && frameOutput == nullptr) {
+                frameExchange->Publish();
+                framebuffer = &frameExchange->GetWriteBuffer();
+            }
             return {0b01};
         } else {
             mode = GbGpuMode::OAM_READ;
@@ -200,6 +261,13 @@ GpuTickResult GbGpuState::CycleVblank()
             currentScanline = 0;
             mode = GbGpuMode::OAM_READ;
             modeCycles = 0;
+            if (framesUntilRender == 0) {
+                isSkippingFrame = false;
+                framesUntilRender = frameSkip;
+            } else {
+                isSkippingFrame = true;
+                framesUntilRender--;
+            }
         } else {
             modeCycles = 0;
         }
@@ -219,11 +287,18 @@ void GbGpuState::DrawScanlinePixel(u8 x)
     Pixel bg = DrawScanlineBackground(x);
     Pixel sprite = DrawScanlineSprite(x);
 
-    u16 framebufferIdx = currentScanline * SCREEN_WIDTH + x;
-    framebuffer[framebufferIdx] = DMG_COLOR_PALETTE[bg.color];
+    u8 * pixel;
+    if (observationSink != nullptr) {
+        pixel = &scanline[x];
+    } else if (frameOutput != nullptr) {
+        pixel = &frameOutput[currentScanline * SCREEN_WIDTH + x];
+    } else {
+        pixel = &(*framebuffer)[currentScanline * SCREEN_WIDTH + x];
+    }
+    *pixel = bg.color;
 
     if (spriteEnabled && sprite.color != 0) {
-        framebuffer[framebufferIdx] = DMG_COLOR_PALETTE[sprite.color];
+        *pixel = sprite.color;
     }
 }
 
@@ -335,7 +410,7 @@ Background GbGpuState::LoadTile(u16 tilemapLocation, u16 x, u16 y)
     // TODO: This is GBC behavior
     ret.attributes = bank1[tileOffsetLocation];
 
-    u8 tileOffset = activeBank[tileOffsetLocation];
+    u8 tileOffset = (*activeBank)[tileOffsetLocation];
     bool isTilebank1 = ret.attributes & BG_TILE_VRAM_BANK;
 
     u8 tileLocation;
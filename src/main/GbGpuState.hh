@@ -1,13 +1,19 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <memory>
 #include <optional>
 
 #include "Common.hh"
+#include "Framebuffer.hh"
 
 namespace gb4e
 {
+class ObservationSink;
 class Renderer;
+class StateReader;
+class StateWriter;
 
 int constexpr BGPD_SIZE = 64;
 int constexpr OAM_SIZE = 160;
@@ -75,10 +81,20 @@ struct Pixel {
 class GbGpuState
 {
 public:
+    // renderer may be nullptr if nothing presents the frames
     GbGpuState(GbModel gbModel, Renderer * renderer);
 
+    GbModel GetModel() const { return gbModel; }
+
     void Reset();
 
+    /**
+     * Everything which affects emulation. The frame being drawn is not included, so a frame drawn across a load is
+     * only complete if the state was saved at the start of a frame.
+     */
+    void SaveState(StateWriter & writer) const;
+    void LoadState(StateReader & reader);
+
     std::optional<u8> ReadMemory(u16 location) const;
 
     GpuTickResult TickCycle();
@@ -90,6 +106,37 @@ public:
 
     std::array<OamEntry, 40> DebugGetOam() const;
 
+    // The frame currently being drawn. Completed frames should be read through GetFrameExchange.
+    Framebuffer const & GetFramebuffer() const { return *framebuffer; }
+    FrameExchange * GetFrameExchange() { return frameExchange.get(); }
+
+    /**
+     * After every rendered frame, the next frameSkip frames will not be drawn to the framebuffer. Mode timing, LY and
+     * interrupts are unaffected. Takes effect from the start of the next frame.
+     */
+    void SetFrameSkip(u8 frameSkip)
+    {
+        this->frameSkip = frameSkip;
+        framesUntilRender = std::min(framesUntilRender, frameSkip);
+    }
+    u8 GetFrameSkip() const { return frameSkip; }
+
+    /**
+     * If out is not nullptr, pixels are drawn straight to out instead of to the framebuffer and completed frames are not
+     * published through the frame exchange. out must have room for SCREEN_WIDTH * SCREEN_HEIGHT shade indices and hold
+     * a complete frame whenever VBlank has just started.
+     */
+    void SetFrameOutput(u8 * out) { frameOutput = out; }
+
+    /**
+     * If sink is not nullptr, every drawn scanline is handed to sink instead of being written to the framebuffer or the
+     * frame output, and no frames are published through the frame exchange.
+     */
+    void SetObservationSink(ObservationSink * sink) { observationSink = sink; }
+
+    // Number of times VBlank has been entered since the GPU was created
+    u64 GetFrameCount() const { return frameCount; }
+
 private:
     GpuTickResult CycleOamRead();
     GpuTickResult CycleVramRead();
@@ -131,16 +178,32 @@ private:
 
     std::array<u8, VRAM_SIZE> bank0 = {0};
     std::array<u8, VRAM_SIZE> bank1 = {0};
-    std::array<u8, VRAM_SIZE> & activeBank = bank0;
+    // Selected by FF4F, a pointer so that switching never copies a bank
+    std::array<u8, VRAM_SIZE> * activeBank = &bank0;
 
     std::array<u8, BGPD_SIZE> bgPaletteData = {0};
     std::array<u8, OAM_SIZE> oamData = {0};
 
-    std::array<u32, SCREEN_HEIGHT * SCREEN_WIDTH> framebuffer;
+    // Only read by the renderer, kept out of line so that it does not spread the emulation state over more memory
+    std::unique_ptr<FrameExchange> frameExchange = std::make_unique<FrameExchange>();
+    // The write buffer of frameExchange
+    Framebuffer * framebuffer = &frameExchange->GetWriteBuffer();
+
+    u8 * frameOutput = nullptr;
+    ObservationSink * observationSink = nullptr;
+    // The scanline being drawn while observationSink is set
+    std::array<u8, SCREEN_WIDTH> scanline{};
+    u64 frameCount = 0;
 
     // When drawing a scanline, the current background tile will be loaded here when it is needed
     Background currentBackground;
 
+    u8 frameSkip = 0;
+    // Number of frames left to skip before a frame is rendered again
+    u8 framesUntilRender = 0;
+    // Decided at the start of each frame. If true, no tiles are fetched and no pixels are written for this frame.
+    bool isSkippingFrame = false;
+
     GbModel gbModel;
 };
 };
@@ -2,12 +2,17 @@
 
 #include "Common.hh"
 #include "InputSystem.hh"
+#include "savestate/StateStream.hh"
 
 namespace gb4e
 {
-JoypadTickResult GbJoypad::Tick()
+u8 GbJoypad::SampleInput() const
+{
+    return inputSystem.GetJoypadState();
+}
+
+JoypadTickResult GbJoypad::Tick(u8 state)
 {
-    u8 state = inputSystem.GetJoypadState();
     u8 newDpad = state & 0xF;
     u8 newButtons = (state & 0xF0) >> 4;
     bool triggerInterrupt = false;
@@ -52,4 +57,18 @@ bool GbJoypad::WriteMemory(u16 location, u8 value)
     return false;
 }
 
-}
\ No newline at end of file
+
+void GbJoypad::SaveState(StateWriter & writer) const
+{
+    writer.Write(joypSelect);
+    writer.Write(dpad);
+    writer.Write(buttons);
+}
+
+void GbJoypad::LoadState(StateReader & reader)
+{
+    reader.Read(joypSelect);
+    reader.Read(dpad);
+    reader.Read(buttons);
+}
+}
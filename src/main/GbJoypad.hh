@@ -7,6 +7,8 @@ namespace gb4e
 {
 
 class InputSystem;
+class StateReader;
+class StateWriter;
 
 u8 constexpr SELECT_ACTION_BUTTONS = BIT(5);
 u8 constexpr SELECT_DPAD_BUTTONS = BIT(4);
@@ -20,11 +22,17 @@ class GbJoypad
 public:
     GbJoypad(InputSystem const & inputSystem) : inputSystem(inputSystem) {}
 
-    JoypadTickResult Tick();
+    // The buttons held right now according to the input system, in the layout of InputSystem::GetJoypadState
+    u8 SampleInput() const;
+    // Updates the buttons to joypadState, which has the layout of InputSystem::GetJoypadState
+    JoypadTickResult Tick(u8 joypadState);
 
     std::optional<u8> ReadMemory(u16 location) const;
     bool WriteMemory(u16 location, u8 value);
 
+    void SaveState(StateWriter & writer) const;
+    void LoadState(StateReader & reader);
+
 private:
     InputSystem const & inputSystem;
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 
 #include "Common.hh"
 
@@ -48,9 +49,11 @@ public:
             joypadState &= ~BIT(btn);
         }
     }
+    // Same layout as GetJoypadState, a cleared bit means the button is held
+    void SetJoypadState(u8 state) { joypadState = state; }
 
 private:
-    u8 joypadState;
+    u8 joypadState = 0xFF;
 };
 
 class InputSystemImpl : public InputSystem
@@ -59,11 +62,12 @@ public:
     void Init() override;
     InputSystemTickResult Tick() override;
 
-    u8 GetJoypadState() const override { return joypadState; }
+    u8 GetJoypadState() const override { return joypadState.load(std::memory_order_relaxed); }
 
 private:
     void SetState(JoypadButton btn, bool state);
 
-    u8 joypadState;
+    // Written by the UI thread, read by the emulation thread
+    std::atomic<u8> joypadState = 0xFF;
 };
 };
\ No newline at end of file
@@ -0,0 +1,22 @@
+#include "InstanceArena.hh"
+
+namespace gb4e
+{
+InstanceArena::InstanceArena(size_t capacity)
+    : memory((u8 *)::operator new[](capacity, std::align_val_t(CACHE_LINE_SIZE))), capacity(capacity)
+{
+}
+
+InstanceArena & InstanceArena::operator=(InstanceArena && other) noexcept
+{
+    std::swap(memory, other.memory);
+    std::swap(capacity, other.capacity);
+    std::swap(used, other.used);
+    return *this;
+}
+
+void InstanceArena::AlignedDelete::operator()(u8 * memory) const
+{
+    ::operator delete[](memory, std::align_val_t(CACHE_LINE_SIZE));
+}
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cassert>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+// Cache line size of every platform the emulator runs on
+size_t constexpr CACHE_LINE_SIZE = 64;
+
+/**
+ * Destroys a component of a GbCpu. Components placed in an InstanceArena are only destroyed, the arena frees their
+ * memory. Components which were allocated on their own, as tests do, are deleted.
+ */
+template <typename T>
+struct ComponentDeleter {
+    ComponentDeleter() = default;
+    explicit ComponentDeleter(bool isInArena) : isInArena(isInArena) {}
+    // Allows a component to be owned through its base class
+    template <typename U>
+    ComponentDeleter(ComponentDeleter<U> const & other) : isInArena(other.isInArena)
+    {
+    }
+
+    void operator()(T * component) const
+    {
+        if (isInArena) {
+            component->~T();
+        } else {
+            delete component;
+        }
+    }
+
+    bool isInArena = false;
+};
+
+template <typename T>
+using ComponentPtr = std::unique_ptr<T, ComponentDeleter<T>>;
+
+/**
+ * A single cache line aligned allocation which the components of one instance are placed in, so that an instance is
+ * one contiguous block of memory instead of one allocation per component. Components must be destroyed before the
+ * arena is.
+ */
+class InstanceArena
+{
+public:
+    InstanceArena() = default;
+    explicit InstanceArena(size_t capacity);
+    InstanceArena(InstanceArena && other) = default;
+    // Swaps rather than frees, so that components assigned after the arena can still be destroyed in the old memory,
+    // which is then freed with other
+    InstanceArena & operator=(InstanceArena && other) noexcept;
+
+    // Capacity which fits one of each of Ts, in any order
+    template <typename... Ts>
+    static constexpr size_t CapacityFor()
+    {
+        return ((sizeof(Ts) + alignof(Ts) - 1) + ...);
+    }
+
+    template <typename T, typename... Args>
+    ComponentPtr<T> Create(Args &&... args)
+    {
+        size_t offset = (used + alignof(T) - 1) / alignof(T) * alignof(T);
+        assert(offset + sizeof(T) <= capacity);
+        used = offset + sizeof(T);
+        return ComponentPtr<T>(new (memory.get() + offset) T(std::forward<Args>(args)...), ComponentDeleter<T>(true));
+    }
+
+    // Bytes used by the components placed so far, including padding for alignment
+    size_t GetSize() const { return used; }
+
+private:
+    struct AlignedDelete {
+        void operator()(u8 * memory) const;
+    };
+
+    std::unique_ptr<u8[], AlignedDelete> memory;
+    size_t capacity = 0;
+    size_t used = 0;
+};
+};
@@ -0,0 +1,30 @@
+#include "InstancePool.hh"
+
+#include "logging/Logger.hh"
+
+static auto const logger = Logger::Create("InstancePool");
+
+namespace gb4e
+{
+
+std::optional<size_t> InstancePool::AddInstance(size_t bootromSize, u8 const * bootrom, GbModel gbModel,
+                                                RomFile const * romFile)
+{
+    auto instance = std::make_unique<EmulatorInstance>();
+    instance->cpu = GbCpu::Create(bootromSize, bootrom, gbModel, &instance->renderer, instance->inputSystem);
+    if (!instance->cpu.has_value()) {
+        logger->Errorf("Failed to create CPU for instance %zu", instances.size());
+        return std::nullopt;
+    }
+    instance->cpu->SetEnableMetrics(false);
+    instance->cpu->LoadRom(romFile);
+
+    instances.push_back(std::move(instance));
+    return instances.size() - 1;
+}
+
+void InstancePool::StepFrames(u32 frames)
+{
+    threadPool.ParallelFor((u32)instances.size(), [&](u32 i) { instances[i]->cpu->RunFrames(frames); });
+}
+};
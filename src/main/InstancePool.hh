@@ -0,0 +1,58 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "Common.hh"
+#include "GbCpu.hh"
+#include "InputSystem.hh"
+#include "Renderer.hh"
+#include "concurrency/WorkStealingThreadPool.hh"
+
+namespace gb4e
+{
+/**
+ * A headless emulator: no audio output, no tracing and no timing metrics. The CPU keeps pointers to the renderer and
+ * input system, so instances are never moved once created.
+ */
+struct EmulatorInstance {
+    FakeRenderer renderer;
+    InputSystemFake inputSystem;
+    std::optional<GbCpu> cpu;
+};
+
+/**
+ * Owns many independent emulator instances and steps them in lockstep on a WorkStealingThreadPool. Instances do not
+ * share any mutable state, so each one is only ever touched by one worker during StepFrames.
+ */
+class InstancePool
+{
+public:
+    // numThreads includes the thread calling StepFrames
+    InstancePool(size_t numThreads = std::thread::hardware_concurrency()) : threadPool(numThreads) {}
+
+    /**
+     * Creates a new instance running romFile and returns its index, or std::nullopt if the CPU could not be created.
+     * bootrom and romFile must stay valid for as long as the pool exists.
+     */
+    std::optional<size_t> AddInstance(size_t bootromSize, u8 const * bootrom, GbModel gbModel, RomFile const * romFile);
+
+    size_t GetNumInstances() const { return instances.size(); }
+    EmulatorInstance & GetInstance(size_t i) { return *instances[i]; }
+
+    // Emulates frames frames on every instance and returns once all of them are done
+    void StepFrames(u32 frames);
+
+    // Calls task(i, instance) for every instance in parallel and returns once all calls have finished
+    template <typename Task>
+    void ForEachInstance(Task const & task)
+    {
+        threadPool.ParallelFor((u32)instances.size(), [&](u32 i) { task(i, *instances[i]); });
+    }
+
+private:
+    WorkStealingThreadPool threadPool;
+    std::vector<std::unique_ptr<EmulatorInstance>> instances;
+};
+};
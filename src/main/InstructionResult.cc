@@ -3,10 +3,10 @@
 #include <chrono>
 #include <sstream>
 
+#include "EmulatorMetrics.hh"
 #include "GbCpuState.hh"
 #include "MemoryState.hh"
 #include "logging/Logger.hh"
-#include "ui/Metrics.hh"
 
 static auto const logger = Logger::Create("InstructionResult");
 
@@ -125,15 +125,24 @@ std::string InstructionResult::ToString() const
     return ss.str();
 }
 
-void ApplyInstructionResult(GbCpuState * cpu, MemoryState * memoryState, InstructionResult const & result)
+void ApplyInstructionResult(GbCpuState * cpu, MemoryState * memoryState, InstructionResult const & result,
+                            EmulatorMetrics * metrics)
 {
-    auto beforeMem = std::chrono::high_resolution_clock::now();
+    using Clock = std::chrono::high_resolution_clock;
+    auto now = [metrics]() { return metrics != nullptr ? Clock::now() : Clock::time_point(); };
+    auto record = [metrics](Metric metric, Clock::time_point before) {
+        if (metrics != nullptr) {
+            metrics->Record(metric, (Clock::now() - before).count());
+        }
+    };
+
+    auto beforeMem = now();
     for (auto const & memWrite : result.GetMemoryWrites()) {
         memoryState->Write(memWrite.GetLocation(), memWrite.GetValue());
     }
-    gb4e::ui::applyMemoryTimeNs = (std::chrono::high_resolution_clock::now() - beforeMem).count();
+    record(Metric::APPLY_MEMORY, beforeMem);
 
-    auto beforeInterrupts = std::chrono::high_resolution_clock::now();
+    auto beforeInterrupts = now();
     if (cpu->HasPendingImeEnable()) {
         cpu->SetInterruptMasterEnable(true);
     }
@@ -145,15 +154,15 @@ void ApplyInstructionResult(GbCpuState * cpu, MemoryState * memoryState, Instruc
             cpu->SetInterruptMasterEnable(interruptSet.GetValue());
         }
     }
-    gb4e::ui::applyInterruptsTimeNs = (std::chrono::high_resolution_clock::now() - beforeInterrupts).count();
+    record(Metric::APPLY_INTERRUPTS, beforeInterrupts);
 
-    auto beforeFlags = std::chrono::high_resolution_clock::now();
+    auto beforeFlags = now();
     if (result.GetFlagSet().has_value()) {
         cpu->SetFlags(result.GetFlagSet().value().GetValue());
     }
-    gb4e::ui::applyFlagsTimeNs = (std::chrono::high_resolution_clock::now() - beforeFlags).count();
+    record(Metric::APPLY_FLAGS, beforeFlags);
 
-    auto beforeReg = std::chrono::high_resolution_clock::now();
+    auto beforeReg = now();
     for (auto const & regWrite : result.GetRegisterWrites()) {
         if (regWrite.GetRegister().Is8Bit()) {
             cpu->Set8BitRegisterValue(regWrite.GetRegister(), regWrite.GetByteValue());
@@ -161,13 +170,13 @@ void ApplyInstructionResult(GbCpuState * cpu, MemoryState * memoryState, Instruc
             cpu->Set16BitRegisterValue(regWrite.GetRegister(), regWrite.GetWordValue());
         }
     }
-    gb4e::ui::applyRegistersTimeNs = (std::chrono::high_resolution_clock::now() - beforeReg).count();
+    record(Metric::APPLY_REGISTERS, beforeReg);
 
-    auto beforePc = std::chrono::high_resolution_clock::now();
+    auto beforePc = now();
     auto pcReg = GetRegister(RegisterName::PC);
     u16 pc = cpu->Get16BitRegisterValue(GetRegister(RegisterName::PC));
     pc += result.GetConsumedBytes();
     cpu->Set16BitRegisterValue(pcReg, pc);
-    gb4e::ui::applyPcTimeNs = (std::chrono::high_resolution_clock::now() - beforeReg).count();
+    record(Metric::APPLY_PC, beforePc);
 }
 };
@@ -9,6 +9,7 @@
 
 namespace gb4e
 {
+class EmulatorMetrics;
 class GbCpuState;
 class MemoryState;
 
@@ -239,24 +240,7 @@ private:
     u8 consumedCycles;
 };
 
-class HistoricInstructionResult
-{
-public:
-    HistoricInstructionResult() : isValid(false), totalCycles(0) {}
-    HistoricInstructionResult(u64 totalCycles, InstructionResult const & result)
-        : isValid(true), totalCycles(totalCycles), result(result)
-    {
-    }
-
-    bool IsValid() const { return isValid; }
-    u64 GetTotalCycles() const { return totalCycles; }
-    InstructionResult const & GetResult() const { return result; }
-
-private:
-    bool isValid;
-    u64 totalCycles;
-    InstructionResult result;
-};
-
-void ApplyInstructionResult(GbCpuState *, MemoryState *, InstructionResult const &);
+// If metrics is not nullptr, the time taken by each step is recorded in it
+void ApplyInstructionResult(GbCpuState *, MemoryState *, InstructionResult const &,
+                            EmulatorMetrics * metrics = nullptr);
 };
@@ -0,0 +1,109 @@
+#include "MappedFile.hh"
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "logging/Logger.hh"
+
+static auto const logger = Logger::Create("MappedFile");
+
+namespace gb4e
+{
+#ifdef _WIN32
+
+std::unique_ptr<MappedFile> MappedFile::Open(std::string const & filename)
+{
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        logger->Errorf("Failed to open filename=%s, err=%lu", filename.c_str(), GetLastError());
+        return nullptr;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        logger->Errorf("Failed to get size or file is empty, filename=%s", filename.c_str());
+        CloseHandle(file);
+        return nullptr;
+    }
+    // The mapping keeps the file open, the file handle itself is no longer needed
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr) {
+        logger->Errorf("Failed to create file mapping for filename=%s, err=%lu", filename.c_str(), GetLastError());
+        return nullptr;
+    }
+    void * view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr) {
+        logger->Errorf("Failed to map view of filename=%s, err=%lu", filename.c_str(), GetLastError());
+        CloseHandle(mapping);
+        return nullptr;
+    }
+
+    std::unique_ptr<MappedFile> mappedFile(new MappedFile());
+    mappedFile->data = (u8 const *)view;
+    mappedFile->size = (size_t)fileSize.QuadPart;
+    mappedFile->mappingHandle = mapping;
+    return mappedFile;
+}
+
+MappedFile::~MappedFile()
+{
+    if (data != nullptr) {
+        UnmapViewOfFile(data);
+    }
+    if (mappingHandle != nullptr) {
+        CloseHandle(mappingHandle);
+    }
+}
+
+#else
+
+std::unique_ptr<MappedFile> MappedFile::Open(std::string const & filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        logger->Errorf("Failed to open filename=%s: %s", filename.c_str(), strerror(errno));
+        return nullptr;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+        logger->Errorf("Failed to get size or file is empty, filename=%s", filename.c_str());
+        close(fd);
+        return nullptr;
+    }
+    size_t size = (size_t)fileStat.st_size;
+    // MAP_PRIVATE on a read-only mapping still shares the page cache pages, it only matters if they were written
+    void * memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        logger->Errorf("Failed to map filename=%s: %s", filename.c_str(), strerror(errno));
+        return nullptr;
+    }
+    // ROM banks are read at random once switched in, read them all ahead rather than faulting page by page
+    madvise(memory, size, MADV_WILLNEED);
+
+    std::unique_ptr<MappedFile> mappedFile(new MappedFile());
+    mappedFile->data = (u8 const *)memory;
+    mappedFile->size = size;
+    return mappedFile;
+}
+
+MappedFile::~MappedFile()
+{
+    if (data != nullptr) {
+        munmap((void *)data, size);
+    }
+}
+
+#endif
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+/**
+ * Read-only view of a whole file mapped into memory. Pages are backed by the OS page cache, so every mapping of the
+ * same file in the process (or in other processes) shares the same physical memory and nothing is copied on load.
+ */
+class MappedFile
+{
+public:
+    static std::unique_ptr<MappedFile> Open(std::string const & filename);
+    ~MappedFile();
+
+    MappedFile(MappedFile const &) = delete;
+    MappedFile & operator=(MappedFile const &) = delete;
+
+    u8 const * GetData() const { return data; }
+
+    size_t GetSize() const { return size; }
+
+private:
+    MappedFile() = default;
+
+    u8 const * data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void * mappingHandle = nullptr;
+#endif
+};
+};
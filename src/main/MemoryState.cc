@@ -68,5 +68,6 @@ void GbMemoryState::Write(u16 location, u8 value)
     gpu->WriteMemory(location, value);
     joypad->WriteMemory(location, value);
     apu->WriteMemory(location, value);
+    cartridge->WriteMemory(location, value);
 }
 }
@@ -23,6 +23,8 @@ public:
 class MemoryState
 {
 public:
+    virtual ~MemoryState() = default;
+
     virtual u8 Read(u16 location) const = 0;
     virtual u16 Read16(u16 location) const = 0;
     virtual void Write(u16 location, u8 value) = 0;
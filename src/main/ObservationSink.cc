@@ -0,0 +1,116 @@
+#include "ObservationSink.hh"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Framebuffer.hh"
+#include "logging/Logger.hh"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GB4E_OBSERVATION_SSE2
+#include <emmintrin.h>
+#endif
+
+static auto const logger = Logger::Create("ObservationSink");
+
+namespace gb4e
+{
+static_assert(SCREEN_WIDTH % 4 == 0);
+
+std::unique_ptr<ObservationSink> ObservationSink::Create(u16 width, u16 height)
+{
+    if (width == 0 || height == 0 || width > SCREEN_WIDTH || height > SCREEN_HEIGHT) {
+        logger->Errorf("Observation size %ux%u must be between 1x1 and %dx%d", width, height, SCREEN_WIDTH,
+                       SCREEN_HEIGHT);
+        return nullptr;
+    }
+    return std::unique_ptr<ObservationSink>(new ObservationSink(width, height));
+}
+
+ObservationSink::ObservationSink(u16 width, u16 height) : width(width), height(height)
+{
+    // Output row i covers screen rows [i * scale, (i + 1) * scale)
+    double scale = (double)SCREEN_HEIGHT / height;
+    for (u16 y = 0; y < SCREEN_HEIGHT; ++y) {
+        // The epsilon keeps rows which start exactly on y from being rounded down to the previous row
+        u16 row = std::min((u16)(y / scale + 1e-9), (u16)(height - 1));
+        double rowEnd = (row + 1) * scale;
+        auto & weights = rowWeights[y];
+        weights.outputRow = row;
+        weights.weight = (float)((std::min(y + 1.0, rowEnd) - y) / scale);
+        weights.nextWeight = (float)((std::max(y + 1.0, rowEnd) - rowEnd) / scale);
+        weights.completesRow = y + 1 >= rowEnd - 1e-9 || y == SCREEN_HEIGHT - 1;
+    }
+
+    scale = (double)SCREEN_WIDTH / width;
+    for (u16 column = 0; column < width; ++column) {
+        columnTapOffsets.push_back((u16)columnTaps.size());
+        double begin = column * scale;
+        double end = (column + 1) * scale;
+        for (u16 x = (u16)begin; x < SCREEN_WIDTH && x < end; ++x) {
+            double overlap = std::min(x + 1.0, end) - std::max((double)x, begin);
+            if (overlap > 1e-9) {
+                columnTaps.push_back({(u8)x, (float)(overlap / scale)});
+            }
+        }
+    }
+    columnTapOffsets.push_back((u16)columnTaps.size());
+}
+
+void ObservationSink::AddScanline(u8 y, u8 const * shades)
+{
+    if (y >= SCREEN_HEIGHT) {
+        return;
+    }
+    alignas(16) float gray[SCREEN_WIDTH];
+    for (size_t x = 0; x < SCREEN_WIDTH; ++x) {
+        // The DMG palette is gray, any one channel is the luminance
+        gray[x] = (float)(DMG_COLOR_PALETTE[shades[x] & 0b11] & 0xFF);
+    }
+
+    auto const & weights = rowWeights[y];
+#ifdef GB4E_OBSERVATION_SSE2
+    __m128 const weight = _mm_set1_ps(weights.weight);
+    __m128 const nextWeight = _mm_set1_ps(weights.nextWeight);
+    for (size_t x = 0; x < SCREEN_WIDTH; x += 4) {
+        __m128 g = _mm_load_ps(gray + x);
+        __m128 sum = _mm_add_ps(_mm_load_ps(rowSum.data() + x), _mm_mul_ps(g, weight));
+        __m128 nextSum = _mm_add_ps(_mm_load_ps(nextRowSum.data() + x), _mm_mul_ps(g, nextWeight));
+        _mm_store_ps(rowSum.data() + x, sum);
+        _mm_store_ps(nextRowSum.data() + x, nextSum);
+    }
+#else
+    for (size_t x = 0; x < SCREEN_WIDTH; ++x) {
+        rowSum[x] += gray[x] * weights.weight;
+        nextRowSum[x] += gray[x] * weights.nextWeight;
+    }
+#endif
+
+    if (weights.completesRow) {
+        FinishRow(weights.outputRow);
+        rowSum = nextRowSum;
+        nextRowSum.fill(0);
+    }
+}
+
+void ObservationSink::EndFrame()
+{
+    rowSum.fill(0);
+    nextRowSum.fill(0);
+}
+
+void ObservationSink::FinishRow(u16 outputRow)
+{
+    if (output == nullptr) {
+        return;
+    }
+    u8 * out = output + outputRow * width;
+    for (u16 column = 0; column < width; ++column) {
+        float sum = 0;
+        for (u16 i = columnTapOffsets[column]; i < columnTapOffsets[column + 1]; ++i) {
+            sum += rowSum[columnTaps[i].x] * columnTaps[i].weight;
+        }
+        out[column] = (u8)std::clamp(sum + 0.5f, 0.f, 255.f);
+    }
+}
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+/**
+ * Turns the scanlines drawn by the GPU into a downsampled grayscale image, for consumers which do not need the full
+ * resolution shade indices (see GbGpuState::SetFrameOutput for those).
+ *
+ * Each output pixel is the area average of the screen pixels it covers, with white as 255 and black as 0. Scanlines are
+ * folded into the output rows they overlap as soon as they are drawn, using SSE2 when available, so the full frame is
+ * never stored. The horizontal reduction happens once per completed output row.
+ */
+class ObservationSink
+{
+public:
+    // Returns nullptr if width or height is 0 or larger than the screen
+    static std::unique_ptr<ObservationSink> Create(u16 width, u16 height);
+
+    u16 GetWidth() const { return width; }
+    u16 GetHeight() const { return height; }
+
+    // out must have room for width * height bytes. Rows are written to it as soon as they are complete.
+    void SetOutput(u8 * out) { output = out; }
+
+    // Called by the GPU with the SCREEN_WIDTH shade indices of scanline y once it has been drawn
+    void AddScanline(u8 y, u8 const * shades);
+    // Called by the GPU at the start of VBlank, discards rows left incomplete if the LCD skipped lines
+    void EndFrame();
+
+private:
+    // How one screen row contributes to the output rows
+    struct RowWeights {
+        u16 outputRow;
+        // Weight for outputRow and the row after it, the latter is 0 unless the screen row straddles both
+        float weight;
+        float nextWeight;
+        // True if this is the last screen row overlapping outputRow
+        bool completesRow;
+    };
+    struct ColumnTap {
+        u8 x;
+        float weight;
+    };
+
+    ObservationSink(u16 width, u16 height);
+
+    void FinishRow(u16 outputRow);
+
+    u16 width;
+    u16 height;
+    u8 * output = nullptr;
+
+    std::array<RowWeights, SCREEN_HEIGHT> rowWeights;
+    // The taps of output column i are columnTaps[columnTapOffsets[i]] up to columnTaps[columnTapOffsets[i + 1]]
+    std::vector<ColumnTap> columnTaps;
+    std::vector<u16> columnTapOffsets;
+
+    // Weighted sums of the screen rows overlapping the current output row and the one after it
+    alignas(16) std::array<float, SCREEN_WIDTH> rowSum{};
+    alignas(16) std::array<float, SCREEN_WIDTH> nextRowSum{};
+};
+};
@@ -7,12 +7,59 @@
 #include "logging/Logger.hh"
 
 static auto const logger = Logger::Create("GbRenderer");
+
+// Fullscreen triangle generated from gl_VertexID so no vertex buffers are needed
+static char const * const VERTEX_SHADER_SOURCE = R"(#version 150
+out vec2 uv;
+void main()
+{
+    vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    uv = pos;
+    gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+static char const * const FRAGMENT_SHADER_SOURCE = R"(#version 150
+uniform sampler2D shades;
+uniform vec4 palette[4];
+in vec2 uv;
+out vec4 color;
+void main()
+{
+    int shade = int(texture(shades, uv).r * 255.0 + 0.5) & 3;
+    color = palette[shade];
+}
+)";
+
+static GLuint CompileShader(GLenum type, char const * source)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    GLint status = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status == GL_FALSE) {
+        char log[512];
+        glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        logger->Errorf("Failed to compile shader, type=%u, log=%s", type, log);
+    }
+    return shader;
+}
+
 namespace gb4e
 {
 
 GbRenderer::GbRenderer()
 {
     logger->Infof("GbRenderer constructor");
+    glGenTextures(1, &indexTexture);
+    glBindTexture(GL_TEXTURE_2D, indexTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -21,19 +68,90 @@ GbRenderer::GbRenderer()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
 
+    glGenFramebuffers(1, &outputFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    GLuint vertexShader = CompileShader(GL_VERTEX_SHADER, VERTEX_SHADER_SOURCE);
+    GLuint fragmentShader = CompileShader(GL_FRAGMENT_SHADER, FRAGMENT_SHADER_SOURCE);
+    program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    glLinkProgram(program);
+    GLint status = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status == GL_FALSE) {
+        char log[512];
+        glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+        logger->Errorf("Failed to link palette program, log=%s", log);
+    }
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    glGenVertexArrays(1, &vertexArray);
+
+    paletteUniform = glGetUniformLocation(program, "palette");
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "shades"), 0);
+    glUseProgram(0);
+    SetPalette(DMG_COLOR_PALETTE);
+
     logger->Infof("GbRenderer constructor end");
 }
 
-void GbRenderer::SetFramebuffer(std::array<u32, SCREEN_HEIGHT * SCREEN_WIDTH> const * framebuffer)
+void GbRenderer::SetFrameExchange(FrameExchange * frameExchange)
 {
-    this->framebuffer = framebuffer;
+    this->frameExchange = frameExchange;
+}
+
+void GbRenderer::SetPalette(u32 const * palette)
+{
+    GLfloat colors[NUM_DMG_SHADES * 4];
+    for (int i = 0; i < NUM_DMG_SHADES; ++i) {
+        colors[i * 4 + 0] = ((palette[i] >> 0) & 0xFF) / 255.f;
+        colors[i * 4 + 1] = ((palette[i] >> 8) & 0xFF) / 255.f;
+        colors[i * 4 + 2] = ((palette[i] >> 16) & 0xFF) / 255.f;
+        colors[i * 4 + 3] = ((palette[i] >> 24) & 0xFF) / 255.f;
+    }
+    GLint lastProgram;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &lastProgram);
+    glUseProgram(program);
+    glUniform4fv(paletteUniform, NUM_DMG_SHADES, colors);
+    glUseProgram(lastProgram);
 }
 
 void GbRenderer::Draw()
 {
+    if (frameExchange == nullptr || !frameExchange->Consume()) {
+        // The output texture still contains the last completed frame
+        return;
+    }
+    Framebuffer const & framebuffer = frameExchange->GetReadBuffer();
+    GLint lastViewport[4];
+    glGetIntegerv(GL_VIEWPORT, lastViewport);
+    GLint lastProgram;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &lastProgram);
+    GLint lastFramebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &lastFramebuffer);
+    GLint lastVertexArray;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &lastVertexArray);
+
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    glBindTexture(GL_TEXTURE_2D, indexTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glTexSubImage2D(
-        GL_TEXTURE_2D, 0, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, framebuffer->data());
+        GL_TEXTURE_2D, 0, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GL_RED, GL_UNSIGNED_BYTE, framebuffer.data());
+
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+    glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    glUseProgram(program);
+    glBindVertexArray(vertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindVertexArray(lastVertexArray);
+    glUseProgram(lastProgram);
+    glBindFramebuffer(GL_FRAMEBUFFER, lastFramebuffer);
+    glViewport(lastViewport[0], lastViewport[1], lastViewport[2], lastViewport[3]);
 }
 };
@@ -5,6 +5,7 @@
 #include <gl/glew.h>
 
 #include "Common.hh"
+#include "Framebuffer.hh"
 
 namespace gb4e
 {
@@ -12,43 +13,55 @@ namespace gb4e
 class Renderer
 {
 public:
-    virtual void SetFramebuffer(std::array<u32, SCREEN_HEIGHT * SCREEN_WIDTH> const * framebuffer) = 0;
+    virtual void SetFrameExchange(FrameExchange * frameExchange) = 0;
 
     virtual void Draw() = 0;
 };
 
+/**
+ * Uploads the most recently completed frame as a single channel texture and converts it to RGBA on the GPU using a
+ * palette uniform. The converted image is available through GetOutputImage. GbRenderer is the consumer side of the
+ * FrameExchange, so Draw may run on a different thread than the emulation.
+ */
 class GbRenderer final : public Renderer
 {
 public:
     GbRenderer();
 
-    void SetFramebuffer(std::array<u32, SCREEN_HEIGHT * SCREEN_WIDTH> const * framebuffer) final override;
+    void SetFrameExchange(FrameExchange * frameExchange) final override;
 
     GLuint GetOutputImage() const { return texture; }
 
+    // palette must contain NUM_DMG_SHADES colors in the same format as DMG_COLOR_PALETTE
+    void SetPalette(u32 const * palette);
+
     void Draw() final override;
 
 private:
+    // Single channel texture containing the shade indices
+    GLuint indexTexture;
+    // RGBA output texture, rendered to through outputFramebuffer
     GLuint texture;
+    GLuint outputFramebuffer;
+    GLuint program;
+    GLuint vertexArray;
+    GLint paletteUniform;
 
-    std::array<u32, SCREEN_HEIGHT * SCREEN_WIDTH> const * framebuffer;
+    FrameExchange * frameExchange = nullptr;
 };
 
 class FakeRenderer final : public Renderer
 {
 
 public:
-    void SetFramebuffer(std::array<u32, SCREEN_HEIGHT * SCREEN_WIDTH> const * fb) final override
-    {
-        this->framebuffer = fb;
-    }
+    void SetFrameExchange(FrameExchange * fe) final override { this->frameExchange = fe; }
 
     void Draw() final override {}
 
-    std::array<u32, SCREEN_HEIGHT * SCREEN_WIDTH> const * GetFramebuffer() const { return framebuffer; }
+    FrameExchange * GetFrameExchange() const { return frameExchange; }
 
 private:
-    std::array<u32, SCREEN_HEIGHT * SCREEN_WIDTH> const * framebuffer;
+    FrameExchange * frameExchange = nullptr;
 };
 
-}
\ No newline at end of file
+}
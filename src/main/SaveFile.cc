@@ -0,0 +1,256 @@
+#include "SaveFile.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "logging/Logger.hh"
+
+static auto const logger = Logger::Create("SaveFile");
+
+namespace gb4e
+{
+// Games write SRAM in bursts when saving, so a second of delay still gets saves to disk long before anyone notices
+static auto constexpr FLUSH_INTERVAL = std::chrono::seconds(1);
+
+// The one background thread flushing every open, non copy-on-write, SaveFile
+class SaveFileFlusher
+{
+public:
+    static SaveFileFlusher & GetInstance()
+    {
+        static SaveFileFlusher instance;
+        return instance;
+    }
+
+    ~SaveFileFlusher()
+    {
+        {
+            std::lock_guard lock(mutex);
+            isStopping = true;
+        }
+        wakeUp.notify_one();
+        thread.join();
+    }
+
+    void Register(SaveFile * saveFile)
+    {
+        std::lock_guard lock(mutex);
+        saveFiles.push_back(saveFile);
+    }
+
+    // Once this returns the flusher thread will not touch saveFile again
+    void Unregister(SaveFile * saveFile)
+    {
+        std::lock_guard lock(mutex);
+        std::erase(saveFiles, saveFile);
+    }
+
+private:
+    SaveFileFlusher() : thread([this] { Run(); }) {}
+
+    void Run()
+    {
+        std::unique_lock lock(mutex);
+        while (!isStopping) {
+            wakeUp.wait_for(lock, FLUSH_INTERVAL, [this] { return isStopping; });
+            for (SaveFile * saveFile : saveFiles) {
+                saveFile->Flush(false);
+            }
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::vector<SaveFile *> saveFiles;
+    bool isStopping = false;
+    std::thread thread;
+};
+
+std::unique_ptr<SaveFile> SaveFile::Open(std::string const & filename, size_t size)
+{
+    std::unique_ptr<SaveFile> saveFile = Map(filename, size, false);
+    if (saveFile) {
+        SaveFileFlusher::GetInstance().Register(saveFile.get());
+        logger->Infof("Opened save filename=%s, size=%zu", filename.c_str(), size);
+    }
+    return saveFile;
+}
+
+std::unique_ptr<SaveFile> SaveFile::OpenCopyOnWrite(std::string const & templateFilename, size_t size)
+{
+    return Map(templateFilename, size, true);
+}
+
+SaveFile::~SaveFile()
+{
+    if (data == nullptr) {
+        return;
+    }
+    if (!isCopyOnWrite) {
+        SaveFileFlusher::GetInstance().Unregister(this);
+        Flush(true);
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle(mappingHandle);
+    CloseHandle(fileHandle);
+#else
+    munmap(data, size);
+#endif
+}
+
+#ifdef _WIN32
+
+std::unique_ptr<SaveFile> SaveFile::Map(std::string const & filename, size_t size, bool isCopyOnWrite)
+{
+    if (size == 0) {
+        logger->Errorf("Save size must not be 0, filename=%s", filename.c_str());
+        return nullptr;
+    }
+    HANDLE file = CreateFileA(filename.c_str(), isCopyOnWrite ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE,
+                              FILE_SHARE_READ, nullptr, isCopyOnWrite ? OPEN_EXISTING : OPEN_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        logger->Errorf("Failed to open filename=%s, err=%lu", filename.c_str(), GetLastError());
+        return nullptr;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || (isCopyOnWrite && (u64)fileSize.QuadPart < size)) {
+        logger->Errorf("Save template filename=%s is smaller than size=%zu", filename.c_str(), size);
+        CloseHandle(file);
+        return nullptr;
+    }
+    // A read-write mapping grows the file to the mapping size
+    HANDLE mapping = CreateFileMappingA(file, nullptr, isCopyOnWrite ? PAGE_WRITECOPY : PAGE_READWRITE,
+                                        (DWORD)((u64)size >> 32), (DWORD)size, nullptr);
+    if (mapping == nullptr) {
+        logger->Errorf("Failed to create file mapping for filename=%s, err=%lu", filename.c_str(), GetLastError());
+        CloseHandle(file);
+        return nullptr;
+    }
+    void * view = MapViewOfFile(mapping, isCopyOnWrite ? FILE_MAP_COPY : FILE_MAP_WRITE, 0, 0, size);
+    if (view == nullptr) {
+        logger->Errorf("Failed to map view of filename=%s, err=%lu", filename.c_str(), GetLastError());
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return nullptr;
+    }
+
+    std::unique_ptr<SaveFile> saveFile(new SaveFile());
+    saveFile->data = (u8 *)view;
+    saveFile->size = size;
+    saveFile->isCopyOnWrite = isCopyOnWrite;
+    saveFile->dirtyPages = std::make_unique<std::atomic<u8>[]>((size + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE);
+    saveFile->fileHandle = file;
+    saveFile->mappingHandle = mapping;
+    return saveFile;
+}
+
+#else
+
+std::unique_ptr<SaveFile> SaveFile::Map(std::string const & filename, size_t size, bool isCopyOnWrite)
+{
+    if (size == 0) {
+        logger->Errorf("Save size must not be 0, filename=%s", filename.c_str());
+        return nullptr;
+    }
+    int fd = isCopyOnWrite ? open(filename.c_str(), O_RDONLY | O_CLOEXEC)
+                           : open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        logger->Errorf("Failed to open filename=%s: %s", filename.c_str(), strerror(errno));
+        return nullptr;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        logger->Errorf("Failed to stat filename=%s: %s", filename.c_str(), strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+    if ((size_t)fileStat.st_size < size) {
+        if (isCopyOnWrite) {
+            logger->Errorf("Save template filename=%s is smaller than size=%zu", filename.c_str(), size);
+            close(fd);
+            return nullptr;
+        }
+        // Zero filled, the same as the RAM of a cartridge without a save
+        if (ftruncate(fd, (off_t)size) != 0) {
+            logger->Errorf("Failed to resize filename=%s to size=%zu: %s", filename.c_str(), size, strerror(errno));
+            close(fd);
+            return nullptr;
+        }
+    }
+    void * memory =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, isCopyOnWrite ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        logger->Errorf("Failed to map filename=%s: %s", filename.c_str(), strerror(errno));
+        return nullptr;
+    }
+
+    std::unique_ptr<SaveFile> saveFile(new SaveFile());
+    saveFile->data = (u8 *)memory;
+    saveFile->size = size;
+    saveFile->isCopyOnWrite = isCopyOnWrite;
+    saveFile->dirtyPages = std::make_unique<std::atomic<u8>[]>((size + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE);
+    return saveFile;
+}
+
+#endif
+
+void SaveFile::Flush(bool wait)
+{
+    if (isCopyOnWrite) {
+        return;
+    }
+    // Write back each run of dirty pages with one call. A page written after its flag is cleared is marked dirty again
+    // and picked up by the next flush.
+    size_t numPages = (size + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE;
+    size_t page = 0;
+    while (page < numPages) {
+        if (dirtyPages[page].exchange(0, std::memory_order_relaxed) == 0) {
+            ++page;
+            continue;
+        }
+        size_t firstPage = page++;
+        while (page < numPages && dirtyPages[page].exchange(0, std::memory_order_relaxed) != 0) {
+            ++page;
+        }
+        size_t offset = firstPage * DIRTY_PAGE_SIZE;
+        size_t length = std::min(page * DIRTY_PAGE_SIZE, size) - offset;
+#ifdef _WIN32
+        if (!FlushViewOfFile(data + offset, length)) {
+            logger->Errorf("Failed to flush save offset=%zu, err=%lu", offset, GetLastError());
+        }
+#else
+        // The platform page can be larger than DIRTY_PAGE_SIZE, msync needs an address aligned to it
+        static size_t const systemPageSize = (size_t)sysconf(_SC_PAGESIZE);
+        size_t alignedOffset = offset / systemPageSize * systemPageSize;
+        if (msync(data + alignedOffset, offset + length - alignedOffset, wait ? MS_SYNC : MS_ASYNC) != 0) {
+            logger->Errorf("Failed to flush save offset=%zu: %s", offset, strerror(errno));
+        }
+#endif
+    }
+#ifdef _WIN32
+    if (wait) {
+        FlushFileBuffers(fileHandle);
+    }
+#endif
+}
+};
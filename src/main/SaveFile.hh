@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+/**
+ * Battery backed cartridge RAM mapped from a .sav file.
+ *
+ * The emulation thread reads and writes GetData like any other memory and calls MarkDirty after writing, which only
+ * sets a flag for the page. A background thread shared by all save files periodically starts an asynchronous write
+ * back of the dirty pages, and the remaining ones are written back synchronously when the SaveFile is destroyed, so no
+ * system calls happen on the emulation thread.
+ *
+ * A copy-on-write save maps a template save privately: it starts with the template's contents, but writes only go to
+ * pages private to this SaveFile and are never written back, so any number of instances can start from the same save.
+ */
+class SaveFile
+{
+public:
+    // Creates the file if it does not exist and grows it to size if it is smaller
+    static std::unique_ptr<SaveFile> Open(std::string const & filename, size_t size);
+    // templateFilename must be at least size bytes, it is never modified
+    static std::unique_ptr<SaveFile> OpenCopyOnWrite(std::string const & templateFilename, size_t size);
+    ~SaveFile();
+
+    SaveFile(SaveFile const &) = delete;
+    SaveFile & operator=(SaveFile const &) = delete;
+
+    u8 * GetData() { return data; }
+    u8 const * GetData() const { return data; }
+
+    size_t GetSize() const { return size; }
+
+    bool IsCopyOnWrite() const { return isCopyOnWrite; }
+
+    void MarkDirty(size_t offset) { dirtyPages[offset / DIRTY_PAGE_SIZE].store(1, std::memory_order_relaxed); }
+
+    void MarkAllDirty()
+    {
+        for (size_t offset = 0; offset < size; offset += DIRTY_PAGE_SIZE) {
+            MarkDirty(offset);
+        }
+    }
+
+    // Starts writing back the pages marked dirty since the last flush. If wait is set, returns once they are written.
+    void Flush(bool wait);
+
+private:
+    // Dirty tracking granularity, the same as the smallest page size of the supported platforms
+    static size_t constexpr DIRTY_PAGE_SIZE = 4096;
+
+    static std::unique_ptr<SaveFile> Map(std::string const & filename, size_t size, bool isCopyOnWrite);
+
+    SaveFile() = default;
+
+    u8 * data = nullptr;
+    size_t size = 0;
+    bool isCopyOnWrite = false;
+    std::unique_ptr<std::atomic<u8>[]> dirtyPages;
+#ifdef _WIN32
+    void * fileHandle = nullptr;
+    void * mappingHandle = nullptr;
+#endif
+};
+};
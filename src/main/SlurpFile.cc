@@ -1,26 +1,36 @@
 #include "SlurpFile.hh"
 
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
 #include "logging/Logger.hh"
 
-auto const logger = Logger::Create("SlurpFile");
+static auto const logger = Logger::Create("SlurpFile");
 
 namespace gb4e
 {
 std::optional<SizedArray> SlurpFile(std::string const & filename)
 {
-    FILE * file;
-    errno_t err = fopen_s(&file, filename.c_str(), "rb");
-    if (err != 0) {
-        logger->Errorf("Failed to open filename=%s, err=%d", filename.c_str(), err);
+    std::unique_ptr<FILE, int (*)(FILE *)> file(std::fopen(filename.c_str(), "rb"), &std::fclose);
+    if (!file) {
+        logger->Errorf("Failed to open filename=%s: %s", filename.c_str(), strerror(errno));
         return {};
     }
 
-    fseek(file, 0, SEEK_END);
-    size_t fileSize = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    u8 * rawFile = new u8[fileSize];
-    fread(rawFile, 1, fileSize, file);
+    std::fseek(file.get(), 0, SEEK_END);
+    long fileSize = std::ftell(file.get());
+    std::fseek(file.get(), 0, SEEK_SET);
+    if (fileSize < 0) {
+        logger->Errorf("Failed to get size of filename=%s", filename.c_str());
+        return {};
+    }
+    auto rawFile = std::make_unique<u8[]>(fileSize);
+    if (std::fread(rawFile.get(), 1, fileSize, file.get()) != (size_t)fileSize) {
+        logger->Errorf("Failed to read filename=%s", filename.c_str());
+        return {};
+    }
 
-    return SizedArray(fileSize, std::unique_ptr<u8[]>(rawFile));
+    return SizedArray(fileSize, std::move(rawFile));
 }
-};
\ No newline at end of file
+};
@@ -0,0 +1,95 @@
+#include "VecEnv.hh"
+
+#include <cstring>
+
+#include "SaveFile.hh"
+#include "logging/Logger.hh"
+
+static auto const logger = Logger::Create("VecEnv");
+
+namespace gb4e
+{
+
+std::unique_ptr<VecEnv> VecEnv::Create(size_t bootromSize, u8 const * bootrom, GbModel gbModel,
+                                       RomFile const * romFile, VecEnvConfig const & config)
+{
+    std::unique_ptr<VecEnv> env(new VecEnv(config));
+    bool isGrayscale = config.observationFormat == ObservationFormat::GRAYSCALE;
+    env->observationSize =
+        isGrayscale ? (size_t)config.observationWidth * config.observationHeight : SCREEN_WIDTH * SCREEN_HEIGHT;
+    env->observations.resize(config.numInstances * env->observationSize);
+    env->ram.resize(config.numInstances * env->ramAddresses.size());
+    env->observationOutput = env->observations.data();
+    env->ramOutput = env->ram.data();
+
+    for (size_t i = 0; i < config.numInstances; ++i) {
+        if (!env->pool.AddInstance(bootromSize, bootrom, gbModel, romFile).has_value()) {
+            logger->Errorf("Failed to create instance %zu of %zu", i, config.numInstances);
+            return nullptr;
+        }
+        u8 * observation = env->observations.data() + i * env->observationSize;
+        auto & cpu = env->pool.GetInstance(i).cpu;
+        Cartridge * cartridge = cpu->GetCartridge();
+        if (!config.saveTemplatePath.empty() && cartridge->GetSaveSize() > 0) {
+            auto saveFile = SaveFile::OpenCopyOnWrite(config.saveTemplatePath, cartridge->GetSaveSize());
+            if (!saveFile || !cartridge->AttachSaveFile(std::move(saveFile))) {
+                return nullptr;
+            }
+        }
+        if (isGrayscale) {
+            auto sink = ObservationSink::Create(config.observationWidth, config.observationHeight);
+            if (!sink) {
+                return nullptr;
+            }
+            sink->SetOutput(observation);
+            cpu->SetObservationSink(sink.get());
+            env->observationSinks.push_back(std::move(sink));
+        } else {
+            cpu->SetFrameOutput(observation);
+        }
+        cpu->TakeSnapshot(env->initialStates.emplace_back());
+    }
+    logger->Infof("Created VecEnv with numInstances=%zu, observationSize=%zu, ramAddresses=%zu", config.numInstances,
+                  env->observationSize, env->ramAddresses.size());
+    return env;
+}
+
+void VecEnv::Step(u8 const * heldButtons, u32 frames)
+{
+    size_t ramSize = ramAddresses.size();
+    pool.ForEachInstance([&](size_t i, EmulatorInstance & instance) {
+        // The joypad register is active low
+        instance.inputSystem.SetJoypadState(~heldButtons[i]);
+        instance.cpu->RunFrames(frames);
+
+        MemoryState const * memory = instance.cpu->GetMemory();
+        u8 * out = ramOutput + i * ramSize;
+        for (size_t j = 0; j < ramSize; ++j) {
+            out[j] = memory->Read(ramAddresses[j]);
+        }
+    });
+}
+
+void VecEnv::Reset()
+{
+    pool.ForEachInstance([&](size_t i, EmulatorInstance & instance) {
+        instance.cpu->RestoreFrom(initialStates[i]);
+        memset(observationOutput + i * observationSize, 0, observationSize);
+        memset(ramOutput + i * ramAddresses.size(), 0, ramAddresses.size());
+    });
+}
+
+void VecEnv::SetOutputs(u8 * newObservations, u8 * newRam)
+{
+    observationOutput = newObservations != nullptr ? newObservations : observations.data();
+    ramOutput = newRam != nullptr ? newRam : ram.data();
+    for (size_t i = 0; i < pool.GetNumInstances(); ++i) {
+        u8 * observation = observationOutput + i * observationSize;
+        if (!observationSinks.empty()) {
+            observationSinks[i]->SetOutput(observation);
+        } else {
+            pool.GetInstance(i).cpu->SetFrameOutput(observation);
+        }
+    }
+}
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Common.hh"
+#include "Framebuffer.hh"
+#include "InstancePool.hh"
+#include "ObservationSink.hh"
+
+namespace gb4e
+{
+enum class ObservationFormat {
+    // Full resolution DMG shade indices, 0=white, 3=black
+    SHADE_INDEX,
+    // Area averaged grayscale of observationWidth * observationHeight, 255=white, 0=black
+    GRAYSCALE,
+};
+
+struct VecEnvConfig {
+    size_t numInstances = 1;
+    // Threads stepping the instances, including the thread calling Step
+    size_t numThreads = std::thread::hardware_concurrency();
+    // Addresses read into GetRam after every step
+    std::vector<u16> ramAddresses;
+
+    ObservationFormat observationFormat = ObservationFormat::SHADE_INDEX;
+    // Only used for ObservationFormat::GRAYSCALE, SHADE_INDEX is always SCREEN_WIDTH * SCREEN_HEIGHT
+    u16 observationWidth = SCREEN_WIDTH;
+    u16 observationHeight = SCREEN_HEIGHT;
+
+    // If set, every instance with cartridge RAM starts from a private copy-on-write mapping of this save file. The RTC
+    // always runs on emulated time so that runs are reproducible.
+    std::string saveTemplatePath;
+};
+
+/**
+ * Batched interface over many instances running the same ROM, meant for training agents.
+ *
+ * Every Step applies one joypad state per instance, runs all instances in parallel for the same number of frames and
+ * leaves the results in buffers which are allocated once up front:
+ *
+ *  - GetObservations: one observation of GetObservationSize bytes per instance, back to back. The GPU of each instance
+ *    draws straight into its slot, or through its ObservationSink for grayscale, so no frames are copied.
+ *  - GetRam: for each instance, the values of VecEnvConfig::ramAddresses, in that order.
+ *
+ * The buffers are only modified during Step. SetOutputs points them at memory owned by the caller instead, for example a
+ * shared memory slot, so the results are never copied out.
+ */
+class VecEnv
+{
+public:
+    /**
+     * Returns nullptr if the config is invalid or any of the instances could not be created. bootrom and romFile must
+     * stay valid for as long as the VecEnv exists.
+     */
+    static std::unique_ptr<VecEnv> Create(size_t bootromSize, u8 const * bootrom, GbModel gbModel,
+                                          RomFile const * romFile, VecEnvConfig const & config);
+
+    size_t GetNumInstances() const { return pool.GetNumInstances(); }
+
+    /**
+     * heldButtons must contain one value per instance, with BIT(JoypadButton) set for every button which is held down
+     * during the step. Returns once all instances have emulated frames frames.
+     */
+    void Step(u8 const * heldButtons, u32 frames);
+
+    // Puts every instance back into the state it was created in and zeroes the outputs, as they were after Create
+    void Reset();
+
+    /**
+     * Makes the following steps write the observations and RAM values to observations and ram, which must have room for
+     * those of every instance in the layout of GetObservations and GetRam, instead of to the buffers of the VecEnv.
+     * nullptr for both goes back to the own buffers. Only the frames drawn after the call are written, so a step of 0
+     * frames leaves the new observations as they were.
+     */
+    void SetOutputs(u8 * observations, u8 * ram);
+
+    size_t GetObservationSize() const { return observationSize; }
+    u8 const * GetObservations() const { return observationOutput; }
+    u8 const * GetObservation(size_t i) const { return observationOutput + i * observationSize; }
+
+    u8 const * GetRam() const { return ramOutput; }
+    size_t GetRamSize() const { return ramAddresses.size(); }
+
+    EmulatorInstance & GetInstance(size_t i) { return pool.GetInstance(i); }
+
+private:
+    VecEnv(VecEnvConfig const & config) : pool(config.numThreads), ramAddresses(config.ramAddresses) {}
+
+    InstancePool pool;
+    std::vector<u16> ramAddresses;
+    // One per instance if the observations are grayscale
+    std::vector<std::unique_ptr<ObservationSink>> observationSinks;
+    // The state of each instance right after Create, restored by Reset
+    std::vector<Snapshot> initialStates;
+
+    size_t observationSize = 0;
+    std::vector<u8> observations;
+    std::vector<u8> ram;
+    // Where the outputs currently go, the buffers above unless SetOutputs was called
+    u8 * observationOutput = nullptr;
+    u8 * ramOutput = nullptr;
+};
+};
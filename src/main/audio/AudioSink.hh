@@ -0,0 +1,53 @@
+#pragma once
+
+#include <optional>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+class EmulatorMetrics;
+
+/**
+ * Destination for the samples generated by the APU. Write is called on the emulation thread.
+ */
+class AudioSink
+{
+public:
+    virtual ~AudioSink() = default;
+
+    // If false the APU still emulates its registers, including the channel status in NR52, but never synthesizes audio
+    virtual bool WantsSamples() const = 0;
+
+    virtual u32 GetSampleRate() const = 0;
+
+    // Called before the first sample is written
+    virtual void Start() {}
+
+    // samples contains frameCount interleaved stereo frames
+    virtual void Write(float const * samples, size_t frameCount) = 0;
+
+    // Sinks which run their own thread can record its timing in metrics, which outlives the sink
+    virtual void SetMetrics(EmulatorMetrics * metrics) {}
+
+    // Nanoseconds of audio the output device has played so far, or nothing if the sink does not play in real time
+    virtual std::optional<u64> GetAudioClockNs() const { return {}; }
+
+    // Nanoseconds of audio written but not yet handed to the output device, or nothing if the sink does not play in
+    // real time
+    virtual std::optional<u64> GetQueuedAudioNs() const { return {}; }
+};
+
+/**
+ * Sink for running without any audio output at the lowest possible cost
+ */
+class NullAudioSink final : public AudioSink
+{
+public:
+    bool WantsSamples() const final override { return false; }
+
+    u32 GetSampleRate() const final override { return 48000; }
+
+    void Write(float const * samples, size_t frameCount) final override {}
+};
+};
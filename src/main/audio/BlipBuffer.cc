@@ -0,0 +1,145 @@
+#include "BlipBuffer.hh"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numbers>
+
+#include "logging/Logger.hh"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GB4E_BLIP_SSE2
+#include <emmintrin.h>
+#endif
+
+static auto const logger = Logger::Create("BlipBuffer");
+
+namespace gb4e
+{
+struct alignas(16) KernelPhase {
+    std::array<float, BlipBuffer::KERNEL_SIZE> taps;
+};
+// One more phase than PHASES so that the last phase can be interpolated towards the next sample
+using Kernel = std::array<KernelPhase, BlipBuffer::PHASES + 1>;
+
+// Bits of the sample position below the phase, used to interpolate between two phases
+u64 constexpr INTERPOLATION_BITS = 32 - BlipBuffer::PHASE_BITS;
+
+// Low-pass cutoff as a fraction of the Nyquist frequency of the output
+double constexpr CUTOFF = 0.9;
+
+/**
+ * Windowed sinc impulse for every sub-sample phase. Adding an impulse to the difference buffer is the same as adding a
+ * band-limited step to the integrated output.
+ */
+static Kernel const & GetKernel()
+{
+    static Kernel const kernel = [] {
+        Kernel kernel;
+        for (size_t phase = 0; phase <= BlipBuffer::PHASES; ++phase) {
+            double fraction = (double)phase / BlipBuffer::PHASES;
+            double sum = 0;
+            for (size_t i = 0; i < BlipBuffer::KERNEL_SIZE; ++i) {
+                double x = (double)i + 1 - BlipBuffer::HALF_WIDTH - fraction;
+                double sinc = x == 0 ? CUTOFF : std::sin(std::numbers::pi * CUTOFF * x) / (std::numbers::pi * x);
+                double window = 0.42 + 0.5 * std::cos(std::numbers::pi * x / BlipBuffer::HALF_WIDTH) +
+                                0.08 * std::cos(2 * std::numbers::pi * x / BlipBuffer::HALF_WIDTH);
+                kernel[phase].taps[i] = (float)(sinc * window);
+                sum += sinc * window;
+            }
+            // Every step must add up to exactly its delta once integrated
+            for (auto & tap : kernel[phase].taps) {
+                tap = (float)(tap / sum);
+            }
+        }
+        return kernel;
+    }();
+    return kernel;
+}
+
+BlipBuffer::BlipBuffer(double clockRate, double sampleRate, size_t maxSamples)
+    : factor((u64)std::llround(sampleRate / clockRate * (double)(1ull << FRAC_BITS))),
+      buffer(maxSamples + KERNEL_SIZE, 0.f)
+{
+    GetKernel();
+}
+
+void BlipBuffer::AddDelta(u64 time, int delta)
+{
+    u64 position = offset + time * factor;
+    size_t index = (size_t)(position >> FRAC_BITS);
+    if (index + KERNEL_SIZE > buffer.size()) {
+        logger->Warnf("AddDelta past the end of the buffer, time=%llu", time);
+        return;
+    }
+    size_t phase = (size_t)(position >> INTERPOLATION_BITS) & (PHASES - 1);
+    float interpolation = (float)(position & ((1ull << INTERPOLATION_BITS) - 1)) / (float)(1ull << INTERPOLATION_BITS);
+
+    float const * from = GetKernel()[phase].taps.data();
+    float const * to = GetKernel()[phase + 1].taps.data();
+    float * out = buffer.data() + index;
+#ifdef GB4E_BLIP_SSE2
+    __m128 const deltas = _mm_set1_ps((float)delta);
+    __m128 const weights = _mm_set1_ps(interpolation);
+    for (size_t i = 0; i < KERNEL_SIZE; i += 4) {
+        __m128 a = _mm_load_ps(from + i);
+        __m128 taps = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(to + i), a), weights));
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(taps, deltas)));
+    }
+#else
+    for (size_t i = 0; i < KERNEL_SIZE; ++i) {
+        float tap = from[i] + (to[i] - from[i]) * interpolation;
+        out[i] += tap * (float)delta;
+    }
+#endif
+}
+
+void BlipBuffer::EndFrame(u64 time)
+{
+    offset += time * factor;
+    if (SamplesAvailable() + KERNEL_SIZE > buffer.size()) {
+        logger->Warnf("EndFrame overflowed the buffer, dropping samples");
+        offset = (u64)(buffer.size() - KERNEL_SIZE) << FRAC_BITS;
+    }
+}
+
+size_t BlipBuffer::ReadSamples(float * out, size_t count, size_t stride)
+{
+    count = std::min(count, SamplesAvailable());
+    size_t i = 0;
+    float sum = integrator;
+#ifdef GB4E_BLIP_SSE2
+    // Prefix sum of four differences at a time, carrying the running sum in every lane
+    __m128 carry = _mm_set1_ps(sum);
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(buffer.data() + i);
+        x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+        x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+        x = _mm_add_ps(x, carry);
+        if (stride == 1) {
+            _mm_storeu_ps(out + i, x);
+        } else {
+            alignas(16) float sums[4];
+            _mm_store_ps(sums, x);
+            for (size_t j = 0; j < 4; ++j) {
+                out[(i + j) * stride] = sums[j];
+            }
+        }
+        carry = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    sum = _mm_cvtss_f32(carry);
+#endif
+    for (; i < count; ++i) {
+        sum += buffer[i];
+        out[i * stride] = sum;
+    }
+    integrator = sum;
+
+    // Keep the tails of steps that extend past the samples which were read
+    size_t remaining = SamplesAvailable() - count + KERNEL_SIZE;
+    std::copy(buffer.begin() + count, buffer.begin() + count + remaining, buffer.begin());
+    std::fill(buffer.begin() + remaining, buffer.begin() + remaining + count, 0.f);
+    offset -= (u64)count << FRAC_BITS;
+    return count;
+}
+};
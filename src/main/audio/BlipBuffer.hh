@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+/**
+ * Band-limited synthesis buffer in the style of blip_buf.
+ *
+ * Instead of generating every output sample, the producer reports each change in amplitude with AddDelta at the clock
+ * it happens. Each change is added to the buffer as a band-limited step, so the output contains no aliasing no matter
+ * how high the frequency of the input is. The cost depends on the number of amplitude changes rather than on the
+ * sample rate.
+ *
+ * The step kernel is a polyphase filter interpolated between PHASES sub-sample positions, which also makes this the
+ * resampler from the clock rate to any output sample rate. Adding kernels and integrating the output use SSE2 when
+ * available.
+ *
+ * Times passed to AddDelta and EndFrame are in clocks relative to the start of the current frame. EndFrame makes all
+ * samples before the given time available and starts a new frame at that time.
+ */
+class BlipBuffer
+{
+public:
+    BlipBuffer(double clockRate, double sampleRate, size_t maxSamples);
+
+    void AddDelta(u64 time, int delta);
+    void EndFrame(u64 time);
+
+    size_t SamplesAvailable() const { return (size_t)(offset >> FRAC_BITS); }
+
+    /**
+     * Removes up to count samples from the buffer and writes them to out, placing consecutive samples stride floats
+     * apart so that the left and right buffers can be read into one interleaved buffer. Returns the number of samples
+     * written.
+     */
+    size_t ReadSamples(float * out, size_t count, size_t stride);
+
+    // Number of samples of delay between an amplitude change and the middle of its step in the output
+    static size_t constexpr HALF_WIDTH = 8;
+    static size_t constexpr KERNEL_SIZE = HALF_WIDTH * 2;
+    static size_t constexpr PHASE_BITS = 6;
+    static size_t constexpr PHASES = 1 << PHASE_BITS;
+
+private:
+    static u64 constexpr FRAC_BITS = 32;
+
+    // Sample position per clock, as fixed point with FRAC_BITS fractional bits
+    u64 factor;
+    // Sample position of the start of the current frame, as fixed point with FRAC_BITS fractional bits
+    u64 offset = 0;
+
+    // Differences between consecutive output samples. Reading integrates them into the output.
+    std::vector<float> buffer;
+    float integrator = 0;
+};
+};
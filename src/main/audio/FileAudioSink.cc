@@ -0,0 +1,122 @@
+#include "FileAudioSink.hh"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+#include "logging/Logger.hh"
+
+using namespace std::chrono_literals;
+
+static auto const logger = Logger::Create("FileAudioSink");
+
+namespace gb4e
+{
+u32 constexpr WAV_HEADER_SIZE = 44;
+
+static void PutU16(std::ofstream & out, u16 value)
+{
+    char bytes[] = {(char)(value & 0xFF), (char)(value >> 8)};
+    out.write(bytes, sizeof(bytes));
+}
+
+static void PutU32(std::ofstream & out, u32 value)
+{
+    PutU16(out, value & 0xFFFF);
+    PutU16(out, value >> 16);
+}
+
+std::unique_ptr<FileAudioSink> FileAudioSink::Create(std::filesystem::path const & path, AudioFileFormat format,
+                                                     u32 sampleRate)
+{
+    std::ofstream outStream(path, std::ios::binary | std::ios::trunc);
+    if (!outStream) {
+        logger->Errorf("Failed to open audio output file path=%s", path.string().c_str());
+        return nullptr;
+    }
+    logger->Infof("Writing audio to path=%s", path.string().c_str());
+    return std::unique_ptr<FileAudioSink>(new FileAudioSink(std::move(outStream), format, sampleRate));
+}
+
+FileAudioSink::FileAudioSink(std::ofstream && outStream, AudioFileFormat format, u32 sampleRate)
+    : outStream(std::move(outStream)), format(format), sampleRate(sampleRate)
+{
+    if (format == AudioFileFormat::WAV) {
+        // The sizes are filled in when the file is finished
+        WriteWavHeader(0);
+    }
+    thread = std::thread(&FileAudioSink::WriterThread, this);
+}
+
+FileAudioSink::~FileAudioSink()
+{
+    isShuttingDown.store(true);
+    thread.join();
+    if (format == AudioFileFormat::WAV) {
+        outStream.seekp(0);
+        WriteWavHeader(dataSize);
+    }
+    logger->Infof("Finished writing %u bytes of audio", dataSize);
+}
+
+void FileAudioSink::Write(float const * in, size_t frameCount)
+{
+    size_t count = frameCount * 2;
+    while (count > 0) {
+        size_t pushed = samples.PushMany(in, count);
+        in += pushed;
+        count -= pushed;
+        if (count > 0) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void FileAudioSink::WriterThread()
+{
+    std::array<float, 4096> in;
+    std::array<char, in.size() * 2> out;
+    while (true) {
+        // Check before popping so that everything pushed before shutting down is written
+        bool isStopping = isShuttingDown.load();
+        size_t count = samples.PopMany(in.data(), in.size());
+        if (count == 0) {
+            if (isStopping) {
+                break;
+            }
+            std::this_thread::sleep_for(1ms);
+            continue;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            s16 sample = (s16)(std::clamp(in[i], -1.f, 1.f) * 32767);
+            out[i * 2] = (char)(sample & 0xFF);
+            out[i * 2 + 1] = (char)((sample >> 8) & 0xFF);
+        }
+        outStream.write(out.data(), count * 2);
+        dataSize += (u32)(count * 2);
+    }
+    outStream.flush();
+}
+
+void FileAudioSink::WriteWavHeader(u32 dataSize)
+{
+    u16 constexpr CHANNELS = 2;
+    u16 constexpr BITS_PER_SAMPLE = 16;
+    u16 constexpr BLOCK_ALIGN = CHANNELS * BITS_PER_SAMPLE / 8;
+
+    outStream.write("RIFF", 4);
+    PutU32(outStream, WAV_HEADER_SIZE - 8 + dataSize);
+    outStream.write("WAVE", 4);
+    outStream.write("fmt ", 4);
+    PutU32(outStream, 16);
+    // PCM
+    PutU16(outStream, 1);
+    PutU16(outStream, CHANNELS);
+    PutU32(outStream, sampleRate);
+    PutU32(outStream, sampleRate * BLOCK_ALIGN);
+    PutU16(outStream, BLOCK_ALIGN);
+    PutU16(outStream, BITS_PER_SAMPLE);
+    outStream.write("data", 4);
+    PutU32(outStream, dataSize);
+}
+};
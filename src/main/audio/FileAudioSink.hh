@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+#include "AudioSink.hh"
+#include "concurrency/SpscRingBuffer.hh"
+
+namespace gb4e
+{
+enum class AudioFileFormat {
+    // 16-bit stereo PCM with a RIFF header
+    WAV,
+    // Headerless 16-bit little-endian stereo PCM
+    RAW,
+};
+
+/**
+ * Streams audio to a file. Samples are converted and written by a background thread so that the emulation thread
+ * never waits for disk I/O. Write only blocks if the writer thread falls more than SAMPLE_QUEUE_SIZE samples behind, so
+ * no audio is ever dropped.
+ */
+class FileAudioSink final : public AudioSink
+{
+public:
+    static std::unique_ptr<FileAudioSink> Create(std::filesystem::path const & path, AudioFileFormat format,
+                                                 u32 sampleRate = 48000);
+    // Writes any buffered samples and finishes the file
+    ~FileAudioSink();
+
+    bool WantsSamples() const final override { return true; }
+
+    u32 GetSampleRate() const final override { return sampleRate; }
+
+    void Write(float const * samples, size_t frameCount) final override;
+
+private:
+    static size_t constexpr SAMPLE_QUEUE_SIZE = 65536;
+
+    FileAudioSink(std::ofstream && outStream, AudioFileFormat format, u32 sampleRate);
+
+    void WriterThread();
+    void WriteWavHeader(u32 dataSize);
+
+    std::ofstream outStream;
+    AudioFileFormat format;
+    u32 sampleRate;
+    // Only touched by the writer thread until it has been joined
+    u32 dataSize = 0;
+
+    SpscRingBuffer<float, SAMPLE_QUEUE_SIZE> samples;
+    std::atomic_bool isShuttingDown = false;
+    std::thread thread;
+};
+};
@@ -25,571 +25,686 @@
 
 #include <algorithm>
 #include <array>
-#include <atomic>
-#include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
 #include <optional>
 
-#include <SDL2/SDL.h>
-
+#include "AudioSink.hh"
+#include "BlipBuffer.hh"
 #include "Common.hh"
 #include "logging/Logger.hh"
-#include "ui/Metrics.hh"
+#include "savestate/StateStream.hh"
 
 static auto const logger = Logger::Create("GbApuState");
 
 namespace gb4e
 {
-float constexpr AUDIO_SAMPLE_RATE = 48000.f;
-float const DIFFS[] = {7.5f, 3.75f, 1.5f};
-u8 const DUTY_LOOKUP[] = {0x10, 0x30, 0x3C, 0xCF};
-u8 const FREQS[] = {8, 16, 32, 48, 64, 80, 96, 112};
-
-struct ChannelCounter final {
-    int load;
-    bool enabled;
-    float counter;
-    float inc;
+size_t constexpr BLIP_BUFFER_SIZE = 4096;
+
+// The frame sequencer clocks length, envelope and sweep at 512 Hz
+u64 constexpr FRAME_SEQUENCER_PERIOD = CLOCK_FREQUENCY / 512;
+// Generated samples are handed to the audio sink once per frame sequencer step, ~2 ms
+u64 constexpr FLUSH_INTERVAL_CYCLES = FRAME_SEQUENCER_PERIOD / 4;
+
+// Largest possible sum of the channel outputs on one side: 4 channels at volume 15 and master volume 8
+float constexpr OUTPUT_SCALE = 1.f / (4 * 15 * 8);
+
+u8 const DUTY_LOOKUP[] = {0b00000001, 0b10000001, 0b10000111, 0b01111110};
+u8 const NOISE_DIVISORS[] = {8, 16, 32, 48, 64, 80, 96, 112};
+
+// Bits which always read back as 1, for the registers from 0xFF10 to 0xFF3F
+u8 const READ_MASKS[0x30] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF, // NR10-NR14
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF, // NR20-NR24
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF, // NR30-NR34
+    0xFF, 0xFF, 0x00, 0x00, 0xBF, // NR40-NR44
+    0x00, 0x00, 0x70,             // NR50-NR52
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    // Wave RAM
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 };
 
-struct ChannelVolumeEnvelope final {
-    int step;
-    bool up;
-    float counter;
-    float inc;
-};
-
-struct ChannelFreqSweep final {
-    u16 freq;
-    int rate;
-    bool up;
-    int shift;
-    float counter;
-    float inc;
-};
+enum ChannelIndex { SQUARE1, SQUARE2, WAVE, NOISE };
 
 struct AudioChannel final {
-    float Hipass(float sample);
-    void SetNoteFreq(float freq);
-    bool UpdateFreq(float * pos);
-    void UpdateSweep();
-    void UpdateVolumeEnvelope();
-
     bool enabled;
-    bool powered;
-    bool onLeft;
-    bool onRight;
-    bool muted;
-
-    int volume;
-    int initialEnvelopeVolume;
+    bool dacEnabled;
 
-    u16 freq;
-    float freqCounter;
-    float freqInc;
+    int lengthCounter;
+    bool lengthEnabled;
 
-    int val;
+    int volume;
+    int envelopePeriod;
+    int envelopeTimer;
+    bool envelopeUp;
 
-    struct ChannelCounter len;
-    struct ChannelVolumeEnvelope env;
-    struct ChannelFreqSweep sweep;
+    u16 frequency;
+    // Clocks between steps of the waveform, 0 if the channel is not clocked at all
+    u64 period;
+    // Clocks left until the next step
+    u64 timer;
 
     /* square */
-    int duty;
-    int dutyCounter;
-
-    /* noise */
-    u16 lfsrReg;
-    bool lfsrWide;
-    int lfsrDiv;
+    u8 duty;
+    u8 dutyStep;
 
     /* wave */
-    u8 sample;
+    u8 wavePosition;
+    u8 waveSample;
+    u8 waveShift;
 
-    float capacitor;
+    /* noise */
+    u16 lfsr;
+    bool lfsrShortMode;
+
+    // The amplitude last added to the left and right blip buffers
+    int left;
+    int right;
 };
 
 class AudioPimpl final
 {
 public:
-    AudioPimpl();
+    AudioPimpl(std::unique_ptr<AudioSink> && sink);
 
-    void TickCycle();
+    void Tick(u32 cycles);
 
-    std::optional<u8> ReadMemory(u16 addr) const;
+    std::optional<u8> ReadMemory(u16 addr);
 
     bool WriteMemory(u16 addr, u8 value);
 
-private:
-    static void AudioCallback(void * userdata, u8 * stream, int len);
-
-    void ChanUpdateLen(u8 i);
-    void EnableChan(u8 i, bool enable);
-    void TriggerChan(u8 i);
-    void UpdateLen(AudioChannel * c);
-    void UpdateNoise(float * samples, int sampleCount);
-    void UpdateRate();
-    void UpdateSquare(float * samples, bool isChannel2, int sampleCount);
-    void UpdateWave(float * samples, int sampleCount);
-    u8 WaveSample(unsigned int pos, unsigned int volume);
-
-    void LockAudioDevice();
-    void UnlockAudioDevice();
-
-    std::array<u8, 0x30> memory;
+    std::optional<u64> GetAudioClockNs() const;
 
-    u8 tac = 0;
-    u8 tma = 0;
+    std::optional<u64> GetQueuedAudioNs() const;
 
-    std::atomic_uint64_t cycle = 0;
-    u64 lastMainThreadCycle = 0;
-    std::chrono::high_resolution_clock::time_point lastCallback = std::chrono::high_resolution_clock::now();
+    void SaveState(StateWriter & writer) const;
 
-    SDL_AudioDeviceID audioDeviceId = 0;
+    void LoadState(StateReader & reader);
 
-    AudioChannel chans[4];
-    float volLeft, volRight;
+private:
+    u8 ChannelOutput(AudioChannel const & c) const;
+    void ClockEnvelopes();
+    void ClockLength();
+    void ClockSweep();
+    void Flush();
+    void PowerOff();
+    void RunChannel(ChannelIndex i, u64 until);
+    void RunUntil(u64 clock);
+    void StepChannel(ChannelIndex i);
+    u16 SweepFrequency();
+    void TriggerChannel(ChannelIndex i);
+    void UpdateOutput(ChannelIndex i, u64 time);
+    void UpdatePeriod(ChannelIndex i);
+    u8 & Register(u16 addr) { return registers[addr - 0xFF10]; }
+
+    std::unique_ptr<AudioSink> sink;
+    // Cached sink->WantsSamples(). If false, channels are never stepped and only the register state is kept.
+    bool isSynthesizing;
+    // Set by the first Tick. Not part of the saved state, a state loaded before then must not keep the sink paused.
+    bool isSinkStarted = false;
+
+    // Only advanced in batches by Tick, the audio thread only ever sees completed blocks of samples
+    u64 cycle = 0;
+
+    std::array<u8, 0x30> registers{};
+    bool isPowered = false;
+
+    AudioChannel chans[4]{};
+
+    // The clock which the channels have been run until
+    u64 clock = 0;
+    u64 nextFrameSequencerClock = FRAME_SEQUENCER_PERIOD;
+    u8 frameSequencerStep = 0;
+    u64 lastFlushCycle = 0;
+
+    int sweepTimer = 0;
+    bool sweepEnabled = false;
+    u16 sweepShadowFrequency = 0;
+
+    BlipBuffer left;
+    BlipBuffer right;
+    // The clock which the current blip buffer frame started at
+    u64 blipFrameClock = 0;
+    float leftCapacitor = 0;
+    float rightCapacitor = 0;
+    std::array<float, BLIP_BUFFER_SIZE * 2> flushBuffer;
 };
 
-float AudioChannel::Hipass(float sample)
+AudioPimpl::AudioPimpl(std::unique_ptr<AudioSink> && sink)
+    : sink(std::move(sink)), isSynthesizing(this->sink->WantsSamples()),
+      left((double)CLOCK_FREQUENCY, this->sink->GetSampleRate(), BLIP_BUFFER_SIZE),
+      right((double)CLOCK_FREQUENCY, this->sink->GetSampleRate(), BLIP_BUFFER_SIZE)
 {
-    float out = sample - capacitor;
-    capacitor = sample - out * 0.996f;
-    return out;
+    chans[NOISE].lfsr = 0x7FFF;
 }
 
-void AudioChannel::SetNoteFreq(float freq)
+void AudioPimpl::Tick(u32 cycles)
 {
-    freqInc = freq / AUDIO_SAMPLE_RATE;
+    if (!isSinkStarted) {
+        sink->Start();
+        isSinkStarted = true;
+    }
+    cycle += cycles;
+    if (cycle - lastFlushCycle >= FLUSH_INTERVAL_CYCLES) {
+        lastFlushCycle = cycle;
+        Flush();
+    }
 }
 
-void AudioPimpl::EnableChan(u8 i, bool enable)
+void AudioPimpl::Flush()
 {
-    chans[i].enabled = enable;
+    RunUntil(cycle * 4);
+    if (!isSynthesizing) {
+        return;
+    }
 
-    u8 val = (memory[0xff26 - 0xff10] & 0x80) | (chans[3].enabled << 3) | (chans[2].enabled << 2) |
-             (chans[1].enabled << 1) | (chans[0].enabled << 0);
+    left.EndFrame(clock - blipFrameClock);
+    right.EndFrame(clock - blipFrameClock);
+    blipFrameClock = clock;
+
+    size_t count = left.ReadSamples(flushBuffer.data(), left.SamplesAvailable(), 2);
+    right.ReadSamples(flushBuffer.data() + 1, count, 2);
+
+    // Remove the DC offset the same way the capacitors on the hardware's output do
+    for (size_t i = 0; i < count; ++i) {
+        float l = flushBuffer[i * 2] * OUTPUT_SCALE;
+        float r = flushBuffer[i * 2 + 1] * OUTPUT_SCALE;
+        flushBuffer[i * 2] = l - leftCapacitor;
+        flushBuffer[i * 2 + 1] = r - rightCapacitor;
+        leftCapacitor = l - flushBuffer[i * 2] * 0.996f;
+        rightCapacitor = r - flushBuffer[i * 2 + 1] * 0.996f;
+    }
 
-    memory[0xff26 - 0xff10] = val;
+    sink->Write(flushBuffer.data(), count);
 }
 
-void AudioChannel::UpdateVolumeEnvelope()
+void AudioPimpl::RunUntil(u64 until)
 {
-    env.counter += env.inc;
+    while (clock < until) {
+        u64 next = std::min(until, nextFrameSequencerClock);
+        if (isSynthesizing) {
+            for (int i = 0; i < 4; ++i) {
+                RunChannel((ChannelIndex)i, next);
+            }
+        }
+        clock = next;
 
-    while (env.counter > 1.0f) {
-        if (env.step) {
-            volume += env.up ? 1 : -1;
-            if (volume == 0 || volume == 15) {
-                env.inc = 0;
+        if (clock == nextFrameSequencerClock) {
+            nextFrameSequencerClock += FRAME_SEQUENCER_PERIOD;
+            if (isPowered) {
+                if ((frameSequencerStep & 1) == 0) {
+                    ClockLength();
+                }
+                if (frameSequencerStep == 2 || frameSequencerStep == 6) {
+                    ClockSweep();
+                }
+                if (frameSequencerStep == 7) {
+                    ClockEnvelopes();
+                }
+                frameSequencerStep = (frameSequencerStep + 1) & 7;
             }
-            volume = std::max(0, std::min(15, volume));
         }
-        env.counter -= 1.0f;
     }
 }
 
-void AudioPimpl::UpdateLen(AudioChannel * c)
+void AudioPimpl::RunChannel(ChannelIndex i, u64 until)
 {
-    if (c->len.enabled) {
-        c->len.counter += c->len.inc;
-        if (c->len.counter > 1.0f) {
-            EnableChan(c - chans, 0);
-            c->len.counter = 0.0f;
+    AudioChannel & c = chans[i];
+    if (!c.enabled || c.period == 0) {
+        return;
+    }
+
+    u64 time = clock + c.timer;
+    if (time >= until) {
+        c.timer = time - until;
+        return;
+    }
+
+    // A silent square or wave channel only needs its position advanced, which can be done without stepping
+    bool isSilent = i == WAVE ? c.waveShift > 4 : c.volume == 0;
+    if (isSilent && i != NOISE) {
+        u64 steps = (until - time + c.period - 1) / c.period;
+        if (i == WAVE) {
+            c.wavePosition = (u8)((c.wavePosition + steps) & 31);
+        } else {
+            c.dutyStep = (u8)((c.dutyStep + steps) & 7);
         }
+        c.timer = time + steps * c.period - until;
+        return;
     }
+
+    for (; time < until; time += c.period) {
+        StepChannel(i);
+        UpdateOutput(i, time);
+    }
+    c.timer = time - until;
 }
 
-bool AudioChannel::UpdateFreq(float * pos)
+void AudioPimpl::StepChannel(ChannelIndex i)
 {
-    float inc = freqInc - *pos;
-    freqCounter += inc;
-
-    if (freqCounter > 1.0f) {
-        *pos = freqInc - (freqCounter - 1.0f);
-        freqCounter = 0.0f;
-        return true;
-    } else {
-        *pos = freqInc;
-        return false;
+    AudioChannel & c = chans[i];
+    switch (i) {
+    case SQUARE1:
+    case SQUARE2:
+        c.dutyStep = (c.dutyStep + 1) & 7;
+        break;
+    case WAVE: {
+        c.wavePosition = (c.wavePosition + 1) & 31;
+        u8 sample = Register(0xFF30 + c.wavePosition / 2);
+        c.waveSample = (c.wavePosition & 1) ? (sample & 0xF) : (sample >> 4);
+        break;
+    }
+    case NOISE: {
+        u16 bit = (c.lfsr ^ (c.lfsr >> 1)) & 1;
+        c.lfsr = (c.lfsr >> 1) | (bit << 14);
+        if (c.lfsrShortMode) {
+            c.lfsr = (c.lfsr & ~(1 << 6)) | (bit << 6);
+        }
+        break;
+    }
     }
 }
 
-void AudioChannel::UpdateSweep()
+u8 AudioPimpl::ChannelOutput(AudioChannel const & c) const
 {
-    sweep.counter += sweep.inc;
-    while (sweep.counter > 1.0f) {
-        if (sweep.shift) {
-            u16 inc = (sweep.freq >> sweep.shift);
-            if (!sweep.up) {
-                inc *= -1;
-            }
-
-            freq = sweep.freq + inc;
-            if (freq > 2047) {
-                enabled = 0;
-            } else {
-                SetNoteFreq(4194304.0f / (float)((2048 - freq) << 5));
-                sweep.freq = freq;
-                freqInc *= 8.0f;
-            }
-        } else if (sweep.rate) {
-            enabled = 0;
-        }
-        sweep.counter -= 1.0f;
+    if (!c.enabled) {
+        return 0;
+    }
+    if (&c == &chans[WAVE]) {
+        return c.waveShift > 4 ? 0 : c.waveSample >> c.waveShift;
     }
+    if (&c == &chans[NOISE]) {
+        return (c.lfsr & 1) ? 0 : c.volume;
+    }
+    return (DUTY_LOOKUP[c.duty] >> c.dutyStep) & 1 ? c.volume : 0;
 }
 
-void AudioPimpl::UpdateSquare(float * samples, bool isChannel2, int sampleCount)
+void AudioPimpl::UpdateOutput(ChannelIndex i, u64 time)
 {
-    AudioChannel * c = chans + isChannel2;
-    if (!c->powered) {
+    if (!isSynthesizing) {
         return;
     }
-
-    c->SetNoteFreq(4194304.0f / (float)((2048 - c->freq) << 5));
-    c->freqInc *= 8.0f;
-
-    for (int i = 0; i < sampleCount; i += 2) {
-        UpdateLen(c);
-
-        if (c->enabled) {
-            c->UpdateVolumeEnvelope();
-            if (!isChannel2) {
-                c->UpdateSweep();
-            }
-
-            float pos = 0.0f;
-            float prevPos = 0.0f;
-            float sample = 0.0f;
-
-            while (c->UpdateFreq(&pos)) {
-                c->dutyCounter = (c->dutyCounter + 1) & 7;
-                sample += ((pos - prevPos) / c->freqInc) * (float)c->val;
-                c->val = (c->duty & (1 << c->dutyCounter)) ? 1 : -1;
-                prevPos = pos;
-            }
-            sample += ((pos - prevPos) / c->freqInc) * (float)c->val;
-            sample = c->Hipass(sample * (c->volume / 15.0f));
-
-            if (!c->muted) {
-                samples[i + 0] += sample * 0.25f * c->onLeft * volLeft;
-                samples[i + 1] += sample * 0.25f * c->onRight * volRight;
-            }
-        }
+    AudioChannel & c = chans[i];
+    u8 nr50 = Register(0xFF24);
+    u8 nr51 = Register(0xFF25);
+    int output = ChannelOutput(c);
+    int newLeft = (nr51 >> (4 + i)) & 1 ? output * (((nr50 >> 4) & 7) + 1) : 0;
+    int newRight = (nr51 >> i) & 1 ? output * ((nr50 & 7) + 1) : 0;
+    if (newLeft != c.left) {
+        left.AddDelta(time - blipFrameClock, newLeft - c.left);
+        c.left = newLeft;
+    }
+    if (newRight != c.right) {
+        right.AddDelta(time - blipFrameClock, newRight - c.right);
+        c.right = newRight;
     }
 }
 
-u8 AudioPimpl::WaveSample(unsigned int pos, unsigned int volume)
+void AudioPimpl::UpdatePeriod(ChannelIndex i)
 {
-    u8 sample = memory[(0xFF30 + pos / 2) - 0xFF10];
-    if (pos & 1) {
-        sample &= 0xF;
-    } else {
-        sample >>= 4;
+    AudioChannel & c = chans[i];
+    switch (i) {
+    case SQUARE1:
+    case SQUARE2:
+        c.period = (2048 - c.frequency) * 4;
+        break;
+    case WAVE:
+        c.period = (2048 - c.frequency) * 2;
+        break;
+    case NOISE: {
+        u8 nr43 = Register(0xFF22);
+        u8 shift = nr43 >> 4;
+        // Shifts of 14 and 15 stop the LFSR from being clocked
+        c.period = shift >= 14 ? 0 : (u64)NOISE_DIVISORS[nr43 & 7] << shift;
+        break;
+    }
     }
-    return volume ? (sample >> (volume - 1)) : 0;
 }
 
-void AudioPimpl::UpdateWave(float * samples, int sampleCount)
+void AudioPimpl::ClockLength()
 {
-    AudioChannel * c = chans + 2;
-    if (!c->powered)
-        return;
-
-    float freq = 4194304.0f / (float)((2048 - c->freq) << 5);
-    c->SetNoteFreq(freq);
-
-    c->freqInc *= 16.0f;
-
-    for (int i = 0; i < sampleCount; i += 2) {
-        UpdateLen(c);
-
-        if (c->enabled) {
-            float pos = 0.0f;
-            float prevPos = 0.0f;
-            float sample = 0.0f;
-
-            c->sample = WaveSample(c->val, c->volume);
-
-            while (c->UpdateFreq(&pos)) {
-                c->val = (c->val + 1) & 31;
-                sample += ((pos - prevPos) / c->freqInc) * (float)c->sample;
-                c->sample = WaveSample(c->val, c->volume);
-                prevPos = pos;
-            }
-            sample += ((pos - prevPos) / c->freqInc) * (float)c->sample;
-
-            if (c->volume > 0) {
-                float diff = DIFFS[c->volume - 1];
-                sample = c->Hipass((sample - diff) / 7.5f);
-
-                if (!c->muted) {
-                    samples[i + 0] += sample * 0.25f * c->onLeft * volLeft;
-                    samples[i + 1] += sample * 0.25f * c->onRight * volRight;
-                }
+    for (int i = 0; i < 4; ++i) {
+        AudioChannel & c = chans[i];
+        if (c.lengthEnabled && c.lengthCounter > 0) {
+            if (--c.lengthCounter == 0) {
+                c.enabled = false;
+                UpdateOutput((ChannelIndex)i, clock);
             }
         }
     }
 }
 
-void AudioPimpl::UpdateNoise(float * samples, int sampleCount)
+void AudioPimpl::ClockEnvelopes()
 {
-    AudioChannel * c = chans + 3;
-    if (!c->powered)
-        return;
-
-    float freq = 4194304.f / (float)(FREQS[c->lfsrDiv] << c->freq);
-    c->SetNoteFreq(freq);
-
-    if (c->freq >= 14) {
-        c->enabled = 0;
-    }
-
-    for (int i = 0; i < sampleCount; i += 2) {
-        UpdateLen(c);
-
-        if (c->enabled) {
-            c->UpdateVolumeEnvelope();
-
-            float pos = 0.0f;
-            float prevPos = 0.0f;
-            float sample = 0.0f;
-
-            while (c->UpdateFreq(&pos)) {
-                c->lfsrReg = (c->lfsrReg << 1) | (c->val == 1);
-
-                if (c->lfsrWide) {
-                    c->val = !(((c->lfsrReg >> 14) & 1) ^ ((c->lfsrReg >> 13) & 1)) ? 1 : -1;
-                } else {
-                    c->val = !(((c->lfsrReg >> 6) & 1) ^ ((c->lfsrReg >> 5) & 1)) ? 1 : -1;
-                }
-                sample += ((pos - prevPos) / c->freqInc) * c->val;
-                prevPos = pos;
-            }
-            sample += ((pos - prevPos) / c->freqInc) * c->val;
-            sample = c->Hipass(sample * (c->volume / 15.0f));
-
-            if (!c->muted) {
-                samples[i + 0] += sample * 0.25f * c->onLeft * volLeft;
-                samples[i + 1] += sample * 0.25f * c->onRight * volRight;
+    for (ChannelIndex i : {SQUARE1, SQUARE2, NOISE}) {
+        AudioChannel & c = chans[i];
+        if (c.envelopePeriod == 0) {
+            continue;
+        }
+        if (--c.envelopeTimer <= 0) {
+            c.envelopeTimer = c.envelopePeriod;
+            if (c.envelopeUp && c.volume < 15) {
+                ++c.volume;
+                UpdateOutput(i, clock);
+            } else if (!c.envelopeUp && c.volume > 0) {
+                --c.volume;
+                UpdateOutput(i, clock);
             }
         }
     }
 }
 
-void AudioPimpl::TriggerChan(u8 i)
+u16 AudioPimpl::SweepFrequency()
 {
-    AudioChannel * c = chans + i;
-
-    EnableChan(i, 1);
-    c->volume = c->initialEnvelopeVolume;
-
-    /* volume envelope */
-    {
-        u8 val = memory[(0xFF12 + (i * 5)) - 0xff10];
-
-        c->env.step = val & 0x07;
-        c->env.up = val & 0x08;
-        c->env.inc = c->env.step ? (64.0f / (float)c->env.step) / AUDIO_SAMPLE_RATE : 8.0f / AUDIO_SAMPLE_RATE;
-        c->env.counter = 0.0f;
+    u8 nr10 = Register(0xFF10);
+    u16 delta = sweepShadowFrequency >> (nr10 & 7);
+    u16 frequency = (nr10 & 0x08) ? sweepShadowFrequency - delta : sweepShadowFrequency + delta;
+    if (frequency > 2047) {
+        chans[SQUARE1].enabled = false;
+        UpdateOutput(SQUARE1, clock);
     }
+    return frequency;
+}
 
-    /* freq sweep */
-    if (i == 0) {
-        u8 val = memory[0xFF10 - 0xff10];
+void AudioPimpl::ClockSweep()
+{
+    u8 nr10 = Register(0xFF10);
+    u8 sweepPeriod = (nr10 >> 4) & 7;
+    if (--sweepTimer > 0) {
+        return;
+    }
+    sweepTimer = sweepPeriod ? sweepPeriod : 8;
+    if (!sweepEnabled || sweepPeriod == 0) {
+        return;
+    }
+    u16 frequency = SweepFrequency();
+    if (frequency <= 2047 && (nr10 & 7) != 0) {
+        sweepShadowFrequency = frequency;
+        chans[SQUARE1].frequency = frequency;
+        UpdatePeriod(SQUARE1);
+        // The new frequency is checked for overflow again but not used
+        SweepFrequency();
+    }
+}
 
-        c->sweep.freq = c->freq;
-        c->sweep.rate = (val >> 4) & 0x07;
-        c->sweep.up = !(val & 0x08);
-        c->sweep.shift = (val & 0x07);
-        c->sweep.inc = c->sweep.rate ? (128.0f / (float)(c->sweep.rate)) / AUDIO_SAMPLE_RATE : 0;
-        c->sweep.counter = nexttowardf(1.0f, 1.1f);
+void AudioPimpl::TriggerChannel(ChannelIndex i)
+{
+    AudioChannel & c = chans[i];
+    c.enabled = c.dacEnabled;
+    if (c.lengthCounter == 0) {
+        c.lengthCounter = i == WAVE ? 256 : 64;
     }
+    UpdatePeriod(i);
+    c.timer = c.period;
 
-    if (i == 2) { /* wave */
-        c->val = 0;
-    } else if (i == 3) { /* noise */
-        c->lfsrReg = 0xFFFF;
-        c->val = -1;
+    if (i == WAVE) {
+        c.wavePosition = 0;
+    } else {
+        u8 envelope = Register(0xFF12 + i * 5);
+        c.volume = envelope >> 4;
+        c.envelopeUp = envelope & 0x08;
+        c.envelopePeriod = envelope & 0x07;
+        c.envelopeTimer = c.envelopePeriod;
+    }
+    if (i == NOISE) {
+        c.lfsr = 0x7FFF;
     }
+    if (i == SQUARE1) {
+        u8 nr10 = Register(0xFF10);
+        u8 sweepPeriod = (nr10 >> 4) & 7;
+        sweepShadowFrequency = c.frequency;
+        sweepTimer = sweepPeriod ? sweepPeriod : 8;
+        sweepEnabled = sweepPeriod != 0 || (nr10 & 7) != 0;
+        if (nr10 & 7) {
+            SweepFrequency();
+        }
+    }
+    UpdateOutput(i, clock);
 }
 
-void AudioPimpl::ChanUpdateLen(u8 i)
+void AudioPimpl::PowerOff()
 {
-    AudioChannel * c = chans + i;
-    int lenMax = i == 2 ? 256 : 64;
-    c->len.inc = (256.0f / (float)(lenMax - c->len.load)) / AUDIO_SAMPLE_RATE;
-    c->len.counter = 0.0f;
+    for (u16 addr = 0xFF10; addr < 0xFF26; ++addr) {
+        Register(addr) = 0;
+    }
+    for (int i = 0; i < 4; ++i) {
+        chans[i].enabled = false;
+        chans[i].dacEnabled = false;
+        chans[i].lengthEnabled = false;
+        UpdateOutput((ChannelIndex)i, clock);
+    }
+    isPowered = false;
 }
 
 bool AudioPimpl::WriteMemory(const u16 addr, const u8 val)
 {
-    if (addr == 0xFF06) {
-        tma = val;
-        UpdateRate();
+    if (addr < 0xFF10 || addr > 0xFF3F) {
+        return false;
+    }
+    // The channels are caught up to the cycle of the write before it takes effect, so the amplitude change it causes
+    // lands on its exact clock in the BlipBuffer. No state here is shared with the audio thread, which only pops
+    // finished samples from the sink, so writes take no lock.
+    RunUntil(cycle * 4);
+
+    if (addr >= 0xFF27) {
+        // Wave RAM, or unused registers in between
+        Register(addr) = val;
+        return true;
+    }
+    if (addr == 0xFF26) {
+        if (!(val & 0x80) && isPowered) {
+            PowerOff();
+        } else if ((val & 0x80) && !isPowered) {
+            isPowered = true;
+            frameSequencerStep = 0;
+        }
         return true;
     }
-    if (addr == 0xFF07) {
-        tac = val;
-        UpdateRate();
+    // All other registers are read-only while the APU is powered off
+    if (!isPowered) {
         return true;
     }
-    if (addr < 0xFF10 || addr > 0xFF3F) {
-        return false;
+
+    Register(addr) = val;
+
+    if (addr == 0xFF24 || addr == 0xFF25) {
+        // NR50 and NR51 belong to no channel but change the panning and volume of all of them
+        for (int j = 0; j < 4; ++j) {
+            UpdateOutput((ChannelIndex)j, clock);
+        }
+        return true;
     }
 
     /* Find sound channel corresponding to register address. */
-    u8 i = (addr - 0xFF10) / 5;
+    ChannelIndex i = (ChannelIndex)((addr - 0xFF10) / 5);
+    AudioChannel & c = chans[i];
 
-    LockAudioDevice();
-    bool result = false;
     switch (addr) {
+    case 0xFF11:
+    case 0xFF16:
+        c.duty = val >> 6;
+        c.lengthCounter = 64 - (val & 0x3F);
+        break;
+    case 0xFF20:
+        c.lengthCounter = 64 - (val & 0x3F);
+        break;
+    case 0xFF1B:
+        c.lengthCounter = 256 - val;
+        break;
+
     case 0xFF12:
     case 0xFF17:
-    case 0xFF21: {
-        chans[i].initialEnvelopeVolume = val >> 4;
-        chans[i].powered = val >> 3;
-
-        /* "zombie mode" stuff, needed for Prehistorik Man and similar */
-        if (chans[i].powered && chans[i].enabled) {
-            if ((chans[i].env.step == 0 && chans[i].env.inc != 0)) {
-                if (val & 0x08) {
-                    chans[i].volume++;
-                } else {
-                    chans[i].volume += 2;
-                }
-            } else {
-                // } else if(chans[i].env.step != (val & 0x07)) {
-                chans[i].volume = 16 - chans[i].volume;
-            }
-
-            chans[i].volume &= 0x0F;
-            chans[i].env.step = val & 0x07;
+    case 0xFF21:
+        c.dacEnabled = (val & 0xF8) != 0;
+        if (!c.dacEnabled) {
+            c.enabled = false;
         }
-        result = true;
         break;
-    }
-    case 0xFF1C:
-        chans[i].volume = chans[i].initialEnvelopeVolume = (val >> 5) & 0x03;
-        result = true;
-        break;
-    case 0xFF11:
-    case 0xFF16:
-    case 0xFF20: {
-        chans[i].len.load = val & 0x3f;
-        chans[i].duty = DUTY_LOOKUP[val >> 6];
-        ChanUpdateLen(i);
-        result = true;
+    case 0xFF1A:
+        c.dacEnabled = val & 0x80;
+        if (!c.dacEnabled) {
+            c.enabled = false;
+        }
         break;
-    }
 
-    case 0xFF1B:
-        chans[i].len.load = val;
-        ChanUpdateLen(i);
-        result = true;
+    case 0xFF1C: {
+        // Output level 0 mutes the channel, 1-3 shift the sample right by 0-2
+        u8 level = (val >> 5) & 0x03;
+        c.waveShift = level == 0 ? 8 : level - 1;
         break;
+    }
 
     case 0xFF13:
     case 0xFF18:
     case 0xFF1D:
-        chans[i].freq &= 0xFF00;
-        chans[i].freq |= val;
-        result = true;
-        break;
-
-    case 0xFF1A:
-        chans[i].powered = val & 0x80;
-        EnableChan(i, val & 0x80);
-        result = true;
+        c.frequency = (c.frequency & 0x0700) | val;
+        UpdatePeriod(i);
         break;
 
     case 0xFF14:
     case 0xFF19:
     case 0xFF1E:
-        chans[i].freq &= 0x00FF;
-        chans[i].freq |= ((val & 0x07) << 8);
+        c.frequency = (c.frequency & 0x00FF) | ((val & 0x07) << 8);
+        UpdatePeriod(i);
+        [[fallthrough]];
     case 0xFF23:
-        chans[i].len.enabled = val & 0x40;
+        c.lengthEnabled = val & 0x40;
         if (val & 0x80) {
-            TriggerChan(i);
+            TriggerChannel(i);
         }
-
-        result = true;
         break;
 
     case 0xFF22:
-        chans[3].freq = val >> 4;
-        chans[3].lfsrWide = !(val & 0x08);
-        chans[3].lfsrDiv = val & 0x07;
-        result = true;
-        break;
-
-    case 0xFF24:
-        volLeft = ((val >> 4) & 0x07) / 7.0f;
-        volRight = (val & 0x07) / 7.0f;
-        result = true;
-        break;
-
-    case 0xFF25:
-        for (int i = 0; i < 4; ++i) {
-            chans[i].onLeft = (val >> (4 + i)) & 1;
-            chans[i].onRight = (val >> i) & 1;
-        }
-        result = true;
+        c.lfsrShortMode = val & 0x08;
+        UpdatePeriod(NOISE);
         break;
     }
 
-    memory[addr - 0xFF10] = val;
-
-    UnlockAudioDevice();
-    return result;
+    UpdateOutput(i, clock);
+    return true;
 }
 
-std::optional<u8> AudioPimpl::ReadMemory(u16 addr) const
+std::optional<u8> AudioPimpl::ReadMemory(u16 addr)
 {
     if (addr < 0xFF10 || addr > 0xFF3F) {
         return {};
     }
-    // TODO:
-    return {};
+    if (addr == 0xFF26) {
+        // Length counters may have run out since the last write
+        RunUntil(cycle * 4);
+        return (isPowered ? 0x80 : 0x00) | READ_MASKS[addr - 0xFF10] | (chans[NOISE].enabled << 3) |
+               (chans[WAVE].enabled << 2) | (chans[SQUARE2].enabled << 1) | (chans[SQUARE1].enabled << 0);
+    }
+    return Register(addr) | READ_MASKS[addr - 0xFF10];
 }
 
-void AudioPimpl::AudioCallback(void * userdata, u8 * stream, int len)
+std::optional<u64> AudioPimpl::GetAudioClockNs() const
 {
-    float * samples = (float *)stream;
-
-    auto audioPimpl = (AudioPimpl *)userdata;
-    auto now = std::chrono::high_resolution_clock::now();
-    u64 duration = (now - audioPimpl->lastCallback).count();
-    audioPimpl->lastCallback = now;
+    return sink->GetAudioClockNs();
+}
 
-    memset(stream, 0, len);
+std::optional<u64> AudioPimpl::GetQueuedAudioNs() const
+{
+    return sink->GetQueuedAudioNs();
+}
 
-    int sampleCount = len / sizeof(float);
+void AudioPimpl::SaveState(StateWriter & writer) const
+{
+    writer.Write(cycle);
+    writer.WriteBytes(registers.data(), registers.size());
+    writer.Write(isPowered);
+    for (AudioChannel const & c : chans) {
+        writer.Write(c.enabled);
+        writer.Write(c.dacEnabled);
+        writer.Write((u32)c.lengthCounter);
+        writer.Write(c.lengthEnabled);
+        writer.Write((u32)c.volume);
+        writer.Write((u32)c.envelopePeriod);
+        writer.Write((u32)c.envelopeTimer);
+        writer.Write(c.envelopeUp);
+        writer.Write(c.frequency);
+        writer.Write(c.period);
+        writer.Write(c.timer);
+        writer.Write(c.duty);
+        writer.Write(c.dutyStep);
+        writer.Write(c.wavePosition);
+        writer.Write(c.waveSample);
+        writer.Write(c.waveShift);
+        writer.Write(c.lfsr);
+        writer.Write(c.lfsrShortMode);
+        writer.Write((u32)c.left);
+        writer.Write((u32)c.right);
+    }
+    writer.Write(clock);
+    writer.Write(nextFrameSequencerClock);
+    writer.Write(frameSequencerStep);
+    writer.Write(lastFlushCycle);
+    writer.Write((u32)sweepTimer);
+    writer.Write(sweepEnabled);
+    writer.Write(sweepShadowFrequency);
+}
 
-    u64 currentMainThreadCycle = audioPimpl->cycle.load();
-    if (currentMainThreadCycle == audioPimpl->lastMainThreadCycle) {
-        // Do not play audio if main thread is stalled
-        return;
+void AudioPimpl::LoadState(StateReader & reader)
+{
+    // Output everything up to now, and remember the levels the blip buffers are at
+    Flush();
+    std::array<int, 4> previousLeft;
+    std::array<int, 4> previousRight;
+    for (int i = 0; i < 4; ++i) {
+        previousLeft[i] = chans[i].left;
+        previousRight[i] = chans[i].right;
     }
-    ui::audioCallbackTimeNs = duration;
-    audioPimpl->lastMainThreadCycle = currentMainThreadCycle;
 
-    audioPimpl->UpdateSquare(samples, 0, sampleCount);
-    audioPimpl->UpdateSquare(samples, 1, sampleCount);
-    audioPimpl->UpdateWave(samples, sampleCount);
-    audioPimpl->UpdateNoise(samples, sampleCount);
+    reader.Read(cycle);
+    reader.ReadBytes(registers.data(), registers.size());
+    reader.Read(isPowered);
+    for (AudioChannel & c : chans) {
+        reader.Read(c.enabled);
+        reader.Read(c.dacEnabled);
+        c.lengthCounter = (int)reader.Read<u32>();
+        reader.Read(c.lengthEnabled);
+        c.volume = (int)reader.Read<u32>();
+        c.envelopePeriod = (int)reader.Read<u32>();
+        c.envelopeTimer = (int)reader.Read<u32>();
+        reader.Read(c.envelopeUp);
+        reader.Read(c.frequency);
+        reader.Read(c.period);
+        reader.Read(c.timer);
+        reader.Read(c.duty);
+        reader.Read(c.dutyStep);
+        reader.Read(c.wavePosition);
+        reader.Read(c.waveSample);
+        reader.Read(c.waveShift);
+        reader.Read(c.lfsr);
+        reader.Read(c.lfsrShortMode);
+        c.left = (int)reader.Read<u32>();
+        c.right = (int)reader.Read<u32>();
+    }
+    reader.Read(clock);
+    reader.Read(nextFrameSequencerClock);
+    reader.Read(frameSequencerStep);
+    reader.Read(lastFlushCycle);
+    sweepTimer = (int)reader.Read<u32>();
+    reader.Read(sweepEnabled);
+    reader.Read(sweepShadowFrequency);
+
+    // The output continues from the loaded levels instead of jumping back to the previous ones
+    blipFrameClock = clock;
+    if (isSynthesizing) {
+        for (int i = 0; i < 4; ++i) {
+            left.AddDelta(0, chans[i].left - previousLeft[i]);
+            right.AddDelta(0, chans[i].right - previousRight[i]);
+        }
+    }
 }
 
-GbApuState::GbApuState() : pimpl(new AudioPimpl()) {}
+GbApuState::GbApuState(std::unique_ptr<AudioSink> && sink) : pimpl(new AudioPimpl(std::move(sink))) {}
 GbApuState::~GbApuState() = default;
 
-void GbApuState::TickCycle()
+void GbApuState::Tick(u32 cycles)
 {
-    pimpl->TickCycle();
+    pimpl->Tick(cycles);
 }
 
 std::optional<u8> GbApuState::ReadMemory(u16 address) const
@@ -597,91 +712,28 @@ std::optional<u8> GbApuState::ReadMemory(u16 address) const
     return pimpl->ReadMemory(address);
 }
 
-bool GbApuState::WriteMemory(u16 address, u8 value)
+std::optional<u64> GbApuState::GetAudioClockNs() const
 {
-    return pimpl->WriteMemory(address, value);
+    return pimpl->GetAudioClockNs();
 }
 
-AudioPimpl::AudioPimpl()
+std::optional<u64> GbApuState::GetQueuedAudioNs() const
 {
-    SDL_InitSubSystem(SDL_INIT_AUDIO);
-
-    memset(chans, 0, sizeof(chans));
-    chans[0].val = chans[1].val = -1;
-
-    WriteMemory(0xFF10, 0x80);
-    WriteMemory(0xFF11, 0x3F);
-    WriteMemory(0xFF14, 0xB8);
-    WriteMemory(0xFF15, 0xFF);
-    WriteMemory(0xFF16, 0x03F);
-    WriteMemory(0xFF19, 0xB8);
-    WriteMemory(0xFF1A, 0x7F);
-    WriteMemory(0xFF1B, 0xFF);
-    WriteMemory(0xFF1C, 0x9F);
-    WriteMemory(0xFF1E, 0xB8);
-    WriteMemory(0xFF1F, 0xFF);
-    WriteMemory(0xFF20, 0xFF);
-    WriteMemory(0xFF23, 0xBF);
-    WriteMemory(0xFF24, 0x00);
-    WriteMemory(0xFF25, 0x00);
-    WriteMemory(0xFF26, 0x70);
-
-    UpdateRate();
+    return pimpl->GetQueuedAudioNs();
 }
 
-void AudioPimpl::TickCycle()
+bool GbApuState::WriteMemory(u16 address, u8 value)
 {
-    if (cycle.fetch_add(1) == 0) {
-        logger->Infof("Unpausing audio");
-        SDL_PauseAudioDevice(audioDeviceId, 0);
-    }
+    return pimpl->WriteMemory(address, value);
 }
 
-void AudioPimpl::UpdateRate()
+void GbApuState::SaveState(StateWriter & writer) const
 {
-    float audioRate = 59.7f;
-
-    if (tac & 0x04) {
-        int rates[] = {4096, 262144, 65536, 16384};
-        audioRate = rates[tac & 0x03] / (float)(256 - tma);
-        if (tac & 0x80)
-            audioRate *= 2.0f;
-    }
-
-    int newSampleCount = (int)(AUDIO_SAMPLE_RATE / audioRate) * 2;
-
-    // TODO: No idea if this will work in practice
-    if (audioDeviceId) {
-        SDL_CloseAudioDevice(audioDeviceId);
-    }
-
-    SDL_AudioSpec have;
-    SDL_AudioSpec want;
-    want.freq = AUDIO_SAMPLE_RATE;
-    want.format = AUDIO_F32SYS;
-    want.channels = 2;
-    want.samples = newSampleCount;
-    want.callback = AudioPimpl::AudioCallback;
-    want.userdata = this;
-
-    logger->Infof("Audio driver: %s", SDL_GetAudioDeviceName(0, 0));
-
-    if ((audioDeviceId = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0)) == 0) {
-        printf("SDL could not open audio device: %s\n", SDL_GetError());
-        exit(1);
-    }
-
-    logger->Infof("Want: %d %d %d %d", want.freq, want.format, want.channels, want.samples);
-    logger->Infof("Have: %d %d %d %d", have.freq, have.format, have.channels, have.samples);
+    pimpl->SaveState(writer);
 }
 
-void AudioPimpl::LockAudioDevice()
+void GbApuState::LoadState(StateReader & reader)
 {
-    SDL_LockAudioDevice(audioDeviceId);
+    pimpl->LoadState(reader);
 }
-
-void AudioPimpl::UnlockAudioDevice()
-{
-    SDL_UnlockAudioDevice(audioDeviceId);
 }
-}
\ No newline at end of file
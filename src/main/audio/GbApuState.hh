@@ -8,39 +8,74 @@
 namespace gb4e
 {
 class AudioPimpl;
+class AudioSink;
+class StateReader;
+class StateWriter;
 
 class ApuState
 {
 public:
-    virtual void TickCycle() = 0;
+    virtual ~ApuState() = default;
+
+    /**
+     * Advances the APU by cycles M-cycles. The caller may batch cycles, but must catch the APU up before any of its
+     * registers are accessed.
+     */
+    virtual void Tick(u32 cycles) = 0;
 
     virtual std::optional<u8> ReadMemory(u16 address) const = 0;
 
     virtual bool WriteMemory(u16 address, u8 value) = 0;
+
+    // Nanoseconds of audio the output device has played so far, or nothing if there is no output device
+    virtual std::optional<u64> GetAudioClockNs() const = 0;
+
+    // Nanoseconds of audio waiting to be played by the output device, or nothing if there is no output device
+    virtual std::optional<u64> GetQueuedAudioNs() const = 0;
+
+    // Audio already produced is not part of the state, loading continues the output from the loaded state
+    virtual void SaveState(StateWriter & writer) const = 0;
+    virtual void LoadState(StateReader & reader) = 0;
 };
 
 class GbApuState final : public ApuState
 {
 public:
-    GbApuState();
+    GbApuState(std::unique_ptr<AudioSink> && sink);
     ~GbApuState();
 
-    void TickCycle() final override;
+    void Tick(u32 cycles) final override;
 
     std::optional<u8> ReadMemory(u16 address) const final override;
 
     bool WriteMemory(u16 address, u8 value) final override;
 
+    std::optional<u64> GetAudioClockNs() const final override;
+
+    std::optional<u64> GetQueuedAudioNs() const final override;
+
+    void SaveState(StateWriter & writer) const final override;
+
+    void LoadState(StateReader & reader) final override;
+
 private:
     std::unique_ptr<AudioPimpl> pimpl;
 };
 
 class ApuStateFake final : public ApuState
 {
-    void TickCycle() final override {}
+    void Tick(u32 cycles) final override {}
 
     std::optional<u8> ReadMemory(u16 address) const final override { return {}; }
 
     bool WriteMemory(u16 address, u8 value) final override {}
+
+    std::optional<u64> GetAudioClockNs() const final override { return {}; }
+
+    std::optional<u64> GetQueuedAudioNs() const final override { return {}; }
+
+    void SaveState(StateWriter & writer) const final override {}
+
+    void LoadState(StateReader & reader) final override {}
 };
 };
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include "SdlAudioSink.hh"
+
+#include <algorithm>
+
+#include "EmulatorMetrics.hh"
+#include "logging/Logger.hh"
+
+static auto const logger = Logger::Create("SdlAudioSink");
+
+namespace gb4e
+{
+// Number of stereo frames the audio device asks for per callback
+u16 constexpr AUDIO_DEVICE_FRAMES = 1024;
+
+std::unique_ptr<SdlAudioSink> SdlAudioSink::Create(u32 sampleRate)
+{
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO)) {
+        logger->Errorf("Failed to init SDL audio: %s", SDL_GetError());
+        return nullptr;
+    }
+
+    std::unique_ptr<SdlAudioSink> sink(new SdlAudioSink());
+
+    SDL_AudioSpec have;
+    SDL_AudioSpec want;
+    SDL_zero(want);
+    want.freq = sampleRate;
+    want.format = AUDIO_F32SYS;
+    want.channels = 2;
+    want.samples = AUDIO_DEVICE_FRAMES;
+    want.callback = SdlAudioSink::AudioCallback;
+    want.userdata = sink.get();
+
+    logger->Infof("Audio driver: %s", SDL_GetAudioDeviceName(0, 0));
+
+    // Let the device pick its native rate rather than having SDL resample, BlipBuffer can produce any rate directly
+    sink->audioDeviceId = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (sink->audioDeviceId == 0) {
+        logger->Errorf("SDL could not open audio device: %s", SDL_GetError());
+        return nullptr;
+    }
+    sink->sampleRate = have.freq;
+
+    logger->Infof("Want: %d %d %d %d", want.freq, want.format, want.channels, want.samples);
+    logger->Infof("Have: %d %d %d %d", have.freq, have.format, have.channels, have.samples);
+    return sink;
+}
+
+SdlAudioSink::~SdlAudioSink()
+{
+    if (audioDeviceId) {
+        SDL_CloseAudioDevice(audioDeviceId);
+    }
+}
+
+void SdlAudioSink::Start()
+{
+    logger->Infof("Unpausing audio");
+    SDL_PauseAudioDevice(audioDeviceId, 0);
+}
+
+void SdlAudioSink::Write(float const * in, size_t frameCount)
+{
+    // Samples that do not fit are dropped, which only happens if the audio device is not keeping up
+    samples.PushMany(in, frameCount * 2);
+}
+
+std::optional<u64> SdlAudioSink::GetAudioClockNs() const
+{
+    return (u64)(playedFrames.load(std::memory_order_relaxed) * 1000000000.0 / sampleRate);
+}
+
+std::optional<u64> SdlAudioSink::GetQueuedAudioNs() const
+{
+    return (u64)(samples.GetSize() / 2 * 1000000000.0 / sampleRate);
+}
+
+void SdlAudioSink::AudioCallback(void * userdata, u8 * stream, int len)
+{
+    float * out = (float *)stream;
+
+    auto sink = (SdlAudioSink *)userdata;
+    auto now = std::chrono::high_resolution_clock::now();
+    u64 duration = (now - sink->lastCallback).count();
+    sink->lastCallback = now;
+    if (sink->metrics != nullptr) {
+        sink->metrics->Record(Metric::AUDIO_CALLBACK, duration);
+    }
+
+    int sampleCount = len / sizeof(float);
+    sink->playedFrames.fetch_add(sampleCount / 2, std::memory_order_relaxed);
+
+    // If the emulation has not produced enough samples, for example because it is paused, play silence for the rest
+    size_t popped = sink->samples.PopMany(out, sampleCount);
+    std::fill(out + popped, out + sampleCount, 0.f);
+}
+};
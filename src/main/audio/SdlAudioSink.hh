@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+#include <SDL2/SDL.h>
+
+#include "AudioSink.hh"
+#include "concurrency/SpscRingBuffer.hh"
+
+namespace gb4e
+{
+/**
+ * Plays audio through an SDL audio device. Samples are buffered in a ring buffer which the SDL callback copies from.
+ */
+class SdlAudioSink final : public AudioSink
+{
+public:
+    /**
+     * Returns nullptr if no audio device could be opened. The device may choose a different sample rate than
+     * sampleRate if it does not support it natively, GetSampleRate returns the rate actually used.
+     */
+    static std::unique_ptr<SdlAudioSink> Create(u32 sampleRate = 48000);
+    ~SdlAudioSink();
+
+    bool WantsSamples() const final override { return true; }
+
+    u32 GetSampleRate() const final override { return sampleRate; }
+
+    void Start() final override;
+
+    void Write(float const * samples, size_t frameCount) final override;
+
+    void SetMetrics(EmulatorMetrics * metrics) final override { this->metrics = metrics; }
+
+    std::optional<u64> GetAudioClockNs() const final override;
+
+    std::optional<u64> GetQueuedAudioNs() const final override;
+
+private:
+    // Interleaved stereo samples buffered between the emulation and the audio device, ~170 ms at 48 kHz
+    static size_t constexpr SAMPLE_QUEUE_SIZE = 16384;
+
+    SdlAudioSink() = default;
+
+    static void AudioCallback(void * userdata, u8 * stream, int len);
+
+    SDL_AudioDeviceID audioDeviceId = 0;
+    u32 sampleRate = 0;
+
+    // Number of stereo sample frames handed to the audio device, including silence
+    std::atomic_uint64_t playedFrames = 0;
+    std::chrono::high_resolution_clock::time_point lastCallback = std::chrono::high_resolution_clock::now();
+    // Set before the device is unpaused and never changed afterwards
+    EmulatorMetrics * metrics = nullptr;
+
+    SpscRingBuffer<float, SAMPLE_QUEUE_SIZE> samples;
+};
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+/**
+ * Lock-free bounded FIFO between one producer thread and one consumer thread.
+ *
+ * CAPACITY must be a power of two. The read and write positions only ever increase and are masked when indexing, so
+ * all CAPACITY slots can be used.
+ */
+template <typename T, size_t CAPACITY>
+class SpscRingBuffer
+{
+    static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+public:
+    // Producer side. Returns false without modifying the buffer if it is full.
+    bool TryPush(T const & value)
+    {
+        size_t write = writePos.load(std::memory_order_relaxed);
+        if (write - cachedReadPos == CAPACITY) {
+            cachedReadPos = readPos.load(std::memory_order_acquire);
+            if (write - cachedReadPos == CAPACITY) {
+                return false;
+            }
+        }
+        buffer[write & MASK] = value;
+        writePos.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer side. Pushes as many of the count values as fit and returns how many were pushed.
+    size_t PushMany(T const * values, size_t count)
+    {
+        size_t write = writePos.load(std::memory_order_relaxed);
+        if (write - cachedReadPos + count > CAPACITY) {
+            cachedReadPos = readPos.load(std::memory_order_acquire);
+        }
+        count = std::min(count, CAPACITY - (write - cachedReadPos));
+        for (size_t i = 0; i < count; ++i) {
+            buffer[(write + i) & MASK] = values[i];
+        }
+        writePos.store(write + count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer side. Returns a pointer to the oldest element without removing it, or nullptr if the buffer is empty.
+    // The pointer is valid until the next call to Pop.
+    T const * Peek()
+    {
+        size_t read = readPos.load(std::memory_order_relaxed);
+        if (read == cachedWritePos) {
+            cachedWritePos = writePos.load(std::memory_order_acquire);
+            if (read == cachedWritePos) {
+                return nullptr;
+            }
+        }
+        return &buffer[read & MASK];
+    }
+
+    // Consumer side. Removes the oldest element, Peek must have returned non-null before calling this.
+    void Pop() { readPos.store(readPos.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // Consumer side. Returns false if the buffer is empty.
+    bool TryPop(T & out)
+    {
+        T const * front = Peek();
+        if (front == nullptr) {
+            return false;
+        }
+        out = *front;
+        Pop();
+        return true;
+    }
+
+    // Consumer side. Pops up to count values into out and returns how many were popped.
+    size_t PopMany(T * out, size_t count)
+    {
+        size_t read = readPos.load(std::memory_order_relaxed);
+        if (cachedWritePos - read < count) {
+            cachedWritePos = writePos.load(std::memory_order_acquire);
+        }
+        count = std::min(count, cachedWritePos - read);
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = buffer[(read + i) & MASK];
+        }
+        readPos.store(read + count, std::memory_order_release);
+        return count;
+    }
+
+    // Either side. The number of values in the buffer, which the other side may change right after.
+    size_t GetSize() const
+    {
+        // readPos is loaded first, it never overtakes writePos
+        size_t read = readPos.load(std::memory_order_acquire);
+        return writePos.load(std::memory_order_acquire) - read;
+    }
+
+private:
+    static size_t constexpr MASK = CAPACITY - 1;
+
+    std::array<T, CAPACITY> buffer{};
+
+    alignas(64) std::atomic<size_t> writePos = 0;
+    // Producer's last seen value of readPos, only touched by the producer
+    size_t cachedReadPos = 0;
+
+    alignas(64) std::atomic<size_t> readPos = 0;
+    // Consumer's last seen value of writePos, only touched by the consumer
+    size_t cachedWritePos = 0;
+};
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+/**
+ * Lock-free exchange of whole values between one producer thread and one consumer thread.
+ *
+ * The producer fills the buffer returned by GetWriteBuffer and calls Publish when it is complete. The consumer calls
+ * Consume to pick up the most recently published buffer and then reads it through GetReadBuffer. Neither side ever
+ * waits for the other or copies a buffer, and the consumer never observes a partially written buffer.
+ */
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Producer side
+    T & GetWriteBuffer() { return buffers[writeIndex]; }
+
+    // Producer side. Makes the write buffer available to the consumer and starts writing to another buffer.
+    void Publish()
+    {
+        u8 previous = middle.exchange(writeIndex | FRESH_BIT, std::memory_order_acq_rel);
+        writeIndex = previous & INDEX_MASK;
+    }
+
+    // Consumer side. Returns true if a buffer was published since the last call, in which case it is now the read buffer
+    bool Consume()
+    {
+        if ((middle.load(std::memory_order_relaxed) & FRESH_BIT) == 0) {
+            return false;
+        }
+        u8 previous = middle.exchange(readIndex, std::memory_order_acq_rel);
+        readIndex = previous & INDEX_MASK;
+        return true;
+    }
+
+    // Consumer side. Valid until the next call to Consume.
+    T const & GetReadBuffer() const { return buffers[readIndex]; }
+
+private:
+    static u8 constexpr INDEX_MASK = 0b011;
+    static u8 constexpr FRESH_BIT = 0b100;
+
+    std::array<T, 3> buffers{};
+
+    // Index of the buffer which is neither being written nor read. FRESH_BIT is set if it was published and not yet
+    // consumed.
+    alignas(64) std::atomic<u8> middle = 1;
+
+    // Only touched by the producer
+    alignas(64) u8 writeIndex = 0;
+    // Only touched by the consumer
+    alignas(64) u8 readIndex = 2;
+};
+};
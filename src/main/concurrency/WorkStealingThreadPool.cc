@@ -0,0 +1,148 @@
+#include "WorkStealingThreadPool.hh"
+
+#include <algorithm>
+
+#include "logging/Logger.hh"
+
+static auto const logger = Logger::Create("WorkStealingThreadPool");
+
+namespace gb4e
+{
+
+WorkStealingThreadPool::WorkStealingThreadPool(size_t numThreads) : ranges(std::max<size_t>(numThreads, 1))
+{
+    logger->Infof("Starting thread pool with numThreads=%zu", ranges.size());
+    // Worker 0 is the thread calling ParallelFor
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        threads.emplace_back(&WorkStealingThreadPool::WorkerThread, this, i);
+    }
+}
+
+WorkStealingThreadPool::~WorkStealingThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        isShuttingDown = true;
+    }
+    wakeWorkers.notify_all();
+    for (auto & thread : threads) {
+        thread.join();
+    }
+}
+
+void WorkStealingThreadPool::Run(u32 count, TaskFunction function, void const * context)
+{
+    if (count == 0) {
+        return;
+    }
+    size_t numWorkers = ranges.size();
+    for (size_t i = 0; i < numWorkers; ++i) {
+        u32 begin = (u32)(count * i / numWorkers);
+        u32 end = (u32)(count * (i + 1) / numWorkers);
+        ranges[i].value.store(Pack(begin, end), std::memory_order_relaxed);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        currentTask = function;
+        currentContext = context;
+        activeWorkers = threads.size();
+        ++generation;
+    }
+    wakeWorkers.notify_all();
+
+    RunTasks(0);
+
+    // Every index has been taken once all workers have run out of work to steal, so waiting for the workers to go idle
+    // also means waiting for all tasks to finish
+    std::unique_lock<std::mutex> lock(mutex);
+    workDone.wait(lock, [this] { return activeWorkers == 0; });
+    currentTask = nullptr;
+    currentContext = nullptr;
+}
+
+void WorkStealingThreadPool::WorkerThread(size_t workerIndex)
+{
+    u64 seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeWorkers.wait(lock, [&] { return isShuttingDown || generation != seenGeneration; });
+            if (isShuttingDown) {
+                return;
+            }
+            seenGeneration = generation;
+        }
+
+        RunTasks(workerIndex);
+
+        bool isLast;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            isLast = --activeWorkers == 0;
+        }
+        if (isLast) {
+            workDone.notify_one();
+        }
+    }
+}
+
+void WorkStealingThreadPool::RunTasks(size_t workerIndex)
+{
+    u32 index;
+    while (TakeOwn(workerIndex, index) || Steal(workerIndex, index)) {
+        currentTask(currentContext, index);
+    }
+}
+
+bool WorkStealingThreadPool::TakeOwn(size_t workerIndex, u32 & index)
+{
+    auto & range = ranges[workerIndex].value;
+    u64 current = range.load(std::memory_order_acquire);
+    while (true) {
+        u32 begin = (u32)(current >> 32);
+        u32 end = (u32)current;
+        if (begin >= end) {
+            return false;
+        }
+        if (range.compare_exchange_weak(current, Pack(begin + 1, end), std::memory_order_acq_rel)) {
+            index = begin;
+            return true;
+        }
+    }
+}
+
+bool WorkStealingThreadPool::Steal(size_t workerIndex, u32 & index)
+{
+    while (true) {
+        // Steal from the worker with the most work left
+        size_t victim = workerIndex;
+        u64 victimRange = 0;
+        u32 mostRemaining = 0;
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            u64 current = ranges[i].value.load(std::memory_order_acquire);
+            u32 begin = (u32)(current >> 32);
+            u32 end = (u32)current;
+            if (i != workerIndex && end > begin && end - begin > mostRemaining) {
+                victim = i;
+                victimRange = current;
+                mostRemaining = end - begin;
+            }
+        }
+        if (victim == workerIndex) {
+            return false;
+        }
+
+        u32 begin = (u32)(victimRange >> 32);
+        u32 end = (u32)victimRange;
+        u32 middle = begin + (end - begin) / 2;
+        if (!ranges[victim].value.compare_exchange_strong(victimRange, Pack(begin, middle),
+                                                          std::memory_order_acq_rel)) {
+            continue;
+        }
+        // Only this worker writes its own range while it is empty, thieves never touch empty ranges
+        ranges[workerIndex].value.store(Pack(middle + 1, end), std::memory_order_release);
+        index = middle;
+        return true;
+    }
+}
+};
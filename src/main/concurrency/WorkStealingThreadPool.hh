@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+/**
+ * Fixed set of worker threads which run parallel loops.
+ *
+ * Each call to ParallelFor splits the index range evenly between the workers. A worker takes indices from the front of
+ * its own range, and once that is empty it steals the back half of the largest remaining range of another worker. This
+ * keeps all cores busy even when some tasks take much longer than others, without any shared queue that all workers
+ * contend on.
+ */
+class WorkStealingThreadPool
+{
+public:
+    // numThreads includes the thread calling ParallelFor, which works alongside the pool threads
+    WorkStealingThreadPool(size_t numThreads = std::thread::hardware_concurrency());
+    ~WorkStealingThreadPool();
+
+    WorkStealingThreadPool(WorkStealingThreadPool const &) = delete;
+    WorkStealingThreadPool & operator=(WorkStealingThreadPool const &) = delete;
+
+    size_t GetNumThreads() const { return ranges.size(); }
+
+    /**
+     * Calls task(i) for every i in [0, count) and returns once all calls have finished. Not reentrant. The workers call
+     * task through a plain function pointer, so passing a lambda never allocates.
+     */
+    template <typename Task>
+    void ParallelFor(u32 count, Task const & task)
+    {
+        Run(count, [](void const * context, u32 index) { (*(Task const *)context)(index); }, &task);
+    }
+
+private:
+    using TaskFunction = void (*)(void const * context, u32 index);
+
+    // A range of indices [begin, end) packed into one word so that the owner and thieves can update it with a CAS
+    struct alignas(64) Range {
+        std::atomic<u64> value = 0;
+    };
+    static u64 Pack(u32 begin, u32 end) { return ((u64)begin << 32) | end; }
+
+    void Run(u32 count, TaskFunction function, void const * context);
+    void WorkerThread(size_t workerIndex);
+    void RunTasks(size_t workerIndex);
+    bool TakeOwn(size_t workerIndex, u32 & index);
+    bool Steal(size_t workerIndex, u32 & index);
+
+    std::vector<Range> ranges;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable wakeWorkers;
+    std::condition_variable workDone;
+    // Incremented for every ParallelFor call, workers wait for it to change
+    u64 generation = 0;
+    bool isShuttingDown = false;
+    // Number of pool threads which have not yet finished the current generation
+    size_t activeWorkers = 0;
+
+    TaskFunction currentTask = nullptr;
+    void const * currentContext = nullptr;
+};
+};
@@ -2,8 +2,6 @@
 
 #include <fstream>
 
-#include <concurrentqueue/concurrentqueue.h>
-
 #include "Instruction.hh"
 #include "logging/Logger.hh"
 
@@ -11,13 +9,12 @@ static const auto logger = Logger::Create("TracerThread");
 
 namespace gb4e::debug
 {
-moodycamel::ConcurrentQueue<TraceData> queue;
-void PushTrace(TraceData const & data)
+void Tracer::Push(TraceData const & data)
 {
     queue.enqueue(data);
 }
 
-void TracerThread(std::filesystem::path const & outFile, std::atomic_bool & isShuttingDown)
+void Tracer::Run(std::filesystem::path const & outFile, std::atomic_bool & isShuttingDown)
 {
     logger->Infof("Starting tracer thread with outFile=%ls", outFile.c_str());
     std::ofstream outStream(outFile.c_str());
@@ -3,6 +3,8 @@
 #include <atomic>
 #include <filesystem>
 
+#include <concurrentqueue/concurrentqueue.h>
+
 #include "Common.hh"
 
 namespace gb4e::debug
@@ -20,6 +22,19 @@ struct TraceData {
     u16 instr;
 };
 
-void PushTrace(TraceData const &);
-void TracerThread(std::filesystem::path const & outFile, std::atomic_bool & isShuttingDown);
+/**
+ * Collects traces from one CPU and writes them to a file on a separate thread, so that several CPUs can be traced to
+ * separate files in the same process.
+ */
+class Tracer
+{
+public:
+    void Push(TraceData const &);
+
+    // Writes traces to outFile until isShuttingDown is set, meant to be run on its own thread
+    void Run(std::filesystem::path const & outFile, std::atomic_bool & isShuttingDown);
+
+private:
+    moodycamel::ConcurrentQueue<TraceData> queue;
+};
 }
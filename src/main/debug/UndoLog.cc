@@ -0,0 +1,217 @@
+#include "UndoLog.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace gb4e::debug
+{
+u8 constexpr HEADER_REGISTER_MASK = 0x3F;
+u8 constexpr HEADER_IME_CHANGED = BIT(6);
+u8 constexpr HEADER_INTERRUPT = BIT(7);
+
+u8 constexpr IME_BIT = BIT(0);
+u8 constexpr PENDING_IME_BIT = BIT(1);
+
+// Header, a 64-bit varint, every register, the IME byte, the write count, every write and the length byte
+size_t constexpr MAX_RECORD_SIZE = 1 + 10 + NUM_UNDO_REGISTERS * 2 + 1 + 1 + MAX_UNDO_MEMORY_WRITES * 4 + 1;
+static_assert(MAX_RECORD_SIZE <= 0xFF, "Record lengths must fit the length byte");
+
+static u8 ImeBits(UndoCpuState const & state)
+{
+    return (state.ime ? IME_BIT : 0) | (state.hasPendingImeEnable ? PENDING_IME_BIT : 0);
+}
+
+void UndoLog::SetCapacity(size_t capacity)
+{
+    buffer.assign(capacity, 0);
+    Clear();
+}
+
+void UndoLog::Clear()
+{
+    oldestPos = 0;
+    endPos = 0;
+    usedSize = 0;
+    recordCount = 0;
+    newestCycles = 0;
+    isRecording = false;
+}
+
+void UndoLog::Begin(u64 totalCycles, UndoCpuState const & before, bool isInterrupt)
+{
+    isRecording = true;
+    pendingCycles = totalCycles;
+    pendingBefore = before;
+    pendingIsInterrupt = isInterrupt;
+    pendingNumMemoryWrites = 0;
+}
+
+void UndoLog::RecordMemoryWrite(u16 location, u8 previousValue, u8 value)
+{
+    assert(isRecording && pendingNumMemoryWrites < MAX_UNDO_MEMORY_WRITES);
+    if (pendingNumMemoryWrites < MAX_UNDO_MEMORY_WRITES) {
+        pendingMemoryWrites[pendingNumMemoryWrites++] = {location, previousValue, value};
+    }
+}
+
+void UndoLog::End(UndoCpuState const & after)
+{
+    assert(isRecording);
+    isRecording = false;
+
+    std::array<u8, MAX_RECORD_SIZE> record;
+    size_t size = 1;
+    u8 header = pendingIsInterrupt ? HEADER_INTERRUPT : 0;
+    // Time only moves forwards between Clears, but a bogus delta is better than a huge one if it does not
+    u64 cycleDelta = pendingCycles >= newestCycles ? pendingCycles - newestCycles : 0;
+    do {
+        u8 byte = cycleDelta & 0x7F;
+        cycleDelta >>= 7;
+        record[size++] = byte | (cycleDelta != 0 ? 0x80 : 0);
+    } while (cycleDelta != 0);
+    for (size_t i = 0; i < NUM_UNDO_REGISTERS; ++i) {
+        if (after.registers[i] != pendingBefore.registers[i] || (i == UNDO_REGISTER_PC && !pendingIsInterrupt)) {
+            header |= BIT(i);
+            record[size++] = pendingBefore.registers[i] & 0xFF;
+            record[size++] = pendingBefore.registers[i] >> 8;
+        }
+    }
+    if (ImeBits(after) != ImeBits(pendingBefore)) {
+        header |= HEADER_IME_CHANGED;
+        record[size++] = ImeBits(pendingBefore);
+    }
+    record[size++] = pendingNumMemoryWrites;
+    for (size_t i = 0; i < pendingNumMemoryWrites; ++i) {
+        UndoMemoryWrite const & write = pendingMemoryWrites[i];
+        record[size++] = write.location & 0xFF;
+        record[size++] = write.location >> 8;
+        record[size++] = write.previousValue;
+        record[size++] = write.value;
+    }
+    record[0] = header;
+    ++size;
+    record[size - 1] = (u8)size;
+
+    if (size > buffer.size()) {
+        return;
+    }
+    while (buffer.size() - usedSize < size) {
+        DropOldest();
+    }
+    size_t firstPart = std::min(size, buffer.size() - endPos);
+    memcpy(buffer.data() + endPos, record.data(), firstPart);
+    memcpy(buffer.data(), record.data() + firstPart, size - firstPart);
+    endPos = (endPos + size) % buffer.size();
+    usedSize += size;
+    ++recordCount;
+    newestCycles = pendingCycles;
+}
+
+size_t UndoLog::Decode(size_t pos, UndoRecord & record, u64 & cycleDelta) const
+{
+    size_t size = 0;
+    auto next = [&] {
+        ++size;
+        u8 byte = buffer[pos];
+        if (++pos == buffer.size()) {
+            pos = 0;
+        }
+        return byte;
+    };
+    auto next16 = [&] {
+        u16 low = next();
+        return (u16)(low | (next() << 8));
+    };
+
+    u8 header = next();
+    cycleDelta = 0;
+    for (int shift = 0;; shift += 7) {
+        u8 byte = next();
+        cycleDelta |= (u64)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    record.isInterrupt = (header & HEADER_INTERRUPT) != 0;
+    record.changedRegisters = header & HEADER_REGISTER_MASK;
+    for (size_t i = 0; i < NUM_UNDO_REGISTERS; ++i) {
+        if (record.changedRegisters & BIT(i)) {
+            record.previousRegisters[i] = next16();
+        }
+    }
+    record.hasImeChange = (header & HEADER_IME_CHANGED) != 0;
+    if (record.hasImeChange) {
+        u8 imeBits = next();
+        record.previousIme = (imeBits & IME_BIT) != 0;
+        record.previousHasPendingImeEnable = (imeBits & PENDING_IME_BIT) != 0;
+    }
+    record.numMemoryWrites = next();
+    for (size_t i = 0; i < record.numMemoryWrites; ++i) {
+        UndoMemoryWrite & write = record.memoryWrites[i];
+        write.location = next16();
+        write.previousValue = next();
+        write.value = next();
+    }
+    // The length byte
+    next();
+    return size;
+}
+
+size_t UndoLog::StartOfRecordEndingAt(size_t end) const
+{
+    size_t lengthPos = (end + buffer.size() - 1) % buffer.size();
+    return (end + buffer.size() - buffer[lengthPos]) % buffer.size();
+}
+
+void UndoLog::DropOldest()
+{
+    UndoRecord record;
+    u64 cycleDelta;
+    size_t size = Decode(oldestPos, record, cycleDelta);
+    oldestPos = (oldestPos + size) % buffer.size();
+    usedSize -= size;
+    --recordCount;
+}
+
+bool UndoLog::Pop(UndoRecord & record)
+{
+    if (recordCount == 0) {
+        return false;
+    }
+    size_t start = StartOfRecordEndingAt(endPos);
+    u64 cycleDelta;
+    size_t size = Decode(start, record, cycleDelta);
+    record.totalCycles = newestCycles;
+    newestCycles -= cycleDelta;
+    endPos = start;
+    usedSize -= size;
+    --recordCount;
+    return true;
+}
+
+size_t UndoLog::ReadNewest(UndoCpuState const & current, std::span<UndoRecord> out) const
+{
+    size_t count = std::min(out.size(), recordCount);
+    std::array<u16, NUM_UNDO_REGISTERS> registers = current.registers;
+    u64 cycles = newestCycles;
+    size_t end = endPos;
+    for (size_t i = 0; i < count; ++i) {
+        UndoRecord & record = out[i];
+        size_t start = StartOfRecordEndingAt(end);
+        u64 cycleDelta;
+        Decode(start, record, cycleDelta);
+        record.totalCycles = cycles;
+        record.registers = registers;
+        for (size_t r = 0; r < NUM_UNDO_REGISTERS; ++r) {
+            if (!(record.changedRegisters & BIT(r))) {
+                record.previousRegisters[r] = registers[r];
+            }
+        }
+        registers = record.previousRegisters;
+        cycles -= cycleDelta;
+        end = start;
+    }
+    return count;
+}
+}
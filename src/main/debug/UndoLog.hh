@@ -0,0 +1,118 @@
+#pragma once
+
+#include <array>
+#include <span>
+#include <vector>
+
+#include "Common.hh"
+
+namespace gb4e::debug
+{
+// Indices into UndoCpuState::registers, the same as the register file of GbCpuState
+size_t constexpr UNDO_REGISTER_AF = 0;
+size_t constexpr UNDO_REGISTER_BC = 1;
+size_t constexpr UNDO_REGISTER_DE = 2;
+size_t constexpr UNDO_REGISTER_HL = 3;
+size_t constexpr UNDO_REGISTER_SP = 4;
+size_t constexpr UNDO_REGISTER_PC = 5;
+size_t constexpr NUM_UNDO_REGISTERS = 6;
+
+// An interrupt dispatch writes the two bytes of the pushed PC and IF, instructions write at most two bytes
+size_t constexpr MAX_UNDO_MEMORY_WRITES = 3;
+
+// The CPU state besides memory which a step can change
+struct UndoCpuState {
+    std::array<u16, NUM_UNDO_REGISTERS> registers;
+    bool ime;
+    bool hasPendingImeEnable;
+};
+
+struct UndoMemoryWrite {
+    u16 location;
+    u8 previousValue;
+    u8 value;
+};
+
+// One executed instruction or interrupt dispatch, decoded
+struct UndoRecord {
+    // CPU cycle count when the step completed
+    u64 totalCycles;
+    bool isInterrupt;
+    // Bit i is set if registers[i] was changed by the step, PC always is for instructions
+    u8 changedRegisters;
+    // Registers before and after the step. UndoLog::Pop only fills in previousRegisters of changed registers.
+    std::array<u16, NUM_UNDO_REGISTERS> previousRegisters;
+    std::array<u16, NUM_UNDO_REGISTERS> registers;
+    bool hasImeChange;
+    bool previousIme;
+    bool previousHasPendingImeEnable;
+    u8 numMemoryWrites;
+    std::array<UndoMemoryWrite, MAX_UNDO_MEMORY_WRITES> memoryWrites;
+};
+
+/**
+ * What every executed step changed, kept so that the debugger can run the CPU backwards.
+ *
+ * Records are packed into one ring of bytes: a header byte with a mask of the changed registers, the cycles since the
+ * previous record as a varint, the previous value of each changed register, the memory writes with the value they
+ * overwrote, and a trailing length byte to walk the ring backwards from the newest record. A typical instruction takes
+ * 6 to 10 bytes, so a few MB hold the last million instructions. When the ring is full the oldest records are dropped.
+ *
+ * A step is recorded by Begin with the state before it, RecordMemoryWrite before each write happens, and End with the
+ * state after it.
+ */
+class UndoLog
+{
+public:
+    // A capacity of 0 disables the log
+    explicit UndoLog(size_t capacity = 0) { SetCapacity(capacity); }
+
+    // Drops every record
+    void SetCapacity(size_t capacity);
+    size_t GetCapacity() const { return buffer.size(); }
+    bool IsEnabled() const { return !buffer.empty(); }
+
+    void Begin(u64 totalCycles, UndoCpuState const & before, bool isInterrupt);
+    void RecordMemoryWrite(u16 location, u8 previousValue, u8 value);
+    void End(UndoCpuState const & after);
+    // True between Begin and End
+    bool IsRecording() const { return isRecording; }
+
+    // Removes the newest record into record, returns false if there is none
+    bool Pop(UndoRecord & record);
+
+    /**
+     * Decodes up to out.size() of the newest records into out, newest first, and returns how many there were. current
+     * is the state after the newest record, from which the full register files of each record are reconstructed.
+     */
+    size_t ReadNewest(UndoCpuState const & current, std::span<UndoRecord> out) const;
+
+    size_t GetRecordCount() const { return recordCount; }
+    // Bytes taken by the records
+    size_t GetUsedSize() const { return usedSize; }
+
+    void Clear();
+
+private:
+    // Decodes the record starting at pos, returns its size. cycleDelta is the cycles since the record before it.
+    size_t Decode(size_t pos, UndoRecord & record, u64 & cycleDelta) const;
+    size_t StartOfRecordEndingAt(size_t end) const;
+    void DropOldest();
+
+    std::vector<u8> buffer;
+    // Where the oldest record starts and where the next record will be written
+    size_t oldestPos = 0;
+    size_t endPos = 0;
+    size_t usedSize = 0;
+    size_t recordCount = 0;
+    u64 newestCycles = 0;
+
+    // The step being recorded
+    bool isRecording = false;
+    u64 pendingCycles = 0;
+    UndoCpuState pendingBefore{};
+    bool pendingIsInterrupt = false;
+    u8 pendingNumMemoryWrites = 0;
+    std::array<UndoMemoryWrite, MAX_UNDO_MEMORY_WRITES> pendingMemoryWrites{};
+};
+}
@@ -0,0 +1,225 @@
+#include "SharedMemoryExporter.hh"
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#include "logging/Logger.hh"
+
+static auto const logger = Logger::Create("SharedMemoryExporter");
+
+namespace gb4e
+{
+static_assert(sizeof(gb4e_shm_header) == 256, "gb4e_shm_header layout changed");
+static_assert(sizeof(gb4e_shm_slot) == 64, "gb4e_shm_slot layout changed");
+
+#ifndef _WIN32
+
+static u64 AlignUp(u64 value)
+{
+    return (value + 63) & ~(u64)63;
+}
+
+/**
+ * Returns true if the segment name was left behind by a producer which is gone, or which closed it and has not yet
+ * removed it. A segment without a complete header may be in the middle of being created and is never stale.
+ */
+static bool IsStale(std::string const & name)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        // Removed in the meantime
+        return errno == ENOENT;
+    }
+    struct stat st;
+    bool isStale = false;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(gb4e_shm_header)) {
+        void * memory = mmap(nullptr, sizeof(gb4e_shm_header), PROT_READ, MAP_SHARED, fd, 0);
+        if (memory != MAP_FAILED) {
+            auto header = (gb4e_shm_header *)memory;
+            if (std::atomic_ref<u32>(header->magic).load(std::memory_order_acquire) == GB4E_SHM_MAGIC) {
+                pid_t producer = (pid_t)header->producer_pid;
+                isStale = std::atomic_ref<u32>(header->closed).load(std::memory_order_acquire) != 0 ||
+                          (kill(producer, 0) != 0 && errno == ESRCH);
+            }
+            munmap(memory, sizeof(gb4e_shm_header));
+        }
+    }
+    close(fd);
+    return isStale;
+}
+
+std::unique_ptr<SharedMemoryExporter> SharedMemoryExporter::Create(std::string const & name,
+                                                                   SharedMemoryLayout const & layout)
+{
+    u32 observationSize = layout.observationFormat == GB4E_SHM_FORMAT_GRAYSCALE
+                              ? layout.observationWidth * layout.observationHeight
+                              : SCREEN_WIDTH * SCREEN_HEIGHT;
+    u64 slotSize = AlignUp(sizeof(gb4e_shm_slot) + (u64)layout.numInstances * (observationSize + layout.ramSize));
+    u64 slotsOffset = sizeof(gb4e_shm_header);
+    u64 inputsOffset = slotsOffset + slotSize * layout.numSlots;
+    u64 segmentSize = AlignUp(inputsOffset + sizeof(gb4e_shm_inputs) + layout.numInstances);
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST && IsStale(name)) {
+        // Left behind by a crashed run, its layout may differ
+        logger->Warnf("Replacing stale shared memory name=%s", name.c_str());
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0 && errno == EEXIST) {
+        logger->Errorf("Shared memory name=%s is in use by another running producer, pick another name or remove it "
+                       "from /dev/shm if that producer is stuck",
+                       name.c_str());
+        return nullptr;
+    }
+    if (fd < 0) {
+        logger->Errorf("Failed to create shared memory name=%s: %s", name.c_str(), strerror(errno));
+        return nullptr;
+    }
+    if (ftruncate(fd, (off_t)segmentSize) != 0) {
+        logger->Errorf("Failed to resize shared memory to size=%zu: %s", segmentSize, strerror(errno));
+        close(fd);
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+    void * memory = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        logger->Errorf("Failed to map shared memory: %s", strerror(errno));
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+
+    std::unique_ptr<SharedMemoryExporter> exporter(new SharedMemoryExporter());
+    exporter->name = name;
+    exporter->header = (gb4e_shm_header *)memory;
+
+    // ftruncate zero fills, only the non-zero fields need to be set. magic is written last so that a consumer which
+    // attaches early does not see a half initialized header.
+    auto header = exporter->header;
+    header->version = GB4E_SHM_VERSION;
+    header->num_instances = layout.numInstances;
+    header->num_slots = layout.numSlots;
+    header->observation_format = layout.observationFormat;
+    header->observation_width = layout.observationWidth;
+    header->observation_height = layout.observationHeight;
+    header->observation_size = observationSize;
+    header->ram_size = layout.ramSize;
+    header->producer_pid = (u32)getpid();
+    header->segment_size = segmentSize;
+    header->slot_size = slotSize;
+    header->slots_offset = slotsOffset;
+    header->inputs_offset = inputsOffset;
+    std::atomic_ref<u32>(header->magic).store(GB4E_SHM_MAGIC, std::memory_order_release);
+
+    logger->Infof("Created shared memory name=%s, size=%zu, numInstances=%u, numSlots=%u", name.c_str(), segmentSize,
+                  layout.numInstances, layout.numSlots);
+    return exporter;
+}
+
+SharedMemoryExporter::~SharedMemoryExporter()
+{
+    std::atomic_ref<u32>(header->closed).store(1, std::memory_order_release);
+    gb4e_shm_futex_wake(&header->published_seq);
+    munmap(header, header->segment_size);
+    shm_unlink(name.c_str());
+}
+
+std::optional<u32> SharedMemoryExporter::WaitForInputs(int timeoutMs)
+{
+    std::atomic_ref<u32> inputSeq(header->input_seq);
+    if (inputSeq.load(std::memory_order_acquire) == lastInputSeq) {
+        gb4e_shm_futex_wait(&header->input_seq, lastInputSeq, timeoutMs);
+    }
+    u32 seq = inputSeq.load(std::memory_order_acquire);
+    if (seq == lastInputSeq || IsStopRequested()) {
+        return std::nullopt;
+    }
+    lastInputSeq = seq;
+    return ((gb4e_shm_inputs const *)((u8 const *)header + header->inputs_offset))->frames;
+}
+
+u8 const * SharedMemoryExporter::GetHeldButtons() const
+{
+    return gb4e_shm_input_buttons(header);
+}
+
+bool SharedMemoryExporter::IsStopRequested() const
+{
+    return std::atomic_ref<u32>(header->stop_requested).load(std::memory_order_acquire) != 0;
+}
+
+gb4e_shm_slot * SharedMemoryExporter::GetNextSlot()
+{
+    // Only this thread writes published_seq
+    u32 seq = std::atomic_ref<u32>(header->published_seq).load(std::memory_order_relaxed);
+    return (gb4e_shm_slot *)gb4e_shm_get_slot(header, seq + 1);
+}
+
+u8 * SharedMemoryExporter::GetNextObservations()
+{
+    return (u8 *)gb4e_shm_observation(header, GetNextSlot(), 0);
+}
+
+u8 * SharedMemoryExporter::GetNextRam()
+{
+    return (u8 *)gb4e_shm_ram(header, GetNextSlot(), 0);
+}
+
+void SharedMemoryExporter::Publish(u64 frame, u32 framesStepped, u64 stepTimeNs)
+{
+    std::atomic_ref<u32> publishedSeq(header->published_seq);
+    u32 seq = publishedSeq.load(std::memory_order_relaxed);
+    gb4e_shm_slot * slot = GetNextSlot();
+    slot->sequence = seq;
+    slot->frame = frame;
+    slot->step_time_ns = stepTimeNs;
+    slot->frames_stepped = framesStepped;
+
+    // The release store also publishes the observations and RAM written by the step
+    publishedSeq.store(seq + 1, std::memory_order_release);
+    gb4e_shm_futex_wake(&header->published_seq);
+}
+
+#else
+
+std::unique_ptr<SharedMemoryExporter> SharedMemoryExporter::Create(std::string const & name,
+                                                                   SharedMemoryLayout const & layout)
+{
+    logger->Errorf("Shared memory export is only supported on POSIX systems");
+    return nullptr;
+}
+
+SharedMemoryExporter::~SharedMemoryExporter() {}
+
+std::optional<u32> SharedMemoryExporter::WaitForInputs(int timeoutMs)
+{
+    return std::nullopt;
+}
+
+u8 const * SharedMemoryExporter::GetHeldButtons() const
+{
+    return nullptr;
+}
+
+bool SharedMemoryExporter::IsStopRequested() const
+{
+    return true;
+}
+
+u8 * SharedMemoryExporter::GetNextObservations()
+{
+    return nullptr;
+}
+
+u8 * SharedMemoryExporter::GetNextRam()
+{
+    return nullptr;
+}
+
+void SharedMemoryExporter::Publish(u64 frame, u32 framesStepped, u64 stepTimeNs) {}
+
+#endif
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "Common.hh"
+#include "gb4e_shm.h"
+
+namespace gb4e
+{
+struct SharedMemoryLayout {
+    u32 numInstances = 1;
+    // Number of published steps a consumer can hold on to before they are overwritten
+    u32 numSlots = 4;
+    u32 observationFormat = GB4E_SHM_FORMAT_SHADE_INDEX;
+    u32 observationWidth = SCREEN_WIDTH;
+    u32 observationHeight = SCREEN_HEIGHT;
+    u32 ramSize = 0;
+};
+
+/**
+ * Producer side of the shared memory segment described in gb4e_shm.h. Creates the segment on construction and removes
+ * it again on destruction. Only available on POSIX systems.
+ *
+ * Steps write their results straight into the next slot, see GetNextObservations and GetNextRam, and Publish then only
+ * hands the slot to the consumer.
+ */
+class SharedMemoryExporter
+{
+public:
+    /**
+     * Returns nullptr if the segment could not be created, including when a segment of the same name belongs to a
+     * running producer. A segment left behind by a producer which exited without closing it is replaced.
+     */
+    static std::unique_ptr<SharedMemoryExporter> Create(std::string const & name, SharedMemoryLayout const & layout);
+    ~SharedMemoryExporter();
+
+    SharedMemoryExporter(SharedMemoryExporter const &) = delete;
+    SharedMemoryExporter & operator=(SharedMemoryExporter const &) = delete;
+
+    /**
+     * Waits up to timeoutMs for the consumer to submit inputs. Returns the number of frames to emulate, in which case
+     * GetHeldButtons contains the new inputs, or nothing if no inputs arrived or the consumer asked to stop.
+     */
+    std::optional<u32> WaitForInputs(int timeoutMs);
+    u8 const * GetHeldButtons() const;
+    bool IsStopRequested() const;
+
+    /**
+     * Where the next step must write the observations and the RAM values of all instances, back to back with the
+     * sizes given in the layout. The consumer may still read the slot it published last, never this one.
+     */
+    u8 * GetNextObservations();
+    u8 * GetNextRam();
+
+    // Publishes the slot of GetNextObservations and GetNextRam, which the step has written to
+    void Publish(u64 frame, u32 framesStepped, u64 stepTimeNs);
+
+private:
+    SharedMemoryExporter() = default;
+
+    gb4e_shm_slot * GetNextSlot();
+
+    std::string name;
+    gb4e_shm_header * header = nullptr;
+    u32 lastInputSeq = 0;
+};
+};
@@ -0,0 +1,218 @@
+/*
+ * C ABI for consuming frames from a gb4e instance running with --shm <name>.
+ *
+ * The emulator creates a POSIX shared memory object named <name> which contains a gb4e_shm_header, a ring of
+ * num_slots slots and an input block. The emulator steps all of its instances in lockstep, driven by the consumer:
+ *
+ *  1. The consumer writes one held buttons byte per instance (bit n set = JoypadButton n held, 0=right, 1=left, 2=up,
+ *     3=down, 4=A, 5=B, 6=select, 7=start) to gb4e_shm_input_buttons, and calls gb4e_shm_submit_inputs with the number
+ *     of frames to emulate.
+ *  2. The emulator steps every instance, drawing the results straight into slot published_seq % num_slots, and
+ *     increments published_seq.
+ *  3. The consumer waits with gb4e_shm_wait_published and reads the slot in place. A slot stays valid until
+ *     num_slots - 1 further steps have been published and inputs for another one are submitted, with a single slot
+ *     only until the next inputs are submitted.
+ *
+ * Each slot is a gb4e_shm_slot followed by num_instances observations of observation_size bytes and then
+ * num_instances RAM snapshots of ram_size bytes. Observations are either DMG shade indices (0=white, 3=black) at
+ * 160x144 or grayscale (255=white) at observation_width x observation_height, see observation_format.
+ *
+ * producer_pid is the process which created the segment. A new producer replaces a segment of the same name only if
+ * that process has exited or closed it.
+ *
+ * Waiting uses futexes on Linux and polling on other POSIX systems. The helpers are static inline so that consumers
+ * only need this header, C consumers must enable POSIX and GNU extensions (e.g. -std=gnu11). Not available on Windows.
+ */
+#ifndef GB4E_SHM_H
+#define GB4E_SHM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GB4E_SHM_MAGIC 0x34454247u /* "GBE4" */
+#define GB4E_SHM_VERSION 1u
+
+#define GB4E_SHM_FORMAT_SHADE_INDEX 0u
+#define GB4E_SHM_FORMAT_GRAYSCALE 1u
+
+/* Fields after the first cache line are accessed atomically, the producer and consumer fields are on separate lines */
+typedef struct gb4e_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_instances;
+    uint32_t num_slots;
+    uint32_t observation_format;
+    uint32_t observation_width;
+    uint32_t observation_height;
+    uint32_t observation_size;
+    uint32_t ram_size;
+    uint32_t producer_pid;
+    uint64_t segment_size;
+    uint64_t slot_size;
+    uint64_t slots_offset;
+    uint64_t inputs_offset;
+    uint8_t layout_padding[56];
+
+    /* Written by the producer */
+    uint32_t published_seq;
+    uint32_t closed;
+    uint8_t producer_padding[56];
+
+    /* Written by the consumer */
+    uint32_t input_seq;
+    uint32_t stop_requested;
+    uint8_t consumer_padding[56];
+} gb4e_shm_header;
+
+typedef struct gb4e_shm_slot {
+    /* Value of published_seq before this slot was published */
+    uint64_t sequence;
+    /* Number of frames emulated by every instance since startup */
+    uint64_t frame;
+    /* Wall time the step took */
+    uint64_t step_time_ns;
+    uint32_t frames_stepped;
+    uint8_t padding[36];
+} gb4e_shm_slot;
+
+/* Followed by num_instances held buttons bytes */
+typedef struct gb4e_shm_inputs {
+    uint32_t frames;
+    uint32_t reserved;
+} gb4e_shm_inputs;
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+/* Blocks until *address != expected or timeout_ms has passed, may return early */
+static inline void gb4e_shm_futex_wait(uint32_t * address, uint32_t expected, int timeout_ms)
+{
+#ifdef __linux__
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+    syscall(SYS_futex, address, FUTEX_WAIT, expected, &timeout, NULL, 0);
+#else
+    (void)timeout_ms;
+    if (__atomic_load_n(address, __ATOMIC_ACQUIRE) == expected) {
+        usleep(50);
+    }
+#endif
+}
+
+static inline void gb4e_shm_futex_wake(uint32_t * address)
+{
+#ifdef __linux__
+    syscall(SYS_futex, address, FUTEX_WAKE, 0x7FFFFFFF, NULL, NULL, 0);
+#else
+    (void)address;
+#endif
+}
+
+/* Maps the segment created by the emulator, returns NULL if it does not exist or is incompatible */
+static inline gb4e_shm_header * gb4e_shm_attach(char const * name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(gb4e_shm_header)) {
+        close(fd);
+        return NULL;
+    }
+    void * memory = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    gb4e_shm_header * header = (gb4e_shm_header *)memory;
+    if (header->magic != GB4E_SHM_MAGIC || header->version != GB4E_SHM_VERSION ||
+        header->segment_size != (uint64_t)st.st_size) {
+        munmap(memory, (size_t)st.st_size);
+        return NULL;
+    }
+    return header;
+}
+
+static inline void gb4e_shm_detach(gb4e_shm_header * header)
+{
+    munmap(header, (size_t)header->segment_size);
+}
+
+static inline uint8_t * gb4e_shm_input_buttons(gb4e_shm_header * header)
+{
+    return (uint8_t *)header + header->inputs_offset + sizeof(gb4e_shm_inputs);
+}
+
+/* Asks the producer to emulate frames frames with the buttons in gb4e_shm_input_buttons */
+static inline void gb4e_shm_submit_inputs(gb4e_shm_header * header, uint32_t frames)
+{
+    gb4e_shm_inputs * inputs = (gb4e_shm_inputs *)((uint8_t *)header + header->inputs_offset);
+    inputs->frames = frames;
+    __atomic_add_fetch(&header->input_seq, 1, __ATOMIC_RELEASE);
+    gb4e_shm_futex_wake(&header->input_seq);
+}
+
+/*
+ * Waits until published_seq differs from last_seq and returns it. Returns last_seq if timeout_ms passed first or the
+ * producer closed the segment.
+ */
+static inline uint32_t gb4e_shm_wait_published(gb4e_shm_header * header, uint32_t last_seq, int timeout_ms)
+{
+    uint32_t seq = __atomic_load_n(&header->published_seq, __ATOMIC_ACQUIRE);
+    if (seq == last_seq && !__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE)) {
+        gb4e_shm_futex_wait(&header->published_seq, last_seq, timeout_ms);
+        seq = __atomic_load_n(&header->published_seq, __ATOMIC_ACQUIRE);
+    }
+    return seq;
+}
+
+/* The slot written by the step which made published_seq equal to seq */
+static inline gb4e_shm_slot const * gb4e_shm_get_slot(gb4e_shm_header const * header, uint32_t seq)
+{
+    uint64_t index = (uint64_t)(seq - 1) % header->num_slots;
+    return (gb4e_shm_slot const *)((uint8_t const *)header + header->slots_offset + index * header->slot_size);
+}
+
+static inline uint8_t const * gb4e_shm_observation(gb4e_shm_header const * header, gb4e_shm_slot const * slot,
+                                                   uint32_t instance)
+{
+    return (uint8_t const *)(slot + 1) + (size_t)instance * header->observation_size;
+}
+
+static inline uint8_t const * gb4e_shm_ram(gb4e_shm_header const * header, gb4e_shm_slot const * slot,
+                                           uint32_t instance)
+{
+    return (uint8_t const *)(slot + 1) + (size_t)header->num_instances * header->observation_size +
+           (size_t)instance * header->ram_size;
+}
+
+/* Asks the producer to shut down */
+static inline void gb4e_shm_request_stop(gb4e_shm_header * header)
+{
+    __atomic_store_n(&header->stop_requested, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&header->input_seq, 1, __ATOMIC_RELEASE);
+    gb4e_shm_futex_wake(&header->input_seq);
+}
+
+#endif /* _WIN32 */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GB4E_SHM_H */
@@ -68,7 +68,11 @@ void Logger::Severef(char const * format, ...)
 
 std::string Logger::Sprintf(char const * format, va_list args)
 {
-    auto size = vsnprintf(nullptr, 0, format, args);
+    // args can only be traversed once on some platforms, the size calculation needs its own copy
+    va_list sizeArgs;
+    va_copy(sizeArgs, args);
+    auto size = vsnprintf(nullptr, 0, format, sizeArgs);
+    va_end(sizeArgs);
     std::vector<char> buf(size + 1);
     vsnprintf(buf.data(), buf.size(), format, args);
     return std::string(buf.data());
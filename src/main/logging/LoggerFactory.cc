@@ -11,16 +11,16 @@ LoggerFactory::LoggerFactory(std::shared_ptr<LogAppender> appender) : appender(a
 
 LoggerFactory * LoggerFactory::GetInstance()
 {
-    static LoggerFactory * singleton = nullptr;
-    if (singleton == nullptr) {
+    // Initialized as a function local static so that loggers can be created from any thread
+    static LoggerFactory * singleton = [] {
         auto consoleAppender = gb4e::ui::GetConsoleAppender();
         // TODO: Find a better place to configure this
         auto stdOutAppender = std::make_shared<StdoutLogAppender>();
         // stdOutAppender->SetMinimumLevel("GbCpu", LogLevel::INFO);
         std::vector<std::shared_ptr<LogAppender>> appenders = {stdOutAppender, consoleAppender};
         auto compositeAppender = std::make_shared<CompositeAppender>(appenders);
-        singleton = new LoggerFactory(compositeAppender);
-    }
+        return new LoggerFactory(compositeAppender);
+    }();
     return singleton;
 }
 
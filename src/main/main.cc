@@ -1,21 +1,32 @@
 
 #include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <thread>
 
 #include <SDL2/SDL.h>
 #include <gl/glew.h>
 #include <imgui.h>
 
+#include "EmulationThread.hh"
+#include "FramePacer.hh"
 #include "GbCpu.hh"
 #include "InputSystem.hh"
 #include "Instruction.hh"
 #include "Renderer.hh"
-#include "SlurpFile.hh"
+#include "SaveFile.hh"
+#include "MappedFile.hh"
+#include "VecEnv.hh"
+#include "audio/FileAudioSink.hh"
+#include "audio/SdlAudioSink.hh"
 #include "debug/InstructionTrace.hh"
+#include "ipc/SharedMemoryExporter.hh"
 #include "logging/Logger.hh"
-#include "romfile/RomFileLoader.hh"
+#include "romfile/RomCache.hh"
+#include "savestate/InputMovie.hh"
 
 #include "ui/Console.hh"
 #include "ui/Debugger.hh"
@@ -33,14 +44,143 @@ using namespace std::chrono_literals;
 
 static const auto logger = Logger::Create("main");
 
+u8 constexpr MAX_ADAPTIVE_FRAME_SKIP = 4;
+u32 constexpr MIN_AUDIO_SAMPLE_RATE = 8000;
+u32 constexpr MAX_AUDIO_SAMPLE_RATE = 192000;
+u32 constexpr MAX_SHM_INSTANCES = 4096;
+
+static void PrintUsage(char const * program)
+{
+    logger->Infof("Usage: %s <romfile> [--frameskip <0-255>|auto] [--audiorate <8000-192000>]", program);
+    logger->Infof("       %s <romfile> --shm <name> [--instances <1-4096>] [--observation <w>x<h>] "
+                  "[--ram <start>-<end>] [--save-template <path>]",
+                  program);
+}
+
+// Parses a whole decimal number within [min, max], logging an error naming option otherwise
+static std::optional<u32> ParseNumberArg(char const * option, char const * str, u32 min, u32 max)
+{
+    char * end;
+    errno = 0;
+    long long value = strtoll(str, &end, 10);
+    if (end == str || *end != '\0' || errno == ERANGE || value < min || value > max) {
+        logger->Errorf("Invalid %s=%s, expected a number from %u to %u", option, str, min, max);
+        return std::nullopt;
+    }
+    return (u32)value;
+}
+
+/**
+ * --shm <name> runs headless, stepping a VecEnv whenever the external process attached to the shared memory segment
+ * described in ipc/gb4e_shm.h submits inputs. --instances <n> sets the number of instances, --observation <w>x<h>
+ * switches to downsampled grayscale observations and every --ram <start>-<end> (hex, inclusive) adds a RAM region to
+ * export. --save-template <path> starts every instance from a copy-on-write mapping of the given save.
+ */
+static int RunSharedMemoryExport(char const * romPath, char const * shmName, int argc, char ** argv)
+{
+    gb4e::VecEnvConfig config;
+    for (int i = 0; i < argc - 1; ++i) {
+        if (strcmp(argv[i], "--instances") == 0) {
+            auto numInstances = ParseNumberArg("--instances", argv[i + 1], 1, MAX_SHM_INSTANCES);
+            if (!numInstances.has_value()) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            config.numInstances = numInstances.value();
+        } else if (strcmp(argv[i], "--observation") == 0) {
+            char const * separator = strchr(argv[i + 1], 'x');
+            if (separator == nullptr) {
+                logger->Errorf("Invalid observation size=%s, expected <width>x<height>", argv[i + 1]);
+                return 1;
+            }
+            // Both are checked before narrowing, so that no size wraps around into the valid range
+            std::string widthStr(argv[i + 1], separator - argv[i + 1]);
+            auto width = ParseNumberArg("--observation width", widthStr.c_str(), 1, gb4e::SCREEN_WIDTH);
+            auto height = ParseNumberArg("--observation height", separator + 1, 1, gb4e::SCREEN_HEIGHT);
+            if (!width.has_value() || !height.has_value()) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            config.observationFormat = gb4e::ObservationFormat::GRAYSCALE;
+            config.observationWidth = (u16)width.value();
+            config.observationHeight = (u16)height.value();
+        } else if (strcmp(argv[i], "--save-template") == 0) {
+            config.saveTemplatePath = argv[i + 1];
+        } else if (strcmp(argv[i], "--ram") == 0) {
+            unsigned start, end;
+            if (sscanf(argv[i + 1], "%x-%x", &start, &end) != 2 || start > end || end > 0xFFFF) {
+                logger->Errorf("Invalid RAM region=%s, expected <start>-<end> in hex", argv[i + 1]);
+                return 1;
+            }
+            for (unsigned address = start; address <= end; ++address) {
+                config.ramAddresses.push_back((u16)address);
+            }
+        }
+    }
+
+    auto & romCache = gb4e::RomCache::GetInstance();
+    std::shared_ptr<gb4e::MappedFile const> bootrom = romCache.LoadFile("bootrom.bin");
+    if (!bootrom) {
+        logger->Errorf("Failed to open bootrom.bin");
+        return 1;
+    }
+    std::shared_ptr<gb4e::RomFile const> romFile = romCache.LoadRom(romPath);
+    if (!romFile) {
+        logger->Errorf("Failed to open ROM file with filename=%s", romPath);
+        return 1;
+    }
+
+    auto env = gb4e::VecEnv::Create(
+        bootrom->GetSize(), bootrom->GetData(), gb4e::GbModel::DMG, romFile.get(), config);
+    if (!env) {
+        return 1;
+    }
+    gb4e::SharedMemoryLayout layout{
+        .numInstances = (u32)config.numInstances,
+        .observationFormat = config.observationFormat == gb4e::ObservationFormat::GRAYSCALE
+                                 ? GB4E_SHM_FORMAT_GRAYSCALE
+                                 : GB4E_SHM_FORMAT_SHADE_INDEX,
+        .observationWidth = config.observationWidth,
+        .observationHeight = config.observationHeight,
+        .ramSize = (u32)config.ramAddresses.size(),
+    };
+    auto exporter = gb4e::SharedMemoryExporter::Create(shmName, layout);
+    if (!exporter) {
+        return 1;
+    }
+
+    u64 frame = 0;
+    while (!exporter->IsStopRequested()) {
+        std::optional<u32> frames = exporter->WaitForInputs(100);
+        if (!frames.has_value()) {
+            continue;
+        }
+        auto beforeStep = std::chrono::high_resolution_clock::now();
+        // The instances draw straight into the slot which is published next
+        env->SetOutputs(exporter->GetNextObservations(), exporter->GetNextRam());
+        env->Step(exporter->GetHeldButtons(), frames.value());
+        u64 stepTimeNs = (std::chrono::high_resolution_clock::now() - beforeStep).count();
+        frame += frames.value();
+        exporter->Publish(frame, frames.value(), stepTimeNs);
+    }
+    logger->Infof("Consumer requested stop after frame=%zu", frame);
+    return 0;
+}
+
 #undef main
 int main(int argc, char ** argv)
 {
     if (argc < 2) {
-        logger->Infof("Usage: %s <romfile>", argv[0]);
+        PrintUsage(argv[0]);
         return 0;
     }
 
+    for (int i = 0; i < argc - 1; ++i) {
+        if (strcmp(argv[i], "--shm") == 0) {
+            return RunSharedMemoryExport(argv[1], argv[i + 1], argc, argv);
+        }
+    }
+
 #ifdef _WIN32
     // Necessary(?) to get audio to play on Windows
     // At least on my machine it wouldn't play without this. Could let the user set it before running the program but
@@ -80,27 +220,66 @@ int main(int argc, char ** argv)
     gb4e::InputSystemImpl inputSystem;
     inputSystem.Init();
 
-    gb4e::ui::InitInstructionHistory();
     gb4e::ui::InitInstructionWatch();
 
-    std::optional<SizedArray> bootrom = gb4e::SlurpFile("bootrom.bin");
-    if (!bootrom.has_value()) {
+    auto & romCache = gb4e::RomCache::GetInstance();
+    std::shared_ptr<gb4e::MappedFile const> bootrom = romCache.LoadFile("bootrom.bin");
+    if (!bootrom) {
         logger->Errorf("Failed to open bootrom.bin");
         return 1;
     }
 
-    std::optional<gb4e::RomFile> romFileOpt = gb4e::LoadRomFile(argv[1]);
+    std::shared_ptr<gb4e::RomFile const> romFilePtr = romCache.LoadRom(argv[1]);
     logger->Infof("After load");
-    if (!romFileOpt.has_value()) {
+    if (!romFilePtr) {
         logger->Errorf("Failed to open ROM file with filename=%s", argv[1]);
         return 1;
     }
-    gb4e::RomFile romFile = std::move(romFileOpt.value());
+    gb4e::RomFile const & romFile = *romFilePtr;
 
     logger->Infof("%s", romFile.ToString().c_str());
 
-    std::optional<gb4e::GbCpu> gbCpuOpt = gb4e::GbCpu::Create(
-        bootrom.value().size, bootrom.value().arr.get(), gb4e::GbModel::DMG, &gbRenderer, inputSystem);
+    // --audio null runs without audio output. --audiofile <path> writes audio to a WAV file if the path ends in .wav
+    // and to a raw 16-bit stereo PCM file otherwise. By default audio is played through SDL.
+    // --audiorate <hz> sets the output sample rate, an audio device may still pick its own native rate.
+    u32 audioSampleRate = 48000;
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--audiorate") == 0 && i < (argc - 1)) {
+            auto rate = ParseNumberArg("--audiorate", argv[i + 1], MIN_AUDIO_SAMPLE_RATE, MAX_AUDIO_SAMPLE_RATE);
+            if (!rate.has_value()) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            audioSampleRate = rate.value();
+            break;
+        }
+    }
+    std::unique_ptr<gb4e::AudioSink> audioSink;
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--audio") == 0 && i < (argc - 1) && strcmp(argv[i + 1], "null") == 0) {
+            audioSink = std::make_unique<gb4e::NullAudioSink>();
+            break;
+        }
+        if (strcmp(argv[i], "--audiofile") == 0 && i < (argc - 1)) {
+            std::filesystem::path audioPath = argv[i + 1];
+            auto format = audioPath.extension() == ".wav" ? gb4e::AudioFileFormat::WAV : gb4e::AudioFileFormat::RAW;
+            audioSink = gb4e::FileAudioSink::Create(audioPath, format, audioSampleRate);
+            if (!audioSink) {
+                return 1;
+            }
+            break;
+        }
+    }
+    if (!audioSink) {
+        audioSink = gb4e::SdlAudioSink::Create(audioSampleRate);
+        if (!audioSink) {
+            logger->Warnf("No audio device available, running without audio");
+        }
+    }
+
+    std::optional<gb4e::GbCpu> gbCpuOpt =
+        gb4e::GbCpu::Create(bootrom->GetSize(), bootrom->GetData(), gb4e::GbModel::DMG, &gbRenderer,
+                            inputSystem, {}, std::move(audioSink));
     if (!gbCpuOpt.has_value()) {
         logger->Errorf("Failed to create GbCpu");
         return 1;
@@ -116,13 +295,107 @@ int main(int argc, char ** argv)
 
     gb4e::GbCpu gbCpu = std::move(gbCpuOpt.value());
 
+    // --frameskip <n> skips rendering of n frames after every drawn frame, --frameskip auto adapts it up to
+    // MAX_ADAPTIVE_FRAME_SKIP depending on whether emulation keeps up
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--frameskip") == 0 && i < (argc - 1)) {
+            if (strcmp(argv[i + 1], "auto") == 0) {
+                gbCpu.SetAdaptiveFrameSkip(MAX_ADAPTIVE_FRAME_SKIP);
+            } else {
+                auto frameSkip = ParseNumberArg("--frameskip", argv[i + 1], 0, UINT8_MAX);
+                if (!frameSkip.has_value()) {
+                    PrintUsage(argv[0]);
+                    return 1;
+                }
+                gbCpu.SetFrameSkip((u8)frameSkip.value());
+            }
+            break;
+        }
+    }
+
+    gb4e::debug::Tracer tracer;
     std::optional<std::thread> tracerThread;
     if (traceOutputFilepath.has_value()) {
-        tracerThread = std::thread(gb4e::debug::TracerThread, traceOutputFilepath.value(), std::ref(isShuttingDown));
-        gbCpu.SetEnableTracing(true);
+        tracerThread =
+            std::thread(&gb4e::debug::Tracer::Run, &tracer, traceOutputFilepath.value(), std::ref(isShuttingDown));
+        gbCpu.SetTracer(&tracer);
     }
     gbCpu.LoadRom(&romFile);
 
+    // --record-movie <path> records the joypad into a movie saved on exit, --play-movie <path> replays one instead of
+    // reading the joypad. See savestate/InputMovie.hh.
+    std::optional<std::string> recordMoviePath;
+    std::optional<std::string> playMoviePath;
+    for (int i = 0; i < argc - 1; ++i) {
+        if (strcmp(argv[i], "--record-movie") == 0) {
+            recordMoviePath = argv[i + 1];
+        } else if (strcmp(argv[i], "--play-movie") == 0) {
+            playMoviePath = argv[i + 1];
+        }
+    }
+
+    // Battery backed RAM and the RTC are kept in <rom>.sav next to the ROM. The RTC follows the real time, like it would
+    // on a cartridge. A movie brings its own RAM, playing one must not overwrite the save.
+    gb4e::Cartridge * cartridge = gbCpu.GetCartridge();
+    cartridge->SetRtcClock(gb4e::RtcClock::WALL);
+    if (cartridge->HasBattery() && cartridge->GetSaveSize() > 0 && !playMoviePath.has_value()) {
+        std::string savePath = std::filesystem::path(argv[1]).replace_extension(".sav").string();
+        auto saveFile = gb4e::SaveFile::Open(savePath, cartridge->GetSaveSize());
+        if (!saveFile || !cartridge->AttachSaveFile(std::move(saveFile))) {
+            logger->Warnf("Failed to open save file=%s, the game will not be saved", savePath.c_str());
+        }
+    }
+
+    // --pacing vsync (default) paces emulation to the display refresh, --pacing audio to the audio device
+    gb4e::PacingMode pacingMode = gb4e::PacingMode::VSYNC;
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--pacing") == 0 && i < (argc - 1)) {
+            auto mode = gb4e::ToPacingMode(argv[i + 1]);
+            if (!mode.has_value()) {
+                logger->Errorf("Unknown pacing mode=%s", argv[i + 1]);
+                return 1;
+            }
+            pacingMode = mode.value();
+            break;
+        }
+    }
+    if (pacingMode == gb4e::PacingMode::AUDIO && !gbCpu.GetApu()->GetAudioClockNs().has_value()) {
+        logger->Warnf("No audio device available, falling back to vsync pacing");
+        pacingMode = gb4e::PacingMode::VSYNC;
+    }
+
+    // Without vsync the UI loop is throttled by sleeping instead, the vsync pacer still works off the swap times
+    bool hasVsync = SDL_GL_SetSwapInterval(1) == 0;
+    if (!hasVsync) {
+        logger->Warnf("Failed to enable vsync");
+    }
+    SDL_DisplayMode displayMode;
+    int displayRefreshRate = 60;
+    if (hasVsync && SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(sdlWindow), &displayMode) == 0 &&
+        displayMode.refresh_rate > 0) {
+        displayRefreshRate = displayMode.refresh_rate;
+    }
+
+    gb4e::VsyncFramePacer vsyncPacer(displayRefreshRate);
+    gb4e::AudioFramePacer audioPacer(gbCpu.GetApu());
+    gb4e::FramePacer * pacer = &vsyncPacer;
+    if (pacingMode == gb4e::PacingMode::AUDIO) {
+        pacer = &audioPacer;
+    }
+
+    gb4e::InputMovie movie;
+    if (playMoviePath.has_value()) {
+        if (!movie.LoadFromFile(playMoviePath.value()) || !movie.Play(gbCpu, movie.GetFirstFrame())) {
+            logger->Errorf("Failed to play movie=%s", playMoviePath.value().c_str());
+            return 1;
+        }
+    } else if (recordMoviePath.has_value()) {
+        movie.StartRecording(gbCpu);
+    }
+
+    gb4e::EmulationThread emulationThread(&gbCpu, pacer);
+    emulationThread.Start();
+
     auto lastTick = std::chrono::high_resolution_clock::now();
     while (1) {
         auto & imguiIo = ImGui::GetIO();
@@ -140,19 +413,25 @@ int main(int argc, char ** argv)
             }
         }
 
-        if (gb4e::ui::isRunning) {
-            gb4e::ui::cyclesPerFrame = gbCpu.Tick(16666666);
+        u8 snapshotFlags = 0;
+        if (gb4e::ui::showMemoryWatch || gb4e::ui::showInstructionWatch) {
+            snapshotFlags |= gb4e::SNAPSHOT_MEMORY;
+        }
+        if (gb4e::ui::showInstructionHistory) {
+            snapshotFlags |= gb4e::SNAPSHOT_HISTORY;
         }
+        emulationThread.SetSnapshotFlags(snapshotFlags);
+        auto const & snapshot = emulationThread.GetSnapshot();
 
         gb4e::ui::DrawNavbar();
-        gb4e::ui::DrawRegisterWatch(gbCpu.GetState());
-        gb4e::ui::DrawInstructionHistory(&gbCpu);
-        gb4e::ui::DrawInstructionWatch(gbCpu.GetState(), gbCpu.GetMemory());
-        gb4e::ui::DrawDebugger(&gbCpu);
-        gb4e::ui::DrawGpuDebugger(gbCpu.GetGpu());
+        gb4e::ui::DrawRegisterWatch(&snapshot.cpuState);
+        gb4e::ui::DrawInstructionHistory(&emulationThread, snapshot);
+        gb4e::ui::DrawInstructionWatch(&snapshot.cpuState, &snapshot.memory);
+        gb4e::ui::DrawDebugger(&emulationThread, snapshot);
+        gb4e::ui::DrawGpuDebugger(snapshot.oam);
         gb4e::ui::DrawConsole();
-        gb4e::ui::DrawMemoryWatch(gbCpu.GetState(), gbCpu.GetMemory());
-        gb4e::ui::DrawMetrics();
+        gb4e::ui::DrawMemoryWatch(&snapshot.cpuState, &snapshot.memory);
+        gb4e::ui::DrawMetrics(gbCpu.GetMetrics()->Snapshot(), snapshot.cyclesPerFrame);
 
         SDL_GetWindowSize(sdlWindow, &windowWidth, &windowHeight);
         glViewport(0, 0, windowWidth, windowHeight);
@@ -168,11 +447,19 @@ int main(int argc, char ** argv)
 
         SDL_GL_SwapWindow(sdlWindow);
 
-        std::this_thread::sleep_until(lastTick + 16ms);
-        lastTick = std::chrono::high_resolution_clock::now();
+        if (!hasVsync) {
+            std::this_thread::sleep_until(lastTick + 16ms);
+            lastTick = std::chrono::high_resolution_clock::now();
+        }
+        vsyncPacer.OnVsync();
     }
 
+    emulationThread.Stop();
     isShuttingDown.store(true);
+    movie.Stop(gbCpu);
+    if (recordMoviePath.has_value() && !playMoviePath.has_value()) {
+        movie.SaveToFile(recordMoviePath.value());
+    }
 
     ImGui_ImplOpenGL3_Shutdown();
     if (tracerThread.has_value()) {
@@ -65,6 +65,20 @@ public:
                type == CartridgeTypeValue::MBC5_RUMBLE_RAM || type == CartridgeTypeValue::MBC5_RUMBLE_RAM_BATTERY;
     }
     bool IsHuc1() const { return type == CartridgeTypeValue::HUC1_RAM_BATTERY; }
+    bool HasTimer() const
+    {
+        return type == CartridgeTypeValue::MBC3_TIMER_BATTERY || type == CartridgeTypeValue::MBC3_TIMER_RAM_BATTERY;
+    }
+    bool HasBattery() const
+    {
+        return type == CartridgeTypeValue::MBC1_RAM_BATTERY || type == CartridgeTypeValue::MBC2_BATTERY ||
+               type == CartridgeTypeValue::ROM_RAM_BATTERY || type == CartridgeTypeValue::MMM01_RAM_BATTERY ||
+               type == CartridgeTypeValue::MBC3_TIMER_BATTERY || type == CartridgeTypeValue::MBC3_TIMER_RAM_BATTERY ||
+               type == CartridgeTypeValue::MBC3_RAM_BATTERY || type == CartridgeTypeValue::MBC5_RAM_BATTERY ||
+               type == CartridgeTypeValue::MBC5_RUMBLE_RAM_BATTERY ||
+               type == CartridgeTypeValue::MBC7_SENSOR_RUMBLE_RAM_BATTERY ||
+               type == CartridgeTypeValue::HUC1_RAM_BATTERY;
+    }
 
 private:
     CartridgeTypeValue type;
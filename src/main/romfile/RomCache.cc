@@ -0,0 +1,116 @@
+#include "RomCache.hh"
+
+#include <cstring>
+
+#include "logging/Logger.hh"
+
+static auto const logger = Logger::Create("RomCache");
+
+namespace gb4e
+{
+RomCache & RomCache::GetInstance()
+{
+    static RomCache instance;
+    return instance;
+}
+
+// Called with the mutex held
+std::shared_ptr<RomCache::CachedImage> RomCache::LoadImage(std::string const & filename)
+{
+    std::error_code err;
+    std::filesystem::path path = std::filesystem::weakly_canonical(filename, err);
+    if (err) {
+        path = filename;
+    }
+    uintmax_t fileSize = std::filesystem::file_size(path, err);
+    if (err) {
+        logger->Errorf("Failed to stat filename=%s: %s", filename.c_str(), err.message().c_str());
+        return nullptr;
+    }
+    std::filesystem::file_time_type modifiedTime = std::filesystem::last_write_time(path, err);
+    std::string key = path.string();
+
+    auto it = entriesByPath.find(key);
+    if (it != entriesByPath.end() && it->second.fileSize == fileSize && it->second.modifiedTime == modifiedTime) {
+        return it->second.image;
+    }
+
+    std::shared_ptr<MappedFile const> file = MappedFile::Open(key);
+    if (!file) {
+        return nullptr;
+    }
+    u64 contentHash = HashRomContent(file->GetData(), file->GetSize());
+
+    std::shared_ptr<CachedImage> image;
+    auto [begin, end] = imagesByHash.equal_range(contentHash);
+    for (auto hashIt = begin; hashIt != end; ++hashIt) {
+        MappedFile const & other = *hashIt->second->file;
+        if (other.GetSize() == file->GetSize() && memcmp(other.GetData(), file->GetData(), file->GetSize()) == 0) {
+            image = hashIt->second;
+            break;
+        }
+    }
+    if (!image) {
+        image = std::make_shared<CachedImage>(CachedImage{contentHash, std::move(file), nullptr});
+        imagesByHash.emplace(contentHash, image);
+        logger->Infof("Mapped filename=%s, size=%zu, hash=%016llx", key.c_str(), (size_t)fileSize,
+                      (unsigned long long)contentHash);
+    }
+    std::shared_ptr<CachedImage> replaced = it != entriesByPath.end() ? it->second.image : nullptr;
+    entriesByPath[key] = PathEntry{fileSize, modifiedTime, image};
+    if (replaced && replaced != image) {
+        // The file changed on disk, forget its old contents unless another path still has them
+        bool isStillUsed = false;
+        for (auto const & [otherKey, entry] : entriesByPath) {
+            isStillUsed |= entry.image == replaced;
+        }
+        if (!isStillUsed) {
+            std::erase_if(imagesByHash, [&](auto const & hashAndImage) { return hashAndImage.second == replaced; });
+        }
+    }
+    return image;
+}
+
+std::shared_ptr<MappedFile const> RomCache::LoadFile(std::string const & filename)
+{
+    std::lock_guard lock(mutex);
+    std::shared_ptr<CachedImage> image = LoadImage(filename);
+    if (!image) {
+        return nullptr;
+    }
+    return image->file;
+}
+
+std::shared_ptr<RomFile const> RomCache::LoadRom(std::string const & filename)
+{
+    std::lock_guard lock(mutex);
+    std::shared_ptr<CachedImage> image = LoadImage(filename);
+    if (!image) {
+        return nullptr;
+    }
+    if (!image->rom) {
+        // The RomFile's data aliases the mapping and keeps it alive
+        std::shared_ptr<u8 const> data(image->file, image->file->GetData());
+        std::optional<RomFile> romFile = RomFile::Create(image->file->GetSize(), std::move(data));
+        if (!romFile.has_value()) {
+            logger->Errorf("Failed to parse ROM file with filename=%s", filename.c_str());
+            return nullptr;
+        }
+        image->rom = std::make_shared<RomFile const>(std::move(romFile.value()));
+    }
+    return image->rom;
+}
+
+size_t RomCache::GetImageCount()
+{
+    std::lock_guard lock(mutex);
+    return imagesByHash.size();
+}
+
+void RomCache::Clear()
+{
+    std::lock_guard lock(mutex);
+    entriesByPath.clear();
+    imagesByHash.clear();
+}
+};
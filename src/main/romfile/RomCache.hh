@@ -0,0 +1,56 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "Common.hh"
+#include "MappedFile.hh"
+#include "RomFile.hh"
+
+namespace gb4e
+{
+/**
+ * Process-wide cache of memory mapped ROM and bootrom images.
+ *
+ * Entries are keyed by canonical path and validated against the file size and modification time, so loading an
+ * unchanged file again is a map lookup. Images are also deduplicated by content hash, copies of the same ROM under
+ * different paths share one mapping. Everything handed out is read-only and may be shared between threads.
+ */
+class RomCache
+{
+public:
+    static RomCache & GetInstance();
+
+    std::shared_ptr<MappedFile const> LoadFile(std::string const & filename);
+    std::shared_ptr<RomFile const> LoadRom(std::string const & filename);
+
+    // Number of distinct images currently held
+    size_t GetImageCount();
+
+    // Drops the cache's references, images stay mapped until the last RomFile or MappedFile using them is gone
+    void Clear();
+
+private:
+    struct CachedImage {
+        u64 contentHash;
+        std::shared_ptr<MappedFile const> file;
+        // Parsed on the first LoadRom of the image
+        std::shared_ptr<RomFile const> rom;
+    };
+
+    struct PathEntry {
+        uintmax_t fileSize;
+        std::filesystem::file_time_type modifiedTime;
+        std::shared_ptr<CachedImage> image;
+    };
+
+    std::shared_ptr<CachedImage> LoadImage(std::string const & filename);
+
+    std::mutex mutex;
+    std::unordered_map<std::string, PathEntry> entriesByPath;
+    std::unordered_multimap<u64, std::shared_ptr<CachedImage>> imagesByHash;
+};
+};
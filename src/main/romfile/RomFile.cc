@@ -132,7 +132,7 @@ RomFile::Builder & RomFile::Builder::WithSize(size_t size)
     return *this;
 }
 
-RomFile::Builder & RomFile::Builder::WithData(std::unique_ptr<u8[]> && data)
+RomFile::Builder & RomFile::Builder::WithData(std::shared_ptr<u8 const> data)
 {
     this->data = std::move(data);
     return *this;
@@ -161,18 +161,24 @@ RomFile RomFile::Builder::Build()
 }
 
 std::optional<RomFile> RomFile::Create(size_t size, std::unique_ptr<u8[]> && data)
+{
+    return Create(size, std::shared_ptr<u8 const>(data.release(), std::default_delete<u8[]>()));
+}
+
+std::optional<RomFile> RomFile::Create(size_t size, std::shared_ptr<u8 const> data)
 {
     logger->Tracef("RomFile::Create, size=%zu, ptr=%p", size, data.get());
 
-    if (size < 0x15) {
-        logger->Errorf("RomFile size must be at least 0x15 to fit the cartridge header");
+    if (size < 0x150) {
+        logger->Errorf("RomFile size must be at least 0x150 to fit the cartridge header");
         return {};
     }
+    u8 const * bytes = data.get();
 
-    char const * titleStart = (char const *)&data[TITLE_START_OFFSET];
+    char const * titleStart = (char const *)&bytes[TITLE_START_OFFSET];
     size_t titleLength = TITLE_LENGTH;
     for (size_t i = 0; i < TITLE_LENGTH; ++i) {
-        if (data[TITLE_START_OFFSET + i] == '\0') {
+        if (bytes[TITLE_START_OFFSET + i] == '\0') {
             titleLength = i;
             break;
         }
@@ -180,68 +186,73 @@ std::optional<RomFile> RomFile::Create(size_t size, std::unique_ptr<u8[]> && dat
     std::string title(titleStart, titleLength);
     logger->Tracef("RomFile::Create, title=%s", title.c_str());
 
-    char const * logoStart = (char const *)&data[LOGO_START_OFFSET];
+    char const * logoStart = (char const *)&bytes[LOGO_START_OFFSET];
     bool hasValidLogo = memcmp(LOGO_BYTES, logoStart, LOGO_LENGTH) == 0;
     if (!hasValidLogo) {
         logger->Warnf("Logo bytes do not match");
     }
 
-    char const * manufacturerCodeStart = (char const *)&data[MANUFACTURER_CODE_START_OFFSET];
+    char const * manufacturerCodeStart = (char const *)&bytes[MANUFACTURER_CODE_START_OFFSET];
     size_t manufacturerCodeLength = 0;
     for (size_t i = 0; i < MANUFACTURER_CODE_LENGTH; ++i) {
-        if (data[MANUFACTURER_CODE_START_OFFSET + i] == '\0') {
+        if (bytes[MANUFACTURER_CODE_START_OFFSET + i] == '\0') {
             manufacturerCodeLength = i;
             break;
         }
     }
     std::string manufacturerCode(manufacturerCodeStart, manufacturerCodeLength);
 
-    u8 cgbFlagByte = data[CGB_FLAG_OFFET];
+    u8 cgbFlagByte = bytes[CGB_FLAG_OFFET];
     CgbFlag cgbFlag = ToCgbFlag(cgbFlagByte);
     if (cgbFlag == CgbFlag::UNKNOWN) {
         logger->Warnf("Got UNKNOWN CgbFlag. cgbFlagByte=%x", cgbFlagByte);
     }
 
-    u16 licenseeCode = *((u16 *)&data[LICENSEE_CODE_START_OFFSET]);
+    u16 licenseeCode = *((u16 *)&bytes[LICENSEE_CODE_START_OFFSET]);
 
-    u8 sgbFlagByte = data[SGB_FLAG_OFFSET];
+    u8 sgbFlagByte = bytes[SGB_FLAG_OFFSET];
     SgbFlag sgbFlag = ToSgbFlag(sgbFlagByte);
     if (sgbFlag == SgbFlag::UNKNOWN) {
         logger->Warnf("Got UNKNOWN SgbFlag. sgbFlagByte=%x", sgbFlagByte);
     }
 
-    u8 cartridgeTypeByte = data[CARTRIDGE_TYPE_OFFSET];
+    u8 cartridgeTypeByte = bytes[CARTRIDGE_TYPE_OFFSET];
     CartridgeType const * cartridgeType = ToCartridgeType(cartridgeTypeByte);
     if (cartridgeType->GetType() == CartridgeTypeValue::UNKNOWN) {
         logger->Warnf("Got UNKNOWN CartridgeType. cartridgeTypeByte=%x", cartridgeTypeByte);
     }
 
-    u8 romSizeByte = data[ROM_SIZE_OFFSET];
+    u8 romSizeByte = bytes[ROM_SIZE_OFFSET];
     RomSize const * romSize = ToRomSize(romSizeByte);
     if (!romSize->IsValid()) {
         logger->Warnf("Got invalid RomSize. romSizeByte=%x", romSizeByte);
+    } else if (romSize->GetByteSize() > size) {
+        // Reading the missing banks would run past the end of the data, or fault on a mapped file
+        logger->Warnf("Header declares romSize=%zu but the file only holds size=%zu, the missing banks mirror the "
+                      "present ones",
+                      romSize->GetByteSize(), size);
     }
 
-    u8 ramSizeByte = data[RAM_SIZE_OFFSET];
+    u8 ramSizeByte = bytes[RAM_SIZE_OFFSET];
     RamSize const * ramSize = ToRamSize(ramSizeByte);
     if (!ramSize->IsValid()) {
         logger->Warnf("Got invalid RamSize. ramSizeByte=%x", ramSizeByte);
     }
 
-    u8 destinationCodeByte = data[DESTINATION_CODE_OFFSET];
+    u8 destinationCodeByte = bytes[DESTINATION_CODE_OFFSET];
     DestinationCode destinationCode = ToDestinationCode(destinationCodeByte);
     if (destinationCode == DestinationCode::UNKNOWN) {
         logger->Warnf("Got UNKNOWN Destinationcode. destinationCodeByte=%x", destinationCodeByte);
     }
 
-    u8 oldLicenseeCode = data[OLD_LICENSEE_CODE_OFFSET];
-    u8 versionNumber = data[VERSION_NUMBER_OFFSET];
+    u8 oldLicenseeCode = bytes[OLD_LICENSEE_CODE_OFFSET];
+    u8 versionNumber = bytes[VERSION_NUMBER_OFFSET];
 
-    u8 headerChecksum = data[HEADER_CHECKSUM_OFFSET];
+    u8 headerChecksum = bytes[HEADER_CHECKSUM_OFFSET];
     logger->Tracef("Before checking header checksum");
     u16 runningHeaderChecksum = 0;
     for (u16 i = 0x134; i < 0x14D; ++i) {
-        runningHeaderChecksum = runningHeaderChecksum - data[i] - 1;
+        runningHeaderChecksum = runningHeaderChecksum - bytes[i] - 1;
     }
     bool hasValidHeaderChecksum = (runningHeaderChecksum & 0xFF) == headerChecksum;
     if (!hasValidHeaderChecksum) {
@@ -251,7 +262,7 @@ std::optional<RomFile> RomFile::Create(size_t size, std::unique_ptr<u8[]> && dat
     }
     logger->Tracef("After checking header checksum");
 
-    u16 globalChecksum = *((u16 *)&data[GLOBAL_CHECKSUM_START_OFFSET]);
+    u16 globalChecksum = *((u16 *)&bytes[GLOBAL_CHECKSUM_START_OFFSET]);
     logger->Warnf("TODO: globalChecksum check is currently stubbed");
     bool hasValidGlobalChecksum = true; // TODO:
 
@@ -281,7 +292,7 @@ RomFile::RomFile(std::string title, bool hasValidLogo, std::string manufacturerC
                  SgbFlag sgbFlag, CartridgeType const * cartridgeType, RomSize const * romSize, RamSize const * ramSize,
                  DestinationCode destinationCode, u8 oldLicenseeCode, u8 versionNumber, u8 headerChecksum,
                  bool hasValidHeaderChecksum, u16 globalChecksum, bool hasValidGlobalChecksum, size_t size,
-                 std::unique_ptr<u8[]> && data)
+                 std::shared_ptr<u8 const> data)
     : title(title), hasValidLogo(hasValidLogo), manufacturerCode(manufacturerCode), cgbFlag(cgbFlag),
       licenseeCode(licenseeCode), sgbFlag(sgbFlag), cartridgeType(cartridgeType), romSize(romSize), ramSize(ramSize),
       destinationCode(destinationCode), oldLicenseeCode(oldLicenseeCode), versionNumber(versionNumber),
@@ -315,4 +326,13 @@ std::string RomFile::ToString() const
     ss << '}';
     return ss.str();
 }
+
+u64 HashRomContent(u8 const * data, size_t size)
+{
+    u64 hash = 0xCBF29CE484222325;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * 0x100000001B3;
+    }
+    return hash;
+}
 };
\ No newline at end of file
@@ -37,7 +37,7 @@ public:
         Builder & WithGlobalChecksum(u16 globalChecksum);
         Builder & WithHasValidGlobalChecksum(bool hasValidGlobalChecksum);
         Builder & WithSize(size_t size);
-        Builder & WithData(std::unique_ptr<u8[]> && data);
+        Builder & WithData(std::shared_ptr<u8 const> data);
         RomFile Build();
 
     private:
@@ -58,10 +58,12 @@ public:
         u16 globalChecksum;
         bool hasValidGlobalChecksum;
         size_t size;
-        std::unique_ptr<u8[]> data;
+        std::shared_ptr<u8 const> data;
     };
 
     static std::optional<RomFile> Create(size_t size, std::unique_ptr<u8[]> && data);
+    // data may alias a shared image such as a MappedFile, the RomFile keeps it alive and never copies it
+    static std::optional<RomFile> Create(size_t size, std::shared_ptr<u8 const> data);
 
     std::string const & GetTitle() const { return title; }
 
@@ -71,6 +73,10 @@ public:
 
     RamSize const * GetRamSize() const { return ramSize; }
 
+    u8 GetHeaderChecksum() const { return headerChecksum; }
+
+    u16 GetGlobalChecksum() const { return globalChecksum; }
+
     size_t const & GetSize() const { return size; }
 
     u8 const * GetData() const { return data.get(); }
@@ -82,7 +88,7 @@ private:
             SgbFlag sgbFlag, CartridgeType const * cartridgeType, RomSize const * romSize, RamSize const * ramSize,
             DestinationCode destinationCode, u8 oldLicenseeCode, u8 versionNumber, u8 headerChecksum,
             bool hasValidHeaderChecksum, u16 globalChecksum, bool hasValidGlobalChecksum, size_t size,
-            std::unique_ptr<u8[]> && data);
+            std::shared_ptr<u8 const> data);
 
     std::string title;
     bool hasValidLogo;
@@ -101,6 +107,9 @@ private:
     u16 globalChecksum;
     bool hasValidGlobalChecksum;
     size_t size;
-    std::unique_ptr<u8[]> data;
+    std::shared_ptr<u8 const> data;
 };
+
+// 64-bit FNV-1a of an image, to find identical images. It is not cryptographic.
+u64 HashRomContent(u8 const * data, size_t size);
 };
\ No newline at end of file
@@ -1,18 +1,19 @@
 #include "RomFileLoader.hh"
 
-#include <cstdio>
-
-#include "SlurpFile.hh"
+#include "MappedFile.hh"
 #include "logging/Logger.hh"
 
 static auto const logger = Logger::Create("RomFileLoader");
 
 std::optional<gb4e::RomFile> gb4e::LoadRomFile(std::string const & filename)
 {
-    std::optional<SizedArray> romFile = SlurpFile(filename);
-    if (!romFile.has_value()) {
+    std::shared_ptr<MappedFile const> mappedFile = MappedFile::Open(filename);
+    if (!mappedFile) {
         logger->Errorf("Failed to load ROM file with filename=%s", filename.c_str());
         return {};
     }
-    return RomFile::Create(romFile.value().size, std::move(romFile.value().arr));
-}
\ No newline at end of file
+    size_t size = mappedFile->GetSize();
+    // The RomFile's data aliases the mapping and keeps it alive
+    std::shared_ptr<u8 const> data(mappedFile, mappedFile->GetData());
+    return RomFile::Create(size, std::move(data));
+}
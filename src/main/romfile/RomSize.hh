@@ -9,20 +9,21 @@ namespace gb4e
 class RomSize
 {
 public:
-    RomSize(u8 byteValue, size_t byteSize, u8 numBanks) : byteValue(byteValue), byteSize(byteSize), numBanks(numBanks)
+    RomSize(u8 byteValue, size_t byteSize, u16 numBanks) : byteValue(byteValue), byteSize(byteSize), numBanks(numBanks)
     {
     }
 
     u8 GetByteValue() const { return byteValue; }
     size_t GetByteSize() const { return byteSize; }
-    u8 GetNumBanks() const { return numBanks; }
+    u16 GetNumBanks() const { return numBanks; }
     bool IsValid() const { return byteValue != 0xFF; }
     std::string ToString() const;
 
 private:
     u8 byteValue;
     size_t byteSize;
-    u8 numBanks;
+    // Up to 512, which does not fit in a byte
+    u16 numBanks;
 };
 
 RomSize const * ToRomSize(u8 romSizeByte);
@@ -0,0 +1,287 @@
+#include "InputMovie.hh"
+
+#include <algorithm>
+#include <fstream>
+
+#include "Cartridge.hh"
+#include "GbCpu.hh"
+#include "SlurpFile.hh"
+#include "logging/Logger.hh"
+#include "romfile/RomFile.hh"
+#include "savestate/SaveState.hh"
+#include "savestate/StateStream.hh"
+
+static auto const logger = Logger::Create("InputMovie");
+
+namespace gb4e
+{
+u32 constexpr MOVIE_MAGIC = SectionTag("GB4M");
+size_t constexpr HEADER_SIZE = 8;
+// A cycle stamp and a joypad state
+size_t constexpr INPUT_SIZE = 9;
+
+InputMovie::InputMovie(u32 framesPerKeyframe) : framesPerKeyframe(std::max<u32>(framesPerKeyframe, 1)) {}
+
+InputMovie::~InputMovie() = default;
+InputMovie::InputMovie(InputMovie &&) = default;
+InputMovie & InputMovie::operator=(InputMovie &&) = default;
+
+void InputMovie::Clear()
+{
+    romHash = 0;
+    lastFrame = 0;
+    inputs.clear();
+    keyframes.clear();
+    isRecording = false;
+    lastJoypadState.reset();
+    matchedRomFile = nullptr;
+}
+
+void InputMovie::StartRecording(GbCpu & cpu)
+{
+    Clear();
+    RomFile const * romFile = cpu.GetCartridge()->GetRomFile();
+    romHash = romFile ? HashRomContent(romFile->GetData(), romFile->GetSize()) : 0;
+    matchedRomFile = romFile;
+    cpu.GetCartridge()->SetRtcClock(RtcClock::EMULATED);
+    isRecording = true;
+    AddKeyframe(cpu);
+    lastFrame = GetFirstFrame();
+    cpu.SetMovie(this, false);
+}
+
+void InputMovie::OnJoypadSampled(GbCpu const & cpu, u8 joypadState)
+{
+    if (!isRecording) {
+        return;
+    }
+    // Only changes are kept. Two samples on the same cycle are both kept, a keyframe may lie between them.
+    if (joypadState != lastJoypadState) {
+        inputs.push_back({cpu.GetState()->GetTotalCycles(), joypadState});
+        lastJoypadState = joypadState;
+    }
+    u64 frame = cpu.GetGpu()->GetFrameCount();
+    if (frame >= keyframes.back().frame + framesPerKeyframe) {
+        AddKeyframe(cpu);
+    }
+    lastFrame = frame;
+}
+
+void InputMovie::AddKeyframe(GbCpu const & cpu)
+{
+    SaveStateSerializer & stateSerializer = GetSerializer(cpu);
+    size_t size = stateSerializer.Save(cpu, scratch, SaveStateCompression::LZ4);
+    if (size == 0) {
+        logger->Errorf("Failed to save keyframe of frame=%zu", (size_t)cpu.GetGpu()->GetFrameCount());
+        return;
+    }
+    keyframes.push_back(
+        {cpu.GetGpu()->GetFrameCount(), (u32)inputs.size(), std::vector<u8>(scratch.begin(), scratch.begin() + size)});
+}
+
+SaveStateSerializer & InputMovie::GetSerializer(GbCpu const & cpu)
+{
+    if (!serializer) {
+        serializer = std::make_unique<SaveStateSerializer>(cpu);
+        scratch.resize(serializer->GetMaxStateSize());
+    }
+    return *serializer;
+}
+
+bool InputMovie::IsOfRom(GbCpu const & cpu)
+{
+    RomFile const * romFile = cpu.GetCartridge()->GetRomFile();
+    if (romFile == nullptr) {
+        return false;
+    }
+    if (romFile != matchedRomFile) {
+        if (HashRomContent(romFile->GetData(), romFile->GetSize()) != romHash) {
+            return false;
+        }
+        matchedRomFile = romFile;
+    }
+    return true;
+}
+
+bool InputMovie::Play(GbCpu & cpu, u64 frame)
+{
+    if (isRecording) {
+        Stop(cpu);
+    }
+    if (keyframes.empty() || frame < GetFirstFrame() || frame > lastFrame) {
+        logger->Errorf("Frame=%zu is outside of the movie, firstFrame=%zu, lastFrame=%zu", (size_t)frame,
+                       (size_t)GetFirstFrame(), (size_t)lastFrame);
+        return false;
+    }
+    if (!IsOfRom(cpu)) {
+        logger->Errorf("Movie was recorded on another ROM, romHash=%016llx", (unsigned long long)romHash);
+        return false;
+    }
+
+    // The newest keyframe at or before frame
+    auto keyframe = std::upper_bound(keyframes.begin(), keyframes.end(), frame,
+                                     [](u64 target, Keyframe const & other) { return target < other.frame; }) -
+                    1;
+    // With both clocks emulated the RTC is restored exactly
+    cpu.GetCartridge()->SetRtcClock(RtcClock::EMULATED);
+    if (!GetSerializer(cpu).Load(cpu, keyframe->state)) {
+        logger->Errorf("Failed to load keyframe of frame=%zu", (size_t)keyframe->frame);
+        cpu.SetMovie(nullptr, false);
+        return false;
+    }
+    cpu.SetMovie(this, true, keyframe->nextInput);
+    cpu.RunFrames((u32)(frame - keyframe->frame));
+    return true;
+}
+
+void InputMovie::Stop(GbCpu & cpu)
+{
+    if (isRecording) {
+        lastFrame = cpu.GetGpu()->GetFrameCount();
+        isRecording = false;
+    }
+    cpu.SetMovie(nullptr, false);
+}
+
+std::vector<u8> InputMovie::Serialize() const
+{
+    auto write = [this](StateWriter & writer) {
+        writer.Write(MOVIE_MAGIC);
+        writer.Write(MOVIE_VERSION);
+        writer.Write<u16>(0);
+
+        writer.BeginSection(SectionTag("MOVI"));
+        writer.Write(romHash);
+        writer.Write(framesPerKeyframe);
+        writer.Write(lastFrame);
+        writer.EndSection();
+
+        writer.BeginSection(SectionTag("INPT"));
+        writer.Write((u32)inputs.size());
+        for (MovieInput const & input : inputs) {
+            writer.Write(input.cycle);
+            writer.Write(input.joypadState);
+        }
+        writer.EndSection();
+
+        for (Keyframe const & keyframe : keyframes) {
+            writer.BeginSection(SectionTag("KEYF"));
+            writer.Write(keyframe.frame);
+            writer.Write(keyframe.nextInput);
+            writer.Write((u32)keyframe.state.size());
+            writer.WriteBytes(keyframe.state.data(), keyframe.state.size());
+            writer.EndSection();
+        }
+    };
+
+    StateWriter measure(nullptr, 0);
+    write(measure);
+    std::vector<u8> data(measure.GetSize());
+    StateWriter writer(data.data(), data.size());
+    write(writer);
+    return data;
+}
+
+bool InputMovie::Deserialize(std::span<u8 const> data)
+{
+    Clear();
+    StateReader header(data.data(), data.size(), MOVIE_VERSION);
+    u32 magic = header.Read<u32>();
+    u16 version = header.Read<u16>();
+    header.Read<u16>();
+    if (header.HasFailed() || magic != MOVIE_MAGIC) {
+        logger->Errorf("Not a movie, size=%zu", data.size());
+        return false;
+    }
+    if (version > MOVIE_VERSION) {
+        logger->Errorf("Movie version=%u is newer than supported version=%u", version, MOVIE_VERSION);
+        return false;
+    }
+
+    StateReader reader(data.data() + HEADER_SIZE, data.size() - HEADER_SIZE, version);
+    while (!reader.IsAtEnd()) {
+        u32 tag = reader.Read<u32>();
+        StateReader section = reader.ReadSubReader(reader.Read<u32>());
+        if (reader.HasFailed()) {
+            logger->Errorf("Movie is truncated");
+            Clear();
+            return false;
+        }
+
+        if (tag == SectionTag("MOVI")) {
+            section.Read(romHash);
+            framesPerKeyframe = std::max<u32>(section.Read<u32>(), 1);
+            section.Read(lastFrame);
+        } else if (tag == SectionTag("INPT")) {
+            u32 numInputs = section.Read<u32>();
+            // Fails on a bogus count before allocating for it
+            StateReader inputReader = section.ReadSubReader((size_t)numInputs * INPUT_SIZE);
+            if (!section.HasFailed()) {
+                inputs.resize(numInputs);
+                for (MovieInput & input : inputs) {
+                    inputReader.Read(input.cycle);
+                    inputReader.Read(input.joypadState);
+                }
+            }
+        } else if (tag == SectionTag("KEYF")) {
+            Keyframe keyframe;
+            section.Read(keyframe.frame);
+            section.Read(keyframe.nextInput);
+            u32 stateSize = section.Read<u32>();
+            StateReader stateReader = section.ReadSubReader(stateSize);
+            if (!section.HasFailed()) {
+                keyframe.state.resize(stateSize);
+                stateReader.ReadBytes(keyframe.state.data(), stateSize);
+                keyframes.push_back(std::move(keyframe));
+            }
+        } else {
+            // Written by a newer version, which also knows how to do without it
+            logger->Warnf("Skipping unknown movie section tag=%08x", tag);
+            continue;
+        }
+
+        if (section.HasFailed() || !section.IsAtEnd()) {
+            logger->Errorf("Malformed movie section tag=%08x", tag);
+            Clear();
+            return false;
+        }
+    }
+
+    bool isValid = !keyframes.empty() && keyframes.back().frame <= lastFrame;
+    for (size_t i = 0; i < keyframes.size() && isValid; ++i) {
+        isValid = keyframes[i].nextInput <= inputs.size() && (i == 0 || keyframes[i].frame > keyframes[i - 1].frame);
+    }
+    for (size_t i = 1; i < inputs.size() && isValid; ++i) {
+        isValid = inputs[i].cycle >= inputs[i - 1].cycle;
+    }
+    if (!isValid) {
+        logger->Errorf("Movie has no keyframes, or keyframes or inputs out of order");
+        Clear();
+        return false;
+    }
+    return true;
+}
+
+bool InputMovie::SaveToFile(std::string const & filename) const
+{
+    std::vector<u8> data = Serialize();
+    std::ofstream outStream(filename, std::ios::binary | std::ios::trunc);
+    outStream.write((char const *)data.data(), data.size());
+    if (!outStream) {
+        logger->Errorf("Failed to write movie to filename=%s", filename.c_str());
+        return false;
+    }
+    logger->Infof("Saved movie filename=%s, frames=%zu, inputs=%zu, keyframes=%zu", filename.c_str(),
+                  (size_t)(lastFrame - GetFirstFrame()), inputs.size(), keyframes.size());
+    return true;
+}
+
+bool InputMovie::LoadFromFile(std::string const & filename)
+{
+    auto file = SlurpFile(filename);
+    if (!file.has_value()) {
+        return false;
+    }
+    return Deserialize(std::span<u8 const>(file->arr.get(), file->size));
+}
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+class GbCpu;
+class RomFile;
+class SaveStateSerializer;
+
+// Version written into new movies. Loading accepts this and every older version.
+u16 constexpr MOVIE_VERSION = 1;
+
+u32 constexpr DEFAULT_FRAMES_PER_KEYFRAME = 60;
+
+// The joypad, in the layout of InputSystem::GetJoypadState, from the start of cycle on
+struct MovieInput {
+    u64 cycle;
+    u8 joypadState;
+};
+
+/**
+ * A reproducible run of a ROM: the state it starts from and every change of the joypad, stamped with the emulated
+ * cycle the CPU sampled it on. Playing applies every change on the same cycle again, so a replay is identical to the
+ * recording however the host paced the frames while recording.
+ *
+ * Every framesPerKeyframe frames the recording adds a keyframe, an LZ4 compressed save state and the index of the
+ * input after it. Seeking restores the newest keyframe at or before the target frame and emulates from there, which
+ * takes as long as emulating framesPerKeyframe frames at most, however long the movie is. The GbCpu only samples the
+ * joypad once per Tick or RunFrames call, a keyframe is added at the first sample after the interval.
+ *
+ * The file is a header of the magic "GB4M", the version and flags, followed by tagged sections: MOVI with the hash of
+ * the ROM image, the interval and the last frame, INPT with the inputs and a KEYF per keyframe. A movie only plays on
+ * the ROM it was recorded on.
+ *
+ * The cartridge RTC is switched to emulated time while recording and playing, wall time would make every run differ.
+ * Only the joypad is recorded, resetting, rewinding or loading a state while recording breaks the movie.
+ */
+class InputMovie
+{
+public:
+    explicit InputMovie(u32 framesPerKeyframe = DEFAULT_FRAMES_PER_KEYFRAME);
+    ~InputMovie();
+    InputMovie(InputMovie &&);
+    InputMovie & operator=(InputMovie &&);
+
+    // Discards the movie and records cpu from its current state on, until Stop
+    void StartRecording(GbCpu & cpu);
+
+    /**
+     * Seeks cpu to the end of frame, a GPU frame count between GetFirstFrame and GetLastFrame, and plays the movie
+     * from there on until Stop. Returns false if cpu runs another ROM or frame is outside the movie. Seeking again
+     * while playing is fine.
+     */
+    bool Play(GbCpu & cpu, u64 frame);
+
+    // Hands the joypad of cpu back to its input system. Stopping a recording ends the movie at the current frame.
+    void Stop(GbCpu & cpu);
+
+    // Called by the GbCpu being recorded with every joypad state it samples, after applying it
+    void OnJoypadSampled(GbCpu const & cpu, u8 joypadState);
+
+    std::vector<u8> Serialize() const;
+    // Returns false, leaving the movie empty, if data is not a valid movie or is of a newer version
+    bool Deserialize(std::span<u8 const> data);
+
+    bool SaveToFile(std::string const & filename) const;
+    bool LoadFromFile(std::string const & filename);
+
+    u64 GetRomHash() const { return romHash; }
+    u32 GetFramesPerKeyframe() const { return framesPerKeyframe; }
+    // The frame the movie starts from, and the last one recorded. Both are 0 for an empty movie.
+    u64 GetFirstFrame() const { return keyframes.empty() ? 0 : keyframes.front().frame; }
+    u64 GetLastFrame() const { return lastFrame; }
+    std::vector<MovieInput> const & GetInputs() const { return inputs; }
+    size_t GetKeyframeCount() const { return keyframes.size(); }
+
+private:
+    struct Keyframe {
+        u64 frame;
+        // Index of the first input after the state
+        u32 nextInput;
+        std::vector<u8> state;
+    };
+
+    void AddKeyframe(GbCpu const & cpu);
+    // Returns false if cpu does not run the ROM of the movie
+    bool IsOfRom(GbCpu const & cpu);
+    // The serializer is sized for the first instance it is used with
+    SaveStateSerializer & GetSerializer(GbCpu const & cpu);
+    void Clear();
+
+    u32 framesPerKeyframe;
+    u64 romHash = 0;
+    u64 lastFrame = 0;
+    std::vector<MovieInput> inputs;
+    std::vector<Keyframe> keyframes;
+
+    bool isRecording = false;
+    std::optional<u8> lastJoypadState;
+
+    std::unique_ptr<SaveStateSerializer> serializer;
+    std::vector<u8> scratch;
+    // Hashing the ROM takes a while, so the image last found to match is remembered
+    RomFile const * matchedRomFile = nullptr;
+};
+};
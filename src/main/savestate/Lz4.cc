@@ -0,0 +1,188 @@
+#include "Lz4.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace gb4e
+{
+size_t constexpr MIN_MATCH = 4;
+// The block format requires the last match to start at least 12 bytes before the end, and the last 5 bytes to be
+// literals
+size_t constexpr MATCH_FIND_LIMIT = 12;
+size_t constexpr LAST_LITERALS = 5;
+size_t constexpr MAX_OFFSET = 0xFFFF;
+u32 constexpr HASH_BITS = 12;
+
+static u32 Read32(u8 const * p)
+{
+    u32 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static u32 Hash(u32 sequence)
+{
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Lengths of 15 or more continue in extra bytes of 255 each, ending with a byte < 255
+static bool WriteLengthExtension(size_t length, u8 *& op, u8 const * end)
+{
+    for (; length >= 255; length -= 255) {
+        if (op == end) {
+            return false;
+        }
+        *op++ = 255;
+    }
+    if (op == end) {
+        return false;
+    }
+    *op++ = (u8)length;
+    return true;
+}
+
+static bool WriteSequence(u8 const * literals, size_t literalLength, size_t offset, size_t matchLength, u8 *& op,
+                          u8 const * end)
+{
+    if (op == end) {
+        return false;
+    }
+    u8 * token = op++;
+    *token = (u8)(std::min<size_t>(literalLength, 15) << 4);
+    if (literalLength >= 15 && !WriteLengthExtension(literalLength - 15, op, end)) {
+        return false;
+    }
+    if ((size_t)(end - op) < literalLength) {
+        return false;
+    }
+    memcpy(op, literals, literalLength);
+    op += literalLength;
+    // The last sequence is literals only
+    if (matchLength == 0) {
+        return true;
+    }
+
+    if (end - op < 2) {
+        return false;
+    }
+    *op++ = (u8)offset;
+    *op++ = (u8)(offset >> 8);
+    size_t extraLength = matchLength - MIN_MATCH;
+    *token |= (u8)std::min<size_t>(extraLength, 15);
+    return extraLength < 15 || WriteLengthExtension(extraLength - 15, op, end);
+}
+
+size_t Lz4Compress(u8 const * src, size_t srcSize, u8 * dst, size_t dstCapacity)
+{
+    u8 * op = dst;
+    u8 const * end = dst + dstCapacity;
+    size_t anchor = 0;
+
+    if (srcSize > MATCH_FIND_LIMIT) {
+        // Positions of the last sequence with each hash. 0 doubles as empty, position 0 is never a match source
+        // worth finding.
+        std::array<u32, 1 << HASH_BITS> table{};
+        size_t matchLimit = srcSize - LAST_LITERALS;
+        size_t ip = 1;
+        while (ip < srcSize - MATCH_FIND_LIMIT) {
+            u32 sequence = Read32(src + ip);
+            u32 hash = Hash(sequence);
+            size_t ref = table[hash];
+            table[hash] = (u32)ip;
+            if (ref == 0 || ip - ref > MAX_OFFSET || Read32(src + ref) != sequence) {
+                // Step faster through data which does not compress
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            // Extend backwards over literals which also match
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                --ip;
+                --ref;
+            }
+            size_t matchLength = MIN_MATCH;
+            while (ip + matchLength < matchLimit && src[ip + matchLength] == src[ref + matchLength]) {
+                ++matchLength;
+            }
+            if (!WriteSequence(src + anchor, ip - anchor, ip - ref, matchLength, op, end)) {
+                return 0;
+            }
+            ip += matchLength;
+            anchor = ip;
+            if (ip < srcSize - MATCH_FIND_LIMIT) {
+                // Keep matches found inside the match findable
+                table[Hash(Read32(src + ip - 2))] = (u32)(ip - 2);
+            }
+        }
+    }
+
+    if (!WriteSequence(src + anchor, srcSize - anchor, 0, 0, op, end)) {
+        return 0;
+    }
+    return op - dst;
+}
+
+static bool ReadLengthExtension(size_t & length, u8 const *& ip, u8 const * end)
+{
+    u8 byte;
+    do {
+        if (ip == end) {
+            return false;
+        }
+        byte = *ip++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool Lz4Decompress(u8 const * src, size_t srcSize, u8 * dst, size_t dstSize)
+{
+    u8 const * ip = src;
+    u8 const * srcEnd = src + srcSize;
+    u8 * op = dst;
+    u8 * dstEnd = dst + dstSize;
+
+    while (ip < srcEnd) {
+        u8 token = *ip++;
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !ReadLengthExtension(literalLength, ip, srcEnd)) {
+            return false;
+        }
+        if ((size_t)(srcEnd - ip) < literalLength || (size_t)(dstEnd - op) < literalLength) {
+            return false;
+        }
+        memcpy(op, ip, literalLength);
+        ip += literalLength;
+        op += literalLength;
+        if (ip == srcEnd) {
+            break;
+        }
+
+        if (srcEnd - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t matchLength = token & 0x0F;
+        if (matchLength == 15 && !ReadLengthExtension(matchLength, ip, srcEnd)) {
+            return false;
+        }
+        matchLength += MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - dst) || (size_t)(dstEnd - op) < matchLength) {
+            return false;
+        }
+        u8 const * match = op - offset;
+        if (offset >= matchLength) {
+            memcpy(op, match, matchLength);
+            op += matchLength;
+        } else {
+            // Overlapping copies repeat the last offset bytes
+            for (size_t i = 0; i < matchLength; ++i) {
+                *op++ = match[i];
+            }
+        }
+    }
+    return op == dstEnd;
+}
+};
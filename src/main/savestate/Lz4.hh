@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Common.hh"
+
+namespace gb4e
+{
+/**
+ * Compression in the LZ4 block format: a fast compressor which finds matches through a small hash table, and a
+ * decompressor which is little more than memcpy. Emulator state is mostly zeros and repeated tiles, which this
+ * compresses well at several hundred MB/s.
+ */
+
+// Largest possible size of compressing size bytes, for incompressible input
+constexpr size_t Lz4CompressBound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+// Returns the compressed size, or 0 if the output does not fit in dstCapacity
+size_t Lz4Compress(u8 const * src, size_t srcSize, u8 * dst, size_t dstCapacity);
+
+// Returns false if src is malformed or does not decompress to exactly dstSize bytes
+bool Lz4Decompress(u8 const * src, size_t srcSize, u8 * dst, size_t dstSize);
+};
@@ -0,0 +1,208 @@
+#include "RewindBuffer.hh"
+
+#include <algorithm>
+#include <cstring>
+
+#include "GbCpu.hh"
+#include "logging/Logger.hh"
+
+static auto const logger = Logger::Create("RewindBuffer");
+
+namespace gb4e
+{
+// Unchanged runs shorter than this cost less to store as changed bytes than to skip
+size_t constexpr MIN_SKIP = 4;
+
+// Largest encoding of a size byte delta, when every token has the shortest unchanged run
+static size_t EncodedSizeBound(size_t size)
+{
+    return size + size / 2 + 32;
+}
+
+static u8 * WriteVarint(u8 * out, size_t value)
+{
+    while (value >= 0x80) {
+        *out++ = (u8)value | 0x80;
+        value >>= 7;
+    }
+    *out++ = (u8)value;
+    return out;
+}
+
+static size_t ReadVarint(u8 const *& in)
+{
+    size_t value = 0;
+    for (u32 shift = 0;; shift += 7) {
+        u8 byte = *in++;
+        value |= (size_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
+/**
+ * Encodes the XOR of older and newer as pairs of the length of a run of unchanged bytes and the length of a run of
+ * changed bytes, both as varints, followed by the XOR of the changed bytes. Unchanged bytes at the end are left out.
+ */
+static size_t EncodeXorDelta(u8 const * older, u8 const * newer, size_t size, u8 * out)
+{
+    u8 * op = out;
+    size_t pos = 0;
+    while (pos < size) {
+        size_t unchangedStart = pos;
+        while (pos < size && older[pos] == newer[pos]) {
+            ++pos;
+        }
+        if (pos == size) {
+            break;
+        }
+        size_t changedStart = pos;
+        size_t changedEnd = pos;
+        while (pos < size) {
+            if (older[pos] != newer[pos]) {
+                changedEnd = ++pos;
+                continue;
+            }
+            size_t runEnd = pos;
+            while (runEnd < size && runEnd - pos < MIN_SKIP && older[runEnd] == newer[runEnd]) {
+                ++runEnd;
+            }
+            if (runEnd - pos >= MIN_SKIP || runEnd == size) {
+                break;
+            }
+            pos = runEnd;
+        }
+        pos = changedEnd;
+
+        op = WriteVarint(op, changedStart - unchangedStart);
+        op = WriteVarint(op, changedEnd - changedStart);
+        for (size_t i = changedStart; i < changedEnd; ++i) {
+            *op++ = older[i] ^ newer[i];
+        }
+    }
+    return op - out;
+}
+
+// XORs state with a delta written by EncodeXorDelta, which turns either side of the delta into the other
+static void ApplyXorDelta(u8 const * in, size_t size, u8 * state)
+{
+    u8 const * end = in + size;
+    size_t pos = 0;
+    while (in < end) {
+        pos += ReadVarint(in);
+        size_t length = ReadVarint(in);
+        for (size_t i = 0; i < length; ++i) {
+            state[pos + i] ^= in[i];
+        }
+        in += length;
+        pos += length;
+    }
+}
+
+RewindBuffer::RewindBuffer(size_t memoryBudget, u32 framesPerSnapshot)
+    : framesPerSnapshot(std::max<u32>(framesPerSnapshot, 1)), storage(memoryBudget)
+{
+}
+
+void RewindBuffer::Update(GbCpu const & cpu)
+{
+    u64 frame = cpu.GetGpu()->GetFrameCount();
+    if (hasNewest && frame < newestFrame) {
+        // Reset, or a state from elsewhere was loaded
+        Clear();
+    }
+    if (hasNewest && frame < newestFrame + framesPerSnapshot) {
+        return;
+    }
+
+    cpu.TakeSnapshot(next);
+    if (hasNewest) {
+        size_t newestSize = newest.GetSize();
+        size_t nextSize = next.GetSize();
+        // The sizes only differ by the queued instruction, the shorter one is padded with zeros
+        size_t size = std::max(newestSize, nextSize);
+        newest.Resize(size);
+        next.Resize(size);
+        if (encoded.size() < EncodedSizeBound(size)) {
+            encoded.resize(EncodedSizeBound(size));
+        }
+        size_t encodedSize = EncodeXorDelta(newest.GetData(), next.GetData(), size, encoded.data());
+        newest.Resize(newestSize);
+        next.Resize(nextSize);
+
+        if (encodedSize <= storage.size()) {
+            size_t offset = Allocate(encodedSize);
+            memcpy(storage.data() + offset, encoded.data(), encodedSize);
+            deltas.push_back({newestFrame, offset, encodedSize, newestSize});
+        } else {
+            // Older snapshots cannot be reached without this delta
+            logger->Warnf("Delta of encodedSize=%zu does not fit memoryBudget=%zu", encodedSize, storage.size());
+            deltas.clear();
+            head = 0;
+        }
+    }
+    std::swap(newest, next);
+    newestFrame = frame;
+    hasNewest = true;
+}
+
+bool RewindBuffer::RewindTo(GbCpu & cpu, u64 frame)
+{
+    if (!hasNewest || frame < GetOldestFrame() || frame > cpu.GetGpu()->GetFrameCount()) {
+        return false;
+    }
+    while (newestFrame > frame) {
+        Delta const & delta = deltas.back();
+        size_t size = std::max(newest.GetSize(), delta.stateSize);
+        newest.Resize(size);
+        ApplyXorDelta(storage.data() + delta.offset, delta.encodedSize, newest.GetData());
+        newest.Resize(delta.stateSize);
+        newestFrame = delta.frame;
+        head = delta.offset;
+        deltas.pop_back();
+    }
+    if (!cpu.RestoreFrom(newest)) {
+        logger->Errorf("Failed to restore snapshot of frame=%zu", (size_t)newestFrame);
+        Clear();
+        return false;
+    }
+    cpu.RunFrames((u32)(frame - newestFrame));
+    return true;
+}
+
+size_t RewindBuffer::GetDeltaSize() const
+{
+    size_t size = 0;
+    for (Delta const & delta : deltas) {
+        size += delta.encodedSize;
+    }
+    return size;
+}
+
+void RewindBuffer::Clear()
+{
+    deltas.clear();
+    head = 0;
+    hasNewest = false;
+    newestFrame = 0;
+}
+
+size_t RewindBuffer::Allocate(size_t encodedSize)
+{
+    // Deltas are stored in the order they are taken, so the oldest delta is always the next one after head
+    if (head + encodedSize > storage.size()) {
+        // Deltas between head and the end are the oldest, they are dropped before wrapping around
+        while (!deltas.empty() && deltas.front().offset >= head) {
+            deltas.pop_front();
+        }
+        head = 0;
+    }
+    while (!deltas.empty() && deltas.front().offset >= head && deltas.front().offset < head + encodedSize) {
+        deltas.pop_front();
+    }
+    size_t offset = head;
+    head += encodedSize;
+    return offset;
+}
+};
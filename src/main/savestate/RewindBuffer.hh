@@ -0,0 +1,75 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "Common.hh"
+#include "savestate/Snapshot.hh"
+
+namespace gb4e
+{
+class GbCpu;
+
+/**
+ * History of a running GbCpu which it can be rewound through, frame by frame.
+ *
+ * Every framesPerSnapshot frames a snapshot is taken. The newest snapshot is kept whole, every older one only as the
+ * XOR of it and the snapshot after it, run-length encoded. Consecutive states differ in a few hundred bytes, so the
+ * deltas are small. They are stored in one ring buffer of memoryBudget bytes, the oldest are dropped when it is full.
+ * Rewinding undoes deltas from the newest snapshot back to the one at or before the target frame, then emulates
+ * forward to the target frame.
+ *
+ * Frames between snapshots are emulated again with the buttons held at the time of rewinding, with one snapshot per
+ * frame rewinding is exact.
+ */
+class RewindBuffer
+{
+public:
+    RewindBuffer(size_t memoryBudget, u32 framesPerSnapshot);
+
+    // Takes a snapshot if framesPerSnapshot frames have passed since the last one. Cheap to call more often.
+    void Update(GbCpu const & cpu);
+
+    /**
+     * Rewinds cpu to the end of frame, a GPU frame count between GetOldestFrame and the current frame. History after
+     * frame is dropped. Returns false, leaving cpu as it was, if frame is outside the history.
+     */
+    bool RewindTo(GbCpu & cpu, u64 frame);
+
+    // Frame of the oldest snapshot, or 0 if nothing has been recorded yet
+    u64 GetOldestFrame() const { return deltas.empty() ? newestFrame : deltas.front().frame; }
+
+    size_t GetSnapshotCount() const { return deltas.size() + (hasNewest ? 1 : 0); }
+
+    // Bytes used by the encoded deltas, at most memoryBudget
+    size_t GetDeltaSize() const;
+
+    void Clear();
+
+private:
+    struct Delta {
+        u64 frame;
+        // Where the encoded delta is in storage
+        size_t offset;
+        size_t encodedSize;
+        // Size of the snapshot of frame, which the delta turns the next newer snapshot into
+        size_t stateSize;
+    };
+
+    // Returns the offset of encodedSize free bytes in storage, dropping the oldest deltas to make room
+    size_t Allocate(size_t encodedSize);
+
+    u32 framesPerSnapshot;
+    std::vector<u8> storage;
+    // Where the next delta is written in storage
+    size_t head = 0;
+    std::deque<Delta> deltas;
+
+    bool hasNewest = false;
+    u64 newestFrame = 0;
+    Snapshot newest;
+    // The snapshot being taken, swapped with newest once its delta is stored
+    Snapshot next;
+    std::vector<u8> encoded;
+};
+};
@@ -0,0 +1,103 @@
+#include "SaveState.hh"
+
+#include <algorithm>
+
+#include "GbCpu.hh"
+#include "logging/Logger.hh"
+#include "savestate/Lz4.hh"
+#include "savestate/StateStream.hh"
+
+static auto const logger = Logger::Create("SaveState");
+
+namespace gb4e
+{
+u32 constexpr SAVE_STATE_MAGIC = SectionTag("GB4S");
+size_t constexpr HEADER_SIZE = 16;
+u16 constexpr FLAG_LZ4 = 1 << 0;
+// Only the queued instruction varies in size, by a few dozen bytes at most
+size_t constexpr PAYLOAD_SLACK = 256;
+
+SaveStateSerializer::SaveStateSerializer(GbCpu const & cpu)
+{
+    StateWriter measure(nullptr, 0);
+    cpu.SaveState(measure);
+    maxPayloadSize = measure.GetSize() + PAYLOAD_SLACK;
+    scratch = std::make_unique<u8[]>(maxPayloadSize);
+}
+
+size_t SaveStateSerializer::GetMaxStateSize() const
+{
+    return HEADER_SIZE + std::max(maxPayloadSize, Lz4CompressBound(maxPayloadSize));
+}
+
+size_t SaveStateSerializer::Save(GbCpu const & cpu, std::span<u8> out, SaveStateCompression compression)
+{
+    if (out.size() < HEADER_SIZE) {
+        return 0;
+    }
+    bool isCompressed = compression == SaveStateCompression::LZ4;
+    // Uncompressed states are written straight into out, compressed ones are compressed from scratch into out
+    u8 * payload = isCompressed ? scratch.get() : out.data() + HEADER_SIZE;
+    size_t payloadCapacity = isCompressed ? maxPayloadSize : out.size() - HEADER_SIZE;
+    StateWriter payloadWriter(payload, payloadCapacity);
+    cpu.SaveState(payloadWriter);
+    if (payloadWriter.HasOverflowed()) {
+        logger->Errorf("State of size=%zu does not fit capacity=%zu", payloadWriter.GetSize(), payloadCapacity);
+        return 0;
+    }
+    size_t payloadSize = payloadWriter.GetSize();
+    size_t storedSize = payloadSize;
+    if (isCompressed) {
+        storedSize = Lz4Compress(payload, payloadSize, out.data() + HEADER_SIZE, out.size() - HEADER_SIZE);
+        if (storedSize == 0) {
+            logger->Errorf("Compressed state does not fit capacity=%zu", out.size());
+            return 0;
+        }
+    }
+
+    StateWriter header(out.data(), HEADER_SIZE);
+    header.Write(SAVE_STATE_MAGIC);
+    header.Write(SAVE_STATE_VERSION);
+    header.Write<u16>(isCompressed ? FLAG_LZ4 : 0);
+    header.Write((u32)payloadSize);
+    header.Write((u32)storedSize);
+    return HEADER_SIZE + storedSize;
+}
+
+bool SaveStateSerializer::Load(GbCpu & cpu, std::span<u8 const> state)
+{
+    StateReader header(state.data(), std::min(state.size(), HEADER_SIZE), 0);
+    u32 magic = header.Read<u32>();
+    u16 version = header.Read<u16>();
+    u16 flags = header.Read<u16>();
+    u32 payloadSize = header.Read<u32>();
+    u32 storedSize = header.Read<u32>();
+    if (header.HasFailed() || magic != SAVE_STATE_MAGIC) {
+        logger->Errorf("Not a save state, size=%zu", state.size());
+        return false;
+    }
+    if (version > SAVE_STATE_VERSION) {
+        logger->Errorf("Save state version=%u is newer than supported version=%u", version, SAVE_STATE_VERSION);
+        return false;
+    }
+    if (storedSize > state.size() - HEADER_SIZE) {
+        logger->Errorf("Save state is truncated, storedSize=%u, size=%zu", storedSize, state.size());
+        return false;
+    }
+
+    u8 const * payload = state.data() + HEADER_SIZE;
+    if (flags & FLAG_LZ4) {
+        if (payloadSize > maxPayloadSize || !Lz4Decompress(payload, storedSize, scratch.get(), payloadSize)) {
+            logger->Errorf("Failed to decompress save state, payloadSize=%u", payloadSize);
+            return false;
+        }
+        payload = scratch.get();
+    } else if (payloadSize != storedSize) {
+        logger->Errorf("Uncompressed save state has payloadSize=%u != storedSize=%u", payloadSize, storedSize);
+        return false;
+    }
+
+    StateReader reader(payload, payloadSize, version);
+    return cpu.LoadState(reader);
+}
+};
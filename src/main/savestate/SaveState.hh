@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <span>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+class GbCpu;
+
+// Version written into new states. Loading accepts this and every older version.
+u16 constexpr SAVE_STATE_VERSION = 1;
+
+enum class SaveStateCompression {
+    NONE,
+    LZ4,
+};
+
+/**
+ * Saves and loads the whole emulator state in a versioned binary format: a 16 byte header of the magic "GB4S", the
+ * version, flags, and the uncompressed and stored payload sizes, followed by the payload. The payload is a list of
+ * tagged, length-prefixed sections written by GbCpu::SaveState, optionally LZ4 compressed.
+ *
+ * The serializer owns the scratch buffer compression needs, so that saving and loading do not allocate. One
+ * serializer can be shared by every instance running the same ROM.
+ */
+class SaveStateSerializer
+{
+public:
+    explicit SaveStateSerializer(GbCpu const & cpu);
+
+    // Size of a buffer which fits any state of cpu, with or without compression
+    size_t GetMaxStateSize() const;
+
+    // Returns the size of the state written to out, or 0 if out is too small
+    size_t Save(GbCpu const & cpu, std::span<u8> out, SaveStateCompression compression);
+
+    /**
+     * Returns false if state is not a valid save state, is of a newer version or of another ROM. cpu is unchanged if
+     * the header is rejected, but may be partially loaded if a section is malformed.
+     */
+    bool Load(GbCpu & cpu, std::span<u8 const> state);
+
+private:
+    size_t maxPayloadSize;
+    std::unique_ptr<u8[]> scratch;
+};
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+/**
+ * The full state of a GbCpu, uncompressed and without the save state header, see GbCpu::TakeSnapshot. A snapshot only
+ * allocates the first time it is taken, or if a later state is larger, so reusing snapshots is cheap.
+ */
+class Snapshot
+{
+public:
+    u8 const * GetData() const { return data.data(); }
+    u8 * GetData() { return data.data(); }
+    size_t GetSize() const { return size; }
+
+    // Bytes past the current size read as zero after growing, shrinking keeps the memory
+    void Resize(size_t newSize)
+    {
+        if (newSize > data.size()) {
+            data.resize(newSize);
+        }
+        if (newSize > size) {
+            memset(data.data() + size, 0, newSize - size);
+        }
+        size = newSize;
+    }
+
+private:
+    friend class GbCpu;
+
+    std::vector<u8> data;
+    size_t size = 0;
+};
+};
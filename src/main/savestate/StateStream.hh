@@ -0,0 +1,164 @@
+#pragma once
+
+#include <bit>
+#include <cstring>
+#include <type_traits>
+
+#include "Common.hh"
+
+namespace gb4e
+{
+// Section tags are four ASCII characters, stored little-endian so they read as text in a hex dump
+constexpr u32 SectionTag(char const (&tag)[5])
+{
+    return (u32)(u8)tag[0] | ((u32)(u8)tag[1] << 8) | ((u32)(u8)tag[2] << 16) | ((u32)(u8)tag[3] << 24);
+}
+
+/**
+ * Writes little-endian values into a caller provided buffer and never allocates.
+ *
+ * Writing past the end of the buffer is not an error while writing, the position keeps advancing so that a writer
+ * without a buffer can be used to measure how large a state is. HasOverflowed tells whether everything fit.
+ */
+class StateWriter
+{
+public:
+    StateWriter(u8 * out, size_t capacity) : out(out), capacity(capacity) {}
+
+    // bool, enums, integers and floats, all stored with their own size
+    template <typename T>
+    void Write(T value)
+    {
+        if constexpr (std::is_same_v<T, bool>) {
+            Write<u8>(value ? 1 : 0);
+        } else if constexpr (std::is_enum_v<T>) {
+            Write((std::underlying_type_t<T>)value);
+        } else if constexpr (std::is_same_v<T, float>) {
+            Write(std::bit_cast<u32>(value));
+        } else {
+            static_assert(std::is_integral_v<T>, "Only bool, enums, integers and floats can be written");
+            if constexpr (std::endian::native == std::endian::big) {
+                value = std::byteswap(value);
+            }
+            WriteBytes(&value, sizeof(T));
+        }
+    }
+
+    void WriteBytes(void const * data, size_t size)
+    {
+        if (pos + size <= capacity) {
+            memcpy(out + pos, data, size);
+        }
+        pos += size;
+    }
+
+    // Starts a section of a tag and a u32 length, EndSection fills in the length. Sections do not nest.
+    void BeginSection(u32 tag)
+    {
+        Write(tag);
+        sectionStart = pos;
+        Write<u32>(0);
+    }
+
+    void EndSection()
+    {
+        u32 length = (u32)(pos - sectionStart - sizeof(u32));
+        if (sectionStart + sizeof(u32) <= capacity) {
+            if constexpr (std::endian::native == std::endian::big) {
+                length = std::byteswap(length);
+            }
+            memcpy(out + sectionStart, &length, sizeof(u32));
+        }
+    }
+
+    size_t GetSize() const { return pos; }
+
+    bool HasOverflowed() const { return pos > capacity; }
+
+private:
+    u8 * out;
+    size_t capacity;
+    size_t pos = 0;
+    size_t sectionStart = 0;
+};
+
+/**
+ * Reads what a StateWriter wrote. Reading past the end returns zeros and marks the reader as failed, so loaders can
+ * read a whole section and check HasFailed once at the end.
+ */
+class StateReader
+{
+public:
+    StateReader(u8 const * in, size_t size, u16 version) : in(in), size(size), version(version) {}
+
+    template <typename T>
+    T Read()
+    {
+        if constexpr (std::is_same_v<T, bool>) {
+            return Read<u8>() != 0;
+        } else if constexpr (std::is_enum_v<T>) {
+            return (T)Read<std::underlying_type_t<T>>();
+        } else if constexpr (std::is_same_v<T, float>) {
+            return std::bit_cast<float>(Read<u32>());
+        } else {
+            static_assert(std::is_integral_v<T>, "Only bool, enums, integers and floats can be read");
+            T value{};
+            ReadBytes(&value, sizeof(T));
+            if constexpr (std::endian::native == std::endian::big) {
+                value = std::byteswap(value);
+            }
+            return value;
+        }
+    }
+
+    template <typename T>
+    void Read(T & value)
+    {
+        value = Read<T>();
+    }
+
+    void ReadBytes(void * data, size_t count)
+    {
+        if (hasFailed || count > size - pos) {
+            hasFailed = true;
+            memset(data, 0, count);
+            return;
+        }
+        memcpy(data, in + pos, count);
+        pos += count;
+    }
+
+    // Returns a reader over the next count bytes and skips them in this reader
+    StateReader ReadSubReader(size_t count)
+    {
+        if (hasFailed || count > size - pos) {
+            hasFailed = true;
+            return StateReader(nullptr, 0, version, true);
+        }
+        StateReader subReader(in + pos, count, version);
+        pos += count;
+        return subReader;
+    }
+
+    void Fail() { hasFailed = true; }
+
+    bool HasFailed() const { return hasFailed; }
+
+    bool IsAtEnd() const { return pos == size; }
+
+    // Format version of the state being read, for loaders which need to handle older layouts
+    u16 GetVersion() const { return version; }
+
+private:
+    StateReader(u8 const * in, size_t size, u16 version, bool hasFailed)
+        : in(in), size(size), version(version), hasFailed(hasFailed)
+    {
+    }
+
+    u8 const * in;
+    size_t size;
+    size_t pos = 0;
+    u16 version;
+    bool hasFailed = false;
+};
+};
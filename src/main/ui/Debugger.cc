@@ -1,10 +1,8 @@
 #include "Debugger.hh"
 
-#include <set>
-
 #include <imgui.h>
 
-#include "GbCpu.hh"
+#include "EmulationThread.hh"
 #include "UiCommon.hh"
 #include "logging/Logger.hh"
 
@@ -22,37 +20,45 @@ char breakpointBuf[BREAKPOINT_BUF_SIZE];
 
 char memoryBreakpointBuf[BREAKPOINT_BUF_SIZE];
 
-void DrawDebugger(GbCpu * cpu)
+void DrawDebugger(EmulationThread * emulationThread, EmulatorSnapshot const & snapshot)
 {
     if (!showDebugger) {
         return;
     }
     if (ImGui::Begin("Debugger")) {
-        auto regPc = GetRegister(RegisterName::PC);
-        auto const & breakpoints = cpu->GetBreakpoints();
-        if (breakpoints.find(cpu->GetState()->Get16BitRegisterValue(regPc)) != breakpoints.end()) {
-            isRunning = false;
-        }
-
-        if (isRunning) {
+        if (snapshot.isRunning) {
             if (ImGui::Button("Break")) {
-                isRunning = false;
+                emulationThread->PushCommand({EmulatorCommandType::BREAK});
             }
         } else {
             if (ImGui::Button("Run")) {
-                isRunning = true;
+                emulationThread->PushCommand({EmulatorCommandType::RUN});
             }
             if (ImGui::Button("Reset")) {
-                cpu->Reset();
+                emulationThread->PushCommand({EmulatorCommandType::RESET});
             }
         }
 
+        if (ImGui::Button("Rewind 1s")) {
+            emulationThread->PushCommand({EmulatorCommandType::REWIND, (u32)(1000000000.0 / FRAME_REAL_DURATION_NS)});
+        }
+        ImGui::SameLine();
+        ImGui::Text("%.1fs of history", snapshot.rewindableFrames * FRAME_REAL_DURATION_NS / 1000000000.0);
+
         if (ImGui::Checkbox("Break on decode error", &breakOnDecodeError)) {
-            cpu->SetBreakOnDecodeError(breakOnDecodeError);
+            emulationThread->PushCommand({EmulatorCommandType::SET_BREAK_ON_DECODE_ERROR, breakOnDecodeError});
         }
 
+        if (ImGui::Button("Step back")) {
+            emulationThread->PushCommand({EmulatorCommandType::STEP_BACK});
+        }
+        ImGui::SameLine();
         if (ImGui::Button("Step fwd")) {
-            cpu->StepInstruction();
+            emulationThread->PushCommand({EmulatorCommandType::STEP});
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Continue back")) {
+            emulationThread->PushCommand({EmulatorCommandType::CONTINUE_BACK});
         }
 
         ImGui::InputText("Breakpoint", breakpointBuf, BREAKPOINT_BUF_SIZE);
@@ -61,47 +67,37 @@ void DrawDebugger(GbCpu * cpu)
             std::string breakpointString(breakpointBuf);
             if (!breakpointString.empty()) {
                 u16 breakpoint = std::stoi(breakpointString, nullptr, 16);
-                cpu->AddBreakpoint(breakpoint);
+                emulationThread->PushCommand({EmulatorCommandType::ADD_BREAKPOINT, breakpoint});
                 breakpointBuf[0] = '\0';
             }
         }
 
-        std::set<u16> removed;
-        for (auto const breakpoint : cpu->GetBreakpoints()) {
+        for (auto const breakpoint : snapshot.breakpoints) {
             ImGui::Text("%04x", breakpoint);
             ImGui::SameLine();
             if (ImGui::SmallButton("Remove")) {
-                removed.emplace(breakpoint);
+                emulationThread->PushCommand({EmulatorCommandType::REMOVE_BREAKPOINT, breakpoint});
             }
         }
 
-        for (auto const breakpoint : removed) {
-            cpu->RemoveBreakpoint(breakpoint);
-        }
-
         ImGui::InputText("Memory Breakpoint", memoryBreakpointBuf, BREAKPOINT_BUF_SIZE);
         ImGui::SameLine();
         if (ImGui::Button("Add Memory Breakpoint")) {
             std::string breakpointString(memoryBreakpointBuf);
             if (!breakpointString.empty()) {
                 u16 memoryBreakpoint = std::stoi(breakpointString, nullptr, 16);
-                cpu->AddMemoryWriteBreakpoint(memoryBreakpoint);
+                emulationThread->PushCommand({EmulatorCommandType::ADD_MEMORY_WRITE_BREAKPOINT, memoryBreakpoint});
                 memoryBreakpointBuf[0] = '\0';
             }
         }
 
-        std::set<u16> removedMemoryBreakpoints;
-        for (auto const breakpoint : cpu->GetMemoryWriteBreakpoints()) {
+        for (auto const breakpoint : snapshot.memoryWriteBreakpoints) {
             ImGui::Text("%04x", breakpoint);
             ImGui::SameLine();
             if (ImGui::SmallButton("Remove")) {
-                removedMemoryBreakpoints.emplace(breakpoint);
+                emulationThread->PushCommand({EmulatorCommandType::REMOVE_MEMORY_WRITE_BREAKPOINT, breakpoint});
             }
         }
-
-        for (auto const breakpoint : removedMemoryBreakpoints) {
-            cpu->RemoveMemoryWriteBreakpoint(breakpoint);
-        }
     }
     ImGui::End();
 }
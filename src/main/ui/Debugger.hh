@@ -2,10 +2,11 @@
 
 namespace gb4e
 {
-class GbCpu;
+class EmulationThread;
+struct EmulatorSnapshot;
 };
 
 namespace gb4e::ui
 {
-void DrawDebugger(GbCpu *);
+void DrawDebugger(EmulationThread *, EmulatorSnapshot const &);
 };
\ No newline at end of file
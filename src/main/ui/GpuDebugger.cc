@@ -9,14 +9,12 @@
 
 namespace gb4e::ui
 {
-void DrawGpuDebugger(GbGpuState const * gpu)
+void DrawGpuDebugger(std::array<OamEntry, 40> const & oam)
 {
     if (!showGpuDebugger) {
         return;
     }
     if (ImGui::Begin("GPU Debugger")) {
-
-        auto oam = gpu->DebugGetOam();
         for (size_t i = 0; i < oam.size(); ++i) {
             auto str = std::to_string(i);
             if (ImGui::TreeNode(str.c_str())) {
@@ -1,11 +1,10 @@
 #pragma once
 
-namespace gb4e
-{
-class GbGpuState;
-};
+#include <array>
+
+#include "GbGpuState.hh"
 
 namespace gb4e::ui
 {
-void DrawGpuDebugger(GbGpuState const *);
+void DrawGpuDebugger(std::array<OamEntry, 40> const & oam);
 };
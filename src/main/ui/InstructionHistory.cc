@@ -1,75 +1,77 @@
 #include "InstructionHistory.hh"
 
-#include <stdlib.h>
+#include <cstdio>
 
 #include <imgui.h>
 
-#include "GbCpu.hh"
+#include "EmulationThread.hh"
+#include "Instruction.hh"
 #include "UiCommon.hh"
 
 int constexpr HISTORY_BUF_SIZE = 8;
-int constexpr INSTRUCTION_STRING_MAX_LENGTH = 1024;
-int constexpr NUM_INSTRUCTIONS_SHOWN = 128;
+int constexpr INSTRUCTION_STRING_MAX_LENGTH = 256;
+
+static char const * const REGISTER_NAMES[gb4e::debug::NUM_UNDO_REGISTERS] = {"AF", "BC", "DE", "HL", "SP", "PC"};
 
 namespace gb4e::ui
 {
 char historySizeBuf[HISTORY_BUF_SIZE];
-char * instructionHistoryStrings[NUM_INSTRUCTIONS_SHOWN];
-int currentSelectedInstructionInListBox = 0;
 
-void InitInstructionHistory()
+// The instruction, then every register and memory location it changed as old->new
+static void FormatRecord(debug::UndoRecord const & record, u16 opcode, char * out, size_t size)
 {
-    char * instructionsMem = (char *)malloc(NUM_INSTRUCTIONS_SHOWN * INSTRUCTION_STRING_MAX_LENGTH);
-    memset(instructionsMem, 0, NUM_INSTRUCTIONS_SHOWN * INSTRUCTION_STRING_MAX_LENGTH);
-    for (int i = 0; i < NUM_INSTRUCTIONS_SHOWN; ++i) {
-        instructionHistoryStrings[i] = &instructionsMem[i * INSTRUCTION_STRING_MAX_LENGTH];
+    u16 pc = record.previousRegisters[debug::UNDO_REGISTER_PC];
+    int length;
+    if (record.isInterrupt) {
+        length = snprintf(out, size, "%llu: %04x: INT", (unsigned long long)record.totalCycles, pc);
+    } else {
+        length = snprintf(out, size, "%llu: %04x: %s", (unsigned long long)record.totalCycles, pc,
+                          DecodeInstruction(opcode)->GetLabel().c_str());
+    }
+    for (size_t i = 0; i < debug::NUM_UNDO_REGISTERS && length >= 0 && (size_t)length < size; ++i) {
+        if (i != debug::UNDO_REGISTER_PC && (record.changedRegisters & BIT(i))) {
+            length += snprintf(out + length, size - length, "  %s=%04x->%04x", REGISTER_NAMES[i],
+                               record.previousRegisters[i], record.registers[i]);
+        }
+    }
+    for (size_t i = 0; i < record.numMemoryWrites && length >= 0 && (size_t)length < size; ++i) {
+        auto const & write = record.memoryWrites[i];
+        length += snprintf(out + length, size - length, "  [%04x]=%02x->%02x", write.location, write.previousValue,
+                           write.value);
     }
 }
 
-void DrawInstructionHistory(GbCpu * cpu)
+void DrawInstructionHistory(EmulationThread * emulationThread, EmulatorSnapshot const & snapshot)
 {
     if (!showInstructionHistory) {
         return;
     }
 
     if (ImGui::Begin("Instruction History")) {
-        ImGui::InputText("History Size", historySizeBuf, HISTORY_BUF_SIZE);
+        ImGui::InputText("History Size (KB)", historySizeBuf, HISTORY_BUF_SIZE);
         ImGui::SameLine();
         if (ImGui::Button("Set")) {
             std::string sizeStr(historySizeBuf);
             if (!sizeStr.empty()) {
-                size_t newSize = std::stoi(sizeStr);
-                cpu->SetHistoricInstructionsBufferSize(newSize);
+                u32 newSize = std::stoi(sizeStr) * 1024;
+                emulationThread->PushCommand({EmulatorCommandType::SET_UNDO_LOG_CAPACITY, newSize});
             }
         }
-        auto const & history = cpu->GetHistoricInstructionsBuffer();
-        size_t currentHistory = cpu->GetHistoricInstructionsPtr();
+        ImGui::Text("%zu instructions in %zu bytes", snapshot.undoLogRecordCount, snapshot.undoLogUsedSize);
 
-        for (size_t i = 0; i < NUM_INSTRUCTIONS_SHOWN; ++i) {
-            size_t currIdx = currentHistory - i;
-            if (i > currentHistory) {
-                currIdx = history.size() - i + currentHistory;
+        // Only the rows in view are formatted
+        ImGui::BeginChild("History", ImVec2(0, 0), true, ImGuiWindowFlags_HorizontalScrollbar);
+        ImGuiListClipper clipper;
+        clipper.Begin((int)snapshot.historySize);
+        char line[INSTRUCTION_STRING_MAX_LENGTH];
+        while (clipper.Step()) {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+                FormatRecord(snapshot.history[i], snapshot.historyOpcodes[i], line, sizeof(line));
+                ImGui::TextUnformatted(line);
             }
-            if (i >= history.size()) {
-                continue;
-            }
-            if (currIdx >= history.size()) {
-                continue;
-            }
-            auto const & currInstr = history[currIdx];
-            if (!currInstr.IsValid()) {
-                continue;
-            }
-            snprintf(instructionHistoryStrings[i],
-                     INSTRUCTION_STRING_MAX_LENGTH,
-                     "%zu: %s",
-                     currInstr.GetTotalCycles(),
-                     currInstr.GetResult().ToString().c_str());
         }
-
-        ImGui::PushItemWidth(-1.f);
-        ImGui::ListBox("", &currentSelectedInstructionInListBox, instructionHistoryStrings, NUM_INSTRUCTIONS_SHOWN, 20);
-        ImGui::PopItemWidth();
+        clipper.End();
+        ImGui::EndChild();
     }
     ImGui::End();
 }
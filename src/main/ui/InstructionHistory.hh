@@ -2,11 +2,11 @@
 
 namespace gb4e
 {
-class GbCpu;
+class EmulationThread;
+struct EmulatorSnapshot;
 };
 
 namespace gb4e::ui
 {
-void InitInstructionHistory();
-void DrawInstructionHistory(GbCpu *);
+void DrawInstructionHistory(EmulationThread *, EmulatorSnapshot const &);
 };
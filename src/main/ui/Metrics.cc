@@ -6,35 +6,18 @@
 
 namespace gb4e::ui
 {
-u64 cycleTimeNs = 0;
-u64 instructionTimeNs = 0;
-u64 applyTimeNs = 0;
-u64 applyFlagsTimeNs = 0;
-u64 applyInterruptsTimeNs = 0;
-u64 applyMemoryTimeNs = 0;
-u64 applyRegistersTimeNs = 0;
-u64 applyPcTimeNs = 0;
-u64 gpuCycleTimeNs = 0;
-u64 audioCallbackTimeNs = 0;
-int cyclesPerFrame = 0;
-
-void DrawMetrics()
+void DrawMetrics(MetricsSnapshot const & metrics, int cyclesPerFrame)
 {
     if (!showMetrics) {
         return;
     }
     if (ImGui::Begin("Metrics")) {
-        ImGui::Text("cycleTimeNs: %zu", cycleTimeNs);
-        ImGui::Text("instructionTimeNs: %zu", instructionTimeNs);
-        ImGui::Text("applyTimeNs: %zu", applyTimeNs);
-        ImGui::Text("gpuCycleTimeNs: %zu", gpuCycleTimeNs);
         ImGui::Text("cyclesPerFrame %d", cyclesPerFrame);
-        ImGui::Text("applyFlagsTimeNs: %zu", applyFlagsTimeNs);
-        ImGui::Text("applyInterruptsTimeNs: %zu", applyInterruptsTimeNs);
-        ImGui::Text("applyMemoryTimeNs: %zu", applyMemoryTimeNs);
-        ImGui::Text("applyRegistersTimeNs: %zu", applyRegistersTimeNs);
-        ImGui::Text("applyPcTimeNs: %zu", applyPcTimeNs);
-        ImGui::Text("audioCallbackTimeNs: %zu", audioCallbackTimeNs);
+        for (size_t i = 0; i < (size_t)Metric::COUNT; ++i) {
+            auto const & metric = metrics.Get((Metric)i);
+            ImGui::Text("%sTimeNs: last=%zu mean=%.1f p99<%zu count=%zu", MetricToString((Metric)i), metric.lastNs,
+                        metric.GetMeanNs(), metric.GetPercentileNs(0.99), metric.count);
+        }
     }
     ImGui::End();
 }
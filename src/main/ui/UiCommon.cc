@@ -13,6 +13,4 @@ bool showMemoryWatch = false;
 bool showMetrics = false;
 bool showNavbar = true;
 bool showRegisterWatch = false;
-
-bool isRunning = false;
 };
\ No newline at end of file
@@ -13,6 +13,4 @@ extern bool showMemoryWatch;
 extern bool showMetrics;
 extern bool showNavbar;
 extern bool showRegisterWatch;
-
-extern bool isRunning;
 };
\ No newline at end of file
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include "greatest.h"
+
+#include "audio/AudioSink.hh"
+#include "audio/BlipBuffer.hh"
+#include "audio/GbApuState.hh"
+#include "savestate/SaveState.hh"
+#include "savestate/StateStream.hh"
+
+class CaptureAudioSink final : public gb4e::AudioSink
+{
+public:
+    CaptureAudioSink(std::vector<float> * samples) : samples(samples) {}
+
+    bool WantsSamples() const final override { return true; }
+
+    u32 GetSampleRate() const final override { return 48000; }
+
+    void Write(float const * in, size_t frameCount) final override
+    {
+        samples->insert(samples->end(), in, in + frameCount * 2);
+    }
+
+private:
+    std::vector<float> * samples;
+};
+
+// Counts Start calls, drops the samples
+class StartCountingAudioSink final : public gb4e::AudioSink
+{
+public:
+    StartCountingAudioSink(int * numStarts) : numStarts(numStarts) {}
+
+    bool WantsSamples() const final override { return false; }
+
+    u32 GetSampleRate() const final override { return 48000; }
+
+    void Start() final override { ++*numStarts; }
+
+    void Write(float const * in, size_t frameCount) final override {}
+
+private:
+    int * numStarts;
+};
+
+// Powers on the APU and triggers channel 1 with a length of 1
+static void TriggerSquare1(gb4e::GbApuState & apu)
+{
+    apu.WriteMemory(0xFF26, 0x80);
+    apu.WriteMemory(0xFF24, 0x77);
+    apu.WriteMemory(0xFF25, 0x10); // Channel 1 on the left only
+    apu.WriteMemory(0xFF11, 0x80 | 0x3F); // 50% duty, length 1
+    apu.WriteMemory(0xFF12, 0xF0);        // Volume 15, no envelope
+    apu.WriteMemory(0xFF13, 0x00);
+    apu.WriteMemory(0xFF14, 0xC7); // Trigger with length enabled, frequency 0x700 = 512 Hz
+}
+
+TEST BlipBuffer_StepSettlesAtDelta()
+{
+    using namespace gb4e;
+
+    // Two clocks per sample
+    BlipBuffer buffer(96000.0, 48000.0, 1024);
+    buffer.AddDelta(21, 100);
+    buffer.EndFrame(200);
+    ASSERT_EQ(100, buffer.SamplesAvailable());
+
+    std::vector<float> samples(100);
+    ASSERT_EQ(100, buffer.ReadSamples(samples.data(), samples.size(), 1));
+    // The step is at sample 10.5 and is delayed by HALF_WIDTH - 1 samples, so half of it is in by sample 17
+    ASSERT_IN_RANGE(0.f, samples[0], 0.01f);
+    ASSERT_IN_RANGE(50.f, samples[17], 0.01f);
+    ASSERT_IN_RANGE(100.f, samples[99], 0.01f);
+    ASSERT_EQ(0, buffer.SamplesAvailable());
+
+    PASS();
+}
+
+TEST BlipBuffer_KeepsStepTailsAcrossReads()
+{
+    using namespace gb4e;
+
+    BlipBuffer buffer(96000.0, 48000.0, 1024);
+    buffer.AddDelta(0, 100);
+    buffer.EndFrame(2);
+
+    float sample;
+    ASSERT_EQ(1, buffer.ReadSamples(&sample, 1, 1));
+    // Only the very start of the kernel's leading ripple has been read
+    ASSERT_IN_RANGE(0.f, sample, 0.1f);
+
+    buffer.EndFrame(200);
+    std::vector<float> samples(buffer.SamplesAvailable());
+    buffer.ReadSamples(samples.data(), samples.size(), 1);
+    ASSERT_IN_RANGE(100.f, samples.back(), 0.01f);
+
+    PASS();
+}
+
+TEST Apu_NullSinkKeepsChannelStatus()
+{
+    using namespace gb4e;
+
+    GbApuState apu(std::make_unique<NullAudioSink>());
+    ASSERT_EQ(0x70, apu.ReadMemory(0xFF26).value());
+
+    TriggerSquare1(apu);
+    ASSERT_EQ(0xF1, apu.ReadMemory(0xFF26).value());
+
+    // The first length clock is at the first frame sequencer step after 8192 clocks
+    apu.Tick(2048);
+    ASSERT_EQ(0xF0, apu.ReadMemory(0xFF26).value());
+
+    apu.WriteMemory(0xFF26, 0x00);
+    ASSERT_EQ(0x70, apu.ReadMemory(0xFF26).value());
+    // Powering off clears the registers
+    ASSERT_EQ(0x00, apu.ReadMemory(0xFF12).value());
+
+    PASS();
+}
+
+TEST Apu_SynthesizesSquareWave()
+{
+    using namespace gb4e;
+
+    std::vector<float> samples;
+    GbApuState apu(std::make_unique<CaptureAudioSink>(&samples));
+    TriggerSquare1(apu);
+    apu.WriteMemory(0xFF14, 0x87); // Retrigger without length
+    // Ticked in instruction sized batches like GbCpu does
+    for (int i = 0; i < 1048576 / 10 / 4; ++i) {
+        apu.Tick(4);
+    }
+
+    // ~100 ms, up to one flush interval may still be buffered in the APU
+    ASSERT_IN_RANGE(4800 * 2, samples.size(), 200);
+    float maxLeft = 0;
+    float maxRight = 0;
+    for (size_t i = 0; i < samples.size(); i += 2) {
+        maxLeft = std::max(maxLeft, std::abs(samples[i]));
+        maxRight = std::max(maxRight, std::abs(samples[i + 1]));
+    }
+    ASSERT(maxLeft > 0.05f);
+    ASSERT_IN_RANGE(0.f, maxRight, 0.0001f);
+
+    PASS();
+}
+
+TEST Apu_StartsSinkAfterStateLoadedBeforeFirstTick()
+{
+    using namespace gb4e;
+
+    GbApuState saved(std::make_unique<NullAudioSink>());
+    saved.Tick(1000);
+    std::vector<u8> state(4096);
+    StateWriter writer(state.data(), state.size());
+    saved.SaveState(writer);
+    ASSERT_FALSE(writer.HasOverflowed());
+
+    // The loaded cycle count is not 0, the sink is started by the first Tick all the same
+    int numStarts = 0;
+    GbApuState apu(std::make_unique<StartCountingAudioSink>(&numStarts));
+    StateReader reader(state.data(), writer.GetSize(), SAVE_STATE_VERSION);
+    apu.LoadState(reader);
+    ASSERT_FALSE(reader.HasFailed());
+    ASSERT_EQ(0, numStarts);
+    apu.Tick(4);
+    apu.Tick(4);
+    ASSERT_EQ(1, numStarts);
+
+    PASS();
+}
+
+SUITE(Apu_test)
+{
+    RUN_TEST(BlipBuffer_StepSettlesAtDelta);
+    RUN_TEST(BlipBuffer_KeepsStepTailsAcrossReads);
+    RUN_TEST(Apu_NullSinkKeepsChannelStatus);
+    RUN_TEST(Apu_SynthesizesSquareWave);
+    RUN_TEST(Apu_StartsSinkAfterStateLoadedBeforeFirstTick);
+}
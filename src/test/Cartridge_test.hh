@@ -0,0 +1,361 @@
+#pragma once
+
+#include "greatest.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#include "Cartridge.hh"
+#include "SaveFile.hh"
+#include "romfile/RomCache.hh"
+#include "romfile/RomFile.hh"
+
+// Builds a ROM where every byte holds the number of the bank it is in
+static gb4e::RomFile CreateBankedRom(u8 cartridgeType, u8 romSizeCode, u8 ramSizeCode)
+{
+    size_t size = (32 * 1024) << romSizeCode;
+    auto data = std::make_unique<u8[]>(size);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = (u8)(i / gb4e::CARTRIDGE_ROM_BANK_SIZE);
+    }
+    data[0x147] = cartridgeType;
+    data[0x148] = romSizeCode;
+    data[0x149] = ramSizeCode;
+    return std::move(gb4e::RomFile::Create(size, std::move(data)).value());
+}
+
+TEST Cartridge_Mbc1SwitchesRomBanks()
+{
+    using namespace gb4e;
+
+    RomFile romFile = CreateBankedRom(0x01, 0x02, 0x00);
+    Cartridge cartridge;
+    cartridge.LoadRom(&romFile);
+    ASSERT_EQ(MbcType::MBC1, cartridge.GetMbcType());
+
+    ASSERT_EQ(0, cartridge.ReadMemory(0x0000).value());
+    ASSERT_EQ(1, cartridge.ReadMemory(0x4000).value());
+    ASSERT_EQ(1, cartridge.ReadMemory(0x7FFF).value());
+
+    cartridge.WriteMemory(0x2000, 3);
+    ASSERT_EQ(3, cartridge.ReadMemory(0x4000).value());
+    // Bank 0 is remapped to bank 1
+    cartridge.WriteMemory(0x3FFF, 0);
+    ASSERT_EQ(1, cartridge.ReadMemory(0x4000).value());
+    // Only 8 banks, the upper bits are ignored
+    cartridge.WriteMemory(0x2000, 13);
+    ASSERT_EQ(5, cartridge.ReadMemory(0x4000).value());
+    ASSERT_EQ(0, cartridge.ReadMemory(0x0000).value());
+
+    PASS();
+}
+
+TEST Cartridge_Mbc1RamNeedsEnableAndBanks()
+{
+    using namespace gb4e;
+
+    RomFile romFile = CreateBankedRom(0x03, 0x00, 0x03);
+    Cartridge cartridge;
+    cartridge.LoadRom(&romFile);
+
+    cartridge.WriteMemory(0xA000, 0x12);
+    ASSERT_EQ(0xFF, cartridge.ReadMemory(0xA000).value());
+
+    cartridge.WriteMemory(0x0000, 0x0A);
+    cartridge.WriteMemory(0xA000, 0x12);
+    ASSERT_EQ(0x12, cartridge.ReadMemory(0xA000).value());
+
+    // RAM banking only applies in advanced banking mode
+    cartridge.WriteMemory(0x4000, 2);
+    ASSERT_EQ(0x12, cartridge.ReadMemory(0xA000).value());
+    cartridge.WriteMemory(0x6000, 1);
+    ASSERT_EQ(0x00, cartridge.ReadMemory(0xA000).value());
+    cartridge.WriteMemory(0xA000, 0x34);
+    cartridge.WriteMemory(0x4000, 0);
+    ASSERT_EQ(0x12, cartridge.ReadMemory(0xA000).value());
+
+    cartridge.WriteMemory(0x0000, 0x00);
+    ASSERT_EQ(0xFF, cartridge.ReadMemory(0xA000).value());
+
+    PASS();
+}
+
+TEST Cartridge_Mbc2HasNibbleRam()
+{
+    using namespace gb4e;
+
+    RomFile romFile = CreateBankedRom(0x06, 0x02, 0x00);
+    Cartridge cartridge;
+    cartridge.LoadRom(&romFile);
+
+    // Address bit 8 selects the ROM bank register
+    cartridge.WriteMemory(0x2100, 5);
+    ASSERT_EQ(5, cartridge.ReadMemory(0x4000).value());
+    cartridge.WriteMemory(0x0000, 0x0A);
+    ASSERT_EQ(5, cartridge.ReadMemory(0x4000).value());
+
+    cartridge.WriteMemory(0xA001, 0xAB);
+    ASSERT_EQ(0xFB, cartridge.ReadMemory(0xA001).value());
+    // The 512 half-bytes repeat
+    ASSERT_EQ(0xFB, cartridge.ReadMemory(0xA201).value());
+
+    PASS();
+}
+
+TEST Cartridge_Mbc3LatchesRtc()
+{
+    using namespace gb4e;
+
+    RomFile romFile = CreateBankedRom(0x10, 0x03, 0x02);
+    Cartridge cartridge;
+    cartridge.LoadRom(&romFile);
+    cartridge.WriteMemory(0x0000, 0x0A);
+
+    cartridge.WriteMemory(0x2000, 0x0F);
+    ASSERT_EQ(15, cartridge.ReadMemory(0x4000).value());
+
+    cartridge.WriteMemory(0xA000, 0x55);
+    cartridge.WriteMemory(0x4000, 0x08);
+    cartridge.WriteMemory(0xA000, 42);
+    ASSERT_EQ(0, cartridge.ReadMemory(0xA000).value());
+    cartridge.WriteMemory(0x6000, 0);
+    cartridge.WriteMemory(0x6000, 1);
+    ASSERT_EQ(42, cartridge.ReadMemory(0xA000).value());
+
+    cartridge.WriteMemory(0x4000, 0x00);
+    ASSERT_EQ(0x55, cartridge.ReadMemory(0xA000).value());
+
+    PASS();
+}
+
+// Selects RTC register, latches and reads it
+static u8 ReadLatchedRtc(gb4e::Cartridge & cartridge, u8 rtcRegister)
+{
+    cartridge.WriteMemory(0x4000, rtcRegister);
+    cartridge.WriteMemory(0x6000, 0);
+    cartridge.WriteMemory(0x6000, 1);
+    return cartridge.ReadMemory(0xA000).value();
+}
+
+TEST Cartridge_Mbc3RtcFollowsEmulatedCycles()
+{
+    using namespace gb4e;
+
+    u64 constexpr CYCLES_PER_SECOND = CLOCK_FREQUENCY / 4;
+    RomFile romFile = CreateBankedRom(0x10, 0x03, 0x02);
+    std::string savePath = (std::filesystem::temp_directory_path() / "gb4e_rtc_test.sav").string();
+    std::filesystem::remove(savePath);
+    u64 totalCycles = 0;
+    {
+        Cartridge cartridge;
+        cartridge.LoadRom(&romFile);
+        cartridge.SetCycleCounter(&totalCycles);
+        ASSERT(cartridge.HasRtc());
+        ASSERT_EQ(0x2000 + RTC_SAVE_FOOTER_SIZE, cartridge.GetSaveSize());
+        ASSERT(cartridge.AttachSaveFile(SaveFile::Open(savePath, cartridge.GetSaveSize())));
+        cartridge.WriteMemory(0x0000, 0x0A);
+
+        totalCycles += (2 * 24 * 60 * 60 + 60 * 60 + 60 + 1) * CYCLES_PER_SECOND;
+        ASSERT_EQ(1, ReadLatchedRtc(cartridge, 0x08));
+        ASSERT_EQ(1, ReadLatchedRtc(cartridge, 0x09));
+        ASSERT_EQ(1, ReadLatchedRtc(cartridge, 0x0A));
+        ASSERT_EQ(2, ReadLatchedRtc(cartridge, 0x0B));
+        ASSERT_EQ(0, ReadLatchedRtc(cartridge, 0x0C));
+
+        // Halted time is not counted
+        cartridge.WriteMemory(0xA000, 0x40);
+        totalCycles += 10 * CYCLES_PER_SECOND;
+        ASSERT_EQ(1, ReadLatchedRtc(cartridge, 0x08));
+        ASSERT_EQ(0x40, ReadLatchedRtc(cartridge, 0x0C));
+        cartridge.WriteMemory(0xA000, 0x00);
+        totalCycles += 5 * CYCLES_PER_SECOND;
+        ASSERT_EQ(6, ReadLatchedRtc(cartridge, 0x08));
+
+        // Writing the seconds restarts the second
+        totalCycles += CYCLES_PER_SECOND / 2;
+        cartridge.WriteMemory(0xA000, 30);
+        totalCycles += CYCLES_PER_SECOND * 3 / 4;
+        ASSERT_EQ(30, ReadLatchedRtc(cartridge, 0x08));
+
+        // The 9-bit day counter wraps and sets the carry
+        totalCycles += 511 * 24 * 60 * 60 * CYCLES_PER_SECOND;
+        ASSERT_EQ(1, ReadLatchedRtc(cartridge, 0x0B));
+        ASSERT_EQ(0x80, ReadLatchedRtc(cartridge, 0x0C));
+    }
+
+    // The RTC is restored from the save footer, emulated time does not pass while closed
+    totalCycles = 0;
+    {
+        Cartridge cartridge;
+        cartridge.LoadRom(&romFile);
+        cartridge.SetCycleCounter(&totalCycles);
+        ASSERT(cartridge.AttachSaveFile(SaveFile::Open(savePath, cartridge.GetSaveSize())));
+        cartridge.WriteMemory(0x0000, 0x0A);
+        cartridge.WriteMemory(0x4000, 0x0B);
+        ASSERT_EQ(1, cartridge.ReadMemory(0xA000).value());
+        ASSERT_EQ(30, ReadLatchedRtc(cartridge, 0x08));
+        ASSERT_EQ(0x80, ReadLatchedRtc(cartridge, 0x0C));
+    }
+    std::filesystem::remove(savePath);
+    PASS();
+}
+
+TEST Cartridge_Mbc5MapsBankZeroAndNinthBit()
+{
+    using namespace gb4e;
+
+    RomFile romFile = CreateBankedRom(0x19, 0x04, 0x00);
+    Cartridge cartridge;
+    cartridge.LoadRom(&romFile);
+
+    cartridge.WriteMemory(0x2000, 0);
+    ASSERT_EQ(0, cartridge.ReadMemory(0x4000).value());
+    cartridge.WriteMemory(0x2000, 31);
+    ASSERT_EQ(31, cartridge.ReadMemory(0x4000).value());
+    // Bank 256 + 31 wraps around the 32 banks of this ROM
+    cartridge.WriteMemory(0x3000, 1);
+    ASSERT_EQ(31, cartridge.ReadMemory(0x4000).value());
+    cartridge.WriteMemory(0x2000, 2);
+    ASSERT_EQ(2, cartridge.ReadMemory(0x4000).value());
+
+    PASS();
+}
+
+TEST Cartridge_BatteryRamPersistsInSaveFile()
+{
+    using namespace gb4e;
+
+    // MBC1+RAM+BATTERY with 4 RAM banks
+    RomFile romFile = CreateBankedRom(0x03, 0x02, 0x03);
+    std::string savePath = (std::filesystem::temp_directory_path() / "gb4e_battery_test.sav").string();
+    std::filesystem::remove(savePath);
+    {
+        Cartridge cartridge;
+        cartridge.LoadRom(&romFile);
+        ASSERT(cartridge.HasBattery());
+        ASSERT_EQ(4 * CARTRIDGE_RAM_BANK_SIZE, cartridge.GetRamSize());
+        ASSERT(cartridge.AttachSaveFile(SaveFile::Open(savePath, cartridge.GetRamSize())));
+        cartridge.WriteMemory(0x0000, 0x0A);
+        cartridge.WriteMemory(0x6000, 0x01);
+        cartridge.WriteMemory(0x4000, 0x02);
+        cartridge.WriteMemory(0xA123, 0x42);
+    }
+    ASSERT_EQ(4 * CARTRIDGE_RAM_BANK_SIZE, std::filesystem::file_size(savePath));
+
+    // A copy-on-write save starts from the template but never writes back to it
+    for (int i = 0; i < 2; ++i) {
+        Cartridge cartridge;
+        cartridge.LoadRom(&romFile);
+        ASSERT(cartridge.AttachSaveFile(SaveFile::OpenCopyOnWrite(savePath, cartridge.GetRamSize())));
+        cartridge.WriteMemory(0x0000, 0x0A);
+        cartridge.WriteMemory(0x6000, 0x01);
+        cartridge.WriteMemory(0x4000, 0x02);
+        ASSERT_EQ(0x42, cartridge.ReadMemory(0xA123).value());
+        cartridge.WriteMemory(0xA123, 0x17);
+        ASSERT_EQ(0x17, cartridge.ReadMemory(0xA123).value());
+    }
+
+    // Reopening the save sees the first write
+    {
+        Cartridge cartridge;
+        cartridge.LoadRom(&romFile);
+        ASSERT(cartridge.AttachSaveFile(SaveFile::Open(savePath, cartridge.GetRamSize())));
+        cartridge.WriteMemory(0x0000, 0x0A);
+        cartridge.WriteMemory(0x6000, 0x01);
+        cartridge.WriteMemory(0x4000, 0x02);
+        ASSERT_EQ(0x42, cartridge.ReadMemory(0xA123).value());
+        cartridge.WriteMemory(0x4000, 0x00);
+        ASSERT_EQ(0x00, cartridge.ReadMemory(0xA123).value());
+    }
+    std::filesystem::remove(savePath);
+    PASS();
+}
+
+TEST RomCache_SharesImagesByPathAndContent()
+{
+    using namespace gb4e;
+
+    RomFile romFile = CreateBankedRom(0x01, 0x01, 0x00);
+    auto directory = std::filesystem::temp_directory_path();
+    std::string firstPath = (directory / "gb4e_rom_cache_a.gb").string();
+    std::string secondPath = (directory / "gb4e_rom_cache_b.gb").string();
+    for (std::string const & path : {firstPath, secondPath}) {
+        FILE * file = std::fopen(path.c_str(), "wb");
+        ASSERT(file != nullptr);
+        std::fwrite(romFile.GetData(), 1, romFile.GetSize(), file);
+        std::fclose(file);
+    }
+
+    RomCache & romCache = RomCache::GetInstance();
+    romCache.Clear();
+    std::shared_ptr<RomFile const> first = romCache.LoadRom(firstPath);
+    ASSERT(first != nullptr);
+    ASSERT_EQ(romFile.GetSize(), first->GetSize());
+    ASSERT_EQ(0, memcmp(romFile.GetData(), first->GetData(), romFile.GetSize()));
+    // Same path returns the same parsed RomFile
+    ASSERT_EQ(first.get(), romCache.LoadRom(firstPath).get());
+    // A copy under another path shares the mapping
+    std::shared_ptr<RomFile const> second = romCache.LoadRom(secondPath);
+    ASSERT_EQ(first->GetData(), second->GetData());
+    ASSERT_EQ(first->GetData(), romCache.LoadFile(secondPath)->GetData());
+    ASSERT_EQ(1, romCache.GetImageCount());
+
+    // Cached images outlive the cache entries
+    romCache.Clear();
+    ASSERT_EQ(romFile.GetData()[0x4000], first->GetData()[0x4000]);
+    ASSERT(romCache.LoadFile((directory / "gb4e_rom_cache_missing.gb").string()) == nullptr);
+
+    std::filesystem::remove(firstPath);
+    std::filesystem::remove(secondPath);
+    PASS();
+}
+
+TEST RomCache_TruncatedRomStaysInsideMapping()
+{
+    using namespace gb4e;
+
+    // The header declares 8 banks, the file only holds 2
+    std::vector<u8> data(2 * CARTRIDGE_ROM_BANK_SIZE);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (u8)(i / CARTRIDGE_ROM_BANK_SIZE);
+    }
+    data[0x147] = 0x01;
+    data[0x148] = 0x02;
+    std::string path = (std::filesystem::temp_directory_path() / "gb4e_rom_cache_truncated.gb").string();
+    FILE * file = std::fopen(path.c_str(), "wb");
+    ASSERT(file != nullptr);
+    std::fwrite(data.data(), 1, data.size(), file);
+    std::fclose(file);
+
+    std::shared_ptr<RomFile const> romFile = RomCache::GetInstance().LoadRom(path);
+    ASSERT(romFile != nullptr);
+    ASSERT_EQ(data.size(), romFile->GetSize());
+    ASSERT_EQ(8 * CARTRIDGE_ROM_BANK_SIZE, romFile->GetRomSize()->GetByteSize());
+    Cartridge cartridge;
+    cartridge.LoadRom(romFile.get());
+    for (u8 bank = 1; bank < 8; ++bank) {
+        cartridge.WriteMemory(0x2000, bank);
+        ASSERT_EQ(bank % 2, cartridge.ReadMemory(0x4000).value());
+        ASSERT_EQ(bank % 2, cartridge.ReadMemory(0x7FFF).value());
+    }
+
+    RomCache::GetInstance().Clear();
+    std::filesystem::remove(path);
+    PASS();
+}
+
+SUITE(Cartridge_test)
+{
+    RUN_TEST(Cartridge_Mbc1SwitchesRomBanks);
+    RUN_TEST(Cartridge_Mbc1RamNeedsEnableAndBanks);
+    RUN_TEST(Cartridge_Mbc2HasNibbleRam);
+    RUN_TEST(Cartridge_Mbc3LatchesRtc);
+    RUN_TEST(Cartridge_Mbc3RtcFollowsEmulatedCycles);
+    RUN_TEST(Cartridge_Mbc5MapsBankZeroAndNinthBit);
+    RUN_TEST(Cartridge_BatteryRamPersistsInSaveFile);
+    RUN_TEST(RomCache_SharesImagesByPathAndContent);
+    RUN_TEST(RomCache_TruncatedRomStaysInsideMapping);
+}
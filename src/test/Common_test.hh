@@ -3,6 +3,8 @@
 #include "greatest.h"
 
 #include "Common.hh"
+#include "concurrency/SpscRingBuffer.hh"
+#include "concurrency/TripleBuffer.hh"
 
 TEST FindFirstSet_0()
 {
@@ -31,9 +33,63 @@ TEST FindFirstSet_2()
     PASS();
 }
 
+TEST TripleBuffer_ConsumeReturnsLatest()
+{
+    using namespace gb4e;
+
+    TripleBuffer<int> buffer;
+    ASSERT_FALSE(buffer.Consume());
+
+    buffer.GetWriteBuffer() = 1;
+    buffer.Publish();
+    buffer.GetWriteBuffer() = 2;
+    buffer.Publish();
+    buffer.GetWriteBuffer() = 3;
+
+    ASSERT(buffer.Consume());
+    ASSERT_EQ(2, buffer.GetReadBuffer());
+    ASSERT_FALSE(buffer.Consume());
+    ASSERT_EQ(2, buffer.GetReadBuffer());
+
+    buffer.Publish();
+    ASSERT(buffer.Consume());
+    ASSERT_EQ(3, buffer.GetReadBuffer());
+
+    PASS();
+}
+
+TEST SpscRingBuffer_FifoUntilFull()
+{
+    using namespace gb4e;
+
+    SpscRingBuffer<int, 4> buffer;
+    int value;
+    ASSERT_FALSE(buffer.TryPop(value));
+
+    for (int i = 0; i < 4; ++i) {
+        ASSERT(buffer.TryPush(i));
+    }
+    ASSERT_FALSE(buffer.TryPush(4));
+
+    ASSERT_EQ(0, *buffer.Peek());
+    ASSERT(buffer.TryPop(value));
+    ASSERT_EQ(0, value);
+    ASSERT(buffer.TryPush(4));
+
+    for (int i = 1; i < 5; ++i) {
+        ASSERT(buffer.TryPop(value));
+        ASSERT_EQ(i, value);
+    }
+    ASSERT_EQ(nullptr, buffer.Peek());
+
+    PASS();
+}
+
 SUITE(Common_test)
 {
     RUN_TEST(FindFirstSet_0);
     RUN_TEST(FindFirstSet_1);
     RUN_TEST(FindFirstSet_2);
+    RUN_TEST(TripleBuffer_ConsumeReturnsLatest);
+    RUN_TEST(SpscRingBuffer_FifoUntilFull);
 }
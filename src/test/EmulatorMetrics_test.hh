@@ -0,0 +1,33 @@
+#pragma once
+
+#include "greatest.h"
+
+#include "EmulatorMetrics.hh"
+
+TEST EmulatorMetrics_SnapshotAggregatesSamples()
+{
+    using namespace gb4e;
+
+    EmulatorMetrics metrics;
+    for (int i = 0; i < 99; ++i) {
+        metrics.Record(Metric::APPLY, 100);
+    }
+    metrics.Record(Metric::APPLY, 5000);
+
+    auto snapshot = metrics.Snapshot();
+    auto const & apply = snapshot.Get(Metric::APPLY);
+    ASSERT_EQ(100, apply.count);
+    ASSERT_EQ(5000, apply.lastNs);
+    ASSERT_IN_RANGE(149.0, apply.GetMeanNs(), 0.001);
+    // 100 ns falls in the [64, 128) bucket and 5000 ns in [4096, 8192)
+    ASSERT_EQ(128, apply.GetPercentileNs(0.5));
+    ASSERT_EQ(8192, apply.GetPercentileNs(0.995));
+    ASSERT_EQ(0, snapshot.Get(Metric::CYCLE).count);
+
+    PASS();
+}
+
+SUITE(EmulatorMetrics_test)
+{
+    RUN_TEST(EmulatorMetrics_SnapshotAggregatesSamples);
+}
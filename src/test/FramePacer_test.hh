@@ -0,0 +1,68 @@
+#pragma once
+
+#include <optional>
+
+#include "greatest.h"
+
+#include "FramePacer.hh"
+#include "audio/GbApuState.hh"
+
+TEST VsyncFramePacer_AccumulatesFractionalFrames()
+{
+    using namespace gb4e;
+
+    // At 60 Hz every vsync is slightly less than one Game Boy frame
+    VsyncFramePacer pacer(60.0);
+    pacer.OnVsync();
+    pacer.OnVsync();
+    ASSERT_EQ(FRAME_DURATION_NS, pacer.WaitForNextSlice());
+
+    pacer.Stop();
+    ASSERT_EQ(0, pacer.WaitForNextSlice());
+
+    PASS();
+}
+
+class AudioClockFake final : public gb4e::ApuState
+{
+public:
+    void Tick(u32 cycles) final override {}
+    std::optional<u8> ReadMemory(u16 address) const final override { return {}; }
+    bool WriteMemory(u16 address, u8 value) final override { return false; }
+    std::optional<u64> GetAudioClockNs() const final override { return clockNs; }
+    std::optional<u64> GetQueuedAudioNs() const final override { return queuedNs; }
+    void SaveState(gb4e::StateWriter & writer) const final override {}
+    void LoadState(gb4e::StateReader & reader) final override {}
+
+    u64 clockNs = 0;
+    u64 queuedNs = 0;
+};
+
+TEST AudioFramePacer_AdjustsRateBothWays()
+{
+    using namespace gb4e;
+
+    AudioClockFake apu;
+    AudioFramePacer pacer(&apu);
+
+    // An empty queue speeds emulation up
+    u64 slice = pacer.WaitForNextSlice();
+    ASSERT(slice > FRAME_DURATION_NS);
+    ASSERT_EQ(0, slice % CYCLE_DURATION_NS);
+
+    // A queue well above the target slows it down
+    apu.clockNs = (u64)FRAME_REAL_DURATION_NS;
+    apu.queuedNs = (u64)(10 * FRAME_REAL_DURATION_NS);
+    ASSERT(pacer.WaitForNextSlice() < FRAME_DURATION_NS);
+
+    pacer.Stop();
+    ASSERT_EQ(0, pacer.WaitForNextSlice());
+
+    PASS();
+}
+
+SUITE(FramePacer_test)
+{
+    RUN_TEST(VsyncFramePacer_AccumulatesFractionalFrames);
+    RUN_TEST(AudioFramePacer_AdjustsRateBothWays);
+}
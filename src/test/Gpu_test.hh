@@ -3,6 +3,7 @@
 #include "greatest.h"
 
 #include "GbGpuState.hh"
+#include "ObservationSink.hh"
 #include "Renderer.hh"
 
 TEST Gpu_LoadTile()
@@ -59,7 +60,151 @@ TEST Gpu_LoadTile()
     PASS();
 }
 
+TEST Gpu_FramebufferContainsShadeIndices()
+{
+    using namespace gb4e;
+
+    FakeRenderer renderer;
+    GbGpuState state(GbModel::DMG, &renderer);
+    state.WriteMemory(0xFF40, 0x91); // LCDC: Display on, 8000 address mode, BG on
+    state.WriteMemory(0xFF47, 0xE4); // BGP: Identity palette
+
+    // Every row of tile 0 uses color index 1
+    for (u16 i = 0; i < 16; i += 2) {
+        state.WriteMemory(0x8000 + i, 0xFF);
+        state.WriteMemory(0x8001 + i, 0x00);
+    }
+
+    // Run through the rest of the initial HBLANK and draw scanline 1
+    for (int i = 0; i < 1000; ++i) {
+        state.TickCycle();
+    }
+
+    auto const & framebuffer = state.GetFramebuffer();
+    ASSERT_EQ(state.GetFrameExchange(), renderer.GetFrameExchange());
+    // Nothing is published until VBlank
+    ASSERT_FALSE(renderer.GetFrameExchange()->Consume());
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        ASSERT_EQ(1, framebuffer[SCREEN_WIDTH + x]);
+    }
+
+    std::array<u32, SCREEN_WIDTH * SCREEN_HEIGHT> rgba;
+    FramebufferToRgba(framebuffer, rgba.data());
+    ASSERT_EQ(DMG_COLOR_PALETTE[1], rgba[SCREEN_WIDTH]);
+    ASSERT_EQ(DMG_COLOR_PALETTE[0], rgba[0]);
+    PASS();
+}
+
+TEST Gpu_FrameSkipKeepsTiming()
+{
+    using namespace gb4e;
+
+    FakeRenderer renderer;
+    GbGpuState rendering(GbModel::DMG, &renderer);
+    GbGpuState skipping(GbModel::DMG, &renderer);
+    skipping.SetFrameSkip(255);
+    for (auto state : {&rendering, &skipping}) {
+        state->WriteMemory(0xFF40, 0x91);
+        state->WriteMemory(0xFF47, 0xE4);
+        for (u16 i = 0; i < 16; i += 2) {
+            state->WriteMemory(0x8000 + i, 0xFF);
+        }
+    }
+
+    // Run through a few frames. The initial partial frame and the first full frame are always rendered.
+    int vblanks = 0;
+    for (int i = 0; i < 500000; ++i) {
+        auto renderingResult = rendering.TickCycle();
+        auto skippingResult = skipping.TickCycle();
+        ASSERT_EQ(renderingResult.interrupts, skippingResult.interrupts);
+        ASSERT_EQ(rendering.ReadMemory(0xFF44).value(), skipping.ReadMemory(0xFF44).value());
+        if (renderingResult.interrupts & 1) {
+            vblanks++;
+            if (vblanks == 2) {
+                skipping.WriteMemory(0xFF47, 0x00);
+                rendering.WriteMemory(0xFF47, 0x00);
+            }
+        }
+    }
+    ASSERT(vblanks > 3);
+    // The skipping GPU kept the shades from the first full frame
+    ASSERT(rendering.GetFrameExchange()->Consume());
+    ASSERT(skipping.GetFrameExchange()->Consume());
+    ASSERT_EQ(0, rendering.GetFrameExchange()->GetReadBuffer()[SCREEN_WIDTH]);
+    ASSERT_EQ(1, skipping.GetFrameExchange()->GetReadBuffer()[SCREEN_WIDTH]);
+    PASS();
+}
+
+TEST Gpu_FrameOutputReceivesPixelsInsteadOfExchange()
+{
+    using namespace gb4e;
+
+    FakeRenderer renderer;
+    GbGpuState state(GbModel::DMG, &renderer);
+    state.WriteMemory(0xFF40, 0x91);
+    state.WriteMemory(0xFF47, 0xE4);
+    for (u16 i = 0; i < 16; i += 2) {
+        state.WriteMemory(0x8000 + i, 0xFF);
+    }
+
+    std::vector<u8> out(SCREEN_WIDTH * SCREEN_HEIGHT, 0xAA);
+    state.SetFrameOutput(out.data());
+    ASSERT_EQ(0, state.GetFrameCount());
+    while (state.GetFrameCount() < 2) {
+        state.TickCycle();
+    }
+
+    ASSERT_FALSE(state.GetFrameExchange()->Consume());
+    ASSERT_EQ(1, out[0]);
+    ASSERT_EQ(1, out[SCREEN_WIDTH * 100 + 50]);
+    // The last visible line is drawn before VBlank starts
+    ASSERT_EQ(1, out[SCREEN_WIDTH * (SCREEN_HEIGHT - 1)]);
+    PASS();
+}
+
+TEST ObservationSink_AreaAveragesScanlines()
+{
+    using namespace gb4e;
+
+    ASSERT_EQ(nullptr, ObservationSink::Create(0, 72));
+    ASSERT_EQ(nullptr, ObservationSink::Create(SCREEN_WIDTH + 1, 72));
+
+    // Alternating white and black lines average to mid gray at half resolution
+    auto half = ObservationSink::Create(80, 72);
+    std::vector<u8> halfOut(80 * 72, 0);
+    half->SetOutput(halfOut.data());
+    // Uneven scaling in both directions, a uniform screen must stay uniform
+    auto odd = ObservationSink::Create(84, 84);
+    std::vector<u8> oddOut(84 * 84, 0);
+    odd->SetOutput(oddOut.data());
+
+    std::array<u8, SCREEN_WIDTH> black;
+    std::array<u8, SCREEN_WIDTH> white;
+    std::array<u8, SCREEN_WIDTH> lightGray;
+    black.fill(3);
+    white.fill(0);
+    lightGray.fill(1);
+    for (u8 y = 0; y < SCREEN_HEIGHT; ++y) {
+        half->AddScanline(y, y % 2 == 0 ? white.data() : black.data());
+        odd->AddScanline(y, lightGray.data());
+    }
+    half->EndFrame();
+    odd->EndFrame();
+
+    for (u8 value : halfOut) {
+        ASSERT_EQ(128, value);
+    }
+    for (u8 value : oddOut) {
+        ASSERT_EQ(DMG_COLOR_PALETTE[1] & 0xFF, value);
+    }
+    PASS();
+}
+
 SUITE(Gpu_test)
 {
     RUN_TEST(Gpu_LoadTile);
+    RUN_TEST(Gpu_FramebufferContainsShadeIndices);
+    RUN_TEST(Gpu_FrameSkipKeepsTiming);
+    RUN_TEST(Gpu_FrameOutputReceivesPixelsInsteadOfExchange);
+    RUN_TEST(ObservationSink_AreaAveragesScanlines);
 }
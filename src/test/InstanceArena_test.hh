@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+#include "greatest.h"
+
+#include "InstanceArena.hh"
+
+struct ArenaCounted {
+    explicit ArenaCounted(int * destroyed) : destroyed(destroyed) {}
+    ~ArenaCounted() { ++*destroyed; }
+
+    int * destroyed;
+    alignas(32) u8 data[40];
+};
+
+TEST InstanceArena_PlacesComponentsContiguously()
+{
+    using namespace gb4e;
+
+    int destroyed = 0;
+    {
+        InstanceArena arena(InstanceArena::CapacityFor<u8, ArenaCounted, u64>());
+        ComponentPtr<u8> first = arena.Create<u8>((u8)7);
+        ComponentPtr<ArenaCounted> second = arena.Create<ArenaCounted>(&destroyed);
+        ComponentPtr<u64> third = arena.Create<u64>((u64)9);
+        ASSERT_EQ(0, (uintptr_t)first.get() % CACHE_LINE_SIZE);
+        ASSERT_EQ(32, (u8 *)second.get() - first.get());
+        ASSERT_EQ(0, (uintptr_t)third.get() % alignof(u64));
+        ASSERT_EQ(7, *first);
+        ASSERT_EQ(9, *third);
+        ASSERT_EQ((u8 *)third.get() + sizeof(u64) - first.get(), arena.GetSize());
+    }
+    ASSERT_EQ(1, destroyed);
+
+    PASS();
+}
+
+SUITE(InstanceArena_test)
+{
+    RUN_TEST(InstanceArena_PlacesComponentsContiguously);
+}
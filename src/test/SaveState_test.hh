@@ -0,0 +1,332 @@
+#pragma once
+
+#include "greatest.h"
+
+#include <array>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "GbCpu.hh"
+#include "GbGpuState.hh"
+#include "InputSystem.hh"
+#include "Renderer.hh"
+#include "TestCpu.hh"
+#include "romfile/RomFile.hh"
+#include "savestate/InputMovie.hh"
+#include "savestate/Lz4.hh"
+#include "savestate/RewindBuffer.hh"
+#include "savestate/SaveState.hh"
+#include "savestate/StateStream.hh"
+
+TEST Lz4_RoundTrips()
+{
+    using namespace gb4e;
+
+    std::vector<u8> repetitive(10000);
+    for (size_t i = 0; i < repetitive.size(); ++i) {
+        repetitive[i] = (u8)(i % 7 == 0 ? i : 0);
+    }
+    std::vector<u8> random(10000);
+    u32 seed = 12345;
+    for (u8 & byte : random) {
+        seed = seed * 1103515245 + 12345;
+        byte = (u8)(seed >> 16);
+    }
+
+    for (std::vector<u8> const * input : {&repetitive, &random}) {
+        std::vector<u8> compressed(Lz4CompressBound(input->size()));
+        size_t compressedSize = Lz4Compress(input->data(), input->size(), compressed.data(), compressed.size());
+        ASSERT(compressedSize > 0);
+        std::vector<u8> output(input->size());
+        ASSERT(Lz4Decompress(compressed.data(), compressedSize, output.data(), output.size()));
+        ASSERT(*input == output);
+        // The size must match exactly
+        ASSERT_FALSE(Lz4Decompress(compressed.data(), compressedSize, output.data(), output.size() - 1));
+    }
+    std::vector<u8> compressed(Lz4CompressBound(repetitive.size()));
+    ASSERT(Lz4Compress(repetitive.data(), repetitive.size(), compressed.data(), compressed.size()) <
+           repetitive.size() / 4);
+    ASSERT_EQ(0, Lz4Compress(random.data(), random.size(), compressed.data(), random.size() / 2));
+
+    PASS();
+}
+
+TEST SaveState_RoundTripsWholeEmulator()
+{
+    using namespace gb4e;
+
+    RomFile romFile = CreateCountingRom();
+    FakeRenderer renderer;
+    InputSystemFake inputSystem;
+    GbCpu cpu = CreateTestCpu(romFile, renderer, inputSystem);
+    SaveStateSerializer serializer(cpu);
+
+    for (SaveStateCompression compression : {SaveStateCompression::NONE, SaveStateCompression::LZ4}) {
+        std::vector<u8> start(serializer.GetMaxStateSize());
+        std::vector<u8> first(serializer.GetMaxStateSize());
+        std::vector<u8> second(serializer.GetMaxStateSize());
+
+        cpu.RunFrames(3);
+        size_t startSize = serializer.Save(cpu, start, compression);
+        ASSERT(startSize > 0);
+        cpu.RunFrames(2);
+        size_t firstSize = serializer.Save(cpu, first, compression);
+        ASSERT(cpu.GetMemory()->Read(0xC000) != 0);
+
+        ASSERT(serializer.Load(cpu, std::span<u8 const>(start.data(), startSize)));
+        cpu.RunFrames(2);
+        size_t secondSize = serializer.Save(cpu, second, compression);
+        ASSERT_EQ(firstSize, secondSize);
+        ASSERT_EQ(0, memcmp(first.data(), second.data(), firstSize));
+
+        // Too small for the state
+        ASSERT_EQ(0, serializer.Save(cpu, std::span<u8>(second.data(), 64), compression));
+        // Truncated or not a state at all
+        ASSERT_FALSE(serializer.Load(cpu, std::span<u8 const>(start.data(), startSize - 1)));
+        start[0] ^= 0xFF;
+        ASSERT_FALSE(serializer.Load(cpu, std::span<u8 const>(start.data(), startSize)));
+    }
+
+    PASS();
+}
+
+TEST SaveState_RestoresSelectedVramBank()
+{
+    using namespace gb4e;
+
+    GbGpuState gpu(GbModel::DMG, nullptr);
+    gpu.WriteMemory(0xFF4F, 0);
+    gpu.WriteMemory(0x8000, 0x11);
+    gpu.WriteMemory(0xFF4F, 1);
+    gpu.WriteMemory(0x8000, 0x22);
+    ASSERT_EQ(0x22, gpu.ReadMemory(0x8000).value());
+
+    std::vector<u8> state(64 * 1024);
+    StateWriter writer(state.data(), state.size());
+    gpu.SaveState(writer);
+    ASSERT(writer.GetSize() <= state.size());
+
+    GbGpuState loaded(GbModel::DMG, nullptr);
+    StateReader reader(state.data(), writer.GetSize(), SAVE_STATE_VERSION);
+    loaded.LoadState(reader);
+    ASSERT_FALSE(reader.HasFailed());
+    // Bank 1 is still selected, and switching banks does not copy one over the other
+    ASSERT_EQ(0x22, loaded.ReadMemory(0x8000).value());
+    loaded.WriteMemory(0xFF4F, 0);
+    ASSERT_EQ(0x11, loaded.ReadMemory(0x8000).value());
+    loaded.WriteMemory(0xFF4F, 1);
+    ASSERT_EQ(0x22, loaded.ReadMemory(0x8000).value());
+
+    PASS();
+}
+
+static bool SnapshotsEqual(gb4e::Snapshot const & a, gb4e::Snapshot const & b)
+{
+    return a.GetSize() == b.GetSize() && memcmp(a.GetData(), b.GetData(), a.GetSize()) == 0;
+}
+
+// Saves go into one buffer of GetMaxStateSize bytes, however often they are taken, and a load changes nothing which a
+// save sees, so the rewind buffer can save and load every frame without growing anything.
+TEST SaveState_SavesFitOneFixedBuffer()
+{
+    using namespace gb4e;
+
+    RomFile romFile = CreateCountingRom();
+    FakeRenderer renderer;
+    InputSystemFake inputSystem;
+    GbCpu cpu = CreateTestCpu(romFile, renderer, inputSystem);
+    SaveStateSerializer serializer(cpu);
+    size_t maxSize = serializer.GetMaxStateSize();
+    std::vector<u8> state(maxSize);
+    std::vector<u8> again(maxSize);
+    cpu.RunFrames(3);
+
+    size_t uncompressedSize = 0;
+    for (SaveStateCompression compression : {SaveStateCompression::NONE, SaveStateCompression::LZ4}) {
+        size_t size = serializer.Save(cpu, state, compression);
+        ASSERT(size > 0 && size <= maxSize);
+        for (int i = 0; i < 10; ++i) {
+            ASSERT(serializer.Load(cpu, std::span<u8 const>(state.data(), size)));
+            ASSERT_EQ(size, serializer.Save(cpu, again, compression));
+            ASSERT_EQ(0, memcmp(state.data(), again.data(), size));
+        }
+        if (compression == SaveStateCompression::NONE) {
+            uncompressedSize = size;
+        } else {
+            ASSERT(size < uncompressedSize);
+        }
+    }
+    ASSERT_EQ(maxSize, serializer.GetMaxStateSize());
+
+    PASS();
+}
+
+TEST GbCpu_CloneAndRestoreAreExact()
+{
+    using namespace gb4e;
+
+    RomFile romFile = CreateCountingRom();
+    FakeRenderer renderer;
+    InputSystemFake inputSystem;
+    GbCpu cpu = CreateTestCpu(romFile, renderer, inputSystem);
+    cpu.RunFrames(3);
+    // Stop in the middle of an instruction
+    cpu.TickCycle();
+    cpu.TickCycle();
+
+    InputSystemFake cloneInputSystem;
+    GbCpu clone = cpu.Clone(cloneInputSystem);
+    Snapshot branchPoint;
+    cpu.TakeSnapshot(branchPoint);
+
+    cpu.RunFrames(2);
+    clone.RunFrames(2);
+    Snapshot expected;
+    Snapshot actual;
+    cpu.TakeSnapshot(expected);
+    clone.TakeSnapshot(actual);
+    ASSERT(SnapshotsEqual(expected, actual));
+    ASSERT_FALSE(SnapshotsEqual(branchPoint, actual));
+
+    // Branching again from the same point
+    ASSERT(clone.RestoreFrom(branchPoint));
+    clone.RunFrames(2);
+    clone.TakeSnapshot(actual);
+    ASSERT(SnapshotsEqual(expected, actual));
+
+    PASS();
+}
+
+TEST RewindBuffer_RewindsToEarlierFrames()
+{
+    using namespace gb4e;
+
+    RomFile romFile = CreateCountingRom();
+    FakeRenderer renderer;
+    InputSystemFake inputSystem;
+    GbCpu cpu = CreateTestCpu(romFile, renderer, inputSystem);
+
+    RewindBuffer rewindBuffer(1024 * 1024, 3);
+    Snapshot expected;
+    u64 expectedFrame = 0;
+    for (u32 i = 0; i < 30; ++i) {
+        cpu.RunFrames(1);
+        rewindBuffer.Update(cpu);
+        // Between two snapshots, so reaching it needs emulating forward
+        if (i == 10) {
+            cpu.TakeSnapshot(expected);
+            expectedFrame = cpu.GetGpu()->GetFrameCount();
+        }
+    }
+    ASSERT_EQ(10, rewindBuffer.GetSnapshotCount());
+    ASSERT(rewindBuffer.GetDeltaSize() < 10 * expected.GetSize() / 4);
+
+    ASSERT_FALSE(rewindBuffer.RewindTo(cpu, rewindBuffer.GetOldestFrame() - 1));
+    ASSERT(rewindBuffer.RewindTo(cpu, expectedFrame));
+    ASSERT_EQ(expectedFrame, cpu.GetGpu()->GetFrameCount());
+    Snapshot actual;
+    cpu.TakeSnapshot(actual);
+    ASSERT(SnapshotsEqual(expected, actual));
+    // Everything after the frame rewound to is gone
+    ASSERT_EQ(4, rewindBuffer.GetSnapshotCount());
+
+    // The oldest history is dropped to stay within the budget
+    RewindBuffer smallRewindBuffer(1024, 1);
+    std::vector<Snapshot> snapshots(30);
+    u64 firstFrame = cpu.GetGpu()->GetFrameCount() + 1;
+    for (Snapshot & snapshot : snapshots) {
+        cpu.RunFrames(1);
+        smallRewindBuffer.Update(cpu);
+        cpu.TakeSnapshot(snapshot);
+    }
+    ASSERT(smallRewindBuffer.GetSnapshotCount() < 30);
+    ASSERT(smallRewindBuffer.GetDeltaSize() <= 1024);
+    u64 oldestFrame = smallRewindBuffer.GetOldestFrame();
+    ASSERT(smallRewindBuffer.RewindTo(cpu, oldestFrame));
+    cpu.TakeSnapshot(actual);
+    ASSERT(SnapshotsEqual(snapshots[oldestFrame - firstFrame], actual));
+
+    PASS();
+}
+
+TEST InputMovie_ReplaysExactly()
+{
+    using namespace gb4e;
+
+    RomFile romFile = CreateJoypadRom();
+    FakeRenderer renderer;
+    InputSystemFake inputSystem;
+    // Everything emulated, without the host clock Tick keeps
+    auto readState = [](GbCpu const & cpu) {
+        std::vector<u8> state(0x2000);
+        for (u16 i = 0; i < state.size(); ++i) {
+            state[i] = cpu.GetMemory()->Read(0xC000 + i);
+        }
+        for (u16 reg : cpu.GetUndoCpuState().registers) {
+            state.push_back(reg & 0xFF);
+            state.push_back(reg >> 8);
+        }
+        u64 totalCycles = cpu.GetState()->GetTotalCycles();
+        state.insert(state.end(), (u8 const *)&totalCycles, (u8 const *)&totalCycles + sizeof(totalCycles));
+        return state;
+    };
+
+    GbCpu cpu = CreateTestCpu(romFile, renderer, inputSystem);
+    cpu.RunFrames(2);
+    InputMovie movie(4);
+    movie.StartRecording(cpu);
+    std::vector<std::pair<u64, std::vector<u8>>> frameEnds;
+    for (int i = 0; i < 30; ++i) {
+        inputSystem.SetJoypadState((u8)~BIT(i % 4));
+        if (i % 3 == 0) {
+            cpu.RunFrames(1);
+            frameEnds.push_back({cpu.GetGpu()->GetFrameCount(), readState(cpu)});
+        } else {
+            // Samples the joypad at cycles which do not line up with frames
+            cpu.Tick(FRAME_DURATION_NS / 3 + i * 1000);
+        }
+    }
+    movie.Stop(cpu);
+    ASSERT(movie.GetInputs().size() > 10);
+    ASSERT(movie.GetKeyframeCount() > 2);
+
+    InputMovie loaded;
+    std::vector<u8> data = movie.Serialize();
+    ASSERT(loaded.Deserialize(data));
+    ASSERT_EQ(movie.GetRomHash(), loaded.GetRomHash());
+    ASSERT_EQ(movie.GetLastFrame(), loaded.GetLastFrame());
+
+    // Seeking backwards and forwards, with the input system saying otherwise
+    inputSystem.SetJoypadState(0xFF);
+    GbCpu replay = CreateTestCpu(romFile, renderer, inputSystem);
+    for (size_t i : {frameEnds.size() - 1, (size_t)0, frameEnds.size() / 2, frameEnds.size() / 2 + 1}) {
+        ASSERT(loaded.Play(replay, frameEnds[i].first));
+        ASSERT_EQ(frameEnds[i].first, replay.GetGpu()->GetFrameCount());
+        ASSERT(readState(replay) == frameEnds[i].second);
+    }
+    // Playing on from a seek
+    replay.RunFrames((u32)(frameEnds.back().first - replay.GetGpu()->GetFrameCount()));
+    ASSERT(readState(replay) == frameEnds.back().second);
+    loaded.Stop(replay);
+
+    ASSERT_FALSE(loaded.Play(replay, loaded.GetLastFrame() + 1));
+    RomFile otherRomFile = CreateCountingRom();
+    replay.LoadRom(&otherRomFile);
+    ASSERT_FALSE(loaded.Play(replay, loaded.GetFirstFrame()));
+    ASSERT_FALSE(loaded.Deserialize(std::span<u8 const>(data.data(), data.size() - 1)));
+
+    PASS();
+}
+
+SUITE(SaveState_test)
+{
+    RUN_TEST(Lz4_RoundTrips);
+    RUN_TEST(SaveState_RoundTripsWholeEmulator);
+    RUN_TEST(SaveState_RestoresSelectedVramBank);
+    RUN_TEST(SaveState_SavesFitOneFixedBuffer);
+    RUN_TEST(GbCpu_CloneAndRestoreAreExact);
+    RUN_TEST(RewindBuffer_RewindsToEarlierFrames);
+    RUN_TEST(InputMovie_ReplaysExactly);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "greatest.h"
+
+#include "InputSystem.hh"
+#include "ipc/SharedMemoryExporter.hh"
+
+#ifndef _WIN32
+TEST SharedMemoryExporter_RoundTripsInputsAndSlots()
+{
+    using namespace gb4e;
+
+    std::string name = "/gb4e_test_" + std::to_string(getpid());
+    auto exporter = SharedMemoryExporter::Create(name, {.numInstances = 2, .numSlots = 2, .ramSize = 3});
+    ASSERT(exporter);
+
+    gb4e_shm_header * header = gb4e_shm_attach(name.c_str());
+    ASSERT(header != nullptr);
+    ASSERT_EQ(SCREEN_WIDTH * SCREEN_HEIGHT, header->observation_size);
+    ASSERT_FALSE(exporter->WaitForInputs(0).has_value());
+
+    gb4e_shm_input_buttons(header)[1] = BIT(BTN_A);
+    gb4e_shm_submit_inputs(header, 4);
+    std::optional<u32> frames = exporter->WaitForInputs(0);
+    ASSERT(frames.has_value());
+    ASSERT_EQ(4, frames.value());
+    ASSERT_EQ(BIT(BTN_A), exporter->GetHeldButtons()[1]);
+
+    // Steps write straight into the next slot
+    std::vector<u8> ram = {1, 2, 3, 4, 5, 6};
+    for (u32 step = 0; step < 3; ++step) {
+        u8 * observations = exporter->GetNextObservations();
+        memset(observations, 2, 2 * SCREEN_WIDTH * SCREEN_HEIGHT);
+        observations[SCREEN_WIDTH * SCREEN_HEIGHT] = (u8)(10 + step);
+        memcpy(exporter->GetNextRam(), ram.data(), ram.size());
+        exporter->Publish(4 * (step + 1), 4, 0);
+        ASSERT_EQ(step + 1, gb4e_shm_wait_published(header, step, 0));
+    }
+    gb4e_shm_slot const * slot = gb4e_shm_get_slot(header, 3);
+    ASSERT_EQ(2, slot->sequence);
+    ASSERT_EQ(12, slot->frame);
+    ASSERT_EQ(2, gb4e_shm_observation(header, slot, 0)[0]);
+    ASSERT_EQ(12, gb4e_shm_observation(header, slot, 1)[0]);
+    ASSERT_EQ(4, gb4e_shm_ram(header, slot, 1)[0]);
+    // The slot before it is left alone by the step after
+    ASSERT_EQ(11, gb4e_shm_observation(header, gb4e_shm_get_slot(header, 2), 1)[0]);
+
+    gb4e_shm_request_stop(header);
+    ASSERT(exporter->IsStopRequested());
+    gb4e_shm_detach(header);
+
+    PASS();
+}
+
+TEST SharedMemoryExporter_OnlyReplacesStaleSegments()
+{
+    using namespace gb4e;
+
+    std::string name = "/gb4e_test_stale_" + std::to_string(getpid());
+    {
+        auto exporter = SharedMemoryExporter::Create(name, {});
+        ASSERT(exporter);
+        // The segment belongs to a running producer
+        ASSERT_FALSE(SharedMemoryExporter::Create(name, {}));
+    }
+
+    // Left behind by a producer which closed it but did not get to remove it
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    ASSERT(fd >= 0);
+    ASSERT_EQ(0, ftruncate(fd, sizeof(gb4e_shm_header)));
+    gb4e_shm_header leftover{};
+    leftover.magic = GB4E_SHM_MAGIC;
+    leftover.producer_pid = (u32)getpid();
+    leftover.closed = 1;
+    ASSERT_EQ(sizeof(leftover), (size_t)pwrite(fd, &leftover, sizeof(leftover), 0));
+    close(fd);
+
+    auto exporter = SharedMemoryExporter::Create(name, {});
+    ASSERT(exporter);
+    gb4e_shm_header * header = gb4e_shm_attach(name.c_str());
+    ASSERT(header != nullptr);
+    ASSERT_EQ(0, header->closed);
+    gb4e_shm_detach(header);
+
+    PASS();
+}
+#endif
+
+SUITE(SharedMemoryExporter_test)
+{
+#ifndef _WIN32
+    RUN_TEST(SharedMemoryExporter_RoundTripsInputsAndSlots);
+    RUN_TEST(SharedMemoryExporter_OnlyReplacesStaleSegments);
+#endif
+}
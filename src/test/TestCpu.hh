@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <memory>
+#include <span>
+
+#include "GbCpu.hh"
+#include "InputSystem.hh"
+#include "Renderer.hh"
+#include "romfile/RomFile.hh"
+
+// Disables itself, after which execution continues in the cartridge at 0x0004
+static std::array<u8, 256> const TEST_BOOTROM = {0x3E, 0x01, 0xE0, 0x50};
+
+// MBC3 with RTC and RAM running program from 0x0004
+static gb4e::RomFile CreateTestRom(std::span<u8 const> program)
+{
+    size_t romSize = 64 * 1024;
+    auto romData = std::make_unique<u8[]>(romSize);
+    memcpy(romData.get() + 0x0004, program.data(), program.size());
+    romData[0x147] = 0x10;
+    romData[0x148] = 0x01;
+    romData[0x149] = 0x02;
+    return std::move(gb4e::RomFile::Create(romSize, std::move(romData)).value());
+}
+
+// LD HL,C000, then loop: INC A; LD (HL+),A; RES 5,H; JR loop
+static gb4e::RomFile CreateCountingRom()
+{
+    static u8 const program[] = {0x21, 0x00, 0xC0, 0x3C, 0x22, 0xCB, 0xAC, 0x18, 0xFA};
+    return CreateTestRom(program);
+}
+
+// A DMG running romFile from TEST_BOOTROM. romFile, renderer and inputSystem must outlive the CPU.
+static gb4e::GbCpu CreateTestCpu(gb4e::RomFile const & romFile, gb4e::Renderer & renderer,
+                                 gb4e::InputSystem const & inputSystem)
+{
+    gb4e::GbCpu cpu = std::move(gb4e::GbCpu::Create(TEST_BOOTROM.size(), TEST_BOOTROM.data(),
+                                                    gb4e::GbModel::DMG, &renderer, inputSystem)
+                                    .value());
+    cpu.LoadRom(&romFile);
+    return cpu;
+}
+
+// LD HL,C000, then loop: LDH A,(00); LD (HL+),A; RES 5,H; JR loop. Fills WRAM with the d-pad as it is read.
+static gb4e::RomFile CreateJoypadRom()
+{
+    static u8 const program[] = {0x21, 0x00, 0xC0, 0xF0, 0x00, 0x22, 0xCB, 0xAC, 0x18, 0xF9};
+    return CreateTestRom(program);
+}
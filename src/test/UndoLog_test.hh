@@ -0,0 +1,157 @@
+#pragma once
+
+#include "greatest.h"
+
+#include <array>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "Cartridge.hh"
+#include "GbCpu.hh"
+#include "InputSystem.hh"
+#include "MemoryState.hh"
+#include "Renderer.hh"
+#include "TestCpu.hh"
+#include "debug/UndoLog.hh"
+#include "romfile/RomFile.hh"
+
+TEST UndoLog_StepsBackThroughInstructions()
+{
+    using namespace gb4e;
+
+    RomFile romFile = CreateCountingRom();
+    FakeRenderer renderer;
+    InputSystemFake inputSystem;
+    GbCpu cpu = CreateTestCpu(romFile, renderer, inputSystem);
+    cpu.SetUndoLogCapacity(64 * 1024);
+    cpu.RunFrames(1);
+
+    auto readWram = [&cpu] {
+        std::vector<u8> wram(0x2000);
+        for (u16 i = 0; i < wram.size(); ++i) {
+            wram[i] = cpu.GetMemory()->Read(0xC000 + i);
+        }
+        return wram;
+    };
+    std::vector<std::array<u16, debug::NUM_UNDO_REGISTERS>> registers;
+    std::vector<u8> startWram = readWram();
+    for (int i = 0; i < 1000; ++i) {
+        registers.push_back(cpu.GetUndoCpuState().registers);
+        cpu.StepInstruction();
+    }
+    std::vector<u8> endWram = readWram();
+    auto endRegisters = cpu.GetUndoCpuState().registers;
+
+    // The newest record leads from the previous registers to the current ones
+    debug::UndoRecord newest;
+    ASSERT_EQ(1, cpu.GetUndoLog().ReadNewest(cpu.GetUndoCpuState(), std::span(&newest, 1)));
+    ASSERT(newest.registers == endRegisters);
+    ASSERT(newest.previousRegisters == registers.back());
+
+    for (int i = 999; i >= 0; --i) {
+        ASSERT(cpu.StepBack());
+        ASSERT(cpu.GetUndoCpuState().registers == registers[i]);
+    }
+    ASSERT(readWram() == startWram);
+
+    // Running forwards again from the undone state takes the same path
+    for (int i = 0; i < 1000; ++i) {
+        cpu.StepInstruction();
+    }
+    ASSERT(cpu.GetUndoCpuState().registers == endRegisters);
+    ASSERT(readWram() == endWram);
+
+    // INC A of the loop
+    cpu.AddBreakpoint(0x0007);
+    u64 numSteps = cpu.ContinueBack();
+    ASSERT(numSteps > 0 && numSteps <= 4);
+    ASSERT_EQ(0x0007, cpu.GetUndoCpuState().registers[debug::UNDO_REGISTER_PC]);
+    cpu.RemoveBreakpoint(0x0007);
+
+    // The oldest records are dropped to stay within the capacity
+    cpu.SetUndoLogCapacity(256);
+    registers.clear();
+    for (int i = 0; i < 1000; ++i) {
+        registers.push_back(cpu.GetUndoCpuState().registers);
+        cpu.StepInstruction();
+    }
+    size_t recordCount = cpu.GetUndoLog().GetRecordCount();
+    ASSERT(recordCount > 10 && recordCount < 1000);
+    ASSERT(cpu.GetUndoLog().GetUsedSize() <= 256);
+    ASSERT_EQ(recordCount, cpu.ContinueBack());
+    ASSERT(cpu.GetUndoCpuState().registers == registers[1000 - recordCount]);
+    ASSERT_FALSE(cpu.StepBack());
+
+    PASS();
+}
+
+// MBC3 with RAM: LD A,0A; LD (0000),A; LD A,02; LD (2000),A; LD (A000),A, then loop: JR loop. Each switchable bank
+// starts with its number, 0x03 lies under the ROM bank register.
+static gb4e::RomFile CreateBankSwitchingRom()
+{
+    static u8 const program[] = {0x3E, 0x0A, 0xEA, 0x00, 0x00, 0x3E, 0x02, 0xEA,
+                                 0x00, 0x20, 0xEA, 0x00, 0xA0, 0x18, 0xFE};
+    size_t romSize = 4 * gb4e::CARTRIDGE_ROM_BANK_SIZE;
+    auto romData = std::make_unique<u8[]>(romSize);
+    memcpy(romData.get() + 0x0004, program, sizeof(program));
+    for (size_t bank = 1; bank < 4; ++bank) {
+        romData[bank * gb4e::CARTRIDGE_ROM_BANK_SIZE] = (u8)bank;
+    }
+    romData[0x2000] = 0x03;
+    romData[0x147] = 0x10;
+    romData[0x148] = 0x01;
+    romData[0x149] = 0x02;
+    return std::move(gb4e::RomFile::Create(romSize, std::move(romData)).value());
+}
+
+TEST UndoLog_RestoresCartridgeBankRegisters()
+{
+    using namespace gb4e;
+
+    RomFile romFile = CreateBankSwitchingRom();
+    FakeRenderer renderer;
+    InputSystemFake inputSystem;
+    GbCpu cpu = CreateTestCpu(romFile, renderer, inputSystem);
+    cpu.SetUndoLogCapacity(4096);
+    auto stepTo = [&cpu](u16 pc) {
+        int numSteps = 0;
+        while (cpu.GetUndoCpuState().registers[debug::UNDO_REGISTER_PC] != pc && numSteps < 100) {
+            cpu.StepInstruction();
+            ++numSteps;
+        }
+        return numSteps;
+    };
+    MemoryState const * memory = cpu.GetMemory();
+
+    stepTo(0x0004);
+    ASSERT_EQ(1, memory->Read(0x4000));
+    ASSERT_EQ(0xFF, memory->Read(0xA000));
+    int numSteps = stepTo(0x0011);
+    ASSERT_EQ(5, numSteps);
+    ASSERT_EQ(2, memory->Read(0x4000));
+    ASSERT_EQ(2, memory->Read(0xA000));
+
+    // The RAM write, then the bank switch and the RAM enable
+    ASSERT(cpu.StepBack());
+    ASSERT_EQ(0, memory->Read(0xA000));
+    for (int i = 1; i < numSteps; ++i) {
+        ASSERT(cpu.StepBack());
+    }
+    ASSERT_EQ(0x0004, cpu.GetUndoCpuState().registers[debug::UNDO_REGISTER_PC]);
+    ASSERT_EQ(1, memory->Read(0x4000));
+    ASSERT_EQ(0xFF, memory->Read(0xA000));
+
+    ASSERT_EQ(numSteps, stepTo(0x0011));
+    ASSERT_EQ(2, memory->Read(0x4000));
+    ASSERT_EQ(2, memory->Read(0xA000));
+
+    PASS();
+}
+
+SUITE(UndoLog_test)
+{
+    RUN_TEST(UndoLog_StepsBackThroughInstructions);
+    RUN_TEST(UndoLog_RestoresCartridgeBankRegisters);
+}
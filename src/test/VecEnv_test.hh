@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+#include "greatest.h"
+
+#include "InputSystem.hh"
+#include "TestCpu.hh"
+#include "VecEnv.hh"
+
+// One d-pad direction per instance, so that every instance fills its WRAM differently
+static std::array<u8, 4> const VEC_ENV_BUTTONS = {
+    BIT(gb4e::DPAD_RIGHT), BIT(gb4e::DPAD_LEFT), BIT(gb4e::DPAD_UP), BIT(gb4e::DPAD_DOWN)};
+
+static std::unique_ptr<gb4e::VecEnv> CreateTestVecEnv(gb4e::RomFile const * romFile, size_t numInstances,
+                                                      size_t numThreads)
+{
+    gb4e::VecEnvConfig config;
+    config.numInstances = numInstances;
+    config.numThreads = numThreads;
+    config.ramAddresses = {0xC000, 0xC100, 0xD000};
+    return gb4e::VecEnv::Create(TEST_BOOTROM.size(), TEST_BOOTROM.data(), gb4e::GbModel::DMG, romFile,
+                                config);
+}
+
+TEST VecEnv_StepLaysOutInstancesBackToBack()
+{
+    using namespace gb4e;
+
+    RomFile romFile = CreateJoypadRom();
+    auto vecEnv = CreateTestVecEnv(&romFile, VEC_ENV_BUTTONS.size(), 3);
+    ASSERT(vecEnv);
+    ASSERT_EQ(SCREEN_WIDTH * SCREEN_HEIGHT, vecEnv->GetObservationSize());
+    ASSERT_EQ(3, vecEnv->GetRamSize());
+    for (size_t i = 0; i < vecEnv->GetNumInstances(); ++i) {
+        ASSERT_EQ(vecEnv->GetObservations() + i * vecEnv->GetObservationSize(), vecEnv->GetObservation(i));
+    }
+
+    vecEnv->Step(VEC_ENV_BUTTONS.data(), 2);
+    size_t numInstances = vecEnv->GetNumInstances();
+    std::vector<u8> firstRam(vecEnv->GetRam(), vecEnv->GetRam() + numInstances * vecEnv->GetRamSize());
+    std::vector<u8> firstObservations(vecEnv->GetObservations(),
+                                      vecEnv->GetObservations() + numInstances * vecEnv->GetObservationSize());
+
+    // Each instance matches the same ROM run alone with its buttons, in its own slot
+    for (size_t i = 0; i < numInstances; ++i) {
+        auto single = CreateTestVecEnv(&romFile, 1, 1);
+        ASSERT(single);
+        single->Step(&VEC_ENV_BUTTONS[i], 2);
+        ASSERT_EQ(0, memcmp(single->GetRam(), vecEnv->GetRam() + i * vecEnv->GetRamSize(), vecEnv->GetRamSize()));
+        ASSERT_EQ(0, memcmp(single->GetObservation(0), vecEnv->GetObservation(i), vecEnv->GetObservationSize()));
+        // The joypad is active low, the d-pad row reads as the inverse of the held direction
+        ASSERT_EQ(0xFF & ~VEC_ENV_BUTTONS[i], vecEnv->GetRam()[i * vecEnv->GetRamSize()] | 0xF0);
+    }
+
+    // Reset zeroes the outputs and stepping again reproduces the first step
+    vecEnv->Reset();
+    for (size_t i = 0; i < firstRam.size(); ++i) {
+        ASSERT_EQ(0, vecEnv->GetRam()[i]);
+    }
+    vecEnv->Step(VEC_ENV_BUTTONS.data(), 2);
+    ASSERT_EQ(0, memcmp(firstRam.data(), vecEnv->GetRam(), firstRam.size()));
+    ASSERT_EQ(0, memcmp(firstObservations.data(), vecEnv->GetObservations(), firstObservations.size()));
+
+    // Outputs pointed elsewhere receive the same results
+    std::vector<u8> externalObservations(firstObservations.size());
+    std::vector<u8> externalRam(firstRam.size());
+    vecEnv->Reset();
+    vecEnv->SetOutputs(externalObservations.data(), externalRam.data());
+    vecEnv->Step(VEC_ENV_BUTTONS.data(), 2);
+    ASSERT_EQ(externalObservations.data(), vecEnv->GetObservations());
+    ASSERT(externalRam == firstRam);
+    ASSERT(externalObservations == firstObservations);
+
+    PASS();
+}
+
+SUITE(VecEnv_test)
+{
+    RUN_TEST(VecEnv_StepLaysOutInstancesBackToBack);
+}
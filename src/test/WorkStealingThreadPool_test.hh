@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "greatest.h"
+
+#include "concurrency/WorkStealingThreadPool.hh"
+
+TEST WorkStealingThreadPool_RunsEveryIndexOnce()
+{
+    using namespace gb4e;
+
+    WorkStealingThreadPool pool(4);
+    std::vector<std::atomic<int>> calls(1000);
+    // Uneven task lengths so that workers run out of their own range at different times and have to steal
+    pool.ParallelFor((u32)calls.size(), [&](u32 i) {
+        if (i < 100) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        calls[i].fetch_add(1);
+    });
+    pool.ParallelFor(3, [&](u32 i) { calls[i].fetch_add(1); });
+
+    for (size_t i = 0; i < calls.size(); ++i) {
+        ASSERT_EQ(i < 3 ? 2 : 1, calls[i].load());
+    }
+
+    PASS();
+}
+
+SUITE(WorkStealingThreadPool_test)
+{
+    RUN_TEST(WorkStealingThreadPool_RunsEveryIndexOnce);
+}
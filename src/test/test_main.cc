@@ -3,10 +3,20 @@
 
 #include "greatest.h"
 
+#include "Apu_test.hh"
+#include "Cartridge_test.hh"
 #include "Common_test.hh"
 #include "Cpu_test.hh"
+#include "EmulatorMetrics_test.hh"
+#include "FramePacer_test.hh"
 #include "Gpu_test.hh"
+#include "InstanceArena_test.hh"
 #include "Instruction_test.hh"
+#include "SaveState_test.hh"
+#include "SharedMemoryExporter_test.hh"
+#include "UndoLog_test.hh"
+#include "VecEnv_test.hh"
+#include "WorkStealingThreadPool_test.hh"
 #include "Test_ROMs.hh"
 
 #pragma warning(push)
@@ -23,6 +33,16 @@ int main(int argc, char ** argv)
     RUN_SUITE(Cpu_test);
     RUN_SUITE(Gpu_test);
     RUN_SUITE(Common_test);
+    RUN_SUITE(Apu_test);
+    RUN_SUITE(Cartridge_test);
+    RUN_SUITE(SaveState_test);
+    RUN_SUITE(UndoLog_test);
+    RUN_SUITE(VecEnv_test);
+    RUN_SUITE(InstanceArena_test);
+    RUN_SUITE(EmulatorMetrics_test);
+    RUN_SUITE(SharedMemoryExporter_test);
+    RUN_SUITE(WorkStealingThreadPool_test);
+    RUN_SUITE(FramePacer_test);
     RUN_SUITE(Test_ROMs);
 
     GREATEST_MAIN_END();